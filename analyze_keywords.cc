@@ -33,6 +33,12 @@ int main(int argc, char ** argv)
     // Extra configuration options
     vector<string> extra_config_options;
 
+    // Benchmark the tokenizer instead of analyzing?
+    bool benchmark = false;
+
+    // Number of iterations for the benchmark
+    int benchmark_iterations = 5;
+
     {
         using namespace boost::program_options;
 
@@ -48,7 +54,12 @@ int main(int argc, char ** argv)
         
         options_description control_options("Control Options");
         
-        control_options.add_options();
+        control_options.add_options()
+            ("benchmark-tokenizer", value<bool>(&benchmark)->zero_tokens(),
+             "time the tokenizers against each other and check that they "
+             "produce the same vocabulary")
+            ("benchmark-iterations", value<int>(&benchmark_iterations),
+             "number of iterations for the tokenizer benchmark");
 
         positional_options_description p;
         p.add("extra-config-option", -1);
@@ -88,5 +99,10 @@ int main(int argc, char ** argv)
     data.load();
     cerr << " done." << endl;
 
+    if (benchmark) {
+        benchmark_tokenizer(data, benchmark_iterations);
+        return 0;
+    }
+
     analyze_keywords(data);
 }
@@ -0,0 +1,115 @@
+/* build_cooc_index.cc
+   Jeremy Barnes, 24 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Program to precompute the cooccurrence index used by the cooc source.
+*/
+
+#include "data.h"
+#include "cooc_index.h"
+#include "arch/exception.h"
+
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+using namespace std;
+using namespace ML;
+
+int main(int argc, char ** argv)
+{
+    // Which cooccurrences to index (1 = cooc, 2 = cooc2)
+    int source = 1;
+
+    // Number of entries to keep per repo
+    int k = 100;
+
+    // Output file
+    string output_file;
+
+    // Build for a fake test?
+    bool fake_test = false;
+
+    // Number of users for fake data generation
+    int num_users = 4788;
+
+    // Random seed for fake data generation
+    int rseed = 0;
+
+    // Cooccurrence controls
+    Data::Cooc_Options cooc_options;
+    int cooc_max_memory_mb = 0;
+
+    {
+        using namespace boost::program_options;
+
+        options_description control_options("Control Options");
+
+        control_options.add_options()
+            ("source,s", value<int>(&source),
+             "which cooccurrences to index: 1 (cooc) or 2 (cooc2)")
+            ("top-k,k", value<int>(&k),
+             "number of entries to keep for each repo")
+            ("fake-test,f", value<bool>(&fake_test)->zero_tokens(),
+             "build for the fake test data instead of the real data")
+            ("num-users,n", value<int>(&num_users),
+             "number of users for fake test")
+            ("random-seed", value<int>(&rseed),
+             "random seed for fake data")
+            ("cooc-max-degree", value<int>(&cooc_options.max_degree),
+             "repos/users with more watchers/watches are hubs")
+            ("cooc-hub-sample", value<int>(&cooc_options.hub_sample),
+             "number of partners to sample within a hub (default 0 = skip hubs)")
+            ("cooc-top-k", value<int>(&cooc_options.top_k),
+             "keep only the top k entries of each cooccurrence list (default 0 = all)")
+            ("cooc-max-memory", value<int>(&cooc_max_memory_mb),
+             "cap on memory for the cooccurrence lists in MB (default 0 = none)")
+            ("output-file,o",
+             value<string>(&output_file),
+             "write index to the given filename");
+
+        options_description all_opt;
+        all_opt
+            .add(control_options);
+
+        all_opt.add_options()
+            ("help,h", "print this message");
+        
+        variables_map vm;
+        store(command_line_parser(argc, argv)
+              .options(all_opt)
+              .run(),
+              vm);
+        notify(vm);
+
+        if (vm.count("help")) {
+            cout << all_opt << endl;
+            return 1;
+        }
+    }
+
+    if (output_file == "")
+        throw Exception("need to specify an output file with -o");
+
+    // Load up the data
+    cerr << "loading data...";
+    Data data;
+    data.cooc_options = cooc_options;
+    data.cooc_options.max_memory = (size_t)cooc_max_memory_mb * 1024 * 1024;
+    data.load();
+    cerr << " done." << endl;
+
+    // The cooccurrences depend upon which watches are held out, so the index
+    // must be built with the same fake test as it will be used with
+    if (fake_test)
+        data.setup_fake_test(num_users, rseed);
+
+    Cooc_Index index;
+    index.build(data, source, k);
+    index.save(output_file);
+
+    cerr << "wrote cooc index for source " << source << " with k = " << k
+         << " to " << output_file << endl;
+}
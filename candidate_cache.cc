@@ -0,0 +1,469 @@
+/* candidate_cache.cc
+   Jeremy Barnes, 29 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the candidate cache.
+*/
+
+#include "candidate_cache.h"
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+
+#include <fstream>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace ML;
+
+
+/*****************************************************************************/
+/* FINGERPRINT                                                               */
+/*****************************************************************************/
+
+uint64_t fingerprint(const void * data, size_t len, uint64_t hash)
+{
+    const unsigned char * p = (const unsigned char *)data;
+    for (size_t i = 0;  i < len;  ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t fingerprint(const std::string & str, uint64_t hash)
+{
+    // Include the length so that concatenations don't collide
+    uint64_t len = str.size();
+    hash = fingerprint(&len, sizeof(len), hash);
+    return fingerprint(str.c_str(), str.size(), hash);
+}
+
+uint64_t fingerprint_file(const std::string & filename, uint64_t hash)
+{
+    ifstream stream(filename.c_str(), ios::binary);
+
+    char buf[65536];
+    while (stream) {
+        stream.read(buf, sizeof(buf));
+        hash = fingerprint(buf, stream.gcount(), hash);
+    }
+
+    return hash;
+}
+
+uint64_t fingerprint(const IdSet & ids, uint64_t hash)
+{
+    uint64_t len = ids.size();
+    hash = fingerprint(&len, sizeof(len), hash);
+    for (IdSet::const_iterator it = ids.begin(), end = ids.end();
+         it != end;  ++it) {
+        int32_t id = *it;
+        hash = fingerprint(&id, sizeof(id), hash);
+    }
+    return hash;
+}
+
+
+namespace {
+
+static const char CACHE_MAGIC[8] = { 'C', 'A', 'N', 'D', 'C', 'C', 'H', '3' };
+
+struct Cache_Header {
+    char magic[8];
+    uint64_t fingerprint;
+    uint64_t nusers;
+};
+
+/// Fixed part of a serialized Ranked_Entry; followed by the source features
+struct Entry_Header {
+    int32_t index;
+    int32_t repo_id;
+    float score;
+    int32_t min_rank;
+    int32_t max_rank;
+    int32_t keep;
+    uint32_t nsource_features;
+};
+
+template<class T>
+void write(std::string & out, const T & val)
+{
+    out.append((const char *)&val, sizeof(val));
+}
+
+void write(std::string & out, const Ranked_Entry & entry)
+{
+    Entry_Header header;
+    header.index = entry.index;
+    header.repo_id = entry.repo_id;
+    header.score = entry.score;
+    header.min_rank = entry.min_rank;
+    header.max_rank = entry.max_rank;
+    header.keep = entry.keep;
+    header.nsource_features = entry.source_features.size();
+    write(out, header);
+    out.append((const char *)entry.source_features.begin(),
+               sizeof(float) * entry.source_features.size());
+}
+
+/// Reads values back out of a record, checking that it doesn't overrun
+struct Reader {
+    Reader(const char * p, const char * end)
+        : p(p), end(end)
+    {
+    }
+
+    const char * p;
+    const char * end;
+
+    void need(size_t n) const
+    {
+        if ((size_t)(end - p) < n)
+            throw Exception("candidate cache: record is truncated");
+    }
+
+    template<class T>
+    void read(T & val)
+    {
+        need(sizeof(val));
+        memcpy(&val, p, sizeof(val));
+        p += sizeof(val);
+    }
+
+    void read(Ranked_Entry & entry)
+    {
+        Entry_Header header;
+        read(header);
+        entry.index = header.index;
+        entry.repo_id = header.repo_id;
+        entry.score = header.score;
+        entry.min_rank = header.min_rank;
+        entry.max_rank = header.max_rank;
+        entry.keep = header.keep;
+
+        if (header.nsource_features > Source_Features::MAX_FEATURES)
+            throw Exception("candidate cache: too many source features");
+        need(sizeof(float) * header.nsource_features);
+        float source_features[Source_Features::MAX_FEATURES];
+        memcpy(source_features, p, sizeof(float) * header.nsource_features);
+        entry.source_features.assign(source_features,
+                                     source_features
+                                     + header.nsource_features);
+        p += sizeof(float) * header.nsource_features;
+    }
+};
+
+struct Index_Less {
+    template<class Entry>
+    bool operator () (const Entry & entry, int user_id) const
+    {
+        return entry.user_id < user_id;
+    }
+};
+
+} // file scope
+
+
+/*****************************************************************************/
+/* CANDIDATE_CACHE                                                           */
+/*****************************************************************************/
+
+Candidate_Cache::
+Candidate_Cache()
+    : fingerprint_(0), mapped(0), mapped_size(0), index(0), index_size(0),
+      hits_(0), misses_(0)
+{
+}
+
+Candidate_Cache::
+~Candidate_Cache()
+{
+    close();
+}
+
+void
+Candidate_Cache::
+close()
+{
+    if (mapped) munmap(mapped, mapped_size);
+    mapped = 0;
+    mapped_size = 0;
+    index = 0;
+    index_size = 0;
+}
+
+void
+Candidate_Cache::
+open(const std::string & dir, uint64_t fingerprint)
+{
+    close();
+    pending.clear();
+
+    fingerprint_ = fingerprint;
+    filename_ = format("%s/candidates-%016llx.bin", dir.c_str(),
+                       (unsigned long long)fingerprint);
+
+    int fd = ::open(filename_.c_str(), O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) return;  // not there yet
+        throw Exception("couldn't open candidate cache " + filename_ + ": "
+                        + strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        ::close(fd);
+        throw Exception("couldn't stat candidate cache " + filename_);
+    }
+
+    // Too short for the header (eg, interrupted while being written); it
+    // will be overwritten on save.  Can't map an empty file anyway.
+    if ((size_t)st.st_size < sizeof(Cache_Header)) {
+        cerr << "warning: ignoring truncated candidate cache " << filename_
+             << endl;
+        ::close(fd);
+        return;
+    }
+
+    void * addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (addr == MAP_FAILED)
+        throw Exception("couldn't map candidate cache " + filename_ + ": "
+                        + strerror(errno));
+
+    mapped = addr;
+    mapped_size = st.st_size;
+
+    const Cache_Header & header = *(const Cache_Header *)mapped;
+
+    // Written so that a corrupt nusers can't overflow
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+        || header.fingerprint != fingerprint
+        || header.nusers > (mapped_size - sizeof(Cache_Header))
+                           / sizeof(Index_Entry)) {
+        // Unusable; it will be overwritten on save
+        cerr << "warning: ignoring invalid candidate cache " << filename_
+             << endl;
+        close();
+        return;
+    }
+
+    index = (const Index_Entry *)((const char *)mapped + sizeof(Cache_Header));
+    index_size = header.nusers;
+
+    cerr << "candidate cache " << filename_ << ": " << index_size
+         << " users" << endl;
+}
+
+bool
+Candidate_Cache::
+get(int user_id, const IdSet & watching,
+    Ranked & candidates, Candidate_Data & candidate_data) const
+{
+    uint64_t watch_hash = fingerprint(watching);
+
+    const char * start = 0, * finish = 0;
+    {
+        Guard guard(lock);
+
+        std::map<int, Pending>::const_iterator it = pending.find(user_id);
+        if (it != pending.end()) {
+            if (it->second.watch_hash == watch_hash) {
+                start = it->second.data.c_str();
+                finish = start + it->second.data.size();
+            }
+        }
+        else if (index) {
+            const Index_Entry * entry
+                = std::lower_bound(index, index + index_size, user_id,
+                                   Index_Less());
+            if (entry != index + index_size && entry->user_id == user_id
+                && entry->watch_hash == watch_hash
+                && entry->offset <= mapped_size
+                && entry->length <= mapped_size - entry->offset) {
+                start = (const char *)mapped + entry->offset;
+                finish = start + entry->length;
+            }
+        }
+
+        if (start) ++hits_;
+        else ++misses_;
+    }
+
+    if (!start) return false;
+
+    // Entries in pending are never modified once added, so it's safe to
+    // read them without the lock
+    Reader reader(start, finish);
+
+    uint32_t ncandidates;
+    reader.read(ncandidates);
+    candidates.clear();
+    candidates.resize(ncandidates);
+    for (unsigned i = 0;  i < ncandidates;  ++i)
+        reader.read(candidates[i]);
+
+    uint32_t nrepos;
+    reader.read(nrepos);
+    candidate_data.info.clear();
+    for (unsigned i = 0;  i < nrepos;  ++i) {
+        int32_t repo_id;
+        uint32_t nsources;
+        reader.read(repo_id);
+        reader.read(nsources);
+
+        map<int, Ranked_Entry> & info = candidate_data.info[repo_id];
+        for (unsigned j = 0;  j < nsources;  ++j) {
+            int32_t source;
+            reader.read(source);
+            reader.read(info[source]);
+        }
+    }
+
+    uint32_t nsources;
+    reader.read(nsources);
+    candidate_data.source_sizes.resize(nsources);
+    for (unsigned i = 0;  i < nsources;  ++i) {
+        int32_t size;
+        reader.read(size);
+        candidate_data.source_sizes[i] = size;
+    }
+
+    return true;
+}
+
+void
+Candidate_Cache::
+put(int user_id, const IdSet & watching,
+    const Ranked & candidates, const Candidate_Data & candidate_data)
+{
+    Pending record;
+    record.watch_hash = fingerprint(watching);
+
+    std::string & out = record.data;
+
+    write(out, (uint32_t)candidates.size());
+    for (unsigned i = 0;  i < candidates.size();  ++i)
+        write(out, candidates[i]);
+
+    write(out, (uint32_t)candidate_data.info.size());
+    for (map<int, map<int, Ranked_Entry> >::const_iterator
+             it = candidate_data.info.begin(),
+             end = candidate_data.info.end();
+         it != end;  ++it) {
+        write(out, (int32_t)it->first);
+        write(out, (uint32_t)it->second.size());
+
+        for (map<int, Ranked_Entry>::const_iterator
+                 jt = it->second.begin(),
+                 jend = it->second.end();
+             jt != jend;  ++jt) {
+            write(out, (int32_t)jt->first);
+            write(out, jt->second);
+        }
+    }
+
+    write(out, (uint32_t)candidate_data.source_sizes.size());
+    for (unsigned i = 0;  i < candidate_data.source_sizes.size();  ++i)
+        write(out, (int32_t)candidate_data.source_sizes[i]);
+
+    Guard guard(lock);
+    // Don't replace an entry that might be being read
+    if (pending.count(user_id)) return;
+
+    Pending & entry = pending[user_id];
+    entry.watch_hash = record.watch_hash;
+    entry.data.swap(record.data);
+}
+
+void
+Candidate_Cache::
+save()
+{
+    if (filename_ == "")
+        throw Exception("Candidate_Cache::save(): not open");
+
+    Guard guard(lock);
+
+    if (pending.empty()) return;
+
+    // Merge the old entries with the new ones, in order of user ID
+    vector<Index_Entry> new_index;
+    vector<pair<const char *, size_t> > records;
+
+    std::map<int, Pending>::const_iterator it = pending.begin();
+
+    for (size_t i = 0;  i <= index_size;  ++i) {
+        int old_user = (i < index_size ? index[i].user_id : INT_MAX);
+
+        for (;  it != pending.end() && it->first <= old_user;  ++it) {
+            Index_Entry entry;
+            entry.user_id = it->first;
+            entry.padding = 0;
+            entry.watch_hash = it->second.watch_hash;
+            entry.length = it->second.data.size();
+            new_index.push_back(entry);
+            records.push_back(make_pair(it->second.data.c_str(),
+                                        it->second.data.size()));
+        }
+
+        if (i == index_size) break;
+        if (!new_index.empty() && new_index.back().user_id == old_user)
+            continue;  // replaced by a new one
+        if (index[i].offset > mapped_size
+            || index[i].length > mapped_size - index[i].offset)
+            continue;  // past the end of a truncated file
+
+        new_index.push_back(index[i]);
+        records.push_back(make_pair((const char *)mapped + index[i].offset,
+                                    (size_t)index[i].length));
+    }
+
+    Cache_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.fingerprint = fingerprint_;
+    header.nusers = new_index.size();
+
+    uint64_t offset = sizeof(header) + sizeof(Index_Entry) * new_index.size();
+    for (unsigned i = 0;  i < new_index.size();  ++i) {
+        new_index[i].offset = offset;
+        offset += new_index[i].length;
+    }
+
+    // Write to a temporary file and rename so that a half-written file is
+    // never seen
+    string tmp_filename = filename_ + ".tmp";
+
+    {
+        ofstream stream(tmp_filename.c_str(), ios::binary);
+        if (!stream)
+            throw Exception("couldn't open " + tmp_filename);
+
+        stream.write((const char *)&header, sizeof(header));
+        if (!new_index.empty())
+            stream.write((const char *)&new_index[0],
+                         sizeof(Index_Entry) * new_index.size());
+        for (unsigned i = 0;  i < records.size();  ++i)
+            stream.write(records[i].first, records[i].second);
+
+        if (!stream)
+            throw Exception("error writing " + tmp_filename);
+    }
+
+    if (rename(tmp_filename.c_str(), filename_.c_str()) == -1)
+        throw Exception("couldn't rename " + tmp_filename + " to "
+                        + filename_ + ": " + strerror(errno));
+
+    cerr << "saved " << new_index.size() << " users to candidate cache "
+         << filename_ << endl;
+}
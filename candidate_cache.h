@@ -0,0 +1,111 @@
+/* candidate_cache.h                                               -*- C++ -*-
+   Jeremy Barnes, 29 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   On-disk cache of the candidates generated for each user.
+*/
+
+#ifndef __github__candidate_cache_h__
+#define __github__candidate_cache_h__
+
+#include "candidate_source.h"
+#include "arch/threads.h"
+#include <string>
+#include <map>
+#include <stdint.h>
+
+
+/// 64 bit FNV-1a hash of the given bytes, continuing from hash
+uint64_t fingerprint(const void * data, size_t len,
+                     uint64_t hash = 14695981039346656037ULL);
+
+uint64_t fingerprint(const std::string & str,
+                     uint64_t hash = 14695981039346656037ULL);
+
+/// Fingerprint of the contents of a file; missing files hash as empty
+uint64_t fingerprint_file(const std::string & filename,
+                          uint64_t hash = 14695981039346656037ULL);
+
+/// Fingerprint of a set of IDs
+uint64_t fingerprint(const IdSet & ids,
+                     uint64_t hash = 14695981039346656037ULL);
+
+
+/*****************************************************************************/
+/* CANDIDATE_CACHE                                                           */
+/*****************************************************************************/
+
+/** Cache of the output of Candidate_Generator::candidates() (the
+    candidates, and the per-source entries and sizes in the Candidate_Data)
+    for each user.  There is one file per fingerprint, which should cover
+    everything that affects the candidates: the generator configuration, the
+    classifiers and the data options.  Within the file, entries are keyed
+    by user ID and a fingerprint of the user's watch set.
+
+    The file is mmapped when opened; new entries are kept in memory until
+    save() is called, which rewrites the file.  get() and put() are thread
+    safe.
+*/
+
+struct Candidate_Cache {
+    Candidate_Cache();
+    ~Candidate_Cache();
+
+    /// Open the cache file for the given fingerprint in the directory.  It's
+    /// fine if it doesn't exist yet.
+    void open(const std::string & dir, uint64_t fingerprint);
+
+    /// Look up the candidates for the user.  Returns false if they aren't
+    /// there or were generated with a different watch set.
+    bool get(int user_id, const IdSet & watching,
+             Ranked & candidates, Candidate_Data & candidate_data) const;
+
+    /// Record the candidates for the user
+    void put(int user_id, const IdSet & watching,
+             const Ranked & candidates, const Candidate_Data & candidate_data);
+
+    /// Write everything out to the file, atomically
+    void save();
+
+    const std::string & filename() const { return filename_; }
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+private:
+    std::string filename_;
+    uint64_t fingerprint_;
+
+    // The mmapped file
+    void * mapped;
+    size_t mapped_size;
+
+    struct Index_Entry {
+        int32_t user_id;
+        uint32_t padding;
+        uint64_t watch_hash;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    const Index_Entry * index;
+    size_t index_size;
+
+    // Entries added since the file was loaded
+    struct Pending {
+        uint64_t watch_hash;
+        std::string data;
+    };
+
+    std::map<int, Pending> pending;
+
+    mutable ML::Lock lock;
+    mutable size_t hits_, misses_;
+
+    void close();
+
+    Candidate_Cache(const Candidate_Cache &);
+    void operator = (const Candidate_Cache &);
+};
+
+#endif /* __github__candidate_cache_h__ */
@@ -6,10 +6,13 @@
 */
 
 #include "candidate_source.h"
+#include "cooc_index.h"
 #include "utils/less.h"
 #include "math/xdiv.h"
 #include "ranker.h"
 #include "utils/hash_set.h"
+#include "top_k.h"
+#include "candidate_cache.h"
 
 
 using namespace std;
@@ -80,6 +83,63 @@ sort()
 
 
 
+/*****************************************************************************/
+/* CANDIDATE_DATA                                                            */
+/*****************************************************************************/
+
+Candidate_Scratch &
+Candidate_Data::
+get_scratch(const Data & data)
+{
+    if (!scratch) {
+        owned_scratch.reset(new Candidate_Scratch());
+        scratch = owned_scratch.get();
+    }
+
+    if (!scratch->initialized(data))
+        scratch->init(data);
+
+    return *scratch;
+}
+
+Common_Block &
+Candidate_Data::
+get_common()
+{
+    if (!common) {
+        owned_common.reset(new Common_Block());
+        common = owned_common.get();
+    }
+
+    return *common;
+}
+
+namespace {
+
+/// Slots in the scratch space used by the sources
+enum Scratch_Slot {
+    SLOT_COOC_INFO,
+    SLOT_COOC_WATCHED,
+    SLOT_COOC_HEAP,
+    SLOT_REPO_CLUSTER_RANGES,
+    SLOT_REPO_CLUSTER_MEMBERS,
+    SLOT_REPO_CLUSTER_TOP,
+    SLOT_REPO_CLUSTER_SCORES,
+    SLOT_USER_CLUSTER_INFO,
+    SLOT_USER_CLUSTER_RANKED,
+    SLOT_PROB_USERS,
+    SLOT_PROB_REPOS,
+    SLOT_MINHASH_INFO,
+    SLOT_MINHASH_SEEN,
+    SLOT_MINHASH_TOP,
+    SLOT_KEYWORDS_SEEN,
+    SLOT_KEYWORDS_HEAP,
+    SLOT_KEYWORDS_TERMS
+};
+
+} // file scope
+
+
 /*****************************************************************************/
 /* CANDIDATE_SOURCE                                                          */
 /*****************************************************************************/
@@ -109,6 +169,14 @@ configure(const ML::Configuration & config_,
     load_data = true;
     config.find(load_data, "load_data");
 
+    // The generator's list is shared by its sources unless they have their
+    // own
+    string ignore;
+    config_.find(ignore, "train_ignore");
+    config.find(ignore, "train_ignore");
+    train_ignore.clear();
+    if (ignore != "") train_ignore = split(ignore, ',');
+
     max_entries = 100;
     config.find(max_entries, "max_entries");
 
@@ -137,6 +205,20 @@ init()
     }
 }
 
+uint64_t
+Candidate_Source::
+fingerprint(uint64_t hash) const
+{
+    hash = ::fingerprint(name_, hash);
+    hash = ::fingerprint(type_, hash);
+    hash = ::fingerprint(&max_entries, sizeof(max_entries), hash);
+    hash = ::fingerprint(&min_prob, sizeof(min_prob), hash);
+    hash = ::fingerprint(classifier_file, hash);
+    if (load_data)
+        hash = fingerprint_file(classifier_file, hash);
+    return hash;
+}
+
 ML::Dense_Feature_Space
 Candidate_Source::
 specific_feature_space() const
@@ -147,30 +229,32 @@ specific_feature_space() const
     return result;
 }
 
+const char * const Common_Schema::names[] = {
+    "density",
+    "user_id",
+    "user_repo_id_ratio",
+    "user_watched_repos",
+    "repo_watched_users",
+    "repo_lines_of_code",
+    "user_prob",
+    "user_prob_rank",
+    "repo_prob",
+    "repo_prob_rank",
+    "user_repo_prob",
+    "repo_has_parent",
+    "repo_num_children",
+    "repo_num_ancestors",
+    "repo_num_siblings",
+    "repo_parent_watchers"
+};
+
+CHECK_FEATURE_SCHEMA(Common_Schema);
+
 Dense_Feature_Space
 Candidate_Source::
 common_feature_space()
 {
-    ML::Dense_Feature_Space result;
-
-    result.add_feature("density", Feature_Info::REAL);
-    result.add_feature("user_id", Feature_Info::REAL);
-    result.add_feature("user_repo_id_ratio", Feature_Info::REAL);
-    result.add_feature("user_watched_repos", Feature_Info::REAL);
-    result.add_feature("repo_watched_users", Feature_Info::REAL);
-    result.add_feature("repo_lines_of_code", Feature_Info::REAL);
-    result.add_feature("user_prob", Feature_Info::REAL);
-    result.add_feature("user_prob_rank", Feature_Info::REAL);
-    result.add_feature("repo_prob", Feature_Info::REAL);
-    result.add_feature("repo_prob_rank", Feature_Info::REAL);
-    result.add_feature("user_repo_prob", Feature_Info::REAL);
-    result.add_feature("repo_has_parent", Feature_Info::REAL);
-    result.add_feature("repo_num_children", Feature_Info::REAL);
-    result.add_feature("repo_num_ancestors", Feature_Info::REAL);
-    result.add_feature("repo_num_siblings", Feature_Info::REAL);
-    result.add_feature("repo_parent_watchers", Feature_Info::REAL);
-
-    return result;
+    return schema_feature_space<Common_Schema>();
 }
 
 boost::shared_ptr<const ML::Dense_Feature_Space>
@@ -184,45 +268,141 @@ feature_space() const
     return result;
 }
 
+namespace {
+
+/// The common features that are copied straight from a repo column
+struct Repo_Column {
+    int feature;
+    Repo_Features::Column column;
+};
+
+const Repo_Column repo_columns[] = {
+    { Common_Schema::REPO_WATCHED_USERS,   Repo_Features::REPO_WATCHED_USERS },
+    { Common_Schema::REPO_LINES_OF_CODE,   Repo_Features::REPO_LINES_OF_CODE },
+    { Common_Schema::REPO_PROB,            Repo_Features::REPO_PROB },
+    { Common_Schema::REPO_PROB_RANK,       Repo_Features::REPO_PROB_RANK },
+    { Common_Schema::REPO_HAS_PARENT,      Repo_Features::REPO_HAS_PARENT },
+    { Common_Schema::REPO_NUM_CHILDREN,    Repo_Features::REPO_NUM_CHILDREN },
+    { Common_Schema::REPO_NUM_ANCESTORS,   Repo_Features::REPO_NUM_ANCESTORS },
+    { Common_Schema::REPO_NUM_SIBLINGS,    Repo_Features::REPO_NUM_SIBLINGS },
+    { Common_Schema::REPO_PARENT_WATCHERS, Repo_Features::REPO_PARENT_WATCHERS }
+};
+
+const int num_repo_columns = sizeof(repo_columns) / sizeof(repo_columns[0]);
+
+} // file scope
+
 void
 Candidate_Source::
-common_features(distribution<float> & result,
-                int user_id, int repo_id, const Data & data,
-                Candidate_Data & candidate_data)
+common_features(float * result, size_t stride, int user_id,
+                const int * repo_ids, size_t n, const Data & data)
 {
-    const User & user = data.users[user_id];
-    const Repo & repo = data.repos[repo_id];
+    typedef Common_Schema S;
 
-    result.clear();
+    const Repo_Hot_Fields & repo_hot = data.repo_hot;
+    const User_Hot_Fields & user_hot = data.user_hot;
+    const Repo_Features & columns = data.repo_features;
 
-    result.push_back(data.density(user_id, repo_id));
-    result.push_back(user_id);
-    result.push_back(xdiv<float>(user_id, repo_id));
+    columns.check(data);
 
-    result.push_back(user.watching.size());
-    result.push_back(repo.watchers.size());
-    result.push_back(log(repo.total_loc + 1));
-    
-    result.push_back(user.user_prob);
-    result.push_back(user.user_prob_rank);
-    result.push_back(repo.repo_prob);
-    result.push_back(repo.repo_prob_rank);
-    result.push_back(user.user_prob * repo.repo_prob);
-    
-    result.push_back(repo.parent != -1);
-    result.push_back(repo.children.size());
-    result.push_back(repo.ancestors.size());
+    data.density(user_id, repo_ids, n, result + S::DENSITY, stride);
 
-    if (repo.parent == -1) {
-        result.push_back(0);
-        result.push_back(-1);
+    // One column at a time, so that each pass reads from just one of the
+    // repo columns
+    for (int c = 0;  c < num_repo_columns;  ++c) {
+        const float * column = columns.column(repo_columns[c].column);
+        float * out = result + repo_columns[c].feature;
+        for (size_t i = 0;  i < n;  ++i)
+            out[i * stride] = column[repo_ids[i]];
     }
-    else {
-        result.push_back(data.repos[repo.parent].children.size());
-        result.push_back(data.repos[repo.parent].watchers.size());
+
+    float user_watched_repos = user_hot.num_watching(user_id);
+    float user_prob = user_hot.user_prob(user_id);
+    float user_prob_rank = user_hot.user_prob_rank(user_id);
+
+    for (size_t i = 0;  i < n;  ++i) {
+        float * row = result + i * stride;
+        int repo_id = repo_ids[i];
+        row[S::USER_ID] = user_id;
+        row[S::USER_REPO_ID_RATIO] = xdiv<float>(user_id, repo_id);
+        row[S::USER_WATCHED_REPOS] = user_watched_repos;
+        row[S::USER_PROB] = user_prob;
+        row[S::USER_PROB_RANK] = user_prob_rank;
+        row[S::USER_REPO_PROB] = user_prob * repo_hot.repo_prob(repo_id);
     }
 }
 
+
+/*****************************************************************************/
+/* COMMON_BLOCK                                                              */
+/*****************************************************************************/
+
+Common_Block::
+Common_Block()
+    : user_id(-1)
+{
+}
+
+void
+Common_Block::
+add(int user_id, const Ranked & candidates, const Data & data)
+{
+    if (repo_to_row.size() < data.repos.size())
+        repo_to_row.resize(data.repos.size(), -1);
+
+    if (user_id != this->user_id) {
+        for (unsigned i = 0;  i < repos.size();  ++i)
+            repo_to_row[repos[i]] = -1;
+        repos.clear();
+        values.clear();
+        this->user_id = user_id;
+    }
+
+    // The repos that we haven't seen yet get calculated as one block
+    size_t first = repos.size();
+    for (unsigned i = 0;  i < candidates.size();  ++i) {
+        int repo_id = candidates[i].repo_id;
+        if (repo_id < 0 || repo_id >= (int)repo_to_row.size())
+            throw Exception(format("common features: invalid repo %d",
+                                   repo_id));
+        if (repo_to_row[repo_id] != -1) continue;
+        repo_to_row[repo_id] = repos.size();
+        repos.push_back(repo_id);
+    }
+
+    if (repos.size() == first) return;
+
+    values.resize(repos.size() * NUM_FEATURES);
+    Candidate_Source::common_features(&values[first * NUM_FEATURES],
+                                      NUM_FEATURES, user_id, &repos[first],
+                                      repos.size() - first, data);
+}
+
+void
+Common_Block::
+check(int user_id) const
+{
+    if (user_id != this->user_id)
+        throw Exception(format("common features are for user %d, not %d",
+                               this->user_id, user_id));
+}
+
+void
+Common_Block::
+not_added(int repo_id) const
+{
+    throw Exception(format("common features of repo %d weren't added",
+                           repo_id));
+}
+
+size_t
+Common_Block::
+memusage() const
+{
+    return sizeof(int) * (repo_to_row.capacity() + repos.capacity())
+        + sizeof(float) * values.capacity();
+}
+
 namespace {
 
 struct Source_Stats {
@@ -278,25 +458,44 @@ gen_candidates(Ranked & entries, int user_id, const Data & data,
     // Get them, unranked
     candidate_set(entries, user_id, data, candidate_data);
 
+    Common_Block & common = candidate_data.get_common();
+    common.add(user_id, entries, data);
+
+    score_candidates(entries, user_id, data, common);
+}
+
+void
+Candidate_Source::
+score_candidates(Ranked & entries, int user_id, const Data & data,
+                 const Common_Block & common_block) const
+{
     int ncorrect = 0, nalready = 0;
 
+    // The common features, then those of the source
+    size_t nfeatures = our_fs->variable_count();
+    size_t nspecific = nfeatures - Common_Block::NUM_FEATURES;
+    float features[nfeatures];
+    float encoded[classifier_fs->variable_count()];
+    common_block.check(user_id);
+
     // For each, get the features and run the classifier
     for (unsigned i = 0;  i < entries.size();  ++i) {
         
         if (entries[i].repo_id == correct_repo) ++ncorrect;
         if (watching && watching->count(entries[i].repo_id)) ++nalready;
+
+        const Source_Features & specific = entries[i].source_features;
+        if (specific.size() != nspecific)
+            throw Exception(format("source %s: candidate has %zd features "
+                                   "but its feature space has %zd",
+                                   name().c_str(), specific.size(),
+                                   nspecific));
         
-        distribution<float> features;
-        features.reserve(our_fs->variable_count());
-        common_features(features, user_id, entries[i].repo_id, data,
-                        candidate_data);
-
-        features.insert(features.end(),
-                        entries[i].features.begin(),
-                        entries[i].features.end());
+        const float * row = common_block.row(entries[i].repo_id);
+        std::copy(specific.begin(), specific.end(),
+                  std::copy(row, row + Common_Block::NUM_FEATURES, features));
        
-        float encoded[classifier_fs->variable_count()];
-        classifier_fs->encode(&features[0], encoded, *our_fs, mapping);
+        classifier_fs->encode(features, encoded, *our_fs, mapping);
         float score = classifier.impl->predict(1, encoded, opt_info);
         entries[i].score = score;
     }
@@ -307,8 +506,9 @@ gen_candidates(Ranked & entries, int user_id, const Data & data,
     for (unsigned i = 0;  i < entries.size();  ++i)
         entries[i].keep = i < max_entries && entries[i].score >= min_prob;
 
+    // name_ rather than name(), which would copy the string
     Guard guard(stats_lock);
-    Source_Stats & stats = source_stats[name()];
+    Source_Stats & stats = source_stats[name_];
 
     stats.total_size += entries.size();
     if (!entries.empty())
@@ -341,22 +541,20 @@ struct Ancestors_Of_Watched_Source : public Candidate_Source {
                  it = user.watching.begin(),
                  end = user.watching.end();
              it != end;  ++it) {
-            int watched_id = *it;
-            const Repo & watched = data.repos[watched_id];
-            if (watched.parent == -1) continue;
-            parents.insert(watched.parent);
+            int parent = data.repo_hot.parent(*it);
+            if (parent == -1) continue;
+            parents.insert(parent);
         }
 
+        const Fork_Forest & forest = data.fork_forest;
+
         for (IdSet::const_iterator
                  it = user.watching.begin(),
                  end = user.watching.end();
-             it != end;  ++it) {
-            int watched_id = *it;
-            const Repo & watched = data.repos[watched_id];
-            if (watched.parent == -1) continue;
-            ancestors.insert(watched.all_ancestors.begin(),
-                             watched.all_ancestors.end());
-        }
+             it != end;  ++it)
+            for (int ancestor = forest.parent(*it);  ancestor != -1;
+                 ancestor = forest.parent(ancestor))
+                ancestors.insert(ancestor);
 
         ancestors.erase(parents);
 
@@ -417,10 +615,9 @@ struct Children_Of_Watched_Source : public Candidate_Source {
                  end = user.watching.end();
              it != end;  ++it) {
             int watched_id = *it;
-            const Repo & watched = data.repos[watched_id];
     
-            watched_children.insert(watched.children.begin(),
-                                    watched.children.end());
+            watched_children.insert(data.fork_forest.children_begin(watched_id),
+                                    data.fork_forest.children_end(watched_id));
         }
 
         watched_children.finish();
@@ -429,9 +626,31 @@ struct Children_Of_Watched_Source : public Candidate_Source {
     }
 };
 
-struct Cooc_Source : public Candidate_Source {
+/// Features of the cooc sources
+struct Cooc_Schema {
+    enum Feature {
+        TOTAL_SCORE,
+        MAX_SCORE,
+        AVG_SCORE,
+        NUM_SCORES,
+        NUM_FEATURES
+    };
+
+    static const char * const names[];
+};
+
+const char * const Cooc_Schema::names[] = {
+    "cooc_total_score",
+    "cooc_max_score",
+    "cooc_avg_score",
+    "cooc_num_scores"
+};
+
+CHECK_FEATURE_SCHEMA(Cooc_Schema);
+
+struct Cooc_Source : public Schema_Source<Cooc_Schema> {
     Cooc_Source()
-        : Candidate_Source("cooc", 2), source(1)
+        : Schema_Source<Cooc_Schema>("cooc", 2), source(1)
     {
         called = total_coocs = max_coocs = 0;
     }
@@ -450,6 +669,14 @@ struct Cooc_Source : public Candidate_Source {
     int source;
     mutable int called, total_coocs, max_coocs;
 
+    /// File containing a precomputed index; if empty, it's not used
+    std::string index_file;
+
+    /// Maximum number of candidates to generate when using the index
+    int max_candidates;
+
+    boost::shared_ptr<Cooc_Index> index;
+
     virtual void configure(const ML::Configuration & config_,
                            const std::string & name)
     {
@@ -459,19 +686,36 @@ struct Cooc_Source : public Candidate_Source {
         source = 1;
         config.get(source, "source");
 
+        index_file = "";
+        config.find(index_file, "index_file");
+
+        max_candidates = 1000;
+        config.find(max_candidates, "max_candidates");
+
         cerr << "candidate source name=" << this->name() << " source = "
              << source << endl;
     }
 
-    virtual ML::Dense_Feature_Space
-    specific_feature_space() const
+    virtual void init()
     {
-        Dense_Feature_Space result;
-        result.add_feature("cooc_total_score", Feature_Info::REAL);
-        result.add_feature("cooc_max_score", Feature_Info::REAL);
-        result.add_feature("cooc_avg_score", Feature_Info::REAL);
-        result.add_feature("cooc_num_scores", Feature_Info::REAL);
-        return result;
+        Candidate_Source::init();
+
+        if (index_file != "") {
+            index.reset(new Cooc_Index());
+            index->load(index_file);
+
+            if (index->source() != source)
+                throw Exception("cooc index " + index_file
+                                + " was built for a different source");
+        }
+    }
+
+    virtual uint64_t fingerprint(uint64_t hash) const
+    {
+        hash = Candidate_Source::fingerprint(hash);
+        if (index_file != "")
+            hash = fingerprint_file(index_file, hash);
+        return hash;
     }
 
     struct Cooc_Info {
@@ -495,17 +739,23 @@ struct Cooc_Source : public Candidate_Source {
     virtual void candidate_set(Ranked & result, int user_id, const Data & data,
                                Candidate_Data & candidate_data) const
     {
+        if (index) {
+            indexed_candidate_set(result, user_id, data, candidate_data);
+            return;
+        }
+
         const User & user = data.users[user_id];
 
         ++called;
 
         // Find cooccurring with the most specicivity
 
-        hash_map<int, Cooc_Info> coocs_map;
+        Candidate_Scratch & scratch = candidate_data.get_scratch(data);
+        scratch.set_watched(user, data);
+
+        Dense_Accumulator<Cooc_Info> & coocs_map
+            = scratch.repo_accumulator<Cooc_Info>(SLOT_COOC_INFO);
 
-        hash_set<string> watched_repo_names;
-        hash_set<int> watched_authors;
-        
         for (IdSet::const_iterator
                  it = user.watching.begin(),
                  end = user.watching.end();
@@ -513,9 +763,6 @@ struct Cooc_Source : public Candidate_Source {
             int repo_id = *it;
             const Repo & repo = data.repos[repo_id];
 
-            watched_repo_names.insert(repo.name);
-            watched_authors.insert(repo.author);
-
             const Cooccurrences & cooc
                 = (source == 1 ? repo.cooc : repo.cooc2);
             
@@ -529,57 +776,211 @@ struct Cooc_Source : public Candidate_Source {
 
         result.reserve(coocs_map.size());
 
-        for (hash_map<int, Cooc_Info>::const_iterator
-                 it = coocs_map.begin(),
-                 end = coocs_map.end();
-             it != end;  ++it) {
+        const vector<int> & cooc_ids = coocs_map.ids();
 
-            const Repo & repo = data.repos[it->first];
-            if (watched_repo_names.count(repo.name)) continue;  // will be handled by same name
-            if (watched_authors.count(repo.author)) continue;   // will be handled by same author
+        for (unsigned i = 0;  i < cooc_ids.size();  ++i) {
+            int repo_id = cooc_ids[i];
+            const Cooc_Info & info = coocs_map.get(repo_id);
+
+            const Repo & repo = data.repos[repo_id];
+            if (scratch.watched_name(repo)) continue;  // will be handled by same name
+            if (scratch.watched_author(repo)) continue;   // will be handled by same author
 
             result.push_back(Ranked_Entry());
 
             Ranked_Entry & entry = result.back();
-            entry.repo_id = it->first;
-            entry.features.reserve(4);
-            entry.features.push_back(it->second.total_score);
-            entry.features.push_back(it->second.max_score);
-            entry.features.push_back(it->second.total_score / it->second.n);
-            entry.features.push_back(it->second.n);
+            entry.repo_id = repo_id;
+            Writer features(entry.source_features);
+            features[Cooc_Schema::TOTAL_SCORE] = info.total_score;
+            features[Cooc_Schema::MAX_SCORE] = info.max_score;
+            features[Cooc_Schema::AVG_SCORE] = info.total_score / info.n;
+            features[Cooc_Schema::NUM_SCORES] = info.n;
         }
 
         total_coocs += coocs_map.size();
         max_coocs = std::max<int>(max_coocs, coocs_map.size());
     }
+
+    // Cooc_Info for the given repo, calculated by random access into the
+    // full cooc lists of the watched repos
+    Cooc_Info cooc_info(int repo_id, const vector<int> & watched,
+                        const Data & data) const
+    {
+        Cooc_Info result;
+        for (unsigned i = 0;  i < watched.size();  ++i) {
+            const Repo & repo = data.repos[watched[i]];
+            const Cooccurrences & cooc
+                = (source == 1 ? repo.cooc : repo.cooc2);
+            float score = cooc[repo_id];
+            if (score != 0.0) result += score;
+        }
+        return result;
+    }
+
+    /** Same as candidate_set, but using the index to find only the
+        max_candidates with the highest total score.  The top-k lists of the
+        watched repos are read in parallel, one level at a time (the
+        threshold algorithm).  Each new repo is scored exactly by random
+        access, and we stop once the sum of the scores at the current level
+        can't beat the worst of the candidates that we have.  The cost
+        depends upon the number of watched repos and max_candidates, not
+        upon the length of the cooc lists.
+    */
+    void indexed_candidate_set(Ranked & result, int user_id,
+                               const Data & data,
+                               Candidate_Data & candidate_data) const
+    {
+        const User & user = data.users[user_id];
+
+        if (index->num_repos() != data.repos.size())
+            throw Exception("cooc index " + index_file
+                            + " doesn't match the data");
+
+        ++called;
+
+        Candidate_Scratch & scratch = candidate_data.get_scratch(data);
+        scratch.set_watched(user, data);
+
+        vector<int> & watched = scratch.buffer<int>(SLOT_COOC_WATCHED);
+        watched.insert(watched.end(),
+                       user.watching.begin(), user.watching.end());
+
+        typedef pair<float, int> Scored;  // total score, repo id
+
+        // The best max_candidates so far
+        Top_K<Scored> top(scratch.buffer<Scored>(SLOT_COOC_HEAP),
+                          max_candidates);
+        Dense_Accumulator<Cooc_Info> & seen
+            = scratch.repo_accumulator<Cooc_Info>(SLOT_COOC_INFO);
+
+        for (unsigned depth = 0;  depth < index->k();  ++depth) {
+            float threshold = 0.0;
+            bool any_left = false;
+
+            for (unsigned i = 0;  i < watched.size();  ++i) {
+                int repo_id = watched[i];
+                size_t n = index->size(repo_id);
+                if (depth >= n) {
+                    // Anything not in a truncated list scores at most the
+                    // last score in it
+                    if (n > 0 && index->truncated(repo_id))
+                        threshold += index->begin(repo_id)[n - 1].score;
+                    continue;
+                }
+
+                any_left = true;
+
+                const Cooc_Index::Entry & entry
+                    = index->begin(repo_id)[depth];
+                threshold += entry.score;
+
+                if (seen.count(entry.with)) continue;
+
+                const Repo & repo = data.repos[entry.with];
+                if (scratch.watched_name(repo)
+                    || scratch.watched_author(repo)) {
+                    seen[entry.with] = Cooc_Info();
+                    continue;
+                }
+
+                Cooc_Info info = cooc_info(entry.with, watched, data);
+                seen[entry.with] = info;
+
+                top.add(Scored(info.total_score, entry.with));
+            }
+
+            if (!any_left) break;
+
+            // Nothing that we haven't seen can beat what we have
+            if (top.full() && top.worst().first >= threshold)
+                break;
+        }
+
+        result.reserve(top.size());
+
+        for (unsigned i = 0;  i < top.size();  ++i) {
+            int repo_id = top[i].second;
+            const Cooc_Info & info = seen.get(repo_id);
+
+            result.push_back(Ranked_Entry());
+
+            Ranked_Entry & entry = result.back();
+            entry.repo_id = repo_id;
+            Writer features(entry.source_features);
+            features[Cooc_Schema::TOTAL_SCORE] = info.total_score;
+            features[Cooc_Schema::MAX_SCORE] = info.max_score;
+            features[Cooc_Schema::AVG_SCORE] = info.total_score / info.n;
+            features[Cooc_Schema::NUM_SCORES] = info.n;
+        }
+
+        total_coocs += seen.size();
+        max_coocs = std::max<int>(max_coocs, seen.size());
+    }
 };
  
-struct In_Cluster_Repo_Source : public Candidate_Source {
+/// Features of the in_cluster_repo source
+struct Repo_Cluster_Schema {
+    enum Feature {
+        NUM_WATCHED_IN_CLUSTER,
+        PROP_WATCHED_IN_CLUSTER,
+        RANK_IN_CLUSTER,
+        BEST_DP_IN_CLUSTER,
+        BEST_NORM_DP_IN_CLUSTER,
+        BEST_KEYWORD_DP_IN_CLUSTER,
+        BEST_NORM_KEYWORD_DP_IN_CLUSTER,
+        NUM_FEATURES
+    };
+
+    static const char * const names[];
+};
+
+const char * const Repo_Cluster_Schema::names[] = {
+    "rcluster_num_watched_in_cluster",
+    "rcluster_prop_watched_in_cluster",
+    "rcluster_rank_in_cluster",
+    "rcluster_best_dp_in_cluster",
+    "rcluster_best_norm_dp_in_cluster",
+    "rcluster_best_keyword_dp_in_cluster",
+    "rcluster_best_norm_keyword_dp_in_cluster"
+};
+
+CHECK_FEATURE_SCHEMA(Repo_Cluster_Schema);
+
+struct In_Cluster_Repo_Source : public Schema_Source<Repo_Cluster_Schema> {
     In_Cluster_Repo_Source()
-        : Candidate_Source("in_cluster_repo", 3)
+        : Schema_Source<Repo_Cluster_Schema>("in_cluster_repo", 3)
     {
     }
 
-    virtual ML::Dense_Feature_Space
-    specific_feature_space() const
-    {
-        Dense_Feature_Space result;
-        result.add_feature("rcluster_num_watched_in_cluster",
-                           Feature_Info::REAL);
-        result.add_feature("rcluster_prop_watched_in_cluster",
-                           Feature_Info::REAL);
-        result.add_feature("rcluster_rank_in_cluster",
-                           Feature_Info::REAL);
-        result.add_feature("rcluster_best_dp_in_cluster",
-                           Feature_Info::REAL);
-        result.add_feature("rcluster_best_norm_dp_in_cluster",
-                           Feature_Info::REAL);
-        result.add_feature("rcluster_best_keyword_dp_in_cluster",
-                           Feature_Info::REAL);
-        result.add_feature("rcluster_best_norm_keyword_dp_in_cluster",
-                           Feature_Info::REAL);
-        return result;
-    }
+    /// Range of the watched repos in a cluster within the members array
+    struct Cluster_Range {
+        Cluster_Range() : start(0), n(0) {}
+        int start, n;
+    };
+
+    /// A repo from one of the clusters, before its features are calculated
+    struct Cluster_Candidate {
+        float score;
+        int repo_id;
+        int cluster_id;
+        int rank;  ///< index within the cluster's members
+    };
+
+    /// Same order as Ranked::sort() (score and then repo ID, descending),
+    /// with the rest to make it total
+    struct Cluster_Candidate_Better {
+        bool operator () (const Cluster_Candidate & c1,
+                          const Cluster_Candidate & c2) const
+        {
+            if (c1.score != c2.score) return c1.score > c2.score;
+            if (c1.repo_id != c2.repo_id) return c1.repo_id > c2.repo_id;
+            if (c1.cluster_id != c2.cluster_id)
+                return c1.cluster_id < c2.cluster_id;
+            return c1.rank < c2.rank;
+        }
+    };
+
+    enum { MAX_CANDIDATES = 2000 };
 
     virtual void candidate_set(Ranked & result,
                                int user_id, const Data & data,
@@ -587,34 +988,62 @@ struct In_Cluster_Repo_Source : public Candidate_Source {
     {
         const User & user = data.users[user_id];
 
-        // Number of entries for this user in each cluster
-        hash_map<int, IdSet> clusters;
+        Candidate_Scratch & scratch = candidate_data.get_scratch(data);
+        scratch.set_watched(user, data);
 
-        hash_set<string> watched_repo_names;
-        hash_set<int> watched_authors;
+        // Watched repos for this user in each cluster, grouped by cluster
+        Dense_Accumulator<Cluster_Range> & clusters
+            = scratch.accumulator<Cluster_Range>(SLOT_REPO_CLUSTER_RANGES,
+                                                 data.repo_clusters.size());
+        vector<int> & members = scratch.buffer<int>(SLOT_REPO_CLUSTER_MEMBERS);
 
+        // Count the number in each cluster...
         for (IdSet::const_iterator
                  it = user.watching.begin(),
                  end = user.watching.end();
              it != end;  ++it) {
-            int repo_id = *it;
-            const Repo & repo = data.repos[repo_id];
-            int cluster_id = repo.kmeans_cluster;
+            int cluster_id = data.repo_hot.kmeans_cluster(*it);
+            if (cluster_id == -1) continue;
+            clusters[cluster_id].n += 1;
+        }
 
-            watched_repo_names.insert(repo.name);
-            watched_authors.insert(repo.author);
+        // ... allocate a range to each cluster ...
+        const vector<int> & cluster_ids = clusters.ids();
+        int num_members = 0;
+        for (unsigned i = 0;  i < cluster_ids.size();  ++i) {
+            Cluster_Range & range = clusters[cluster_ids[i]];
+            range.start = num_members;
+            num_members += range.n;
+            range.n = 0;
+        }
 
+        // ... and fill them in, in order of repo ID
+        members.resize(num_members);
+        for (IdSet::const_iterator
+                 it = user.watching.begin(),
+                 end = user.watching.end();
+             it != end;  ++it) {
+            int cluster_id = data.repo_hot.kmeans_cluster(*it);
             if (cluster_id == -1) continue;
-            clusters[cluster_id].insert(repo_id);
+            Cluster_Range & range = clusters[cluster_id];
+            members[range.start + range.n++] = *it;
         }
 
-        for (hash_map<int, IdSet>::iterator
-                 it = clusters.begin(),
-                 end = clusters.end();
-             it != end;  ++it) {
+        // Find the top MAX_CANDIDATES by number of watchers, so that we
+        // only need to calculate the features for those
+        Top_K<Cluster_Candidate, Cluster_Candidate_Better>
+            top(scratch.buffer<Cluster_Candidate>(SLOT_REPO_CLUSTER_TOP),
+                MAX_CANDIDATES);
+
+        // Scores of all of the candidates, to find the size of the group
+        // that ties at the cutoff
+        vector<float> & scores
+            = scratch.buffer<float>(SLOT_REPO_CLUSTER_SCORES);
+        scores.clear();
 
-            int cluster_id = it->first;
+        for (unsigned c = 0;  c < cluster_ids.size();  ++c) {
 
+            int cluster_id = cluster_ids[c];
             const Cluster & cluster = data.repo_clusters[cluster_id];
 
             for (unsigned i = 0;  i < cluster.top_members.size();  ++i) {
@@ -624,73 +1053,119 @@ struct In_Cluster_Repo_Source : public Candidate_Source {
                 if (user.watching.count(repo_id)) continue;
 
                 const Repo & repo = data.repos[repo_id];
-                if (watched_repo_names.count(repo.name)) continue;  // will be handled by same name
-                if (watched_authors.count(repo.author)) continue;   // will be handled by same author
+                if (scratch.watched_name(repo)) continue;  // will be handled by same name
+                if (scratch.watched_author(repo)) continue;   // will be handled by same author
+
+                Cluster_Candidate candidate;
+                candidate.score = repo.watchers.size();
+                candidate.repo_id = repo_id;
+                candidate.cluster_id = cluster_id;
+                candidate.rank = i;
+                top.add(candidate);
+                scores.push_back(candidate.score);
+            }
+        }
 
-                result.push_back(Ranked_Entry());
-                Ranked_Entry & entry = result.back();
-                entry.score = data.repos[repo_id].watchers.size();
-                entry.repo_id = repo_id;
-                entry.features.reserve(5);
-                entry.features.push_back(it->second.size());
-                entry.features.push_back(xdiv<float>(it->second.size(),
-                                                     user.watching.size()));
-                entry.features.push_back(i);
-
-                float best_dp = -2.0, best_dp_norm = -2.0;
-                // Find the best DP with a cluster member
-
-                float best_dp_kw = -2.0, best_dp_norm_kw = -2.0;
-
-                for (IdSet::const_iterator
-                         jt = it->second.begin(),
-                         jend = it->second.end();
-                     jt != jend;  ++jt) {
-                    if (*jt == -1) continue;
-                    const Repo & repo2 = data.repos[*jt];
-                    float dp = repo.singular_vec.dotprod(repo2.singular_vec);
-                    float dp_norm
-                        = xdiv(dp, repo.singular_2norm * repo2.singular_2norm);
-                    best_dp = max(best_dp, dp);
-                    best_dp_norm = max(best_dp_norm, dp_norm);
-
-                    dp = repo.keyword_vec.dotprod(repo2.keyword_vec);
-                    dp_norm
-                        = xdiv(dp, repo.keyword_vec_2norm * repo2.keyword_vec_2norm);
-                    best_dp_kw = max(best_dp_kw, dp);
-                    best_dp_norm_kw = max(best_dp_norm_kw, dp_norm);
-                }
+        top.sort();
+
+        result.reserve(top.size());
+
+        for (unsigned c = 0;  c < top.size();  ++c) {
+            const Cluster_Candidate & candidate = top[c];
+            int repo_id = candidate.repo_id;
+            const Repo & repo = data.repos[repo_id];
+
+            const Cluster_Range & range = clusters.get(candidate.cluster_id);
+            const int * watched_begin = &members[range.start];
+            const int * watched_end = watched_begin + range.n;
+
+            result.push_back(Ranked_Entry());
+            Ranked_Entry & entry = result.back();
+            entry.score = candidate.score;
+            entry.repo_id = repo_id;
+
+            typedef Repo_Cluster_Schema S;
+            Writer features(entry.source_features);
+            features[S::NUM_WATCHED_IN_CLUSTER] = range.n;
+            features[S::PROP_WATCHED_IN_CLUSTER]
+                = xdiv<float>(range.n, user.watching.size());
+            features[S::RANK_IN_CLUSTER] = candidate.rank;
 
-                entry.features.push_back(best_dp);
-                entry.features.push_back(best_dp_norm);
-                entry.features.push_back(best_dp_kw);
-                entry.features.push_back(best_dp_norm_kw);
+            float best_dp = -2.0, best_dp_norm = -2.0;
+            // Find the best DP with a cluster member
+
+            float best_dp_kw = -2.0, best_dp_norm_kw = -2.0;
+
+            for (const int * jt = watched_begin;  jt != watched_end;  ++jt) {
+                if (*jt == -1) continue;
+                const Repo & repo2 = data.repos[*jt];
+                update_best_dp(repo.singular_vec, repo.singular_2norm,
+                               repo.singular_q,
+                               repo2.singular_vec, repo2.singular_2norm,
+                               repo2.singular_q,
+                               best_dp, best_dp_norm,
+                               data.quantized_rescore);
+
+                update_best_dp(repo.keyword_vec, repo.keyword_vec_2norm,
+                               repo.keyword_q,
+                               repo2.keyword_vec, repo2.keyword_vec_2norm,
+                               repo2.keyword_q,
+                               best_dp_kw, best_dp_norm_kw,
+                               data.quantized_rescore);
             }
+
+            features[S::BEST_DP_IN_CLUSTER] = best_dp;
+            features[S::BEST_NORM_DP_IN_CLUSTER] = best_dp_norm;
+            features[S::BEST_KEYWORD_DP_IN_CLUSTER] = best_dp_kw;
+            features[S::BEST_NORM_KEYWORD_DP_IN_CLUSTER] = best_dp_norm_kw;
         }
 
-        // Add the top 2000 only
+        // Already in order; this fills in the ranks
         result.sort();
 
-        if (result.size() > 2000)
-            result.erase(result.begin() + 2000, result.end());
+        // The ranks were calculated over all of the candidates before they
+        // were cut to MAX_CANDIDATES.  The last group of tied scores may
+        // continue past the cut, in which case its max_rank is where it
+        // would have ended.
+        if (top.full() && scores.size() > top.size()) {
+            float cutoff = result.back().score;
+            int num_tied = std::count(scores.begin(), scores.end(), cutoff);
+            int num_better = 0;
+            while (result[num_better].score != cutoff) ++num_better;
+
+            for (unsigned i = num_better;  i < result.size();  ++i)
+                if (result[i].max_rank != -1)
+                    result[i].max_rank = num_better + num_tied;
+        }
     }
 };
 
-struct In_Cluster_User_Source : public Candidate_Source {
-    In_Cluster_User_Source()
-        : Candidate_Source("in_cluster_user", 4)
-    {
-    }
+/// Features of the in_cluster_user source
+struct User_Cluster_Schema {
+    enum Feature {
+        NUM_WATCHERS,
+        WATCHER_SCORE,
+        HIGHEST_DP,
+        HIGHEST_DP_NORM,
+        NUM_FEATURES
+    };
+
+    static const char * const names[];
+};
+
+const char * const User_Cluster_Schema::names[] = {
+    "ucluster_num_watchers",
+    "ucluster_watcher_score",
+    "ucluster_highest_dp",
+    "ucluster_highest_dp_norm"
+};
+
+CHECK_FEATURE_SCHEMA(User_Cluster_Schema);
 
-    virtual ML::Dense_Feature_Space
-    specific_feature_space() const
+struct In_Cluster_User_Source : public Schema_Source<User_Cluster_Schema> {
+    In_Cluster_User_Source()
+        : Schema_Source<User_Cluster_Schema>("in_cluster_user", 4)
     {
-        Dense_Feature_Space result;
-        result.add_feature("ucluster_num_watchers", Feature_Info::REAL);
-        result.add_feature("ucluster_watcher_score", Feature_Info::REAL);
-        result.add_feature("ucluster_highest_dp", Feature_Info::REAL);
-        result.add_feature("ucluster_highest_dp_norm", Feature_Info::REAL);
-        return result;
     }
 
     struct Rank_Info {
@@ -700,43 +1175,41 @@ struct In_Cluster_User_Source : public Candidate_Source {
         {
         }
 
-        bool operator < (const Rank_Info & other) const
-        {
-            return num_watched > other.num_watched;
-        }
-
         int num_watched;
         float watched_score;
         float highest_dp;
         float highest_dp_norm;
     };
 
+    /// Most watched first, then by repo ID
+    struct Rank_Better {
+        bool operator () (const pair<int, Rank_Info> & p1,
+                          const pair<int, Rank_Info> & p2) const
+        {
+            if (p1.second.num_watched != p2.second.num_watched)
+                return p1.second.num_watched > p2.second.num_watched;
+            return p1.first < p2.first;
+        }
+    };
+
+    enum { MAX_CANDIDATES = 2000 };
+
     virtual void candidate_set(Ranked & result, int user_id,
                                const Data & data,
                                Candidate_Data & candidate_data) const
     {
         const User & user = data.users[user_id];
-        IdSet in_cluster_user;
 
-        // Find repos watched by other users in the same cluster
-        hash_map<int, Rank_Info> watched_by_cluster_user;
-
-        int clusterno = user.kmeans_cluster;
+        int clusterno = data.user_hot.kmeans_cluster(user_id);
 
         if (clusterno == -1) return;
 
-        hash_set<string> watched_repo_names;
-        hash_set<int> watched_authors;
+        Candidate_Scratch & scratch = candidate_data.get_scratch(data);
+        scratch.set_watched(user, data);
 
-        for (IdSet::const_iterator
-                 it = user.watching.begin(),
-                 end = user.watching.end();
-             it != end;  ++it) {
-            int repo_id = *it;
-            const Repo & repo = data.repos[repo_id];
-            watched_repo_names.insert(repo.name);
-            watched_authors.insert(repo.author);
-        }
+        // Find repos watched by other users in the same cluster
+        Dense_Accumulator<Rank_Info> & watched_by_cluster_user
+            = scratch.repo_accumulator<Rank_Info>(SLOT_USER_CLUSTER_INFO);
 
         const Cluster & cluster = data.user_clusters[clusterno];
 
@@ -747,7 +1220,9 @@ struct In_Cluster_User_Source : public Candidate_Source {
             const User & user2 = data.users[user_id2];
             if (user2.invalid()) continue;
             
-            float dp = user.singular_vec.dotprod(user2.singular_vec);
+            float dp = dotprod(user.singular_vec, user.singular_q,
+                               user2.singular_vec, user2.singular_q,
+                               data.quantized_rescore);
             float dp_norm
                 = xdiv<float>(dp, user.singular_2norm * user2.singular_2norm);
 
@@ -757,8 +1232,8 @@ struct In_Cluster_User_Source : public Candidate_Source {
                  it != end;  ++it) {
 
                 const Repo & repo = data.repos[*it];
-                if (watched_repo_names.count(repo.name)) continue;  // will be handled by same name
-                if (watched_authors.count(repo.author)) continue;   // will be handled by same author
+                if (scratch.watched_name(repo)) continue;  // will be handled by same name
+                if (scratch.watched_author(repo)) continue;   // will be handled by same author
 
                 Rank_Info & entry = watched_by_cluster_user[*it];
                 entry.num_watched += 1;
@@ -768,30 +1243,37 @@ struct In_Cluster_User_Source : public Candidate_Source {
             }
         }
 
-        vector<pair<int, Rank_Info> > ranked(watched_by_cluster_user.begin(),
-                                             watched_by_cluster_user.end());
+        // Keep the MAX_CANDIDATES most watched
+        Top_K<pair<int, Rank_Info>, Rank_Better>
+            top(scratch.buffer<pair<int, Rank_Info> >(SLOT_USER_CLUSTER_RANKED),
+                MAX_CANDIDATES);
 
-        sort_on_second_ascending(ranked);
-        
-        result.reserve(min<int>(2000, ranked.size()));
-
-        for (unsigned i = 0;
-             result.size() < 2000 && i < ranked.size();
-             ++i) {
-            int repo_id = ranked[i].first;
+        const vector<int> & watched_ids = watched_by_cluster_user.ids();
+        for (unsigned i = 0;  i < watched_ids.size();  ++i) {
+            int repo_id = watched_ids[i];
             if (repo_id == -1) continue;  // just in case...
-            const Rank_Info & info = ranked[i].second;
-
             if (user.watching.count(repo_id)) continue;
 
+            top.add(make_pair(repo_id, watched_by_cluster_user.get(repo_id)));
+        }
+
+        top.sort();
+        
+        result.reserve(top.size());
+
+        for (unsigned i = 0;  i < top.size();  ++i) {
+            int repo_id = top[i].first;
+            const Rank_Info & info = top[i].second;
+
             result.push_back(Ranked_Entry());
             Ranked_Entry & entry = result.back();
             entry.repo_id = repo_id;
-            entry.features.reserve(4);
-            entry.features.push_back(info.num_watched);
-            entry.features.push_back(info.watched_score);
-            entry.features.push_back(info.highest_dp);
-            entry.features.push_back(info.highest_dp_norm);
+            typedef User_Cluster_Schema S;
+            Writer features(entry.source_features);
+            features[S::NUM_WATCHERS] = info.num_watched;
+            features[S::WATCHER_SCORE] = info.watched_score;
+            features[S::HIGHEST_DP] = info.highest_dp;
+            features[S::HIGHEST_DP_NORM] = info.highest_dp_norm;
         }
     }
 };
@@ -805,15 +1287,15 @@ struct In_Id_Range_Source : public Candidate_Source {
     virtual void candidate_set(Ranked & result, int user_id, const Data & data,
                                Candidate_Data & candidate_data) const
     {
-        const User & user = data.users[user_id];
+        const User_Hot_Fields & user_hot = data.user_hot;
 
         IdSet in_id_range;
 
         // Find which of the repos could match up
-        for (int r = user.min_repo;  r <= user.max_repo;  ++r) {
+        for (int r = user_hot.min_repo(user_id);
+             r <= user_hot.max_repo(user_id);  ++r) {
             if (r == -1) break;
-            const Repo & repo = data.repos[r];
-            if (repo.invalid()) continue;
+            if (data.repo_hot.invalid(r)) continue;
             in_id_range.insert(r);
         }
 
@@ -840,12 +1322,11 @@ struct Parents_Of_Watched_Source : public Candidate_Source {
                  it = user.watching.begin(),
                  end = user.watching.end();
              it != end;  ++it) {
-            int watched_id = *it;
-            const Repo & watched = data.repos[watched_id];
+            int parent = data.repo_hot.parent(*it);
     
-            if (watched.parent == -1) continue;
+            if (parent == -1) continue;
         
-            parents_of_watched.insert(watched.parent);
+            parents_of_watched.insert(parent);
         }
 
         parents_of_watched.finish();
@@ -854,30 +1335,43 @@ struct Parents_Of_Watched_Source : public Candidate_Source {
     }
 };
 
-struct By_Watched_Author_Source : public Candidate_Source {
-    By_Watched_Author_Source()
-        : Candidate_Source("by_watched_author", 7)
-    {
-    }
+/// Features of a repo within a group of repos that the user watches some of
+/// (by_watched_author and same_name, which prefix the names)
+struct Group_Schema {
+    enum Feature {
+        ALREADY_WATCHED_NUM,
+        UNWATCHED_NUM,
+        ALREADY_WATCHED_PROP,
+        NUM_WATCHERS_ALREADY,
+        PROP_WATCHERS_ALREADY,
+        ABS_RANK,
+        ABS_PERCENTILE,
+        UNWATCHED_RANK,
+        UNWATCHED_PERCENTILE,
+        NUM_FEATURES
+    };
 
-    virtual ML::Dense_Feature_Space
-    specific_feature_space() const
-    {
-        Dense_Feature_Space result;
-        result.add_feature("author_already_watched_num", Feature_Info::REAL);
-        result.add_feature("author_unwatched_num", Feature_Info::REAL);
-        result.add_feature("author_already_watched_prop",
-                           Feature_Info::REAL);
-        result.add_feature("author_num_watchers_already",
-                           Feature_Info::REAL);
-        result.add_feature("author_prop_watchers_already",
-                           Feature_Info::REAL);
-        result.add_feature("author_abs_rank", Feature_Info::REAL);
-        result.add_feature("author_abs_percentile", Feature_Info::REAL);
-        result.add_feature("author_unwatched_rank", Feature_Info::REAL);
-        result.add_feature("author_unwatched_percentile", Feature_Info::REAL);
+    static const char * const names[];
+};
 
-        return result;
+const char * const Group_Schema::names[] = {
+    "already_watched_num",
+    "unwatched_num",
+    "already_watched_prop",
+    "num_watchers_already",
+    "prop_watchers_already",
+    "abs_rank",
+    "abs_percentile",
+    "unwatched_rank",
+    "unwatched_percentile"
+};
+
+CHECK_FEATURE_SCHEMA(Group_Schema);
+
+struct By_Watched_Author_Source : public Schema_Source<Group_Schema> {
+    By_Watched_Author_Source()
+        : Schema_Source<Group_Schema>("by_watched_author", 7, "author_")
+    {
     }
 
     virtual void candidate_set(Ranked & result, int user_id, const Data & data,
@@ -891,8 +1385,8 @@ struct By_Watched_Author_Source : public Candidate_Source {
                  it = user.watching.begin(),
                  end = user.watching.end();
              it != end;  ++it)
-            if (data.repos[*it].author != -1)
-                authors_of_watched_repos.insert(data.repos[*it].author);
+            if (data.repo_hot.author(*it) != -1)
+                authors_of_watched_repos.insert(data.repo_hot.author(*it));
         
         result.clear();
 
@@ -942,15 +1436,24 @@ struct By_Watched_Author_Source : public Candidate_Source {
                 result.push_back(author_entries[i]);
                 Ranked_Entry & entry = result.back();
                 entry.index = result.size() - 1;
-                entry.features.push_back(n_already_watched);
-                entry.features.push_back(n_unwatched);
-                entry.features.push_back(xdiv<float>(n_already_watched, author.repositories.size()));
-                entry.features.push_back(author_num_watchers);
-                entry.features.push_back(xdiv<float>(watchers_already_watched, author_num_watchers));
-                entry.features.push_back(entry.min_rank);
-                entry.features.push_back(xdiv<float>(entry.min_rank, author_entries.size()));
-                entry.features.push_back(rank);
-                entry.features.push_back(xdiv<float>(rank, n_unwatched));
+
+                typedef Group_Schema S;
+                Writer features(entry.source_features);
+                features[S::ALREADY_WATCHED_NUM] = n_already_watched;
+                features[S::UNWATCHED_NUM] = n_unwatched;
+                features[S::ALREADY_WATCHED_PROP]
+                    = xdiv<float>(n_already_watched,
+                                  author.repositories.size());
+                features[S::NUM_WATCHERS_ALREADY] = author_num_watchers;
+                features[S::PROP_WATCHERS_ALREADY]
+                    = xdiv<float>(watchers_already_watched,
+                                  author_num_watchers);
+                features[S::ABS_RANK] = entry.min_rank;
+                features[S::ABS_PERCENTILE]
+                    = xdiv<float>(entry.min_rank, author_entries.size());
+                features[S::UNWATCHED_RANK] = rank;
+                features[S::UNWATCHED_PERCENTILE]
+                    = xdiv<float>(rank, n_unwatched);
                 
                 ++rank;
             }
@@ -974,30 +1477,8 @@ struct Authored_By_Collaborator_Source : public Candidate_Source {
 
         const User & user = data.users[user_id];
 
-        IdSet collaborating_authors;
-        for (IdSet::const_iterator
-                 it = user.collaborators.begin(),
-                 end = user.collaborators.end();
-             it != end;  ++it) {
-            collaborating_authors.insert(data.users[*it].inferred_authors.begin(),
-                                         data.users[*it].inferred_authors.end());
-        }
-
-        // Find all other repos by authors of watched repos
-        IdSet repos_by_collaborating_authors;
-
-        for (IdSet::const_iterator
-                 it = collaborating_authors.begin(),
-                 end = collaborating_authors.end();
-             it != end;  ++it) {
-            repos_by_collaborating_authors
-                .insert(data.users[*it].watching.begin(),
-                        data.users[*it].watching.end());
-        }
-        
-        repos_by_collaborating_authors.finish();
-
-        result = repos_by_collaborating_authors;
+        // Precalculated by Data::find_collaborators()
+        result = user.collaborator_authored;
     }
 };
 
@@ -1016,51 +1497,17 @@ struct Watched_By_Collaborator_Source : public Candidate_Source {
 
         const User & user = data.users[user_id];
 
-        // Find all other repos by authors of watched repos
-        IdSet watched_by_collaborating_authors;
-
-        for (IdSet::const_iterator
-                 it = user.collaborators.begin(),
-                 end = user.collaborators.end();
-             it != end;  ++it) {
-            watched_by_collaborating_authors
-                .insert(data.users[*it].watching.begin(),
-                        data.users[*it].watching.end());
-        }
-        
-        watched_by_collaborating_authors.finish();
-
-        result = watched_by_collaborating_authors;
+        // Precalculated by Data::find_collaborators()
+        result = user.collaborator_watched;
     }
 };
 
-struct Same_Name_Source : public Candidate_Source {
+struct Same_Name_Source : public Schema_Source<Group_Schema> {
     Same_Name_Source()
-        : Candidate_Source("same_name", 8)
+        : Schema_Source<Group_Schema>("same_name", 8, "same_name_")
     {
     }
 
-    virtual ML::Dense_Feature_Space
-    specific_feature_space() const
-    {
-        Dense_Feature_Space result;
-        result.add_feature("same_name_already_watched_num", Feature_Info::REAL);
-        result.add_feature("same_name_unwatched_num", Feature_Info::REAL);
-        result.add_feature("same_name_already_watched_prop",
-                           Feature_Info::REAL);
-        result.add_feature("same_name_num_watchers_already",
-                           Feature_Info::REAL);
-        result.add_feature("same_name_prop_watchers_already",
-                           Feature_Info::REAL);
-        result.add_feature("same_name_abs_rank", Feature_Info::REAL);
-        result.add_feature("same_name_abs_percentile", Feature_Info::REAL);
-        result.add_feature("same_name_unwatched_rank", Feature_Info::REAL);
-        result.add_feature("same_name_unwatched_percentile",
-                           Feature_Info::REAL);
-
-        return result;
-    }
-
     virtual void candidate_set(Ranked & result, int user_id, const Data & data,
                                Candidate_Data & candidate_data) const
     {
@@ -1125,18 +1572,22 @@ struct Same_Name_Source : public Candidate_Source {
 
                 Ranked_Entry & entry = result.back();
                 entry.index = result.size() - 1;
-                entry.features.push_back(n_already_watched);
-                entry.features.push_back(n_unwatched);
-                entry.features.push_back
-                    (xdiv<float>(n_already_watched, with_same_name.size()));
-                entry.features.push_back(name_num_watchers);
-                entry.features.push_back
-                    (xdiv<float>(watchers_already_watched, name_num_watchers));
-                entry.features.push_back(entry.min_rank);
-                entry.features.push_back
-                    (xdiv<float>(entry.min_rank, with_same_name.size()));
-                entry.features.push_back(rank);
-                entry.features.push_back(xdiv<float>(rank, n_unwatched));
+
+                typedef Group_Schema S;
+                Writer features(entry.source_features);
+                features[S::ALREADY_WATCHED_NUM] = n_already_watched;
+                features[S::UNWATCHED_NUM] = n_unwatched;
+                features[S::ALREADY_WATCHED_PROP]
+                    = xdiv<float>(n_already_watched, with_same_name.size());
+                features[S::NUM_WATCHERS_ALREADY] = name_num_watchers;
+                features[S::PROP_WATCHERS_ALREADY]
+                    = xdiv<float>(watchers_already_watched, name_num_watchers);
+                features[S::ABS_RANK] = entry.min_rank;
+                features[S::ABS_PERCENTILE]
+                    = xdiv<float>(entry.min_rank, with_same_name.size());
+                features[S::UNWATCHED_RANK] = rank;
+                features[S::UNWATCHED_PERCENTILE]
+                    = xdiv<float>(rank, n_unwatched);
                 
                 ++rank;
             }
@@ -1165,20 +1616,31 @@ struct Most_Watched_Source : public Candidate_Source {
     }
 };
 
-struct Probability_Propagation_Source : public Candidate_Source {
-    Probability_Propagation_Source()
-        : Candidate_Source("probability_propagation", 9)
-    {
-    }
+/// Features of the probability_propagation source
+struct Prob_Prop_Schema {
+    enum Feature {
+        TOTAL_PROB,
+        NUSERS,
+        PROP_PER_USER,
+        NUM_FEATURES
+    };
+
+    static const char * const names[];
+};
+
+const char * const Prob_Prop_Schema::names[] = {
+    "prob_prop_total_prob",
+    "prob_prop_nusers",
+    "prob_prop_prop_per_user"
+};
+
+CHECK_FEATURE_SCHEMA(Prob_Prop_Schema);
 
-    virtual ML::Dense_Feature_Space
-    specific_feature_space() const
+struct Probability_Propagation_Source
+    : public Schema_Source<Prob_Prop_Schema> {
+    Probability_Propagation_Source()
+        : Schema_Source<Prob_Prop_Schema>("probability_propagation", 9)
     {
-        Dense_Feature_Space result;
-        result.add_feature("prob_prop_total_prob", Feature_Info::REAL);
-        result.add_feature("prob_prop_nusers", Feature_Info::REAL);
-        result.add_feature("prob_prop_prop_per_user", Feature_Info::REAL);
-        return result;
     }
 
     struct Prob_Info {
@@ -1201,8 +1663,11 @@ struct Probability_Propagation_Source : public Candidate_Source {
     {
         const User & user = data.users[user_id];
 
+        Candidate_Scratch & scratch = candidate_data.get_scratch(data);
+
         // Step 1: propagate to users that watch more than one repo
-        hash_map<int, double> user_probs;
+        Dense_Accumulator<double> & user_probs
+            = scratch.user_accumulator<double>(SLOT_PROB_USERS);
         double total_prob = 0.0;
 
         for (IdSet::const_iterator
@@ -1228,13 +1693,15 @@ struct Probability_Propagation_Source : public Candidate_Source {
         double prob_inverse = 1.0 / total_prob;
 
         // Step 2: propagate back to repos watched by those users
-        hash_map<int, Prob_Info> repo_probs;
-        for (hash_map<int, double>::const_iterator
-                 it = user_probs.begin(),
-                 end = user_probs.end();
-             it != end;  ++it) {
+        Dense_Accumulator<Prob_Info> & repo_probs
+            = scratch.repo_accumulator<Prob_Info>(SLOT_PROB_REPOS);
 
-            const User & user = data.users[it->first];
+        const vector<int> & user_ids = user_probs.ids();
+        for (unsigned i = 0;  i < user_ids.size();  ++i) {
+            int user_id2 = user_ids[i];
+            double user_prob = user_probs.get(user_id2);
+
+            const User & user = data.users[user_id2];
 
             double nwatching_inverse = 1.0 / user.watching.size();
 
@@ -1243,25 +1710,343 @@ struct Probability_Propagation_Source : public Candidate_Source {
                      jend = user.watching.end();
                  jt != jend;  ++jt)
                 repo_probs[*jt]
-                    += it->second * prob_inverse * nwatching_inverse;
+                    += user_prob * prob_inverse * nwatching_inverse;
         }
 
         // Step 3: rank, cut off, generate features, return results
-        for (hash_map<int, Prob_Info>::const_iterator
-                 it = repo_probs.begin(),
-                 end = repo_probs.end();
-             it != end;  ++it) {
+        const vector<int> & repo_ids = repo_probs.ids();
+        for (unsigned i = 0;  i < repo_ids.size();  ++i) {
+            int repo_id = repo_ids[i];
+            const Prob_Info & info = repo_probs.get(repo_id);
 
-            if (user.watching.count(it->first)) continue;
+            if (user.watching.count(repo_id)) continue;
             
             result.push_back(Ranked_Entry());
             
             Ranked_Entry & entry = result.back();
-            entry.score = it->second.total;
-            entry.repo_id = it->first;
-            entry.features.push_back(it->second.total);
-            entry.features.push_back(it->second.nwatchers);
-            entry.features.push_back(it->second.total / it->second.nwatchers);
+            entry.score = info.total;
+            entry.repo_id = repo_id;
+            Writer features(entry.source_features);
+            features[Prob_Prop_Schema::TOTAL_PROB] = info.total;
+            features[Prob_Prop_Schema::NUSERS] = info.nwatchers;
+            features[Prob_Prop_Schema::PROP_PER_USER]
+                = info.total / info.nwatchers;
+        }
+    }
+};
+
+/// Features of the minhash source
+struct MinHash_Schema {
+    enum Feature {
+        TOTAL_JACCARD,
+        MAX_JACCARD,
+        NUM_WATCHED,
+        NUM_FEATURES
+    };
+
+    static const char * const names[];
+};
+
+const char * const MinHash_Schema::names[] = {
+    "minhash_total_jaccard",
+    "minhash_max_jaccard",
+    "minhash_num_watched"
+};
+
+CHECK_FEATURE_SCHEMA(MinHash_Schema);
+
+struct MinHash_Source : public Schema_Source<MinHash_Schema> {
+    MinHash_Source()
+        : Schema_Source<MinHash_Schema>("minhash", 13),
+          min_jaccard(0.1), max_bucket_size(500), max_candidates(1000)
+    {
+    }
+
+    /// Neighbours with a lower estimated Jaccard similarity are ignored
+    float min_jaccard;
+
+    /// Buckets bigger than this are skipped (they are mostly repos with a
+    /// single, common watcher)
+    int max_bucket_size;
+
+    /// Maximum number of candidates to generate
+    int max_candidates;
+
+    virtual void configure(const ML::Configuration & config_,
+                           const std::string & name)
+    {
+        Candidate_Source::configure(config_, name);
+
+        Configuration config(config_, name, Configuration::PREFIX_APPEND);
+        config.find(min_jaccard, "min_jaccard");
+        config.find(max_bucket_size, "max_bucket_size");
+        config.find(max_candidates, "max_candidates");
+    }
+
+    struct MinHash_Info {
+        MinHash_Info()
+            : total(0.0f), max(0.0f), n(0)
+        {
+        }
+
+        float total;
+        float max;
+        int n;
+    };
+
+    virtual void candidate_set(Ranked & result, int user_id, const Data & data,
+                               Candidate_Data & candidate_data) const
+    {
+        const MinHash_Index & index = data.minhash;
+        if (index.empty())
+            throw Exception("minhash source: index wasn't built (use "
+                            "--minhash-bands)");
+
+        const User & user = data.users[user_id];
+
+        Candidate_Scratch & scratch = candidate_data.get_scratch(data);
+
+        Dense_Accumulator<MinHash_Info> & neighbours
+            = scratch.repo_accumulator<MinHash_Info>(SLOT_MINHASH_INFO);
+
+        // Watched repo (+ 1) for which we last looked at each repo, so that
+        // a repo in several of the same buckets is only counted once
+        Dense_Accumulator<int> & seen
+            = scratch.repo_accumulator<int>(SLOT_MINHASH_SEEN);
+
+        for (IdSet::const_iterator
+                 it = user.watching.begin(),
+                 end = user.watching.end();
+             it != end;  ++it) {
+            int watched_id = *it;
+            if (!index.has_signature(watched_id)) continue;
+
+            for (int band = 0;  band < index.num_bands();  ++band) {
+                if (index.bucket_size(band, watched_id) > max_bucket_size)
+                    continue;
+
+                for (const int
+                         * jt = index.bucket_begin(band, watched_id),
+                         * jend = index.bucket_end(band, watched_id);
+                     jt != jend;  ++jt) {
+                    int repo_id = *jt;
+                    if (repo_id == watched_id) continue;
+
+                    int & last_seen = seen[repo_id];
+                    if (last_seen == watched_id + 1) continue;
+                    last_seen = watched_id + 1;
+
+                    float jaccard = index.jaccard(watched_id, repo_id);
+                    if (jaccard < min_jaccard) continue;
+
+                    MinHash_Info & info = neighbours[repo_id];
+                    info.total += jaccard;
+                    info.max = std::max(info.max, jaccard);
+                    info.n += 1;
+                }
+            }
+        }
+
+        typedef pair<float, int> Scored;  // total, repo id
+
+        // Keep the max_candidates with the highest total
+        Top_K<Scored> top(scratch.buffer<Scored>(SLOT_MINHASH_TOP),
+                          max_candidates);
+
+        const vector<int> & repo_ids = neighbours.ids();
+        for (unsigned i = 0;  i < repo_ids.size();  ++i) {
+            int repo_id = repo_ids[i];
+            if (user.watching.count(repo_id)) continue;
+            top.add(Scored(neighbours.get(repo_id).total, repo_id));
+        }
+
+        top.sort();
+
+        result.reserve(top.size());
+
+        for (unsigned i = 0;  i < top.size();  ++i) {
+            int repo_id = top[i].second;
+            const MinHash_Info & info = neighbours.get(repo_id);
+
+            result.push_back(Ranked_Entry());
+            Ranked_Entry & entry = result.back();
+            entry.score = info.total;
+            entry.repo_id = repo_id;
+            Writer features(entry.source_features);
+            features[MinHash_Schema::TOTAL_JACCARD] = info.total;
+            features[MinHash_Schema::MAX_JACCARD] = info.max;
+            features[MinHash_Schema::NUM_WATCHED] = info.n;
+        }
+    }
+};
+
+/// Features of the keywords source
+struct Keywords_Schema {
+    enum Feature {
+        SCORE,
+        COSINE,
+        NUM_MATCHED,
+        NUM_FEATURES
+    };
+
+    static const char * const names[];
+};
+
+const char * const Keywords_Schema::names[] = {
+    "keywords_score",
+    "keywords_cosine",
+    "keywords_num_matched"
+};
+
+CHECK_FEATURE_SCHEMA(Keywords_Schema);
+
+struct Keywords_Source : public Schema_Source<Keywords_Schema> {
+    Keywords_Source()
+        : Schema_Source<Keywords_Schema>("keywords", 14),
+          max_terms(50), max_candidates(500)
+    {
+    }
+
+    /// Only the heaviest max_terms keywords of the user's profile are used
+    int max_terms;
+
+    /// Maximum number of candidates to generate
+    int max_candidates;
+
+    virtual void configure(const ML::Configuration & config_,
+                           const std::string & name)
+    {
+        Candidate_Source::configure(config_, name);
+
+        Configuration config(config_, name, Configuration::PREFIX_APPEND);
+        config.find(max_terms, "max_terms");
+        config.find(max_candidates, "max_candidates");
+    }
+
+    struct Weight_Greater {
+        bool operator () (const Cooc_Entry & e1, const Cooc_Entry & e2) const
+        {
+            if (e1.score != e2.score) return e1.score > e2.score;
+            return e1.with < e2.with;
+        }
+    };
+
+    struct Keyword_Info {
+        Keyword_Info()
+            : score(0.0f), nmatched(0)
+        {
+        }
+
+        float score;
+        int nmatched;
+    };
+
+    /** The user's profile is the sum of the tf-idf vectors of the watched
+        repos, cut down to the max_terms heaviest keywords.  The index's
+        posting lists are sorted by weight, so we find the top
+        max_candidates repos by dot product with the threshold algorithm:
+        go down the lists in parallel, scoring each new repo in full
+        against the profile, until the best that an unseen repo could score
+        can't get into the top max_candidates.
+    */
+    virtual void candidate_set(Ranked & result, int user_id, const Data & data,
+                               Candidate_Data & candidate_data) const
+    {
+        const Keyword_Index & index = data.keyword_index;
+        if (index.empty())
+            throw Exception("keywords source: keyword index wasn't built");
+
+        const User & user = data.users[user_id];
+
+        Cooccurrences all_terms;
+        for (IdSet::const_iterator
+                 it = user.watching.begin(), end = user.watching.end();
+             it != end;  ++it)
+            all_terms.add(data.repos[*it].keywords_idf);
+        all_terms.finish();
+
+        if (all_terms.empty()) return;
+
+        Candidate_Scratch & scratch = candidate_data.get_scratch(data);
+
+        // Heaviest terms, by weight
+        vector<Cooc_Entry> & terms
+            = scratch.buffer<Cooc_Entry>(SLOT_KEYWORDS_TERMS);
+        terms.insert(terms.end(), all_terms.begin(), all_terms.end());
+
+        if (terms.size() > (size_t)max_terms) {
+            std::nth_element(terms.begin(), terms.begin() + max_terms,
+                             terms.end(), Weight_Greater());
+            terms.erase(terms.begin() + max_terms, terms.end());
+        }
+
+        std::sort(terms.begin(), terms.end());
+
+        Cooccurrences profile;
+        profile.insert(profile.end(), terms.begin(), terms.end());
+
+        float profile_2norm = sqrt(profile.overlap(profile).first);
+
+        typedef pair<float, int> Scored;  // score, repo id
+
+        // The best max_candidates so far
+        Top_K<Scored> top(scratch.buffer<Scored>(SLOT_KEYWORDS_HEAP),
+                          max_candidates);
+        Dense_Accumulator<Keyword_Info> & seen
+            = scratch.repo_accumulator<Keyword_Info>(SLOT_KEYWORDS_SEEN);
+
+        for (unsigned depth = 0;  ;  ++depth) {
+            float threshold = 0.0;
+            bool any_left = false;
+
+            for (unsigned i = 0;  i < terms.size();  ++i) {
+                int term = terms[i].with;
+                if (term >= (int)index.num_terms()) continue;
+                if (depth >= index.size(term)) continue;
+
+                any_left = true;
+
+                const Keyword_Index::Posting & posting
+                    = index.begin(term)[depth];
+                threshold += terms[i].score * posting.weight;
+
+                int repo_id = posting.repo_id;
+                if (seen.count(repo_id)) continue;
+
+                Keyword_Info & info = seen[repo_id];
+                if (user.watching.count(repo_id)) continue;
+
+                const Repo & repo = data.repos[repo_id];
+                pair<float, float> overlap = repo.keywords_idf.overlap(profile);
+                info.score = overlap.first / repo.keywords_idf_2norm;
+                info.nmatched = overlap.second;
+
+                top.add(Scored(info.score, repo_id));
+            }
+
+            if (!any_left) break;
+
+            // Nothing that we haven't seen can beat what we have
+            if (top.full() && top.worst().first >= threshold)
+                break;
+        }
+
+        result.reserve(top.size());
+
+        for (unsigned i = 0;  i < top.size();  ++i) {
+            int repo_id = top[i].second;
+            const Keyword_Info & info = seen.get(repo_id);
+
+            result.push_back(Ranked_Entry());
+
+            Ranked_Entry & entry = result.back();
+            entry.repo_id = repo_id;
+            entry.score = info.score;
+            Writer features(entry.source_features);
+            features[Keywords_Schema::SCORE] = info.score;
+            features[Keywords_Schema::COSINE]
+                = xdiv<float>(info.score, profile_2norm);
+            features[Keywords_Schema::NUM_MATCHED] = info.nmatched;
         }
     }
 };
@@ -1327,6 +2112,12 @@ get_candidate_source(const ML::Configuration & config_,
     else if (type == "probability_propagation") {
         result.reset(new Probability_Propagation_Source());
     }
+    else if (type == "minhash") {
+        result.reset(new MinHash_Source());
+    }
+    else if (type == "keywords") {
+        result.reset(new Keywords_Source());
+    }
     else throw Exception("Source of type " + type + " doesn't exist");
 
     result->configure(config_, name);
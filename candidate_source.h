@@ -10,11 +10,18 @@
 
 
 #include "data.h"
+#include "scratch.h"
+#include "feature_schema.h"
 #include "utils/configuration.h"
+#include "utils/hash_map.h"
 #include "boosting/dense_features.h"
 #include "boosting/classifier.h"
 
 #include <map>
+#include <stdint.h>
+
+struct Ranking_Memo;
+struct Common_Block;
 
 struct Ranked_Entry {
     Ranked_Entry()
@@ -28,7 +35,10 @@ struct Ranked_Entry {
     float score;
     int min_rank;
     int max_rank;
-    ML::distribution<float> features;
+
+    /// The source's own features, for the candidates of a source
+    Source_Features source_features;
+
     bool keep;
 };
 
@@ -40,6 +50,11 @@ struct Ranked : std::vector<Ranked_Entry> {
 
 
 struct Candidate_Data {
+    Candidate_Data()
+        : scratch(0), memo(0), common(0)
+    {
+    }
+
     virtual ~Candidate_Data()
     {
     }
@@ -47,8 +62,116 @@ struct Candidate_Data {
     // Information about each candidate source from each repo
     // Access with: info[repo_id][source_id]
     std::map<int, std::map<int, Ranked_Entry> > info;
+
+    /// Number of candidates that each source produced
+    std::vector<int> source_sizes;
+
+    /// Scratch space for the sources to use.  Normally set to the
+    /// generator's one for this thread; not owned.
+    Candidate_Scratch * scratch;
+
+    /// Return the scratch space, initialized for the given data.  If none
+    /// was set, one is created for this object.
+    Candidate_Scratch & get_scratch(const Data & data);
+
+    /// Results of ranking this user's candidates, shared between the
+    /// ranker stages.  Set by the caller for each user; not owned.  If
+    /// null, everything is calculated each time that it's needed.
+    Ranking_Memo * memo;
+
+    /// The common features of this user's candidates, shared between the
+    /// sources.  Normally the generator's one for this thread; not owned.
+    Common_Block * common;
+
+    /// Return the common features block.  If none was set, one is created
+    /// for this object.
+    Common_Block & get_common();
+
+private:
+    boost::shared_ptr<Candidate_Scratch> owned_scratch;
+    boost::shared_ptr<Common_Block> owned_common;
+};
+
+/*****************************************************************************/
+/* COMMON_SCHEMA                                                             */
+/*****************************************************************************/
+
+/// Features that are calculated for the candidates of every source
+struct Common_Schema {
+    enum Feature {
+        DENSITY,
+        USER_ID,
+        USER_REPO_ID_RATIO,
+        USER_WATCHED_REPOS,
+        REPO_WATCHED_USERS,
+        REPO_LINES_OF_CODE,
+        USER_PROB,
+        USER_PROB_RANK,
+        REPO_PROB,
+        REPO_PROB_RANK,
+        USER_REPO_PROB,
+        REPO_HAS_PARENT,
+        REPO_NUM_CHILDREN,
+        REPO_NUM_ANCESTORS,
+        REPO_NUM_SIBLINGS,
+        REPO_PARENT_WATCHERS,
+        NUM_FEATURES
+    };
+
+    static const char * const names[];
+};
+
+
+/*****************************************************************************/
+/* COMMON_BLOCK                                                              */
+/*****************************************************************************/
+
+/** The common features of one user's candidates.  They are calculated a
+    block at a time, and only once for each repo however many of the
+    sources produce it.  The row of each repo is found through a dense
+    array indexed by repo ID, and everything keeps its memory from one user
+    to the next, so the generator keeps one per thread.
+
+    Not locked: add() must not run at the same time as anything else.
+    Once everything is added, any number of threads can read at once;
+    the generator adds the candidates of all of the sources before it
+    fans out the scoring.
+*/
+struct Common_Block {
+    Common_Block();
+
+    enum { NUM_FEATURES = Common_Schema::NUM_FEATURES };
+
+    /// Calculate the common features of the candidates that don't have
+    /// them yet.  Adding for another user starts again.
+    void add(int user_id, const Ranked & candidates, const Data & data);
+
+    /// Throw unless the block is for this user
+    void check(int user_id) const;
+
+    /// The NUM_FEATURES common features of the repo, which must have been
+    /// added.  Points into the block, so it's only good until the next
+    /// add().
+    const float * row(int repo_id) const
+    {
+        int r = (repo_id >= 0 && repo_id < (int)repo_to_row.size()
+                 ? repo_to_row[repo_id] : -1);
+        if (r == -1) not_added(repo_id);
+        return &values[r * NUM_FEATURES];
+    }
+
+    size_t memusage() const;
+
+private:
+    int user_id;
+    std::vector<int> repo_to_row;  ///< By repo ID; -1 if not added
+    std::vector<int> repos;        ///< Repo ID of each row
+    std::vector<float> values;     ///< NUM_FEATURES per row
+
+    void not_added(int repo_id) const;
 };
 
+
 /*****************************************************************************/
 /* CANDIDATE_SOURCE                                                          */
 /*****************************************************************************/
@@ -71,6 +194,11 @@ struct Candidate_Source {
 
     virtual void init();
 
+    /// Hash, continuing from hash, of what affects the candidates besides
+    /// the configuration: the name, limits and classifier file.  Sources
+    /// that load other files add their contents.
+    virtual uint64_t fingerprint(uint64_t hash) const;
+
     /// Generate feature space specific to this candidate
     virtual boost::shared_ptr<const ML::Dense_Feature_Space>
     feature_space() const;
@@ -79,18 +207,28 @@ struct Candidate_Source {
     static ML::Dense_Feature_Space
     common_feature_space();
 
+    /// Common features of the user with each of the n repos, written into
+    /// the first NUM_FEATURES columns of rows that are stride floats apart.
+    /// Done a column at a time, gathering from the repo feature columns.
     static void
-    common_features(distribution<float> & result,
-                    int user_id, int repo_id, const Data & data,
-                    Candidate_Data & candidate_data);
+    common_features(float * result, size_t stride, int user_id,
+                    const int * repo_ids, size_t n, const Data & data);
 
     /// Feature space containing features specific to this candidate source
     virtual ML::Dense_Feature_Space specific_feature_space() const;
 
+    /// Generate, score and rank the candidates: candidate_set(), then the
+    /// common features, then score_candidates()
     virtual void
     gen_candidates(Ranked & result, int user_id, const Data & data,
                    Candidate_Data & candidate_data) const;
 
+    /// Score and rank the candidates from candidate_set().  Their common
+    /// features must already be in the block.  Only reads the block, so
+    /// sources can score in parallel.
+    void score_candidates(Ranked & entries, int user_id, const Data & data,
+                          const Common_Block & common) const;
+
     /// Generate the very basic set of candidates with features but no
     /// ranking information
     virtual void
@@ -112,6 +250,40 @@ struct Candidate_Source {
     ML::Dense_Feature_Space::Mapping mapping;
     ML::Optimization_Info opt_info;
     bool load_data;
+
+    /// Features that the classifier isn't trained on (train_ignore in the
+    /// source or, failing that, the generator)
+    std::vector<std::string> train_ignore;
+};
+
+
+/*****************************************************************************/
+/* SCHEMA_SOURCE                                                             */
+/*****************************************************************************/
+
+/** A source whose specific features are those of a schema.  The feature
+    space and the writer for the features both come from the schema, so
+    they can't disagree.  Sources that share a schema give a prefix for
+    the names.
+*/
+
+template<class Schema>
+struct Schema_Source : public Candidate_Source {
+    Schema_Source(const std::string & type, int id,
+                  const std::string & prefix = "")
+        : Candidate_Source(type, id), prefix(prefix)
+    {
+    }
+
+    typedef Schema_Writer<Schema> Writer;
+
+    virtual ML::Dense_Feature_Space specific_feature_space() const
+    {
+        return schema_feature_space<Schema>(prefix);
+    }
+
+private:
+    std::string prefix;
 };
 
 
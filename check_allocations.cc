@@ -0,0 +1,316 @@
+/* check_allocations.cc
+   Jeremy Barnes, 6 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Program to count the heap allocations made by candidate generation once
+   the per-thread scratch space has warmed up.  It fails if scoring the
+   candidates (the common features and the source classifiers) allocates;
+   the counts for generating the candidate sets and for the whole
+   generator are reported for information.
+*/
+
+#include "data.h"
+#include "ranker.h"
+#include "decompose.h"
+#include "keywords.h"
+
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+#include "utils/configuration.h"
+
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <new>
+#include <stdlib.h>
+
+
+using namespace std;
+using namespace ML;
+
+
+/*****************************************************************************/
+/* ALLOCATION COUNTING                                                       */
+/*****************************************************************************/
+
+/* Every operator new in the program goes through here.  The counter is only
+   advanced while counting is set, and the candidates are generated on this
+   thread only, so it needs no locking. */
+
+namespace {
+
+bool counting = false;
+size_t num_allocations = 0;
+
+void * counted_alloc(size_t size)
+{
+    if (counting) ++num_allocations;
+    void * result = malloc(size ? size : 1);
+    if (!result) throw std::bad_alloc();
+    return result;
+}
+
+} // file scope
+
+void * operator new (size_t size) throw (std::bad_alloc)
+{
+    return counted_alloc(size);
+}
+
+void * operator new [] (size_t size) throw (std::bad_alloc)
+{
+    return counted_alloc(size);
+}
+
+void operator delete (void * ptr) throw ()
+{
+    free(ptr);
+}
+
+void operator delete [] (void * ptr) throw ()
+{
+    free(ptr);
+}
+
+namespace {
+
+/** Counts the allocations made while it's in scope. */
+struct Count_Allocations {
+    Count_Allocations()
+        : before(num_allocations)
+    {
+        counting = true;
+    }
+
+    ~Count_Allocations()
+    {
+        counting = false;
+    }
+
+    size_t count() const { return num_allocations - before; }
+
+    size_t before;
+};
+
+/** Allocations made by one stage over the users: total and max per user. */
+struct Counts {
+    Counts()
+        : total(0), max(0)
+    {
+    }
+
+    void add(size_t n)
+    {
+        total += n;
+        max = std::max(max, n);
+    }
+
+    size_t total, max;
+};
+
+} // file scope
+
+
+int main(int argc, char ** argv)
+{
+    // Configuration file to use
+    string config_file = "config.txt";
+
+    // Candidate generator to use
+    string generator_name = "@default_generator";
+
+    // Extra configuration options
+    vector<string> extra_config_options;
+
+    // Number of users for fake data generation
+    int num_users = 4788;
+
+    // Random seed for fake data generation
+    int rseed = 0;
+
+    // Number of the test users to check
+    int num_to_check = 100;
+
+    // Factors to load instead of decomposing
+    string load_factors_file;
+
+    // MinHash signature shape
+    int minhash_bands = 0;
+    int minhash_rows = 4;
+
+    {
+        using namespace boost::program_options;
+
+        options_description config_options("Configuration");
+
+        config_options.add_options()
+            ("config-file,c", value<string>(&config_file),
+             "configuration file to read configuration options from")
+            ("generator-name,g", value<string>(&generator_name),
+             "name of object to generate candidates for ranking")
+            ("extra-config-option", value<vector<string> >(&extra_config_options),
+             "extra configuration option=value (can go directly on command line)");
+
+        options_description control_options("Control Options");
+
+        control_options.add_options()
+            ("num-users,n", value<int>(&num_users),
+             "number of users for fake test")
+            ("random-seed", value<int>(&rseed),
+             "random seed for fake data")
+            ("num-to-check", value<int>(&num_to_check),
+             "number of the fake test users to generate candidates for")
+            ("load-factors", value<string>(&load_factors_file),
+             "load factors from the given file instead of decomposing")
+            ("minhash-bands", value<int>(&minhash_bands),
+             "number of minhash bands (0 = no minhash)")
+            ("minhash-rows", value<int>(&minhash_rows),
+             "number of rows per minhash band");
+
+        positional_options_description p;
+        p.add("extra-config-option", -1);
+
+        options_description all_opt;
+        all_opt
+            .add(config_options)
+            .add(control_options);
+
+        all_opt.add_options()
+            ("help,h", "print this message");
+
+        variables_map vm;
+        store(command_line_parser(argc, argv)
+              .options(all_opt)
+              .positional(p)
+              .run(),
+              vm);
+        notify(vm);
+
+        if (vm.count("help")) {
+            cout << all_opt << endl;
+            return 1;
+        }
+    }
+
+    Configuration config;
+    if (config_file != "") config.load(config_file);
+    config.parse_command_line(extra_config_options);
+
+    // Load up the data the same way as the github program does
+    cerr << "loading data...";
+    Data data;
+    data.load();
+    cerr << " done." << endl;
+
+    data.setup_fake_test(num_users, rseed);
+
+    Decomposition decomposition;
+    if (load_factors_file != "")
+        decomposition.load_factors(load_factors_file, data);
+    else decomposition.decompose(data);
+
+    analyze_keywords(data);
+
+    if (minhash_bands > 0)
+        data.calc_minhash(minhash_bands, minhash_rows);
+
+    decomposition.load_kmeans_users("data/kmeans_users.txt", data);
+    decomposition.load_kmeans_repos("data/kmeans_repos.txt", data);
+
+    data.calc_repo_features();
+
+    if (generator_name != "" && generator_name[0] == '@')
+        config.must_find(generator_name, string(generator_name, 1));
+
+    boost::shared_ptr<Candidate_Generator> generator
+        = get_candidate_generator(config, generator_name);
+
+    // Everything on this thread, so that the counts are of this user only
+    generator->parallel_sources = false;
+
+    const vector<boost::shared_ptr<Candidate_Source> > & sources
+        = generator->sources;
+
+    size_t nusers = 0;
+    Counts generator_counts;
+    vector<Counts> set_counts(sources.size()), score_counts(sources.size());
+
+    Common_Block & common_block = generator->common_block();
+
+    for (unsigned i = 0;  i < data.users_to_test.size()
+             && nusers < (size_t)num_to_check;  ++i) {
+        int user_id = data.users_to_test[i];
+        ++nusers;
+
+        // The first time warms up the scratch space for this user; the
+        // second should find everything already allocated.
+        for (unsigned pass = 0;  pass < 2;  ++pass) {
+            Ranked candidates;
+            Candidate_Data candidate_data;
+
+            Count_Allocations counter;
+            generator->candidates(candidates, candidate_data, data, user_id);
+
+            if (pass == 0) continue;
+            generator_counts.add(counter.count());
+        }
+
+        // Each source on its own, split the same way as gen_candidates()
+        // so that the scoring is counted apart from the candidate set.
+        Candidate_Data candidate_data;
+        candidate_data.scratch = &generator->scratch(data);
+        candidate_data.common = &common_block;
+
+        for (unsigned j = 0;  j < sources.size();  ++j) {
+            for (unsigned pass = 0;  pass < 2;  ++pass) {
+                Ranked ranked;
+                size_t nset, nscore;
+                {
+                    Count_Allocations counter;
+                    sources[j]->candidate_set(ranked, user_id, data,
+                                              candidate_data);
+                    nset = counter.count();
+                }
+                {
+                    Count_Allocations counter;
+                    common_block.add(user_id, ranked, data);
+                    sources[j]->score_candidates(ranked, user_id, data,
+                                                 common_block);
+                    nscore = counter.count();
+                }
+
+                if (pass == 0) continue;
+                set_counts[j].add(nset);
+                score_counts[j].add(nscore);
+            }
+        }
+    }
+
+    if (nusers == 0)
+        throw Exception("no users to test");
+
+    size_t score_total = 0;
+
+    cout << format("%-30s %10s %8s %10s %8s\n", "allocations on second call",
+                   "set mean", "max", "score mean", "max");
+    for (unsigned j = 0;  j < sources.size();  ++j) {
+        cout << format("%-30s %10.2f %8zd %10.2f %8zd\n",
+                       sources[j]->name().c_str(),
+                       1.0 * set_counts[j].total / nusers, set_counts[j].max,
+                       1.0 * score_counts[j].total / nusers,
+                       score_counts[j].max);
+        score_total += score_counts[j].total;
+    }
+    cout << format("%-30s %10.2f %8zd\n", "generator",
+                   1.0 * generator_counts.total / nusers,
+                   generator_counts.max);
+    cout << format("over %zd users\n", nusers);
+
+    if (score_total != 0)
+        cout << "FAILED: scoring allocated" << endl;
+
+    return score_total == 0 ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/* check_repo_features.cc
+   Jeremy Barnes, 18 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Program to check the precomputed repo feature columns against the
+   per-candidate calculation that they replaced in common_features() and
+   Ranker::features().
+*/
+
+#include "data.h"
+#include "decompose.h"
+#include "keywords.h"
+
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <cmath>
+#include <string.h>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace {
+
+/** The repo features of the repo, calculated the way that they were for
+    each candidate, in the order of Repo_Features::Column.  The
+    expressions are those of the original code; the ancestors come from
+    the fork forest, which replaced Repo::ancestors.
+*/
+void old_features(float * result, int repo_id, const Data & data)
+{
+    static const boost::gregorian::date epoch(2007, 1, 1);
+
+    const Repo & repo = data.repos[repo_id];
+
+    // Common features
+    *result++ = repo.watchers.size();
+    *result++ = log(repo.total_loc + 1);
+    *result++ = repo.repo_prob;
+    *result++ = repo.repo_prob_rank;
+
+    *result++ = repo.parent != -1;
+    *result++ = data.fork_forest.num_children(repo_id);
+    *result++ = data.fork_forest.depth(repo_id);
+    if (repo.parent == -1) {
+        *result++ = 0;
+        *result++ = -1;
+    }
+    else {
+        *result++ = data.fork_forest.num_children(repo.parent);
+        *result++ = data.repos[repo.parent].watchers.size();
+    }
+
+    // Ranker features
+    bool valid_author
+        = repo.author >= 0 && repo.author < (int)data.authors.size();
+    string author_name
+        = (valid_author ? data.authors[repo.author].name : string());
+
+    const Data::Name_Info & name_info = data.name_to_repos(repo.name);
+
+    *result++ = author_name.find(repo.name) != string::npos;
+    *result++ = repo.name.find(author_name) != string::npos;
+
+    if (valid_author) {
+        *result++ = data.authors[repo.author].repositories.size();
+        *result++ = data.authors[repo.author].num_watchers;
+    }
+    else {
+        *result++ = -1;
+        *result++ = -1;
+    }
+
+    *result++ = name_info.size();
+    *result++ = name_info.num_watchers;
+    *result++ = repo.cooc.size();
+    *result++ = repo.cooc2.size();
+
+    long repo_date = (repo.date - epoch).days();
+
+    *result++ = repo_date;
+
+    long author_date = 0;
+
+    if (repo.author != -1 && data.authors[repo.author].num_followers != -1)
+        author_date = (data.authors[repo.author].date - epoch).days();
+
+    *result++ = author_date;
+    *result++ = repo_date - author_date;
+
+    if (repo.author != -1) {
+        *result++ = data.authors[repo.author].num_followers;
+        *result++ = data.authors[repo.author].num_following;
+    }
+    else {
+        *result++ = -1;
+        *result++ = -1;
+    }
+
+    bool suspicious_repo
+        = repo.watchers.empty()
+        || *repo.watchers.begin() > repo.max_user;
+
+    *result++ = repo.max_user - repo.min_user;
+    *result++ = suspicious_repo;
+
+    *result++ = repo.keywords.size();
+    *result++ = repo.keywords_2norm;
+    *result++ = repo.keywords_idf_2norm;
+
+    *result++ = repo.keyword_vec.max();
+    *result++ = repo.keyword_vec.max() / repo.keyword_vec_2norm;
+
+    *result++ = repo.num_watches_api;
+    *result++ = repo.num_watches_api - (int)repo.watchers.size();
+    *result++ = repo.num_forks_api;
+    *result++ = repo.num_forks_api - data.fork_forest.num_children(repo_id);
+
+    int author_num_possible_users = 0;
+    if (repo.author != -1)
+        author_num_possible_users
+            = data.authors[repo.author].possible_users.size();
+
+    *result++ = author_num_possible_users;
+}
+
+/// Same float, to the bit, or both NaN
+bool same(float x, float y)
+{
+    if (isnan(x) || isnan(y)) return isnan(x) && isnan(y);
+    return memcmp(&x, &y, sizeof(float)) == 0;
+}
+
+} // file scope
+
+
+int main(int argc, char ** argv)
+{
+    // Number of users for fake data generation
+    int num_users = 4788;
+
+    // Random seed for fake data generation
+    int rseed = 0;
+
+    // Factors to load instead of decomposing
+    string load_factors_file;
+
+    // Number of mismatches to print
+    int max_print = 20;
+
+    {
+        using namespace boost::program_options;
+
+        options_description control_options("Control Options");
+
+        control_options.add_options()
+            ("num-users,n", value<int>(&num_users),
+             "number of users for fake test")
+            ("random-seed", value<int>(&rseed),
+             "random seed for fake data")
+            ("load-factors", value<string>(&load_factors_file),
+             "load factors from the given file instead of decomposing")
+            ("max-print", value<int>(&max_print),
+             "number of mismatches to print");
+
+        options_description all_opt;
+        all_opt
+            .add(control_options);
+
+        all_opt.add_options()
+            ("help,h", "print this message");
+
+        variables_map vm;
+        store(command_line_parser(argc, argv)
+              .options(all_opt)
+              .run(),
+              vm);
+        notify(vm);
+
+        if (vm.count("help")) {
+            cout << all_opt << endl;
+            return 1;
+        }
+    }
+
+    // Load up the data the same way as the github program does
+    cerr << "loading data...";
+    Data data;
+    data.load();
+    cerr << " done." << endl;
+
+    data.setup_fake_test(num_users, rseed);
+
+    Decomposition decomposition;
+    if (load_factors_file != "")
+        decomposition.load_factors(load_factors_file, data);
+    else decomposition.decompose(data);
+
+    analyze_keywords(data);
+
+    decomposition.load_kmeans_users("data/kmeans_users.txt", data);
+    decomposition.load_kmeans_repos("data/kmeans_repos.txt", data);
+
+    data.calc_repo_features();
+
+    const Repo_Features & columns = data.repo_features;
+    columns.check(data);
+
+    size_t nrepos = 0, nwrong = 0;
+    vector<size_t> column_wrong(Repo_Features::NUM_COLUMNS);
+
+    for (unsigned i = 0;  i < data.repos.size();  ++i) {
+        if (data.repos[i].invalid()) continue;
+        ++nrepos;
+
+        float expected[Repo_Features::NUM_COLUMNS];
+        old_features(expected, i, data);
+
+        for (unsigned c = 0;  c < Repo_Features::NUM_COLUMNS;  ++c) {
+            float value = columns.get(Repo_Features::Column(c), i);
+            if (same(value, expected[c])) continue;
+
+            if (nwrong < (size_t)max_print)
+                cout << format("repo %d column %d: %.9g should be %.9g\n",
+                               i, c, value, expected[c]);
+            ++nwrong;
+            ++column_wrong[c];
+        }
+    }
+
+    for (unsigned c = 0;  c < Repo_Features::NUM_COLUMNS;  ++c)
+        if (column_wrong[c])
+            cout << format("column %2d: %zd wrong\n", c, column_wrong[c]);
+
+    cout << format("%zd repos, %zd values wrong\n", nrepos, nwrong);
+
+    return nwrong == 0 ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/* cooc_index.cc
+   Jeremy Barnes, 24 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the cooccurrence index.
+*/
+
+#include "cooc_index.h"
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace {
+
+static const char INDEX_MAGIC[8] = { 'C', 'O', 'O', 'C', 'I', 'D', 'X', '1' };
+
+struct Index_Header {
+    char magic[8];
+    int32_t nrepos;
+    int32_t source;
+    int32_t k;
+    int32_t padding;
+    uint64_t nentries;
+};
+
+struct Sort_By_Score {
+    bool operator () (const Cooc_Entry & e1, const Cooc_Entry & e2) const
+    {
+        if (e1.score != e2.score) return e1.score > e2.score;
+        return e1.with < e2.with;
+    }
+};
+
+} // file scope
+
+
+/*****************************************************************************/
+/* COOC_INDEX                                                                */
+/*****************************************************************************/
+
+Cooc_Index::
+Cooc_Index()
+    : mapped(0), mapped_size(0)
+{
+    clear();
+}
+
+Cooc_Index::
+~Cooc_Index()
+{
+    clear();
+}
+
+void
+Cooc_Index::
+clear()
+{
+    if (mapped) munmap(mapped, mapped_size);
+    mapped = 0;
+    mapped_size = 0;
+
+    nrepos = 0;
+    source_ = 0;
+    k_ = 0;
+
+    offsets_storage.clear();
+    offsets_storage.push_back(0);
+    entries_storage.clear();
+    truncated_storage.clear();
+
+    offsets = &offsets_storage[0];
+    entries = 0;
+    truncated_ = 0;
+}
+
+void
+Cooc_Index::
+build(const Data & data, int source, int k)
+{
+    if (source != 1 && source != 2)
+        throw Exception("Cooc_Index::build(): source must be 1 or 2");
+    if (k <= 0)
+        throw Exception("Cooc_Index::build(): k must be positive");
+
+    clear();
+
+    nrepos = data.repos.size();
+    source_ = source;
+    k_ = k;
+
+    offsets_storage.clear();
+    offsets_storage.reserve(nrepos + 1);
+    truncated_storage.resize(nrepos);
+
+    vector<Cooc_Entry> sorted;
+
+    for (unsigned i = 0;  i < nrepos;  ++i) {
+        offsets_storage.push_back(entries_storage.size());
+
+        const Repo & repo = data.repos[i];
+        if (repo.invalid()) continue;
+
+        const Cooccurrences & cooc = (source == 1 ? repo.cooc : repo.cooc2);
+
+        sorted.clear();
+        for (Cooccurrences::const_iterator
+                 it = cooc.begin(), end = cooc.end();
+             it != end;  ++it) {
+            if (data.repos[it->with].watchers.size() < 2) continue;
+            sorted.push_back(*it);
+        }
+
+        if (sorted.size() > k) {
+            std::partial_sort(sorted.begin(), sorted.begin() + k,
+                              sorted.end(), Sort_By_Score());
+            sorted.resize(k);
+            truncated_storage[i] = true;
+        }
+        else std::sort(sorted.begin(), sorted.end(), Sort_By_Score());
+
+        for (unsigned j = 0;  j < sorted.size();  ++j) {
+            Entry entry;
+            entry.with = sorted[j].with;
+            entry.score = sorted[j].score;
+            entries_storage.push_back(entry);
+        }
+    }
+
+    offsets_storage.push_back(entries_storage.size());
+
+    offsets = &offsets_storage[0];
+    entries = entries_storage.empty() ? 0 : &entries_storage[0];
+    truncated_ = truncated_storage.empty() ? 0 : &truncated_storage[0];
+}
+
+void
+Cooc_Index::
+save(const std::string & filename) const
+{
+    Index_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.nrepos = nrepos;
+    header.source = source_;
+    header.k = k_;
+    header.nentries = offsets[nrepos];
+
+    // Write to a temporary file and rename so that a half-written file is
+    // never seen
+    string tmp_filename = filename + ".tmp";
+
+    {
+        ofstream stream(tmp_filename.c_str(), ios::binary);
+        if (!stream)
+            throw Exception("couldn't open " + tmp_filename);
+
+        stream.write((const char *)&header, sizeof(header));
+        stream.write((const char *)offsets, sizeof(uint32_t) * (nrepos + 1));
+        stream.write((const char *)entries, sizeof(Entry) * header.nentries);
+        stream.write((const char *)truncated_, nrepos);
+
+        if (!stream)
+            throw Exception("error writing " + tmp_filename);
+    }
+
+    if (rename(tmp_filename.c_str(), filename.c_str()) == -1)
+        throw Exception("couldn't rename " + tmp_filename + " to "
+                        + filename + ": " + strerror(errno));
+}
+
+void
+Cooc_Index::
+load(const std::string & filename)
+{
+    clear();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw Exception("couldn't open cooc index " + filename + ": "
+                        + strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw Exception("couldn't stat cooc index " + filename);
+    }
+
+    void * addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED)
+        throw Exception("couldn't map cooc index " + filename + ": "
+                        + strerror(errno));
+
+    mapped = addr;
+    mapped_size = st.st_size;
+
+    if (mapped_size < sizeof(Index_Header)) {
+        clear();
+        throw Exception("cooc index " + filename + " is truncated");
+    }
+
+    const Index_Header & header = *(const Index_Header *)mapped;
+
+    if (memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+        clear();
+        throw Exception(filename + " is not a cooc index");
+    }
+
+    size_t expected
+        = sizeof(Index_Header)
+        + sizeof(uint32_t) * (header.nrepos + 1)
+        + sizeof(Entry) * header.nentries
+        + header.nrepos;
+
+    if (mapped_size != expected) {
+        clear();
+        throw Exception(format("cooc index %s has wrong size: %zd vs %zd",
+                               filename.c_str(), mapped_size, expected));
+    }
+
+    const char * p = (const char *)mapped + sizeof(Index_Header);
+
+    nrepos = header.nrepos;
+    source_ = header.source;
+    k_ = header.k;
+
+    offsets = (const uint32_t *)p;
+    p += sizeof(uint32_t) * (nrepos + 1);
+    entries = (const Entry *)p;
+    p += sizeof(Entry) * header.nentries;
+    truncated_ = (const uint8_t *)p;
+}
@@ -0,0 +1,99 @@
+/* cooc_index.h                                                    -*- C++ -*-
+   Jeremy Barnes, 24 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Precomputed index of the top cooccurring repos for each repo.
+*/
+
+#ifndef __github__cooc_index_h__
+#define __github__cooc_index_h__
+
+#include "data.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+/*****************************************************************************/
+/* COOC_INDEX                                                                */
+/*****************************************************************************/
+
+/** For each repo, the (at most) k repos that it cooccurs with most strongly
+    sorted by descending score.  Stored as a flat array so that it can be
+    written to disk and mmapped back in.
+*/
+
+struct Cooc_Index {
+    Cooc_Index();
+    ~Cooc_Index();
+
+    struct Entry {
+        int with;
+        float score;
+    };
+
+    /** Build from the cooc (source == 1) or cooc2 (source == 2) lists of
+        the repos.  Repos with fewer than two watchers are left out of the
+        lists, as the cooc source ignores them anyway.
+    */
+    void build(const Data & data, int source, int k);
+
+    void save(const std::string & filename) const;
+
+    /// Load the file by mmapping it
+    void load(const std::string & filename);
+
+    bool empty() const { return nrepos == 0; }
+
+    size_t num_repos() const { return nrepos; }
+
+    int source() const { return source_; }
+    int k() const { return k_; }
+
+    const Entry * begin(int repo_id) const
+    {
+        return entries + offsets[repo_id];
+    }
+
+    const Entry * end(int repo_id) const
+    {
+        return entries + offsets[repo_id + 1];
+    }
+
+    size_t size(int repo_id) const
+    {
+        return offsets[repo_id + 1] - offsets[repo_id];
+    }
+
+    /// Was this repo's list truncated?  If so, anything not in it scores
+    /// at most the score of the last entry.
+    bool truncated(int repo_id) const
+    {
+        return truncated_[repo_id];
+    }
+
+private:
+    int nrepos;
+    int source_;
+    int k_;
+
+    const uint32_t * offsets;  ///< nrepos + 1 of them
+    const Entry * entries;
+    const uint8_t * truncated_;
+
+    // Storage when built in memory
+    std::vector<uint32_t> offsets_storage;
+    std::vector<Entry> entries_storage;
+    std::vector<uint8_t> truncated_storage;
+
+    // Storage when mmapped
+    void * mapped;
+    size_t mapped_size;
+
+    void clear();
+
+    Cooc_Index(const Cooc_Index &);
+    void operator = (const Cooc_Index &);
+};
+
+#endif /* __github__cooc_index_h__ */
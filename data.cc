@@ -20,11 +20,14 @@
 #include "arch/exception.h"
 #include "math/xdiv.h"
 #include "stats/distribution_simd.h"
+#include "parallel.h"
+#include "scratch.h"
 
 
 #include <boost/assign/list_of.hpp>
 
 #include <fstream>
+#include <climits>
 
 
 using namespace std;
@@ -61,9 +64,31 @@ std::string unescape_json_string(const std::string & str)
 }
 
 Data::Data()
+    : quantized(false), quantized_rescore(false)
 {
 }
 
+std::vector<std::string>
+Data::
+input_files()
+{
+    static const char * const files[] = {
+        "download/repos.txt",
+        "repo_descriptions.txt",
+        "authors.txt",
+        "download/lang.txt",
+        "download/data.txt",
+        "download/test.txt",
+        "download/repo_forks.txt",
+        "download/repo_watch.txt",
+        "download/repo_col.txt",
+        "download/follow.txt",
+        "stop_words.txt"
+    };
+
+    return vector<string>(files, files + sizeof(files) / sizeof(files[0]));
+}
+
 void Data::load()
 {
     Parse_Context repo_file("download/repos.txt");
@@ -124,6 +149,19 @@ void Data::load()
     cerr << "full_repo_name_to_index.size() = " << full_repo_name_to_index.size()
          << endl;
 
+    // Give each distinct name a dense ID
+    int name_id = 0;
+    for (Repo_Name_To_Repos::iterator
+             it = repo_name_to_repos.begin(),
+             end = repo_name_to_repos.end();
+         it != end;  ++it, ++name_id) {
+        for (IdSet::const_iterator
+                 jt = it->second.begin(),
+                 jend = it->second.end();
+             jt != jend;  ++jt)
+            repos[*jt].name_id = name_id;
+    }
+
     Parse_Context repo_desc_file("repo_descriptions.txt");
 
     while (repo_desc_file) {
@@ -202,15 +240,8 @@ void Data::load()
         author_file.expect_eol();
     }
 
-    // Children.  Only direct ones for the moment.
-    for (unsigned i = 0;  i < repos.size();  ++i) {
-        Repo & repo = repos[i];
-        if (repo.id == -1) continue;  // invalid repo
-        if (repo.parent == -1) continue;  // no parent
-        repos[repo.parent].children.insert(i);
-    }
-
-    /* Expand all parents */
+    /* Check the parent links and find the depths.  The forest is indexed in
+       finish(), once the watchers are known. */
     bool need_another = true;
     int depth = 0;
 
@@ -235,17 +266,6 @@ void Data::load()
             }
 
             repo.depth = parent.depth + 1;
-            repo.ancestors = parent.ancestors;
-            repo.ancestors.push_back(repo.parent);
-            repo.all_ancestors.insert(repo.ancestors.begin(),
-                                      repo.ancestors.end());
-
-#if 0
-            if (depth > 1)
-                cerr << "repo " << repo.id << " " << repo.name
-                     << " has ancestors "
-                     << repo.ancestors << endl;
-#endif
         }
     }
 
@@ -792,108 +812,192 @@ overlap(const IdSet & ids) const
     return make_pair(total, maxval);
 }
 
-void
-Data::
-calc_cooccurrences()
-{
-    // Clear all of the cooccurrence sets
-    for (unsigned i = 0;  i < users.size();  ++i) {
-        users[i].cooc.clear();
-        users[i].cooc2.clear();
+namespace {
+
+/** Keeps only the top k entries, by score.  The result is sorted by with
+    so that it can be searched.
+*/
+struct Cooc_Score_Greater {
+    bool operator () (const Cooc_Entry & e1, const Cooc_Entry & e2) const
+    {
+        if (e1.score != e2.score) return e1.score > e2.score;
+        return e1.with < e2.with;
     }
+};
 
-    // For each, find those that cooccur within the same set of predictions
-    // Ignore those users that have too many predictions or those repos that
-    // have too many watchers
-    for (unsigned i = 0;  i < repos.size();  ++i) {
-        const Repo & repo = repos[i];
-        if (repo.invalid()) continue;
-        if (repo.watchers.empty()) continue;
+/** Calculates the cooccurrence lists for a range of objects (users or
+    repos).  Object x cooccurs with y with a weight w for each link (repo or
+    user) that they share; the weight depends upon the degree n of the link:
+
+      cooc:   1/n^2 if n <= 20
+      cooc2:  1/n
+
+    Rather than pushing each pair to both ends, as the serial version did,
+    each object pulls its own list together in a dense accumulator.  That
+    way the jobs write only to their own objects.  Besides the lists
+    themselves, each job needs two accumulators as large as the number of
+    objects.  With top_k (or max_memory) set, the lists keep only their
+    top entries, which caps their memory but drops the rest of the scores.
+
+    Links with a degree above max_degree (hubs) are skipped, as in the
+    serial version, unless hub_sample is non-zero.  Then each object
+    samples hub_sample of the other members of the hub and scales the
+    weights by (n - 1) / hub_sample, so that the cooc2 scores are unbiased
+    estimates rather than exact.
+*/
+struct Cooc_Job {
+    Cooc_Job(const vector<const IdSet *> & links,
+             const vector<const IdSet *> & back_links,
+             const vector<Cooccurrences *> & cooc,
+             const vector<Cooccurrences *> & cooc2,
+             const Data::Cooc_Options & options,
+             int top_k)
+        : links(links), back_links(back_links), cooc(cooc), cooc2(cooc2),
+          options(options), top_k(top_k)
+    {
+    }
 
-        // More than 20 means 1/400th or less of a point for each of 400 or
-        // more, which uses lots of memory and doesn't make much difference.
-        // So we simply skip these ones.
-        if (repo.watchers.size() > 50) continue;
+    const vector<const IdSet *> & links;
+    const vector<const IdSet *> & back_links;
+    const vector<Cooccurrences *> & cooc;
+    const vector<Cooccurrences *> & cooc2;
+    const Data::Cooc_Options & options;
+    int top_k;
+
+    void operator () (int chunk, int first, int last) const
+    {
+        int nobjects = links.size();
+        Dense_Accumulator<double> accum1(nobjects), accum2(nobjects);
+        vector<Cooc_Entry> entries;
+
+        for (int x = first;  x < last;  ++x) {
+            const IdSet & my_links = *links[x];
 
-        // Weight it so that we give out a total of one point for each repo
-        double wt1 = 1.0 / (repo.watchers.size() * repo.watchers.size());
-        double wt2 = 1.0 / repo.watchers.size();
-        
-        for (IdSet::const_iterator
-                 it = repo.watchers.begin(),
-                 end = repo.watchers.end();
-             it != end;  ++it) {
-            int user_id1 = *it;
             for (IdSet::const_iterator
-                     jt = boost::next(it);
-                 jt != end;  ++jt) {
-                int user_id2 = *jt;
-                
-                if (repo.watchers.size() <= 20) {
-                    users[user_id1].cooc.add(user_id2, wt1);
-                    users[user_id2].cooc.add(user_id1, wt1);
+                     it = my_links.begin(),
+                     end = my_links.end();
+                 it != end;  ++it) {
+                const IdSet & members = *back_links[*it];
+                int n = members.size();
+                if (n < 2) continue;
+
+                float wt1 = 1.0 / ((double)n * n);
+                float wt2 = 1.0 / n;
+
+                if (n <= options.max_degree) {
+                    for (IdSet::const_iterator
+                             jt = members.begin(),
+                             jend = members.end();
+                         jt != jend;  ++jt) {
+                        int y = *jt;
+                        if (y == x) continue;
+                        if (n <= 20) accum1[y] += wt1;
+                        accum2[y] += wt2;
+                    }
+                    continue;
+                }
+
+                if (options.hub_sample <= 0) continue;
+
+                // Hub: take hub_sample members, cyclically from a start
+                // point that depends upon both x and the link
+                int nsample = std::min(options.hub_sample, n - 1);
+                float wt = wt2 * (n - 1) / nsample;
+
+                int start
+                    = ((uint64_t)(x + 1) * 2654435761ULL
+                       ^ (uint64_t)(*it + 1) * 40503ULL) % n;
+                int nsampled = 0;
+                for (int j = 0;  nsampled < nsample;  ++j) {
+                    int y = members.begin()[(start + j) % n];
+                    if (y == x) continue;
+                    accum2[y] += wt;
+                    ++nsampled;
                 }
-                users[user_id1].cooc2.add(user_id2, wt2);
-                users[user_id2].cooc2.add(user_id1, wt2);
             }
+
+            store(*cooc[x], accum1, entries);
+            store(*cooc2[x], accum2, entries);
         }
     }
 
-    // Finish all of the cooccurrence sets
-    for (unsigned i = 0;  i < users.size();  ++i) {
-        users[i].cooc.finish();
-        users[i].cooc2.finish();
-    }
+    void store(Cooccurrences & result, Dense_Accumulator<double> & accum,
+               vector<Cooc_Entry> & entries) const
+    {
+        entries.clear();
 
-    // Clear all of the cooccurrence sets
-    for (unsigned i = 0;  i < repos.size();  ++i) {
-        repos[i].cooc.clear();
-        repos[i].cooc2.clear();
-    }
+        const vector<int> & ids = accum.ids();
+        for (unsigned i = 0;  i < ids.size();  ++i)
+            entries.push_back(Cooc_Entry(ids[i], accum.get(ids[i])));
 
-    // For each, find those that cooccur within the same set of predictions
-    // Ignore those repos that have too many predictions or those users that
-    // have too many watchers
-    for (unsigned i = 0;  i < users.size();  ++i) {
-        const User & user = users[i];
-        if (user.invalid()) continue;
-        if (user.watching.empty()) continue;
+        accum.clear();
 
-        // More than 20 means 1/400th or less of a point for each of 400 or
-        // more, which uses lots of memory and doesn't make much difference.
-        // So we simply skip these ones.
-        if (user.watching.size() > 50) continue;
+        if (top_k > 0 && entries.size() > (size_t)top_k) {
+            std::nth_element(entries.begin(), entries.begin() + top_k,
+                             entries.end(), Cooc_Score_Greater());
+            entries.resize(top_k);
+        }
 
-        // Weight it so that we give out a total of one point for each user
-        double wt1 = 1.0 / (user.watching.size() * user.watching.size());
-        double wt2 = 1.0 / user.watching.size();
+        std::sort(entries.begin(), entries.end());
 
-        for (IdSet::const_iterator
-                 it = user.watching.begin(),
-                 end = user.watching.end();
-             it != end;  ++it) {
-            int repo_id1 = *it;
-            for (IdSet::const_iterator
-                     jt = boost::next(it);
-                 jt != end;  ++jt) {
-                int repo_id2 = *jt;
-                
-                if (user.watching.size() <= 20) {
-                    repos[repo_id1].cooc.add(repo_id2, wt1);
-                    repos[repo_id2].cooc.add(repo_id1, wt1);
-                }
+        Cooccurrences new_result;
+        new_result.reserve(entries.size());
+        new_result.insert(new_result.end(), entries.begin(), entries.end());
+        result.swap(new_result);
+    }
+};
 
-                repos[repo_id1].cooc2.add(repo_id2, wt2);
-                repos[repo_id2].cooc2.add(repo_id1, wt2);
-            }
-        }
+} // file scope
+
+void
+Data::
+calc_cooccurrences()
+{
+    const Cooc_Options & options = cooc_options;
+
+    // The jobs read these, and sorting them isn't thread safe
+    vector<const IdSet *> watching(users.size()), watchers(repos.size());
+    vector<Cooccurrences *> user_cooc(users.size()), user_cooc2(users.size());
+    vector<Cooccurrences *> repo_cooc(repos.size()), repo_cooc2(repos.size());
+
+    for (unsigned i = 0;  i < users.size();  ++i) {
+        users[i].watching.finish();
+        watching[i] = &users[i].watching;
+        user_cooc[i] = &users[i].cooc;
+        user_cooc2[i] = &users[i].cooc2;
     }
 
-    // Finish all of the cooccurrence sets
     for (unsigned i = 0;  i < repos.size();  ++i) {
-        repos[i].cooc.finish();
-        repos[i].cooc2.finish();
-    }
+        repos[i].watchers.finish();
+        watchers[i] = &repos[i].watchers;
+        repo_cooc[i] = &repos[i].cooc;
+        repo_cooc2[i] = &repos[i].cooc2;
+    }
+
+    // Work out how many entries per list we can afford
+    int top_k = options.top_k;
+    if (options.max_memory > 0) {
+        size_t nlists = 2 * (users.size() + repos.size());
+        size_t budget
+            = std::max<size_t>(1, options.max_memory
+                                  / (sizeof(Cooc_Entry) * nlists));
+        if (top_k == 0 || budget < (size_t)top_k)
+            top_k = std::min<size_t>(budget, INT_MAX);
+    }
+
+    static const int OBJECTS_PER_CHUNK = 1000;
+
+    // Users cooccur via the repos they watch...
+    run_in_parallel(users.size(), OBJECTS_PER_CHUNK,
+                    Cooc_Job(watching, watchers, user_cooc, user_cooc2,
+                             options, top_k),
+                    "user cooccurrences");
+
+    // ... and repos via their watchers
+    run_in_parallel(repos.size(), OBJECTS_PER_CHUNK,
+                    Cooc_Job(watchers, watching, repo_cooc, repo_cooc2,
+                             options, top_k),
+                    "repo cooccurrences");
 }
 
 float
@@ -909,6 +1013,25 @@ density(int user_id, int repo_id) const
                     density2[xuser2][yrepo2]);
 }
 
+void
+Data::
+density(int user_id, const int * repo_ids, size_t n,
+        float * result, size_t stride) const
+{
+    int xuser1 = user_id / DENSITY_USER_STEP;
+    int xuser2 = (user_id + DENSITY_USER_STEP / 2) / DENSITY_USER_STEP;
+
+    // The user's rows only need to be found once
+    const unsigned * row1 = &density1[xuser1][0];
+    const unsigned * row2 = &density2[xuser2][0];
+
+    for (size_t i = 0;  i < n;  ++i) {
+        int yrepo1 = repo_ids[i] / DENSITY_REPO_STEP;
+        int yrepo2 = (repo_ids[i] + DENSITY_REPO_STEP / 2) / DENSITY_REPO_STEP;
+        result[i * stride] = std::max(row1[yrepo1], row2[yrepo2]);
+    }
+}
+
 void
 Data::
 stochastic_random_walk()
@@ -1538,78 +1661,277 @@ infer_from_ids()
     exit(0);  // for now...
 }
 
+namespace {
+
+/** Finds the collaborators for a range of users.  The collaborators of user
+    i are the users k != i such that
+
+      - k watches a repo by one of i's inferred authors (k in A(i)), and
+      - one of k's inferred authors wrote a repo that i watches (k in B(i)).
+
+    A is the sparse product users x authors . authors x repos . repos x
+    users; B(i) is A transposed, which we get by going from the authors of
+    i's watched repos to the users that could be those authors.  Each job
+    has its own marker arrays and writes only to its own users.
+
+    The product is done a row (user) at a time, with the marker arrays as
+    the accumulator.  Each row of the inputs is read once per user that
+    reaches it; blocking the columns would need them to be read once per
+    block, and the markers (two ints per user) already fit in the L2 cache.
+*/
+struct Find_Collaborators_Job {
+    Find_Collaborators_Job(Data & data,
+                           const vector<int> & author_user_offsets,
+                           const vector<int> & author_users,
+                           vector<size_t> & chunk_counts)
+        : data(data), author_user_offsets(author_user_offsets),
+          author_users(author_users), chunk_counts(chunk_counts)
+    {
+    }
+
+    Data & data;
+    const vector<int> & author_user_offsets;
+    const vector<int> & author_users;
+    vector<size_t> & chunk_counts;
+
+    void operator () (int chunk, int first, int last) const
+    {
+        const Data & cdata = data;
+
+        // in_b[k] == i means that user k is in B(i); done[k] == i means that
+        // it's already been added to i's collaborators
+        vector<int> in_b(cdata.users.size(), -1);
+        vector<int> done(cdata.users.size(), -1);
+
+        size_t num_collaborators = 0;
+
+        for (int i = first;  i < last;  ++i) {
+            User & user = data.users[i];
+            const User & cuser = user;
+            user.collaborators.clear();
+
+            if (cuser.invalid()) continue;
+            if (cuser.inferred_authors.empty()) continue;
+
+            // B(i): users that could be the author of a repo that we watch
+            for (IdSet::const_iterator
+                     it = cuser.watching.begin(),
+                     end = cuser.watching.end();
+                 it != end;  ++it) {
+                int author_id = cdata.repos[*it].author;
+                if (author_id == -1) continue;
+                for (int j = author_user_offsets[author_id];
+                     j < author_user_offsets[author_id + 1];  ++j)
+                    in_b[author_users[j]] = i;
+            }
+
+            // A(i), intersected with B(i) as we go
+            for (IdSet::const_iterator
+                     it = cuser.inferred_authors.begin(),
+                     end = cuser.inferred_authors.end();
+                 it != end;  ++it) {
+
+                const IdSet & repos_by_author
+                    = cdata.authors[*it].repositories;
+
+                for (IdSet::const_iterator
+                         jt = repos_by_author.begin(),
+                         jend = repos_by_author.end();
+                     jt != jend;  ++jt) {
+
+                    const Repo & repo = cdata.repos[*jt];
+
+                    for (IdSet::const_iterator
+                             kt = repo.watchers.begin(), 
+                             kend = repo.watchers.end();
+                         kt != kend;  ++kt) {
+                        int user_id2 = *kt;
+                        if (user_id2 == i) continue;
+                        if (in_b[user_id2] != i) continue;
+                        if (done[user_id2] == i) continue;
+                        done[user_id2] = i;
+                        user.collaborators.insert(user_id2);
+                        ++num_collaborators;
+                    }
+                }
+            }
+
+            user.collaborators.finish();
+        }
+
+        chunk_counts[chunk] = num_collaborators;
+    }
+};
+
+/** Materializes the repos that the authored_by_collaborator and
+    watched_by_collaborator sources use.  Needs the collaborators of all
+    users to have been found first.
+*/
+struct Collaborator_Repos_Job {
+    Collaborator_Repos_Job(Data & data)
+        : data(data)
+    {
+    }
+
+    Data & data;
+
+    void operator () (int chunk, int first, int last) const
+    {
+        const Data & cdata = data;
+
+        for (int i = first;  i < last;  ++i) {
+            User & user = data.users[i];
+            const User & cuser = user;
+
+            user.collaborator_watched.clear();
+            user.collaborator_authored.clear();
+
+            IdSet collaborating_authors;
+
+            for (IdSet::const_iterator
+                     it = cuser.collaborators.begin(),
+                     end = cuser.collaborators.end();
+                 it != end;  ++it) {
+                const User & user2 = cdata.users[*it];
+                user.collaborator_watched.insert(user2.watching.begin(),
+                                                 user2.watching.end());
+                collaborating_authors.insert(user2.inferred_authors.begin(),
+                                             user2.inferred_authors.end());
+            }
+
+            // As the authored_by_collaborator source always did it: the
+            // author IDs are looked up as user IDs, and their watched repos
+            // taken
+            for (IdSet::const_iterator
+                     it = collaborating_authors.begin(),
+                     end = collaborating_authors.end();
+                 it != end;  ++it) {
+                const User & author_user = cdata.users[*it];
+                user.collaborator_authored.insert(author_user.watching.begin(),
+                                                  author_user.watching.end());
+            }
+
+            user.collaborator_watched.finish();
+            user.collaborator_authored.finish();
+        }
+    }
+};
+
+} // file scope
+
 void
 Data::
 find_collaborators()
 {
     cerr << "collaborators...";
 
-    int num_collaborators = 0;
-
+    // Everything that the jobs read must be sorted before we start, as the
+    // sorting isn't thread safe
     for (unsigned i = 0;  i < users.size();  ++i) {
-        User & user = users[i];
-        user.collaborators.clear();
-
-        if (user.invalid()) continue;
+        users[i].watching.finish();
+        users[i].inferred_authors.finish();
+    }
+    for (unsigned i = 0;  i < repos.size();  ++i)
+        repos[i].watchers.finish();
+    for (unsigned i = 0;  i < authors.size();  ++i)
+        authors[i].repositories.finish();
 
-        if (user.inferred_authors.empty()) continue;
+    // Index from author to the users that could be that author
+    vector<int> author_user_offsets(authors.size() + 1);
+    for (unsigned i = 0;  i < users.size();  ++i) {
+        const User & user = users[i];
+        for (IdSet::const_iterator
+                 it = user.inferred_authors.begin(),
+                 end = user.inferred_authors.end();
+             it != end;  ++it)
+            author_user_offsets[*it + 1] += 1;
+    }
 
-        // All authors that we watch
-        IdSet watched_authors;
+    for (unsigned i = 0;  i < authors.size();  ++i)
+        author_user_offsets[i + 1] += author_user_offsets[i];
 
-        for (IdSet::const_iterator
-                 it = user.watching.begin(),
-                 end = user.watching.end();
-             it != end;  ++it) {
-            if (repos[*it].author != -1)
-                watched_authors.insert(repos[*it].author);
-        }
+    vector<int> author_users(author_user_offsets.back());
+    vector<int> fill(author_user_offsets.begin(),
+                     author_user_offsets.end() - 1);
 
-        // For each author that we could be
+    for (unsigned i = 0;  i < users.size();  ++i) {
+        const User & user = users[i];
         for (IdSet::const_iterator
                  it = user.inferred_authors.begin(),
                  end = user.inferred_authors.end();
-             it != end;  ++it) {
+             it != end;  ++it)
+            author_users[fill[*it]++] = i;
+    }
 
-            // For each repo by this author
-            IdSet & repos_by_author = authors[*it].repositories;
+    static const int USERS_PER_CHUNK = 1000;
 
-            for (IdSet::const_iterator
-                     jt = repos_by_author.begin(),
-                     jend = repos_by_author.end();
-                 jt != jend;  ++jt) {
+    vector<size_t> chunk_counts(num_chunks(users.size(), USERS_PER_CHUNK));
 
-                Repo & repo = repos[*jt];
+    run_in_parallel(users.size(), USERS_PER_CHUNK,
+                    Find_Collaborators_Job(*this, author_user_offsets,
+                                           author_users, chunk_counts),
+                    "find collaborators");
 
-                // For each watcher of this repo
-                for (IdSet::const_iterator
-                         kt = repo.watchers.begin(), 
-                         kend = repo.watchers.end();
-                     kt != kend;  ++kt) {
+    run_in_parallel(users.size(), USERS_PER_CHUNK,
+                    Collaborator_Repos_Job(*this),
+                    "collaborator repos");
 
-                    // This user doesn't count...
-                    if (*kt == i) continue;
-                    User & user2 = users[*kt];
+    size_t num_collaborators = 0;
+    for (unsigned i = 0;  i < chunk_counts.size();  ++i)
+        num_collaborators += chunk_counts[i];
 
-                    bool done_user = false;
+    cerr << "got " << num_collaborators << " collaborator pairs"
+         << endl;
+
+    cerr << "done" << endl;
+}
+
+void
+Data::
+check_collaborators(int step) const
+{
+    for (unsigned i = 0;  i < users.size();  i += step) {
+        const User & user = users[i];
+
+        // The nested loops that find_collaborators() used to do
+        IdSet expected;
+
+        if (!user.invalid()) {
+            for (IdSet::const_iterator
+                     it = user.inferred_authors.begin(),
+                     end = user.inferred_authors.end();
+                 it != end;  ++it) {
+                const IdSet & repos_by_author = authors[*it].repositories;
+
+                for (IdSet::const_iterator
+                         jt = repos_by_author.begin(),
+                         jend = repos_by_author.end();
+                     jt != jend;  ++jt) {
+                    const Repo & repo = repos[*jt];
 
-                    // For each author for this watcher
                     for (IdSet::const_iterator
-                             lt = user2.inferred_authors.begin(),
-                             lend = user2.inferred_authors.end();
-                         lt != lend && !done_user;  ++lt) {
+                             kt = repo.watchers.begin(),
+                             kend = repo.watchers.end();
+                         kt != kend;  ++kt) {
+                        if (*kt == (int)i) continue;
+                        const User & user2 = users[*kt];
 
-                        Author & author2 = authors[*lt];
+                        bool done_user = false;
 
-                        // For each repo for this author
                         for (IdSet::const_iterator
-                                 mt = author2.repositories.begin(),
-                                 mend = author2.repositories.end();
-                             mt != mend && !done_user;  ++mt) {
-                            if (user.watching.count(*mt)) {
-                                user.collaborators.insert(*kt);
-                                done_user = true;
-                                ++num_collaborators;
+                                 lt = user2.inferred_authors.begin(),
+                                 lend = user2.inferred_authors.end();
+                             lt != lend && !done_user;  ++lt) {
+                            const Author & author2 = authors[*lt];
+
+                            for (IdSet::const_iterator
+                                     mt = author2.repositories.begin(),
+                                     mend = author2.repositories.end();
+                                 mt != mend && !done_user;  ++mt) {
+                                if (user.watching.count(*mt)) {
+                                    expected.insert(*kt);
+                                    done_user = true;
+                                }
                             }
                         }
                     }
@@ -1617,14 +1939,17 @@ find_collaborators()
             }
         }
 
-        user.collaborators.finish();
-    }
-
-    cerr << "got " << num_collaborators << " collaborator pairs"
-         << endl;
+        expected.finish();
 
-    cerr << "done" << endl;
-}    
+        if (expected.size() != user.collaborators.size()
+            || !std::equal(expected.begin(), expected.end(),
+                           user.collaborators.begin()))
+            throw Exception(format("find_collaborators(): user %d has %zd "
+                                   "collaborators but should have %zd",
+                                   i, user.collaborators.size(),
+                                   expected.size()));
+    }
+}
 
 void
 Data::
@@ -1813,6 +2138,74 @@ rank_repos_by_popularity(const std::set<int> & repos) const
     return rank_repos_by_popularity(repos.begin(), repos.end());
 }
 
+void
+Data::
+calc_minhash(int num_bands, int rows_per_band)
+{
+    minhash.build(*this, num_bands, rows_per_band);
+}
+
+void
+Data::
+calc_repo_features()
+{
+    // The clusters and the fake test have changed things since finish()
+    calc_hot_fields();
+
+    repo_features.build(*this);
+}
+
+void
+Data::
+calc_hot_fields()
+{
+    repo_hot.build(repos);
+    user_hot.build(users);
+}
+
+void
+Data::
+quantize_embeddings()
+{
+    size_t float_mem = 0, quantized_mem = 0;
+
+    for (unsigned i = 0;  i < repos.size();  ++i) {
+        Repo & repo = repos[i];
+        if (repo.invalid()) continue;
+        repo.singular_q.quantize(repo.singular_vec);
+        repo.keyword_q.quantize(repo.keyword_vec);
+
+        float_mem += sizeof(float)
+            * (repo.singular_vec.size() + repo.keyword_vec.size());
+        quantized_mem += repo.singular_q.memusage() + repo.keyword_q.memusage();
+
+        if (!quantized_rescore) {
+            distribution<float>().swap(repo.singular_vec);
+            distribution<float>().swap(repo.keyword_vec);
+        }
+    }
+
+    for (unsigned i = 0;  i < users.size();  ++i) {
+        User & user = users[i];
+        if (user.invalid()) continue;
+        user.singular_q.quantize(user.singular_vec);
+
+        float_mem += sizeof(float) * user.singular_vec.size();
+        quantized_mem += user.singular_q.memusage();
+
+        if (!quantized_rescore)
+            distribution<float>().swap(user.singular_vec);
+    }
+
+    quantized = true;
+
+    cerr << "quantized embeddings: " << float_mem << " bytes as float, "
+         << quantized_mem << " bytes quantized"
+         << (quantized_rescore ? " (floats kept for rescoring)"
+             : " (floats released)")
+         << endl;
+}
+
 void
 Data::
 finish()
@@ -1828,4 +2221,8 @@ finish()
              end = repo_name_to_repos.end();
          it != end;  ++it)
         it->second.finish();
+
+    fork_forest.build(repos);
+
+    calc_hot_fields();
 }
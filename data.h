@@ -18,6 +18,12 @@
 #include "stats/distribution.h"
 #include "utils/vector_utils.h"
 #include "utils/compact_vector.h"
+#include "quantized.h"
+#include "fork_forest.h"
+#include "minhash.h"
+#include "keyword_index.h"
+#include "repo_features.h"
+#include "hot_fields.h"
 
 using ML::Stats::distribution;
 
@@ -241,7 +247,7 @@ struct Cooccurrences
 
 struct Repo {
     Repo()
-        : id(-1), author(-1), parent(-1), depth(-1), total_loc(0),
+        : id(-1), author(-1), name_id(-1), parent(-1), depth(-1), total_loc(0),
           popularity_rank(-1),
           repo_prob(0.0), repo_prob_rank(-1), repo_prob_percentile(0.0),
           kmeans_cluster(-1), min_user(-1), max_user(-1),
@@ -252,14 +258,13 @@ struct Repo {
     int id;
     int author;
     std::string name;
+    int name_id;  ///< Index of name in repo_name_to_repos
     std::string description;
     boost::gregorian::date date;
     int parent;
     int depth;
 
-    std::vector<int> ancestors;
-    std::set<int> all_ancestors;
-    std::set<int> children;
+    // The children and ancestors are in Data::fork_forest
 
     typedef std::map<int, size_t> LanguageMap;
     LanguageMap languages;
@@ -276,6 +281,7 @@ struct Repo {
 
     distribution<float> singular_vec;
     float singular_2norm;
+    Quantized_Vec singular_q;  ///< Quantized version of singular_vec
 
     int kmeans_cluster;
 
@@ -292,6 +298,7 @@ struct Repo {
 
     distribution<float> keyword_vec;
     float keyword_vec_2norm;
+    Quantized_Vec keyword_q;  ///< Quantized version of keyword_vec
 
     int num_forks_api;
     int num_watches_api;
@@ -337,6 +344,7 @@ struct User {
 
     distribution<float> singular_vec;
     float singular_2norm;
+    Quantized_Vec singular_q;  ///< Quantized version of singular_vec
 
     distribution<float> repo_centroid;
 
@@ -365,6 +373,14 @@ struct User {
     /// 3.  User B watches at least one of user A's repos
     IdSet collaborators;
 
+    /// Repos watched by our collaborators
+    IdSet collaborator_watched;
+
+    /// For the authored_by_collaborator source: the repos watched by the
+    /// users whose IDs are those of the authors that our collaborators
+    /// could be
+    IdSet collaborator_authored;
+
     IdSet following, followers;
 
     bool invalid() const { return id == -1; }
@@ -375,6 +391,8 @@ struct User {
         inferred_authors.finish();
         corresponding_repo.finish();
         collaborators.finish();
+        collaborator_watched.finish();
+        collaborator_authored.finish();
         following.finish();
         followers.finish();
     }
@@ -415,6 +433,9 @@ struct Data {
 
     void load();
 
+    /// The files that load() reads, and analyze_keywords() after it
+    static std::vector<std::string> input_files();
+
     std::vector<Repo> repos;
     std::map<std::string, int> author_name_to_id;
     std::vector<Author> authors;
@@ -437,6 +458,34 @@ struct Data {
 
     const Name_Info & name_to_repos(const std::string & name) const;
 
+    /// Children, parents and depths of the repos
+    Fork_Forest fork_forest;
+
+    /// Index of repos with similar watchers; empty unless calc_minhash()
+    /// was called
+    MinHash_Index minhash;
+
+    void calc_minhash(int num_bands, int rows_per_band);
+
+    /// Repos for each keyword; built by analyze_keywords()
+    Keyword_Index keyword_index;
+
+    /// Features that depend only upon the repo; empty until
+    /// calc_repo_features() is called
+    Repo_Features repo_features;
+
+    /// Must be called once everything else about the repos is done
+    void calc_repo_features();
+
+    /// Copies of the scalar fields of the repos and users that scoring
+    /// reads in its inner loops; built by finish() and calc_repo_features()
+    Repo_Hot_Fields repo_hot;
+    User_Hot_Fields user_hot;
+
+    /// Rebuild repo_hot and user_hot from the repos and users.  Needs to be
+    /// called again if any of the fields change.
+    void calc_hot_fields();
+
     std::vector<int> users_to_test;
 
     /// Answers, for when running a fake test
@@ -450,14 +499,42 @@ struct Data {
 
     void calc_author_stats();
 
+    /// Controls for calc_cooccurrences().  By default, hubs with more than
+    /// 50 watchers or watches are skipped and the lists are kept in full,
+    /// as the original version did.  A non-zero hub_sample makes each hub
+    /// contribute a sample of that many partners instead, which gives
+    /// estimated rather than exact scores.
+    struct Cooc_Options {
+        Cooc_Options()
+            : max_degree(50), hub_sample(0), top_k(0), max_memory(0)
+        {
+        }
+
+        int max_degree;     ///< More watchers/watches than this is a hub
+        int hub_sample;     ///< Partners to sample within a hub (0 = skip it)
+        int top_k;          ///< Keep only the top k of each list (0 = all)
+        size_t max_memory;  ///< Cap on memory for the lists, bytes (0 = none)
+    };
+
+    Cooc_Options cooc_options;
+
     void calc_cooccurrences();
 
     void infer_from_ids();
 
     void find_collaborators();
 
+    /// Check the collaborators of every step'th user against the nested
+    /// loop calculation.  Throws if they differ.
+    void check_collaborators(int step) const;
+
     float density(int user_id, int repo_id) const;
 
+    /// density() of the user with each of the n repos, written stride
+    /// floats apart into result
+    void density(int user_id, const int * repo_ids, size_t n,
+                 float * result, size_t stride) const;
+
     std::vector<int>
     rank_repos_by_popularity(const std::set<int> & repos) const;
 
@@ -488,6 +565,26 @@ struct Data {
 
     void frequency_stats();
 
+    /** Make the quantized copies of the singular and keyword vectors of
+        the repos and users.  Needs to be called again whenever the vectors
+        change.
+
+        Unless quantized_rescore is set, nothing needs the exact floats
+        any more and they are released; anything that reads them after
+        that does so through an Embedding.  Everything that reads the
+        floats directly (the kmeans clusters and the repo features) must
+        be done first.
+    */
+    void quantize_embeddings();
+
+    /// Are the quantized embeddings available?
+    bool quantized;
+
+    /// If false (the default), dot products between quantized embeddings
+    /// are used directly and the floats are released.  If true, they are
+    /// only used to prune the exact float computation.
+    bool quantized_rescore;
+
     void finish();
 
 private:
@@ -6,12 +6,15 @@
 
 #include "decompose.h"
 #include "svdlibc/svdlib.h"
+#include "svd_cache.h"
 #include "arch/timers.h"
 #include "utils/vector_utils.h"
 #include "arch/simd_vector.h"
 #include "stats/distribution_simd.h"
 #include "utils/parse_context.h"
 #include "utils/pair_utils.h"
+#include "utils/string_functions.h"
+#include "math/xdiv.h"
 
 
 using namespace std;
@@ -22,6 +25,29 @@ enum {
     NUM_CLUSTERS_REPO = 200
 };
 
+namespace {
+
+void calc_repo_centroid(User & user, const Data & data)
+{
+    int nvalues = data.singular_values.size();
+
+    distribution<double> centroid(nvalues);
+
+    for (IdSet::const_iterator
+             it = user.watching.begin(),
+             end = user.watching.end();
+         it != end;  ++it) {
+        const distribution<float> & repo_vec = data.repos[*it].singular_vec;
+        if (repo_vec.size() != nvalues) continue;
+        centroid += repo_vec;
+    }
+    centroid /= centroid.two_norm();
+
+    user.repo_centroid = centroid;
+}
+
+} // file scope
+
 void
 Decomposition::
 decompose(Data & data)
@@ -82,7 +108,7 @@ decompose(Data & data)
     int nvalues = 50;
 
     // Run the SVD
-    svdrec * result = svdLAS2A(&matrix, nvalues);
+    svdrec * result = cached_svdLAS2A(matrix, nvalues, "watches");
 
     cerr << "SVD elapsed: " << timer.elapsed() << endl;
 
@@ -169,18 +195,18 @@ decompose(Data & data)
 
         user.singular_2norm = user_vec.two_norm();
 
-        distribution<double> centroid(nvalues);
+        calc_repo_centroid(user, data);
+    }
 
-        for (IdSet::const_iterator
-                 it = user.watching.begin(),
-                 end = user.watching.end();
-             it != end;  ++it) {
-            centroid += data.repos[*it].singular_vec;
-        }
-        centroid /= centroid.two_norm();
+    repo_factored.clear();
+    repo_factored.resize(data.repos.size());
+    for (unsigned i = 0;  i < index_to_repo.size();  ++i)
+        repo_factored[index_to_repo[i]] = true;
 
-        user.repo_centroid = centroid;
-    }
+    user_factored.clear();
+    user_factored.resize(data.users.size());
+    for (unsigned i = 0;  i < index_to_user.size();  ++i)
+        user_factored[index_to_user[i]] = true;
 
     // Free up memory (TODO: put into guards...)
     delete[] matrix.pointr;
@@ -189,6 +215,233 @@ decompose(Data & data)
     svdFreeSVDRec(result);
 }
 
+void
+Decomposition::
+save_factors(std::ostream & stream, const Data & data) const
+{
+    int nvalues = data.singular_values.size();
+
+    stream << "values " << nvalues << ":";
+    for (unsigned j = 0;  j < nvalues;  ++j)
+        stream << format(" %.8g", data.singular_values[j]);
+    stream << "\n";
+
+    for (unsigned i = 0;  i < data.repos.size();  ++i) {
+        if (i >= repo_factored.size() || !repo_factored[i]) continue;
+        const Repo & repo = data.repos[i];
+        stream << "repo " << i << ":";
+        for (unsigned j = 0;  j < nvalues;  ++j)
+            stream << format(" %.8g", repo.singular_vec[j]);
+        stream << "\n";
+    }
+
+    for (unsigned i = 0;  i < data.users.size();  ++i) {
+        if (i >= user_factored.size() || !user_factored[i]) continue;
+        const User & user = data.users[i];
+        stream << "user " << i << ":";
+        for (unsigned j = 0;  j < nvalues;  ++j)
+            stream << format(" %.8g", user.singular_vec[j]);
+        stream << "\n";
+    }
+}
+
+void
+Decomposition::
+load_factors(const std::string & filename, Data & data)
+{
+    Parse_Context context(filename);
+
+    context.expect_literal("values ");
+    int nvalues = context.expect_int();
+    context.expect_literal(':');
+
+    if (nvalues <= 0)
+        context.exception("invalid number of singular values");
+
+    data.singular_values.resize(nvalues);
+    for (unsigned j = 0;  j < nvalues;  ++j) {
+        context.expect_literal(' ');
+        data.singular_values[j] = context.expect_float();
+    }
+    context.expect_eol();
+
+    repo_factored.clear();
+    repo_factored.resize(data.repos.size());
+    user_factored.clear();
+    user_factored.resize(data.users.size());
+
+    for (unsigned i = 0;  i < data.repos.size();  ++i) {
+        data.repos[i].singular_vec.clear();
+        data.repos[i].singular_vec.resize(nvalues);
+        data.repos[i].singular_2norm = 0.0;
+    }
+
+    for (unsigned i = 0;  i < data.users.size();  ++i) {
+        data.users[i].singular_vec.clear();
+        data.users[i].singular_vec.resize(nvalues);
+        data.users[i].singular_2norm = 0.0;
+        data.users[i].repo_centroid.clear();
+        data.users[i].repo_centroid.resize(nvalues);
+    }
+
+    while (context) {
+        bool is_repo = context.match_literal("repo ");
+        if (!is_repo) context.expect_literal("user ");
+
+        int id = context.expect_int();
+        context.expect_literal(':');
+
+        distribution<float> * vec = 0;
+        float * norm = 0;
+
+        if (is_repo) {
+            if (id < 0 || id >= data.repos.size())
+                context.exception("invalid repo ID");
+            vec = &data.repos[id].singular_vec;
+            norm = &data.repos[id].singular_2norm;
+            repo_factored[id] = true;
+        }
+        else {
+            if (id < 0 || id >= data.users.size())
+                context.exception("invalid user ID");
+            vec = &data.users[id].singular_vec;
+            norm = &data.users[id].singular_2norm;
+            user_factored[id] = true;
+        }
+
+        for (unsigned j = 0;  j < nvalues;  ++j) {
+            context.expect_literal(' ');
+            (*vec)[j] = context.expect_float();
+        }
+        context.expect_eol();
+
+        *norm = vec->two_norm();
+    }
+
+    for (unsigned i = 0;  i < data.users.size();  ++i) {
+        User & user = data.users[i];
+        if (!user_factored[i] || user.watching.empty()) continue;
+        calc_repo_centroid(user, data);
+    }
+
+    pair<int, int> folded = fold_in(data);
+
+    cerr << "loaded factors from " << filename << "; folded in "
+         << folded.first << " users and " << folded.second << " repos"
+         << endl;
+}
+
+distribution<float>
+Decomposition::
+fold_in_user(const IdSet & watching, const Data & data) const
+{
+    // The user vector is the user's column of V, which is given by
+    // v = S^-1 U^T a where a is the user's column of the adjacency matrix.
+    // As a is 0/1, U^T a is simply the sum of the watched repos' vectors.
+    int nvalues = data.singular_values.size();
+
+    distribution<double> result(nvalues);
+
+    for (IdSet::const_iterator
+             it = watching.begin(),
+             end = watching.end();
+         it != end;  ++it) {
+        int repo_id = *it;
+        if (repo_id < 0 || repo_id >= repo_factored.size()
+            || !repo_factored[repo_id]) continue;
+        result += data.repos[repo_id].singular_vec;
+    }
+
+    for (unsigned j = 0;  j < nvalues;  ++j)
+        result[j] = xdiv<double>(result[j], data.singular_values[j]);
+
+    return distribution<float>(result.begin(), result.end());
+}
+
+distribution<float>
+Decomposition::
+fold_in_repo(const IdSet & watchers, const Data & data) const
+{
+    // Same as fold_in_user, but u = S^-1 V^T a^T
+    int nvalues = data.singular_values.size();
+
+    distribution<double> result(nvalues);
+
+    for (IdSet::const_iterator
+             it = watchers.begin(),
+             end = watchers.end();
+         it != end;  ++it) {
+        int user_id = *it;
+        if (user_id < 0 || user_id >= user_factored.size()
+            || !user_factored[user_id]) continue;
+        result += data.users[user_id].singular_vec;
+    }
+
+    for (unsigned j = 0;  j < nvalues;  ++j)
+        result[j] = xdiv<double>(result[j], data.singular_values[j]);
+
+    return distribution<float>(result.begin(), result.end());
+}
+
+std::pair<int, int>
+Decomposition::
+fold_in(Data & data)
+{
+    if (data.singular_values.empty())
+        throw Exception("fold_in(): no factors to fold into");
+
+    // Users first, then repos.  Both only use factorized vectors, so the
+    // order doesn't matter for the vectors themselves, but the centroids
+    // need to see the folded in repos.
+    vector<int> new_users;
+    for (unsigned i = 0;  i < data.users.size();  ++i) {
+        const User & user = data.users[i];
+        if (user.invalid() || user.watching.empty()) continue;
+        if (i < user_factored.size() && user_factored[i]) continue;
+        new_users.push_back(i);
+    }
+
+    vector<distribution<float> > user_vecs(new_users.size());
+    for (unsigned i = 0;  i < new_users.size();  ++i)
+        user_vecs[i] = fold_in_user(data.users[new_users[i]].watching, data);
+
+    int nrepos = 0;
+    for (unsigned i = 0;  i < data.repos.size();  ++i) {
+        Repo & repo = data.repos[i];
+        if (repo.invalid() || repo.watchers.empty()) continue;
+        if (i < repo_factored.size() && repo_factored[i]) continue;
+        repo.singular_vec = fold_in_repo(repo.watchers, data);
+        repo.singular_2norm = repo.singular_vec.two_norm();
+        ++nrepos;
+    }
+
+    for (unsigned i = 0;  i < new_users.size();  ++i) {
+        User & user = data.users[new_users[i]];
+        user.singular_vec = user_vecs[i];
+        user.singular_2norm = user.singular_vec.two_norm();
+    }
+
+    // The repo centroid depends upon the folded in repos, so recalculate
+    // it for anyone watching one
+    for (unsigned i = 0;  i < data.users.size();  ++i) {
+        User & user = data.users[i];
+        if (user.invalid() || user.watching.empty()) continue;
+
+        bool needs_centroid = !(i < user_factored.size() && user_factored[i]);
+
+        for (IdSet::const_iterator
+                 it = user.watching.begin(),
+                 end = user.watching.end();
+             it != end && !needs_centroid;  ++it)
+            needs_centroid = !(*it < repo_factored.size()
+                               && repo_factored[*it]);
+
+        if (needs_centroid) calc_repo_centroid(user, data);
+    }
+
+    return make_pair(new_users.size(), nrepos);
+}
+
 struct RepoDataAccess {
     RepoDataAccess(const Data & data)
         : data(data), singular_vecs(data.repos.size())
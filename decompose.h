@@ -15,6 +15,32 @@ struct Decomposition {
     // Perform a SVD on the adjacency matrix
     void decompose(Data & data);
 
+    // Save the factors (singular values and the repo and user vectors) so
+    // that they can be reloaded without redoing the SVD
+    void save_factors(std::ostream & stream, const Data & data) const;
+
+    // Load factors saved with save_factors.  Anything with watches that
+    // isn't in the file is folded in.
+    void load_factors(const std::string & filename, Data & data);
+
+    // Project a user's watch vector into the latent space using the
+    // factorized repo vectors and singular values.  O(nnz * k).
+    distribution<float>
+    fold_in_user(const IdSet & watching, const Data & data) const;
+
+    // Ditto for a repo's watcher vector, using the factorized user vectors
+    distribution<float>
+    fold_in_repo(const IdSet & watchers, const Data & data) const;
+
+    // Fold in all users and repos that have watches but weren't part of
+    // the factorization (for example, added since it was done).  Returns
+    // the number of users and repos folded in.
+    std::pair<int, int> fold_in(Data & data);
+
+    // Which repos and users have vectors that came from the factorization
+    // itself (rather than being folded in)?
+    std::vector<bool> repo_factored, user_factored;
+
     // Perform a k-means clustering based upon embedded representation
     void kmeans_repos(Data & data);
 
@@ -0,0 +1,40 @@
+/* feature_matrix.cc
+   Jeremy Barnes, 3 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the feature matrix.
+*/
+
+#include "feature_matrix.h"
+#include "boosting/dense_features.h"
+#include "utils/string_functions.h"
+
+
+using namespace std;
+using namespace ML;
+
+
+/*****************************************************************************/
+/* FEATURE_MATRIX                                                            */
+/*****************************************************************************/
+
+void
+Feature_Matrix::
+check(size_t nrows, size_t ncols, const char * what) const
+{
+    if (this->nrows != nrows || this->ncols < ncols)
+        throw Exception(format("%s: feature matrix is %zdx%zd but needs %zd "
+                               "rows and at least %zd columns",
+                               what, this->nrows, this->ncols, nrows, ncols));
+}
+
+int
+Feature_Matrix::
+column(const ML::Dense_Feature_Space & fs, const std::string & name)
+{
+    vector<Feature> features = fs.features();
+    for (unsigned i = 0;  i < features.size();  ++i)
+        if (fs.print(features[i]) == name) return i;
+
+    throw Exception("feature " + name + " isn't in the feature space");
+}
@@ -0,0 +1,137 @@
+/* feature_matrix.h                                                -*- C++ -*-
+   Jeremy Barnes, 3 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Matrix of candidates by features, filled in place.
+*/
+
+#ifndef __github__feature_matrix_h__
+#define __github__feature_matrix_h__
+
+#include "stats/distribution.h"
+#include "arch/exception.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+
+namespace ML {
+class Dense_Feature_Space;
+} // namespace ML
+
+
+/*****************************************************************************/
+/* FEATURE_MATRIX                                                            */
+/*****************************************************************************/
+
+/** The feature vectors for a set of candidates, one row per candidate
+    (indexed by its position in the Ranked) and one column per variable of
+    the feature space.  The storage is one contiguous block that keeps its
+    capacity when it is re-initialized, so one matrix per thread can be
+    reused from user to user without allocating.
+
+    The caller sizes the matrix for the feature space of the ranker whose
+    features() it calls; that ranker fills its columns and those of the
+    rankers and generator that it builds upon, which are at the start of
+    each row.  Everything starts off as NaN.
+*/
+
+struct Feature_Matrix {
+    Feature_Matrix()
+        : nrows(0), ncols(0)
+    {
+    }
+
+    /// Size for nrows candidates of ncols features, all NaN
+    void init(size_t nrows, size_t ncols)
+    {
+        this->nrows = nrows;
+        this->ncols = ncols;
+        values.clear();
+        values.resize(nrows * ncols, std::numeric_limits<float>::quiet_NaN());
+    }
+
+    size_t rows() const { return nrows; }
+    size_t cols() const { return ncols; }
+
+    float * operator [] (size_t row) { return &values[row * ncols]; }
+
+    const float * operator [] (size_t row) const
+    {
+        return &values[row * ncols];
+    }
+
+    /// Throw unless there is a row for each candidate and at least ncols
+    /// columns; what says who is complaining
+    void check(size_t nrows, size_t ncols, const char * what) const;
+
+    /// Copy of a row, for the things that need a distribution
+    ML::distribution<float> row(size_t row) const
+    {
+        return ML::distribution<float>((*this)[row], (*this)[row] + ncols);
+    }
+
+    /// Column of the named feature in the feature space; throws if it isn't
+    /// there
+    static int column(const ML::Dense_Feature_Space & fs,
+                      const std::string & name);
+
+    size_t memusage() const { return sizeof(float) * values.capacity(); }
+
+private:
+    size_t nrows, ncols;
+    std::vector<float> values;
+};
+
+
+/*****************************************************************************/
+/* FEATURE_WRITER                                                            */
+/*****************************************************************************/
+
+/** Writes consecutive features into one row of a matrix, starting at a
+    given column, with the same interface as pushing them onto the back of
+    a distribution.
+*/
+
+struct Feature_Writer {
+    Feature_Writer(Feature_Matrix & matrix, size_t row, size_t first_column)
+        : start(matrix[row]), pos(start + first_column),
+          end(start + matrix.cols())
+    {
+    }
+
+    void push_back(float val)
+    {
+        if (pos == end)
+            throw ML::Exception("Feature_Writer: too many features");
+        *pos++ = val;
+    }
+
+    /// Write n copies of val
+    void fill(size_t n, float val)
+    {
+        if (pos + n > end)
+            throw ML::Exception("Feature_Writer: too many features");
+        std::fill(pos, pos + n, val);
+        pos += n;
+    }
+
+    template<class Iterator>
+    void append(Iterator first, Iterator last)
+    {
+        if (pos + std::distance(first, last) > end)
+            throw ML::Exception("Feature_Writer: too many features");
+        pos = std::copy(first, last, pos);
+    }
+
+    /// The last feature written
+    float back() const { return pos[-1]; }
+
+    /// The column that the next feature will be written to
+    size_t column() const { return pos - start; }
+
+private:
+    float * start, * pos, * end;
+};
+
+#endif /* __github__feature_matrix_h__ */
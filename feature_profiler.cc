@@ -0,0 +1,368 @@
+/* feature_profiler.cc
+   Jeremy Barnes, 5 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the feature profiler.
+*/
+
+#include "feature_profiler.h"
+#include "arch/tick_counter.h"
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <set>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace {
+
+const float NaN = numeric_limits<float>::quiet_NaN();
+
+/// Seconds elapsed since before (in ticks)
+double seconds_since(unsigned long long before)
+{
+    return (ticks() - before) * seconds_per_tick;
+}
+
+struct Sort_By_Seconds {
+    Sort_By_Seconds(const vector<double> & seconds)
+        : seconds(seconds)
+    {
+    }
+
+    const vector<double> & seconds;
+
+    bool operator () (int i, int j) const
+    {
+        return seconds[i] > seconds[j];
+    }
+};
+
+} // file scope
+
+
+/*****************************************************************************/
+/* FEATURE_PROFILER                                                          */
+/*****************************************************************************/
+
+Feature_Profiler::
+Feature_Profiler(Ranker & ranker, const Data & data, int max_candidates)
+    : ranker(ranker), data(data), max_candidates(max_candidates),
+      num_users(0), num_candidates(0), importance_candidates(0)
+{
+    const Candidate_Generator & generator = *ranker.generator;
+
+    common_group
+        = add_group("common",
+                    vector<string>(Common_Schema::names,
+                                   Common_Schema::names
+                                   + Common_Schema::NUM_FEATURES));
+
+    for (unsigned i = 0;  i < generator.sources.size();  ++i) {
+        string name = generator.sources[i]->name();
+
+        Dense_Feature_Space fs = generator.sources[i]->specific_feature_space();
+        vector<Feature> features = fs.features();
+
+        vector<string> names;
+        for (unsigned j = 0;  j < features.size();  ++j)
+            names.push_back(name + "_" + fs.print(features[j]));
+        names.push_back(name + "_rank");
+        names.push_back(name + "_percentile");
+        names.push_back(name + "_score");
+
+        source_groups.push_back(add_group("source " + name, names));
+    }
+
+    for (unsigned i = 0;  i < ranker.registry.num_groups();  ++i)
+        add_group(ranker.registry.group_name(i), ranker.registry.features(i),
+                  i);
+
+    // Whatever is left over belongs to the generator or the ranker itself
+    generator_group = add_group("generator", vector<string>());
+    rest_group = add_group("ranker", vector<string>());
+
+    boost::shared_ptr<const Dense_Feature_Space> generator_fs
+        = generator.feature_space();
+    boost::shared_ptr<const Dense_Feature_Space> ranker_fs
+        = ranker.feature_space();
+
+    ncols = ranker_fs->variable_count();
+
+    vector<Feature> features = ranker_fs->features();
+    for (unsigned i = 0;  i < features.size();  ++i) {
+        string name = ranker_fs->print(features[i]);
+        if (feature_group.count(name)) continue;
+
+        int group = (i < generator_fs->variable_count()
+                     ? generator_group : rest_group);
+        groups[group].features.push_back(name);
+        feature_group[name] = group;
+    }
+}
+
+int
+Feature_Profiler::
+add_group(const std::string & name,
+          const std::vector<std::string> & features,
+          int registry_group)
+{
+    int result = groups.size();
+
+    Group group;
+    group.name = name;
+    group.features = features;
+    group.registry_group = registry_group;
+    groups.push_back(group);
+
+    for (unsigned i = 0;  i < features.size();  ++i)
+        if (!feature_group.count(features[i]))
+            feature_group[features[i]] = result;
+
+    return result;
+}
+
+void
+Feature_Profiler::
+add_user(int user_id)
+{
+    const Candidate_Generator & generator = *ranker.generator;
+
+    Candidate_Data candidate_data;
+    candidate_data.scratch = &generator.scratch(data);
+
+    // Each source on its own, split the same way as gen_candidates() and
+    // sharing a block of common features as they do when generating.  The
+    // source is charged for generating and scoring its candidates; the
+    // common features of those that the earlier sources didn't have go to
+    // the common group.
+    Common_Block & common_block = generator.common_block();
+
+    for (unsigned i = 0;  i < generator.sources.size();  ++i) {
+        const Candidate_Source & source = *generator.sources[i];
+
+        Candidate_Data source_data;
+        source_data.scratch = candidate_data.scratch;
+        source_data.common = &common_block;
+
+        Ranked ranked;
+        unsigned long long before = ticks();
+        source.candidate_set(ranked, user_id, data, source_data);
+        double source_seconds = seconds_since(before);
+
+        before = ticks();
+        common_block.add(user_id, ranked, data);
+        groups[common_group].seconds += seconds_since(before);
+
+        before = ticks();
+        source.score_candidates(ranked, user_id, data, common_block);
+        source_seconds += seconds_since(before);
+
+        groups[source_groups[i]].seconds += source_seconds;
+    }
+
+    Ranked candidates;
+    generator.candidates(candidates, candidate_data, data, user_id);
+
+    if (candidates.empty()) return;
+
+    ++num_users;
+    num_candidates += candidates.size();
+
+    Feature_Matrix & features = ranker.matrix();
+    features.init(candidates.size(), ncols);
+
+    unsigned long long before = ticks();
+    generator.features(features, user_id, candidates, candidate_data, data);
+    double generator_seconds = seconds_since(before);
+
+    groups[generator_group].seconds += generator_seconds;
+
+    // A group of the registry costs what is saved by leaving it out.  One
+    // that others depend upon saves nothing while they're there; what they
+    // share ends up in the rest of the ranker.
+    Feature_Registry saved = ranker.registry;
+    vector<string> all_features = ranker.registry.all_features();
+
+    vector<double> without(ranker.registry.num_groups());
+
+    for (unsigned i = 0;  i < ranker.registry.num_groups();  ++i) {
+        const vector<string> & group_features = ranker.registry.features(i);
+        set<string> dead(group_features.begin(), group_features.end());
+
+        vector<string> live;
+        for (unsigned j = 0;  j < all_features.size();  ++j)
+            if (!dead.count(all_features[j]))
+                live.push_back(all_features[j]);
+
+        ranker.registry.set_live(live);
+
+        before = ticks();
+        ranker.features(features, user_id, candidates, candidate_data, data);
+        without[i] = seconds_since(before);
+    }
+
+    // Last, so that the matrix has everything in it for the importance
+    ranker.registry.set_all_live();
+
+    before = ticks();
+    ranker.features(features, user_id, candidates, candidate_data, data);
+    double all_seconds = seconds_since(before);
+
+    ranker.registry = saved;
+
+    double rest_seconds = all_seconds - generator_seconds;
+    for (unsigned i = 0;  i < groups.size();  ++i) {
+        if (groups[i].registry_group == -1) continue;
+        double saved_seconds = all_seconds - without[groups[i].registry_group];
+        groups[i].seconds += saved_seconds;
+        rest_seconds -= saved_seconds;
+    }
+
+    groups[rest_group].seconds += rest_seconds;
+
+    add_importance(candidates, features);
+}
+
+void
+Feature_Profiler::
+add_importance(const Ranked & candidates, const Feature_Matrix & features)
+{
+    const Classifier_Ranker * classifier_ranker
+        = dynamic_cast<const Classifier_Ranker *>(&ranker);
+    if (!classifier_ranker || !classifier_ranker->load_data) return;
+
+    const Classifier_Ranker & cr = *classifier_ranker;
+    const Dense_Feature_Space & classifier_fs = *cr.classifier_fs;
+
+    // The columns of the classifier's features that it uses
+    set<string> used(cr.used_features.begin(), cr.used_features.end());
+    vector<Feature> classifier_features = classifier_fs.features();
+
+    vector<int> columns;
+    vector<string> names;
+    for (unsigned i = 0;  i < classifier_features.size();  ++i) {
+        string name = classifier_fs.print(classifier_features[i]);
+        if (!used.count(name)) continue;
+        columns.push_back(i);
+        names.push_back(name);
+    }
+
+    size_t n = std::min<size_t>(candidates.size(), max_candidates);
+
+    float encoded[classifier_fs.variable_count()];
+    vector<double> total(columns.size());
+
+    for (unsigned i = 0;  i < n;  ++i) {
+        classifier_fs.encode(features[i], encoded, *cr.ranker_fs, cr.mapping);
+        float score = cr.classifier.impl->predict(1, encoded, cr.opt_info);
+
+        for (unsigned j = 0;  j < columns.size();  ++j) {
+            float old = encoded[columns[j]];
+            encoded[columns[j]] = NaN;
+            total[j] += fabs(cr.classifier.impl->predict(1, encoded, cr.opt_info)
+                             - score);
+            encoded[columns[j]] = old;
+        }
+    }
+
+    for (unsigned j = 0;  j < columns.size();  ++j)
+        importance[names[j]] += total[j];
+
+    importance_candidates += n;
+}
+
+void
+Feature_Profiler::
+report(std::ostream & out) const
+{
+    out << format("feature profile over %zd users and %zd candidates\n\n",
+                  num_users, num_candidates);
+
+    if (num_candidates == 0) return;
+
+    bool have_importance = importance_candidates > 0;
+
+    // Average importance of each feature; those that the classifier doesn't
+    // use aren't there
+    map<string, double> avg_importance;
+    for (map<string, double>::const_iterator
+             it = importance.begin(), end = importance.end();
+         it != end;  ++it)
+        avg_importance[it->first] = it->second / importance_candidates;
+
+    vector<double> ns(groups.size()), group_importance(groups.size());
+    vector<int> nused(groups.size());
+    vector<int> order;
+
+    for (unsigned i = 0;  i < groups.size();  ++i) {
+        ns[i] = 1e9 * std::max(0.0, groups[i].seconds) / num_candidates;
+        for (unsigned j = 0;  j < groups[i].features.size();  ++j) {
+            map<string, double>::const_iterator found
+                = avg_importance.find(groups[i].features[j]);
+            if (found == avg_importance.end()) continue;
+            group_importance[i] += found->second;
+            ++nused[i];
+        }
+        order.push_back(i);
+    }
+
+    std::sort(order.begin(), order.end(), Sort_By_Seconds(ns));
+
+    out << "group                            ns/cand  importance  imp/us  "
+        << "used/features" << endl;
+
+    for (unsigned i = 0;  i < order.size();  ++i) {
+        int g = order[i];
+        out << format("%-30s %9.1f ", groups[g].name.c_str(), ns[g]);
+        if (have_importance)
+            out << format("%11.5f %7.3f  ", group_importance[g],
+                          ns[g] == 0.0 ? 0.0
+                          : group_importance[g] / (ns[g] * 0.001));
+        else out << "          -       -  ";
+        out << format("%4d/%zd", nused[g], groups[g].features.size())
+            << endl;
+    }
+
+    if (!have_importance) {
+        out << endl << "(no importance without a loaded classifier)" << endl;
+        return;
+    }
+
+    out << endl
+        << "(importance is to the ranker's classifier only; a source's own "
+        << "classifier" << endl
+        << " is counted through the source's features, not per input)"
+        << endl;
+
+    // Then the features, least important first
+    vector<pair<double, string> > features;
+    for (map<string, int>::const_iterator
+             it = feature_group.begin(), end = feature_group.end();
+         it != end;  ++it) {
+        map<string, double>::const_iterator found
+            = avg_importance.find(it->first);
+        features.push_back
+            (make_pair(found == avg_importance.end() ? -1.0 : found->second,
+                       it->first));
+    }
+
+    std::sort(features.begin(), features.end());
+
+    out << endl << "feature                                        "
+        << "group                           importance" << endl;
+
+    for (unsigned i = 0;  i < features.size();  ++i) {
+        const string & name = features[i].second;
+        const Group & group = groups[feature_group.find(name)->second];
+        out << format("%-46s %-30s ", name.c_str(), group.name.c_str());
+        if (features[i].first < 0.0) out << "     unused";
+        else out << format("%11.5f", features[i].first);
+        out << endl;
+    }
+}
@@ -0,0 +1,99 @@
+/* feature_profiler.h                                              -*- C++ -*-
+   Jeremy Barnes, 5 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Profiles what each group of ranker features costs against what it is
+   worth to the classifier.
+*/
+
+#ifndef __github__feature_profiler_h__
+#define __github__feature_profiler_h__
+
+#include "ranker.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+
+
+/*****************************************************************************/
+/* FEATURE_PROFILER                                                          */
+/*****************************************************************************/
+
+/** Works out, for a sample of users, how long each group of the ranker's
+    features takes per ranked candidate and how much the classifier's
+    scores depend upon it, so that the expensive ones that are worth little
+    can be found.
+
+    The groups are the common features, each source (whose features cost
+    the time to generate and score its candidates), the generator's merged
+    features, each group of the ranker's feature registry and the rest of
+    the ranker's features.  A registry group costs the time that is saved by leaving it
+    out.  Nothing is instrumented: the profiler runs each stage itself, one
+    user at a time.
+
+    The importance of a feature is the average absolute change in the
+    classifier's score when it is missing, over up to max_candidates of
+    each user's candidates.  It is only available with a classifier ranker
+    that has loaded its classifier.  The classifiers of the sources aren't
+    profiled: what the inputs of a source's classifier are worth only shows
+    up through the source's features (its score, rank and percentile) in
+    the ranker's classifier.
+*/
+
+struct Feature_Profiler {
+    Feature_Profiler(Ranker & ranker, const Data & data,
+                     int max_candidates = 100);
+
+    /// Profile the features for the user.  Not thread safe, as the
+    /// ranker's feature registry is changed while profiling.
+    void add_user(int user_id);
+
+    /// Write the report of the groups by cost, then of the features by
+    /// importance
+    void report(std::ostream & out) const;
+
+private:
+    Ranker & ranker;
+    const Data & data;
+    int max_candidates;
+
+    /// Number of columns of the ranker's feature space
+    size_t ncols;
+
+    struct Group {
+        Group()
+            : seconds(0.0), registry_group(-1)
+        {
+        }
+
+        std::string name;
+        std::vector<std::string> features;
+        double seconds;
+        int registry_group;   ///< Or -1 if not in the registry
+    };
+
+    std::vector<Group> groups;
+    int common_group, generator_group, rest_group;
+    std::vector<int> source_groups;
+
+    /// Group of each feature of the ranker's feature space, by name
+    std::map<std::string, int> feature_group;
+
+    size_t num_users, num_candidates;
+
+    /// Total absolute change in score for each feature, by name, and the
+    /// number of candidates it was measured over
+    std::map<std::string, double> importance;
+    size_t importance_candidates;
+
+    /// Add a group and return its index
+    int add_group(const std::string & name,
+                  const std::vector<std::string> & features,
+                  int registry_group = -1);
+
+    void add_importance(const Ranked & candidates,
+                        const Feature_Matrix & features);
+};
+
+#endif /* __github__feature_profiler_h__ */
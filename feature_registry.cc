@@ -0,0 +1,131 @@
+/* feature_registry.cc
+   Jeremy Barnes, 2 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the feature registry.
+*/
+
+#include "feature_registry.h"
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+
+
+using namespace std;
+using namespace ML;
+
+
+/*****************************************************************************/
+/* FEATURE_REGISTRY                                                          */
+/*****************************************************************************/
+
+Feature_Registry::
+Feature_Registry()
+    : all_live(true)
+{
+}
+
+int
+Feature_Registry::
+add_group(const std::string & name,
+          const std::vector<std::string> & features,
+          float cost,
+          const std::vector<int> & depends)
+{
+    int id = groups.size();
+
+    for (unsigned i = 0;  i < depends.size();  ++i)
+        if (depends[i] < 0 || depends[i] >= id)
+            throw Exception("feature group " + name
+                            + " depends upon a group that isn't there yet");
+
+    Group group;
+    group.name = name;
+    group.features = features;
+    group.cost = cost;
+    group.depends = depends;
+    group.live = true;
+    groups.push_back(group);
+
+    update();
+
+    return id;
+}
+
+void
+Feature_Registry::
+set_live(const std::vector<std::string> & features)
+{
+    all_live = false;
+    live_features.clear();
+    live_features.insert(features.begin(), features.end());
+    update();
+}
+
+void
+Feature_Registry::
+add_live(const std::vector<std::string> & features)
+{
+    live_features.insert(features.begin(), features.end());
+    update();
+}
+
+void
+Feature_Registry::
+set_all_live()
+{
+    all_live = true;
+    update();
+}
+
+void
+Feature_Registry::
+update()
+{
+    for (unsigned i = 0;  i < groups.size();  ++i) {
+        Group & group = groups[i];
+        group.live = all_live;
+        for (unsigned j = 0;  !group.live && j < group.features.size();  ++j)
+            group.live = live_features.count(group.features[j]);
+    }
+
+    // Dependencies always come first, so one pass backwards is enough
+    for (int i = groups.size() - 1;  i >= 0;  --i) {
+        if (!groups[i].live) continue;
+        for (unsigned j = 0;  j < groups[i].depends.size();  ++j)
+            groups[groups[i].depends[j]].live = true;
+    }
+}
+
+std::vector<std::string>
+Feature_Registry::
+all_features() const
+{
+    vector<string> result;
+    for (unsigned i = 0;  i < groups.size();  ++i)
+        result.insert(result.end(),
+                      groups[i].features.begin(), groups[i].features.end());
+    return result;
+}
+
+std::string
+Feature_Registry::
+summary() const
+{
+    int nlive = 0;
+    float total_cost = 0.0, live_cost = 0.0;
+    string dead;
+
+    for (unsigned i = 0;  i < groups.size();  ++i) {
+        total_cost += groups[i].cost;
+        if (groups[i].live) {
+            ++nlive;
+            live_cost += groups[i].cost;
+        }
+        else dead += " " + groups[i].name;
+    }
+
+    return format("%d/%zd feature groups live (%.0f%% of cost); skipping:%s",
+                  nlive, groups.size(),
+                  total_cost == 0.0 ? 100.0 : 100.0 * live_cost / total_cost,
+                  dead == "" ? " none" : dead.c_str());
+}
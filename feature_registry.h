@@ -0,0 +1,95 @@
+/* feature_registry.h                                              -*- C++ -*-
+   Jeremy Barnes, 2 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Registry of the features that are expensive to calculate, so that the
+   ones that the classifier doesn't use can be skipped.
+*/
+
+#ifndef __github__feature_registry_h__
+#define __github__feature_registry_h__
+
+#include <vector>
+#include <string>
+#include <set>
+
+
+/*****************************************************************************/
+/* FEATURE_REGISTRY                                                          */
+/*****************************************************************************/
+
+/** Features are registered in groups that are calculated together.  Each
+    group has the names of the features it produces, a rough relative cost
+    and the groups that it depends upon (a group with no features of its
+    own can be used for an intermediate result, such as a per-user
+    profile).
+
+    A group is live if any of its features are live or if a live group
+    depends upon it.  Features that aren't in any group are always
+    calculated.  Everything is live until set_live() is called; callers
+    should fill the features of dead groups with NaN so that the feature
+    vectors keep their layout.
+*/
+
+struct Feature_Registry {
+    Feature_Registry();
+
+    /// Add a group and return its ID.  Groups must be added in dependency
+    /// order (the dependencies first).
+    int add_group(const std::string & name,
+                  const std::vector<std::string> & features,
+                  float cost,
+                  const std::vector<int> & depends = std::vector<int>());
+
+    /// Only these features are used
+    void set_live(const std::vector<std::string> & features);
+
+    /// These features are used as well
+    void add_live(const std::vector<std::string> & features);
+
+    /// Everything is used
+    void set_all_live();
+
+    bool live(int group) const { return groups.at(group).live; }
+
+    size_t num_groups() const { return groups.size(); }
+
+    const std::string & group_name(int group) const
+    {
+        return groups.at(group).name;
+    }
+
+    /// Number of features in the group (for filling with NaN)
+    size_t num_features(int group) const
+    {
+        return groups.at(group).features.size();
+    }
+
+    const std::vector<std::string> & features(int group) const
+    {
+        return groups.at(group).features;
+    }
+
+    /// Every feature that is in a group
+    std::vector<std::string> all_features() const;
+
+    /// One line summary of what is live and the proportion of the cost
+    std::string summary() const;
+
+private:
+    struct Group {
+        std::string name;
+        std::vector<std::string> features;
+        float cost;
+        std::vector<int> depends;
+        bool live;
+    };
+
+    std::vector<Group> groups;
+    std::set<std::string> live_features;
+    bool all_live;
+
+    void update();
+};
+
+#endif /* __github__feature_registry_h__ */
@@ -0,0 +1,143 @@
+/* feature_schema.h                                                -*- C++ -*-
+   Jeremy Barnes, 4 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Feature layouts that are declared once and checked by the compiler.
+*/
+
+#ifndef __github__feature_schema_h__
+#define __github__feature_schema_h__
+
+#include "boosting/dense_features.h"
+#include "arch/exception.h"
+#include <boost/static_assert.hpp>
+#include <algorithm>
+#include <limits>
+#include <string>
+
+
+/*****************************************************************************/
+/* FEATURE SCHEMAS                                                           */
+/*****************************************************************************/
+
+/** A schema is a struct with an enum of its features, in column order and
+    ending with NUM_FEATURES, and a table of their names in the same order:
+
+        struct Cooc_Schema {
+            enum Feature { TOTAL_SCORE, MAX_SCORE, NUM_FEATURES };
+            static const char * const names[];
+        };
+
+        const char * const Cooc_Schema::names[]
+            = { "total_score", "max_score" };
+
+        CHECK_FEATURE_SCHEMA(Cooc_Schema);
+
+    The column of each feature is its enum value, so writing it is a store
+    to a fixed offset.  The check fails to compile if the table and the enum
+    have different lengths, and the writer below can only be indexed with
+    its own schema's enum.  The feature space for training and for the
+    classifiers is generated from the table.
+*/
+
+#define CHECK_FEATURE_SCHEMA(Schema)                                    \
+    BOOST_STATIC_ASSERT(sizeof(Schema::names) / sizeof(Schema::names[0]) \
+                        == Schema::NUM_FEATURES)
+
+/// Feature space with a real feature for each feature of the schema, with
+/// the prefix in front of the names
+template<class Schema>
+ML::Dense_Feature_Space
+schema_feature_space(const std::string & prefix = "")
+{
+    ML::Dense_Feature_Space result;
+    for (unsigned i = 0;  i < Schema::NUM_FEATURES;  ++i)
+        result.add_feature(prefix + Schema::names[i], ML::Feature_Info::REAL);
+    return result;
+}
+
+
+/*****************************************************************************/
+/* SOURCE_FEATURES                                                           */
+/*****************************************************************************/
+
+/** Fixed size storage for the specific features of a candidate source,
+    kept inline in each Ranked_Entry so that writing them doesn't allocate.
+    Big enough for the largest schema; Schema_Writer checks that at
+    compile time.
+*/
+
+struct Source_Features {
+    enum { MAX_FEATURES = 12 };
+
+    Source_Features()
+        : n(0)
+    {
+    }
+
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+
+    float & operator [] (int i) { return values[i]; }
+    float operator [] (int i) const { return values[i]; }
+
+    const float * begin() const { return values; }
+    const float * end() const { return values + n; }
+
+    /// Size for n features, all NaN
+    void init(size_t n)
+    {
+        check(n);
+        this->n = n;
+        std::fill(values, values + n,
+                  std::numeric_limits<float>::quiet_NaN());
+    }
+
+    void assign(const float * first, const float * last)
+    {
+        check(last - first);
+        n = last - first;
+        std::copy(first, last, values);
+    }
+
+private:
+    unsigned n;
+    float values[MAX_FEATURES];
+
+    static void check(size_t n)
+    {
+        if (n > MAX_FEATURES)
+            throw ML::Exception("Source_Features: too many features");
+    }
+};
+
+
+/*****************************************************************************/
+/* SCHEMA_WRITER                                                             */
+/*****************************************************************************/
+
+/** Writes the features of a schema into the features of an entry, which
+    are sized for the schema (with NaN) when the writer is made.
+*/
+
+template<class Schema>
+struct Schema_Writer {
+    BOOST_STATIC_ASSERT((int)Schema::NUM_FEATURES
+                        <= (int)Source_Features::MAX_FEATURES);
+
+    Schema_Writer(Source_Features & features)
+        : features(features)
+    {
+        features.init(Schema::NUM_FEATURES);
+    }
+
+    float & operator [] (typename Schema::Feature feature)
+    {
+        return features[feature];
+    }
+
+private:
+    Source_Features & features;
+};
+
+#endif /* __github__feature_schema_h__ */
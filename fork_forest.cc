@@ -0,0 +1,130 @@
+/* fork_forest.cc
+   Jeremy Barnes, 26 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the fork forest index.
+*/
+
+#include "fork_forest.h"
+#include "data.h"
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+
+
+using namespace std;
+using namespace ML;
+
+
+/*****************************************************************************/
+/* FORK_FOREST                                                               */
+/*****************************************************************************/
+
+Fork_Forest::
+Fork_Forest()
+{
+    clear();
+}
+
+void
+Fork_Forest::
+clear()
+{
+    child_offsets.clear();
+    child_offsets.push_back(0);
+    child_list.clear();
+    roots.clear();
+    parents.clear();
+    depths.clear();
+
+    // Sentinel, so that taking the address of the start of an empty range
+    // is always valid
+    child_list.push_back(-1);
+}
+
+void
+Fork_Forest::
+build(const std::vector<Repo> & repos)
+{
+    clear();
+
+    int nrepos = repos.size();
+
+    // Children, in CSR format.  Count, prefix sum, then fill in; since we
+    // fill in order of increasing child ID the lists come out sorted.
+    child_offsets.clear();
+    child_offsets.resize(nrepos + 1);
+
+    for (int i = 0;  i < nrepos;  ++i) {
+        const Repo & repo = repos[i];
+        if (repo.invalid() || repo.parent == -1) continue;
+        if (repo.parent < 0 || repo.parent >= nrepos
+            || repos[repo.parent].invalid())
+            throw Exception(format("Fork_Forest::build(): repo %d has "
+                                   "invalid parent %d", i, repo.parent));
+        child_offsets[repo.parent + 1] += 1;
+    }
+
+    for (int i = 0;  i < nrepos;  ++i)
+        child_offsets[i + 1] += child_offsets[i];
+
+    child_list.clear();
+    child_list.resize(child_offsets[nrepos] + 1, -1);
+
+    vector<int> fill(child_offsets.begin(), child_offsets.end() - 1);
+
+    for (int i = 0;  i < nrepos;  ++i) {
+        const Repo & repo = repos[i];
+        if (repo.invalid() || repo.parent == -1) continue;
+        child_list[fill[repo.parent]++] = i;
+    }
+
+    // Depth-first traversal from each root in order of ID.  Done with an
+    // explicit stack as the fork chains can be long.
+    roots.resize(nrepos, -1);
+    parents.resize(nrepos, -1);
+    depths.resize(nrepos, 0);
+
+    // (repo, next child to visit)
+    vector<pair<int, int> > stack;
+
+    for (int i = 0;  i < nrepos;  ++i) {
+        const Repo & repo = repos[i];
+        if (repo.invalid() || repo.parent != -1) continue;
+
+        roots[i] = i;
+        stack.push_back(make_pair(i, child_offsets[i]));
+
+        while (!stack.empty()) {
+            int repo_id = stack.back().first;
+            int & next = stack.back().second;
+
+            if (next == child_offsets[repo_id + 1]) {
+                // Finished with this one
+                stack.pop_back();
+                continue;
+            }
+
+            int child = child_list[next++];
+            roots[child] = i;
+            parents[child] = repo_id;
+            depths[child] = depths[repo_id] + 1;
+            stack.push_back(make_pair(child, child_offsets[child]));
+        }
+    }
+
+    // Anything valid that wasn't reached from a root is in a cycle
+    for (int i = 0;  i < nrepos;  ++i) {
+        if (roots[i] == -1 && !repos[i].invalid())
+            throw Exception(format("Fork_Forest::build(): repo %d is in a "
+                                   "parent cycle", i));
+    }
+}
+
+size_t
+Fork_Forest::
+memusage() const
+{
+    return sizeof(int)
+        * (child_offsets.capacity() + child_list.capacity()
+           + roots.capacity() + parents.capacity() + depths.capacity());
+}
@@ -0,0 +1,74 @@
+/* fork_forest.h                                                   -*- C++ -*-
+   Jeremy Barnes, 26 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Index over the forest formed by the repo parent (fork) links.
+*/
+
+#ifndef __github__fork_forest_h__
+#define __github__fork_forest_h__
+
+#include <vector>
+#include <stddef.h>
+
+struct Repo;
+
+
+/*****************************************************************************/
+/* FORK_FOREST                                                               */
+/*****************************************************************************/
+
+/** The repos arranged into a forest by their parent links.  Children are
+    stored contiguously for each repo, and the depth and root of each are
+    found by a depth-first traversal.  The ancestors of a repo are found by
+    following parent() up to -1.
+*/
+
+struct Fork_Forest {
+    Fork_Forest();
+
+    /// Build from the parent links of the repos.  Invalid repos are left
+    /// out.
+    void build(const std::vector<Repo> & repos);
+
+    void clear();
+
+    size_t size() const { return parents.size(); }
+
+    /// Parent of the repo, or -1 if it's a root (or invalid)
+    int parent(int repo_id) const { return parents[repo_id]; }
+
+    /// Number of ancestors of the repo; 0 for a root
+    int depth(int repo_id) const { return depths[repo_id]; }
+
+    /// Range of the direct children of the repo, in increasing ID order
+    const int * children_begin(int repo_id) const
+    {
+        return &child_list[0] + child_offsets[repo_id];
+    }
+
+    const int * children_end(int repo_id) const
+    {
+        return &child_list[0] + child_offsets[repo_id + 1];
+    }
+
+    int num_children(int repo_id) const
+    {
+        return child_offsets[repo_id + 1] - child_offsets[repo_id];
+    }
+
+    /// Root of the tree that the repo is in
+    int root(int repo_id) const { return roots[repo_id]; }
+
+    /// Memory used by the index, in bytes
+    size_t memusage() const;
+
+private:
+    std::vector<int> child_offsets;  ///< nrepos + 1 of them
+    std::vector<int> child_list;
+
+    std::vector<int> roots;
+    std::vector<int> parents, depths;
+};
+
+#endif /* __github__fork_forest_h__ */
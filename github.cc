@@ -8,7 +8,12 @@
 #include "data.h"
 #include "ranker.h"
 #include "decompose.h"
+#include "svd_cache.h"
 #include "keywords.h"
+#include "candidate_cache.h"
+#include "ranking_memo.h"
+#include "trainer.h"
+#include "feature_profiler.h"
 
 #include <fstream>
 #include <iterator>
@@ -70,6 +75,46 @@ struct Result_Stats {
     }
 };
 
+/// Choose the examples to train on for a user from its possible choices:
+/// up to 20 of those that aren't watched, and if include_all_correct is set,
+/// up to 20 of those that are.  The correct repo is added by the caller.
+void sample_examples(set<int> & correct, set<int> & incorrect,
+                     const set<int> & possible_choices,
+                     const User & user, int correct_repo_id,
+                     bool include_all_correct)
+{
+    std::set_difference(possible_choices.begin(),
+                        possible_choices.end(),
+                        user.watching.begin(),
+                        user.watching.end(),
+                        inserter(incorrect, incorrect.end()));
+    incorrect.erase(correct_repo_id);
+
+    if (incorrect.size() > 20) {
+        vector<int> sample(incorrect.begin(), incorrect.end());
+        std::random_shuffle(sample.begin(), sample.end());
+
+        incorrect.clear();
+        incorrect.insert(sample.begin(), sample.begin() + 20);
+    }
+
+    if (include_all_correct) {
+        std::set_intersection(possible_choices.begin(),
+                              possible_choices.end(),
+                              user.watching.begin(),
+                              user.watching.end(),
+                              inserter(correct, correct.end()));
+
+        if (correct.size() > 20) {
+            vector<int> sample(correct.begin(), correct.end());
+            std::random_shuffle(sample.begin(), sample.end());
+
+            correct.clear();
+            correct.insert(sample.begin(), sample.begin() + 20);
+        }
+    }
+}
+
 struct Global_Info {
     const Data & data;
 
@@ -82,10 +127,26 @@ struct Global_Info {
     bool possible_only;
     bool include_all_correct;
 
-    boost::shared_ptr<const Candidate_Source> source;
+    /// Sources to generate training examples for, with their feature spaces
+    vector<boost::shared_ptr<const Candidate_Source> > sources;
+    vector<boost::shared_ptr<const Dense_Feature_Space> > source_fs;
+
     boost::shared_ptr<const Candidate_Generator> generator;
     boost::shared_ptr<const Ranker> ranker;
-    boost::shared_ptr<const Dense_Feature_Space> source_fs, ranker_fs;
+    boost::shared_ptr<const Dense_Feature_Space> ranker_fs;
+
+    /// Are the merger examples for the first stage of the ranking cascade?
+    /// If so, they have only the generator features, which are in
+    /// generator_fs.
+    bool dump_cascade_data;
+    boost::shared_ptr<const Dense_Feature_Space> generator_fs;
+
+    /// Cache of the candidates for each user; null if not used
+    Candidate_Cache * candidate_cache;
+
+    /// Where the training examples go when training in process: one for
+    /// each source, or one for the ranker.  Empty when they're dumped.
+    vector<boost::shared_ptr<Training_Set> > training_sets;
 
 
     // This lock protects everything below this point
@@ -104,10 +165,8 @@ struct Global_Info {
                 bool train_discriminative,
                 bool possible_only,
                 bool include_all_correct,
-                boost::shared_ptr<const Candidate_Source> source,
                 boost::shared_ptr<const Candidate_Generator> generator,
                 boost::shared_ptr<const Ranker> ranker,
-                boost::shared_ptr<const Dense_Feature_Space> source_fs,
                 boost::shared_ptr<const Dense_Feature_Space> ranker_fs)
         : data(data), dump_source_data(dump_source_data),
           dump_merger_data(dump_merger_data),
@@ -116,9 +175,8 @@ struct Global_Info {
           train_discriminative(train_discriminative),
           possible_only(possible_only),
           include_all_correct(include_all_correct),
-          source(source), generator(generator), ranker(ranker),
-          source_fs(source_fs), ranker_fs(ranker_fs),
-          out(out)
+          generator(generator), ranker(ranker), ranker_fs(ranker_fs),
+          dump_cascade_data(false), candidate_cache(0), out(out)
     {
         up_to_job = 0;
     }
@@ -139,6 +197,12 @@ struct Do_User_Job {
     vector<vector<int> *> all_possible_choices;
     vector<vector<int> *> all_non_zero;
 
+    /// Training examples for each of info.training_sets
+    vector<Training_Set::Examples> examples;
+
+    /// Features of the candidates of a source, reused from one to the next
+    Feature_Matrix source_matrix;
+
     boost::progress_display & progress;
 
     Do_User_Job(Global_Info & info,
@@ -156,6 +220,7 @@ struct Do_User_Job {
           all_results(all_results),
           all_possible_choices(all_possible_choices),
           all_non_zero(all_non_zero),
+          examples(info.training_sets.size()),
           progress(progress)
     {
     }
@@ -167,6 +232,9 @@ struct Do_User_Job {
                     *all_results[i], *all_possible_choices[i],
                     *all_non_zero[i]);
         }
+
+        for (unsigned i = 0;  i < examples.size();  ++i)
+            info.training_sets[i]->add(job_num, examples[i]);
         
         // Now, re-assemble the text written for the output
         Guard guard(info.lock);
@@ -183,6 +251,104 @@ struct Do_User_Job {
         }
     }
 
+    /// Generate the examples to train the classifier of source i for the
+    /// user, either dumping them or adding them to its training set
+    void source_examples(unsigned i, int user_id, int correct_repo_id,
+                         Candidate_Data & candidate_data)
+    {
+        const Data & data = info.data;
+        const User & user = data.users[user_id];
+        bool dump = info.training_sets.empty();
+
+        Ranked candidates;
+        info.sources[i]->candidate_set(candidates, user_id, data,
+                                       candidate_data);
+
+        if (candidates.empty()) return;
+
+        set<int> possible_choices;
+        for (unsigned j = 0;  j < candidates.size();  ++j)
+            possible_choices.insert(candidates[j].repo_id);
+
+        if (dump)
+            out << "# user_id " << user_id << " correct " << correct_repo_id
+                << " ncandidates " << candidates.size() << " possible "
+                << possible_choices.count(correct_repo_id)
+                << endl;
+
+        // Divide into two sets: those that predict a watched repo,
+        // and those that don't
+
+        set<int> incorrect;
+        set<int> correct;
+
+        sample_examples(correct, incorrect, possible_choices, user,
+                        correct_repo_id, info.include_all_correct);
+
+        correct.insert(correct_repo_id);
+
+        // The common features of all of the candidates, shared with the
+        // other sources for this user
+        Common_Block & common_block = candidate_data.get_common();
+        common_block.add(user_id, candidates, data);
+
+        size_t nfeatures = info.source_fs[i]->variable_count();
+        source_matrix.init(candidates.size(), nfeatures);
+
+        // Go through and dump those selected
+        for (unsigned j = 0;  j < candidates.size();  ++j) {
+            const Ranked_Entry & candidate = candidates[j];
+            int repo_id = candidate.repo_id;
+
+            // if it's one we don't dump then don't output it
+            if (!correct.count(repo_id)
+                && !incorrect.count(repo_id))
+                continue;
+
+            bool label = correct.count(repo_id);
+            float weight = (label
+                            ? 1.0f / correct.size()
+                            : 1.0f / incorrect.size());
+
+            int group = user_id;
+
+            const float * common_row = common_block.row(repo_id);
+
+            Feature_Writer features(source_matrix, j, 0);
+            features.append(common_row,
+                            common_row + Common_Block::NUM_FEATURES);
+            features.append(candidate.source_features.begin(),
+                            candidate.source_features.end());
+
+            if (features.column() != nfeatures)
+                throw Exception(format("source %s: %zd features not %zd",
+                                       info.sources[i]->name().c_str(),
+                                       features.column(), nfeatures));
+
+            if (!dump) {
+                examples[i].add(label, weight, group,
+                                repo_id == correct_repo_id,
+                                source_matrix[j], source_matrix[j] + nfeatures);
+                continue;
+            }
+
+            out << label << " " << weight << " " << group << " "
+                << (repo_id == correct_repo_id) << " ";
+
+            boost::shared_ptr<Mutable_Feature_Set> encoded
+                = info.source_fs[i]->encode(source_matrix.row(j));
+            out << info.source_fs[i]->print(*encoded);
+
+            // A comment so we know where this feature vector came from
+            out << " # repo " << repo_id << " "
+                << (data.repos[repo_id].author == -1 ? "????"
+                    : data.authors[data.repos[repo_id].author].name.c_str())
+                << "/" << data.repos[repo_id].name << endl;
+        }
+
+        if (dump) out << endl << endl;
+    }
+
     void do_user(int user_id, int correct_repo_id,
                  set<int> & results,
                  vector<int> & result_possible_choices,
@@ -198,106 +364,13 @@ struct Do_User_Job {
         if (info.dump_source_data) {
             
             Candidate_Data candidate_data;
-
-            Ranked candidates;
-            info.source->candidate_set(candidates, user_id, data,
-                                       candidate_data);
-
-            if (candidates.empty()) return;
-
-            set<int> possible_choices;
-            for (unsigned j = 0;  j < candidates.size();  ++j)
-                possible_choices.insert(candidates[j].repo_id);
-
-            out << "# user_id " << user_id << " correct " << correct_repo_id
-                << " ncandidates " << candidates.size() << " possible "
-                << possible_choices.count(correct_repo_id)
-                << endl;
-            
-            // Divide into two sets: those that predict a watched repo,
-            // and those that don't
-            
-            set<int> incorrect;
-            set<int> correct;
-            
-            std::set_difference(possible_choices.begin(),
-                                possible_choices.end(),
-                                user.watching.begin(),
-                                user.watching.end(),
-                                inserter(incorrect, incorrect.end()));
-            incorrect.erase(correct_repo_id);
-            
-            if (incorrect.size() > 20) {
-                
-                vector<int> sample(incorrect.begin(), incorrect.end());
-                std::random_shuffle(sample.begin(), sample.end());
-                
-                incorrect.clear();
-                incorrect.insert(sample.begin(), sample.begin() + 20);
+            if (info.generator) {
+                candidate_data.scratch = &info.generator->scratch(data);
+                candidate_data.common = &info.generator->common_block();
             }
-                
-            if (info.include_all_correct) {
-                std::set_intersection(possible_choices.begin(),
-                                      possible_choices.end(),
-                                      user.watching.begin(),
-                                      user.watching.end(),
-                                      inserter(correct, correct.end()));
-                
-                
-                    
-                if (correct.size() > 20) {
-                    
-                    vector<int> sample(correct.begin(), correct.end());
-                    std::random_shuffle(sample.begin(), sample.end());
-                    
-                    correct.clear();
-                    correct.insert(sample.begin(), sample.begin() + 20);
-                }
-            }
-            
-            correct.insert(correct_repo_id);
-            
-            // Go through and dump those selected
-            for (unsigned j = 0;  j < candidates.size();  ++j) {
-                const Ranked_Entry & candidate = candidates[j];
-                int repo_id = candidate.repo_id;
-                
-                // if it's one we don't dump then don't output it
-                if (!correct.count(repo_id)
-                    && !incorrect.count(repo_id))
-                    continue;
-                
-                bool label = correct.count(repo_id);
-                float weight = (label
-                                ? 1.0f / correct.size()
-                                : 1.0f / incorrect.size());
-                
-                int group = user_id;
-                
-                out << label << " " << weight << " " << group << " "
-                    << (repo_id == correct_repo_id) << " ";
 
-                // Get the common features
-                distribution<float> features;
-                Candidate_Source::common_features(features, user_id, repo_id,
-                                                  data, candidate_data);
-                
-                features.insert(features.end(),
-                                candidate.features.begin(),
-                                candidate.features.end());
-
-                boost::shared_ptr<Mutable_Feature_Set> encoded
-                    = info.source_fs->encode(features);
-                out << info.source_fs->print(*encoded);
-                
-                // A comment so we know where this feature vector came from
-                out << " # repo " << repo_id << " "
-                    << (data.repos[repo_id].author == -1 ? "????"
-                        : data.authors[data.repos[repo_id].author].name.c_str())
-                    << "/" << data.repos[repo_id].name << endl;
-            }
-            
-            out << endl << endl;
+            for (unsigned i = 0;  i < info.sources.size();  ++i)
+                source_examples(i, user_id, correct_repo_id, candidate_data);
 
             return;
         }
@@ -305,7 +378,19 @@ struct Do_User_Job {
         // Not doing source training
         Ranked candidates;
         Candidate_Data candidate_data;
-        info.generator->candidates(candidates, candidate_data, data, user_id);
+        if (!info.candidate_cache
+            || !info.candidate_cache->get(user_id, user.watching,
+                                          candidates, candidate_data)) {
+            info.generator->candidates(candidates, candidate_data, data,
+                                       user_id);
+            if (info.candidate_cache)
+                info.candidate_cache->put(user_id, user.watching,
+                                          candidates, candidate_data);
+        }
+
+        // Each ranker stage and output mode shares the results for this user
+        Ranking_Memo memo;
+        candidate_data.memo = &memo;
 
         set<int> possible_choices;
         for (unsigned j = 0;  j < candidates.size();  ++j)
@@ -387,7 +472,8 @@ struct Do_User_Job {
             correct.insert(correct_repo_id);
             
             // Generate features
-            vector<distribution<float> > features;
+            Feature_Matrix & features = info.ranker->matrix();
+            features.init(candidates.size(), info.ranker_fs->variable_count());
             info.ranker->features(features, user_id, candidates, candidate_data,
                                   data);
             
@@ -412,7 +498,7 @@ struct Do_User_Job {
                     << (repo_id == correct_repo_id) << " ";
                 
                 boost::shared_ptr<Mutable_Feature_Set> encoded
-                    = info.ranker_fs->encode(features[j]);
+                    = info.ranker_fs->encode(features.row(j));
                 out << info.ranker_fs->print(*encoded);
                 
                 // A comment so we know where this feature vector came from
@@ -427,14 +513,16 @@ struct Do_User_Job {
 
         if (info.dump_merger_data) {
             bool possible = possible_choices.count(correct_repo_id);
+            bool dump = info.training_sets.empty();
 
-            out << "# user_id " << user_id << " correct " << correct_repo_id
-                << " npossible " << possible_choices.size() << " possible "
-                << possible
-                << endl;
+            if (dump)
+                out << "# user_id " << user_id << " correct "
+                    << correct_repo_id << " npossible "
+                    << possible_choices.size() << " possible " << possible
+                    << endl;
 
             if (!possible) {
-                out << endl;
+                if (dump) out << endl;
                 return;
             }
 
@@ -454,50 +542,23 @@ struct Do_User_Job {
                     incorrect.insert(repo_id);
                 }
             }
-            else {
-                std::set_difference(possible_choices.begin(),
-                                    possible_choices.end(),
-                                    user.watching.begin(),
-                                    user.watching.end(),
-                                    inserter(incorrect, incorrect.end()));
-                incorrect.erase(correct_repo_id);
-                
-                if (incorrect.size() > 20) {
-                    
-                    vector<int> sample(incorrect.begin(), incorrect.end());
-                    std::random_shuffle(sample.begin(), sample.end());
-                    
-                    incorrect.clear();
-                    incorrect.insert(sample.begin(), sample.begin() + 20);
-                }
-                
-                if (info.include_all_correct) {
-                    std::set_intersection(possible_choices.begin(),
-                                          possible_choices.end(),
-                                          user.watching.begin(),
-                                          user.watching.end(),
-                                          inserter(correct, correct.end()));
-                    
-                    
-                    
-                    if (correct.size() > 20) {
-                        
-                        vector<int> sample(correct.begin(), correct.end());
-                        std::random_shuffle(sample.begin(), sample.end());
-                        
-                        correct.clear();
-                        correct.insert(sample.begin(), sample.begin() + 20);
-                    }
-                }
-                
-            }
+            else sample_examples(correct, incorrect, possible_choices, user,
+                                 correct_repo_id, info.include_all_correct);
             
             correct.insert(correct_repo_id);
             
-            // Generate features
-            vector<distribution<float> > features;
-            info.ranker->features(features, user_id, candidates, candidate_data,
-                                  data);
+            // Generate features.  The first stage of the cascade sees only
+            // those of the generator.
+            Feature_Matrix & features = info.ranker->matrix();
+            const Dense_Feature_Space & fs
+                = (info.dump_cascade_data ? *info.generator_fs
+                   : *info.ranker_fs);
+            features.init(candidates.size(), fs.variable_count());
+            if (info.dump_cascade_data)
+                info.generator->features(features, user_id, candidates,
+                                         candidate_data, data);
+            else info.ranker->features(features, user_id, candidates,
+                                       candidate_data, data);
             
             // Go through and dump those selected
             for (unsigned j = 0;  j < candidates.size();  ++j) {
@@ -515,13 +576,21 @@ struct Do_User_Job {
                                 : 1.0f / incorrect.size());
                 
                 int group = user_id;
+
+                if (!dump) {
+                    examples[0].add(label, weight, group,
+                                    repo_id == correct_repo_id,
+                                    features[j],
+                                    features[j] + features.cols());
+                    continue;
+                }
                 
                 out << label << " " << weight << " " << group << " "
                     << (repo_id == correct_repo_id) << " ";
                 
                 boost::shared_ptr<Mutable_Feature_Set> encoded
-                    = info.ranker_fs->encode(features[j]);
-                out << info.ranker_fs->print(*encoded);
+                    = fs.encode(features.row(j));
+                out << fs.print(*encoded);
                 
                 // A comment so we know where this feature vector came from
                 out << " # repo " << repo_id << " "
@@ -532,7 +601,7 @@ struct Do_User_Job {
                     << data.repos[repo_id].name << endl;
             }
             
-            out << endl << endl;
+            if (dump) out << endl << endl;
         }
 
         if (info.dump_merger_data || info.possible_only) {
@@ -653,6 +722,9 @@ int main(int argc, char ** argv)
     // Dump the data to train a merger classifier?
     bool dump_merger_data = false;
 
+    // Dump the data to train the first stage of the ranking cascade?
+    bool dump_cascade_data = false;
+
     // Include all correct entries or only the removed one?
     bool include_all_correct = false;
 
@@ -692,9 +764,49 @@ int main(int argc, char ** argv)
     // Which source to dump?
     string source_to_train;
 
+    // Train the classifiers in process instead of dumping their data?  One
+    // of "sources" (those of the generator), "ranker" or "cascade" (the
+    // ranker's first stage).
+    string train;
+
+    // Configuration file and trainer to use for the training
+    string training_config_file = "ranker-classifier-training-config.txt";
+    string trainer_name;
+
+    // Profile the cost and importance of the ranker features over this
+    // many users, instead of ranking (0 = don't)
+    int profile_users = 0;
+
+    // Check the collaborators of every n'th user against the nested loop
+    // calculation, for debugging (0 = don't)
+    int check_collaborators = 0;
+
     // Tranche specification
     string tranches = "1";
 
+    // File to save the SVD factors to
+    string save_factors_file;
+
+    // File to load the SVD factors from instead of decomposing
+    string load_factors_file;
+
+    // Keep int8 copies of the embeddings to speed up dot products?
+    bool quantize_embeddings = false;
+
+    // Rescore pruned dot products with the float vectors?
+    bool quantized_rescore = false;
+
+    // Cooccurrence controls
+    Data::Cooc_Options cooc_options;
+    int cooc_max_memory_mb = 0;
+
+    // Directory for the candidate cache (empty = don't cache)
+    string candidate_cache_dir;
+
+    // Build the minhash index with this many bands (0 = don't)
+    int minhash_bands = 0;
+    int minhash_rows = 4;
+
     {
         using namespace boost::program_options;
 
@@ -721,10 +833,22 @@ int main(int argc, char ** argv)
              "random seed for fake data")
             ("dump-merger-data", value<bool>(&dump_merger_data)->zero_tokens(),
              "dump data to train a merger classifier")
+            ("dump-cascade-data", value<bool>(&dump_cascade_data)->zero_tokens(),
+             "dump data to train the first stage of the ranking cascade (generator features only)")
             ("dump-source-data", value<bool>(&dump_source_data)->zero_tokens(),
              "dump data to train a classifier for the named repo source")
             ("source-to-train", value<string>(&source_to_train),
-             "source to dump data for")
+             "source to dump data for (or the only one to train)")
+            ("train", value<string>(&train),
+             "train the classifiers of the generator's sources (sources), the ranker (ranker) or the ranker's cascade (cascade) in process and save them")
+            ("training-config", value<string>(&training_config_file),
+             "configuration file with the trainers for --train")
+            ("trainer-name", value<string>(&trainer_name),
+             "trainer for --train (default phase1 for sources, default for the ranker)")
+            ("profile-features", value<int>(&profile_users),
+             "profile the cost and importance of the ranker features over this many users, writing a report")
+            ("check-collaborators", value<int>(&check_collaborators),
+             "check the collaborators of every n'th user against the slow calculation (debugging; 0 = don't)")
             ("dump-results", value<bool>(&dump_results)->zero_tokens(),
              "dump ranked results in official submission format")
             ("dump-predictions", value<bool>(&dump_predictions)->zero_tokens(),
@@ -742,6 +866,31 @@ int main(int argc, char ** argv)
              "cluster users, writing a cluster map")
             ("tranches", value<string>(&tranches),
              "bitmap of which parts of the testing set to use")
+            ("svd-cache-dir", value<string>(&svd_cache_dir),
+             "cache SVD results in this directory (default none = always recompute)")
+            ("save-factors", value<string>(&save_factors_file),
+             "save SVD factors to the given file")
+            ("load-factors", value<string>(&load_factors_file),
+             "load SVD factors from the given file, folding in anything new")
+            ("quantize-embeddings",
+             value<bool>(&quantize_embeddings)->zero_tokens(),
+             "keep int8 copies of the embeddings for fast dot products")
+            ("quantized-rescore", value<bool>(&quantized_rescore),
+             "use quantized dot products only to prune exact ones (1) or directly (0, default)?")
+            ("cooc-max-degree", value<int>(&cooc_options.max_degree),
+             "repos/users with more watchers/watches are hubs in the cooccurrences")
+            ("cooc-hub-sample", value<int>(&cooc_options.hub_sample),
+             "number of partners to sample within a hub (default 0 = skip hubs)")
+            ("cooc-top-k", value<int>(&cooc_options.top_k),
+             "keep only the top k entries of each cooccurrence list (default 0 = all)")
+            ("cooc-max-memory", value<int>(&cooc_max_memory_mb),
+             "cap on memory for the cooccurrence lists in MB (default 0 = none)")
+            ("candidate-cache", value<string>(&candidate_cache_dir),
+             "cache the generated candidates in this directory, so that ranker-only runs can skip generating them")
+            ("minhash-bands", value<int>(&minhash_bands),
+             "build a minhash index of the watchers with this many bands (needed by the minhash source)")
+            ("minhash-rows", value<int>(&minhash_rows),
+             "number of rows in each band of the minhash index")
             ("output-file,o",
              value<string>(&output_file),
              "dump output file to the given filename");
@@ -771,6 +920,18 @@ int main(int argc, char ** argv)
         }
     }
 
+    // Training generates the same examples as the dumps, but keeps them
+    bool train_sources = (train == "sources");
+    bool train_ranker = (train == "ranker");
+    bool train_cascade = (train == "cascade");
+    if (train != "" && !train_sources && !train_ranker && !train_cascade)
+        throw Exception("--train must be sources, ranker or cascade, not "
+                        + train);
+    if (train_sources) dump_source_data = true;
+    if (train_ranker) dump_merger_data = true;
+    if (train_cascade) dump_cascade_data = true;
+    if (dump_cascade_data) dump_merger_data = true;
+
     // Load up configuration
     Configuration config;
     if (config_file != "") config.load(config_file);
@@ -781,19 +942,34 @@ int main(int argc, char ** argv)
     // Load up the data
     cerr << "loading data...";
     Data data;
+    data.cooc_options = cooc_options;
+    data.cooc_options.max_memory = (size_t)cooc_max_memory_mb * 1024 * 1024;
     data.load();
     cerr << " done." << endl;
 
     if (fake_test || dump_merger_data || dump_source_data)
         data.setup_fake_test(num_users, rseed);
 
+    if (check_collaborators > 0)
+        data.check_collaborators(check_collaborators);
+
     Decomposition decomposition;
-    decomposition.decompose(data);
+    if (load_factors_file != "")
+        decomposition.load_factors(load_factors_file, data);
+    else decomposition.decompose(data);
+
+    if (save_factors_file != "") {
+        filter_ostream factors_out(save_factors_file);
+        decomposition.save_factors(factors_out, data);
+    }
 
     cerr << "doing keywords" << endl;
     analyze_keywords(data);
     cerr << "done keywords" << endl;
 
+    if (minhash_bands > 0)
+        data.calc_minhash(minhash_bands, minhash_rows);
+
     // results file
     filter_ostream out(output_file);
 
@@ -812,6 +988,13 @@ int main(int argc, char ** argv)
         decomposition.load_kmeans_repos("data/kmeans_repos.txt", data);
     }
 
+    data.calc_repo_features();
+
+    // After the clusters and repo features, which need the exact floats
+    data.quantized_rescore = quantized_rescore;
+    if (quantize_embeddings)
+        data.quantize_embeddings();
+
     if (generator_name != "" && generator_name[0] == '@')
         config.must_find(generator_name, string(generator_name, 1));
 
@@ -824,18 +1007,46 @@ int main(int argc, char ** argv)
     boost::shared_ptr<Ranker> ranker
         = get_ranker(config, ranker_name, generator);
 
-    boost::shared_ptr<Candidate_Source> source;
-    boost::shared_ptr<const ML::Dense_Feature_Space> source_fs;
-    if (dump_source_data) {
-        source = get_candidate_source(config, source_to_train);
-        source_fs = source->feature_space();
+    // Training data needs all of the features, not just those that the
+    // current classifier uses
+    if (dump_merger_data || dump_source_data)
+        ranker->calculate_all_features();
+
+    vector<boost::shared_ptr<const Candidate_Source> > sources;
+    vector<boost::shared_ptr<const ML::Dense_Feature_Space> > source_fs;
+    if (train_sources) {
+        for (unsigned i = 0;  i < generator->sources.size();  ++i)
+            if (source_to_train == ""
+                || generator->sources[i]->name() == source_to_train)
+                sources.push_back(generator->sources[i]);
+        if (sources.empty())
+            throw Exception("generator has no source " + source_to_train);
     }
+    else if (dump_source_data)
+        sources.push_back(get_candidate_source(config, source_to_train));
+
+    for (unsigned i = 0;  i < sources.size();  ++i)
+        source_fs.push_back(sources[i]->feature_space());
 
     boost::shared_ptr<const ML::Dense_Feature_Space> ranker_fs
         = ranker->feature_space();
 
+    if (profile_users > 0) {
+        cerr << "profiling features..." << endl;
+
+        Feature_Profiler profiler(*ranker, data);
+
+        int n = std::min<int>(profile_users, data.users_to_test.size());
+        boost::progress_display progress(n, cerr);
+        for (int i = 0;  i < n;  ++i, ++progress)
+            profiler.add_user(data.users_to_test[i]);
+
+        profiler.report(out);
+        return 0;
+    }
+
     // Dump the feature vector for the merger file
-    if (dump_merger_data || dump_source_data) {
+    if ((dump_merger_data || dump_source_data) && train == "") {
         // Get the feature space for the merger file
 
         // Write out the header
@@ -843,9 +1054,11 @@ int main(int argc, char ** argv)
             << "WT:k=REAL/o=BIASED "
             << "GROUP:k=REAL/o=GROUPING "
             << "REAL_TEST:k=BOOLEAN/o=BIASED ";
-        if (dump_merger_data)
+        if (dump_cascade_data)
+            out << generator->feature_space()->print();
+        else if (dump_merger_data)
             out << ranker_fs->print();
-        else out << source_fs->print();
+        else out << source_fs[0]->print();
         out << endl;
     }
 
@@ -854,7 +1067,76 @@ int main(int argc, char ** argv)
                      dump_predictions, dump_results,
                      train_discriminative, possible_only,
                      include_all_correct,
-                     source, generator, ranker, source_fs, ranker_fs);
+                     generator, ranker, ranker_fs);
+
+    info.sources = sources;
+    info.source_fs = source_fs;
+    info.dump_cascade_data = dump_cascade_data;
+    info.generator_fs = generator->feature_space();
+
+    for (unsigned i = 0;  train_sources && i < sources.size();  ++i) {
+        boost::shared_ptr<Training_Set> training_set
+            (new Training_Set(sources[i]->name(), *source_fs[i],
+                              sources[i]->classifier_file));
+        training_set->ignore_features = sources[i]->train_ignore;
+        info.training_sets.push_back(training_set);
+    }
+
+    if (train_ranker) {
+        const Classifier_Ranker * classifier_ranker
+            = dynamic_cast<const Classifier_Ranker *>(ranker.get());
+        if (!classifier_ranker)
+            throw Exception("--train=ranker needs a classifier ranker");
+        info.training_sets.push_back
+            (boost::shared_ptr<Training_Set>
+             (new Training_Set("ranker", *ranker_fs,
+                               classifier_ranker->classifier_file)));
+    }
+
+    if (train_cascade) {
+        const Classifier_Ranker * classifier_ranker
+            = dynamic_cast<const Classifier_Ranker *>(ranker.get());
+        if (!classifier_ranker
+            || classifier_ranker->cascade_classifier_file == "")
+            throw Exception("--train=cascade needs a classifier ranker with "
+                            "a cascade_classifier_file");
+        info.training_sets.push_back
+            (boost::shared_ptr<Training_Set>
+             (new Training_Set("cascade", *info.generator_fs,
+                               classifier_ranker->cascade_classifier_file)));
+    }
+
+    // The cache is keyed by everything that affects the candidates apart
+    // from the user's own watches, which are checked per user
+    Candidate_Cache candidate_cache;
+    if (candidate_cache_dir != "") {
+        uint64_t fp = generator->fingerprint();
+        fp = fingerprint_file(config_file, fp);
+        for (unsigned i = 0;  i < extra_config_options.size();  ++i)
+            fp = fingerprint(extra_config_options[i], fp);
+        fp = fingerprint(generator_name, fp);
+        fp = fingerprint(format("%d %d %d %d %d %d %zd %d %d %d",
+                                (int)(fake_test || dump_merger_data
+                                      || dump_source_data),
+                                num_users, rseed,
+                                cooc_options.max_degree,
+                                cooc_options.hub_sample,
+                                cooc_options.top_k,
+                                data.cooc_options.max_memory,
+                                (int)quantize_embeddings,
+                                (int)quantized_rescore,
+                                minhash_bands * 1000 + minhash_rows),
+                         fp);
+        fp = fingerprint_file(load_factors_file, fp);
+        vector<string> input_files = Data::input_files();
+        for (unsigned i = 0;  i < input_files.size();  ++i)
+            fp = fingerprint_file(input_files[i], fp);
+        fp = fingerprint_file("data/kmeans_users.txt", fp);
+        fp = fingerprint_file("data/kmeans_repos.txt", fp);
+
+        candidate_cache.open(candidate_cache_dir, fp);
+        info.candidate_cache = &candidate_cache;
+    }
 
     Timer timer;
 
@@ -940,6 +1222,25 @@ int main(int argc, char ** argv)
 
     cerr << "elapsed: " << timer.elapsed() << endl;
 
+    if (info.candidate_cache) {
+        cerr << "candidate cache: " << candidate_cache.hits() << " hits, "
+             << candidate_cache.misses() << " misses" << endl;
+        candidate_cache.save();
+    }
+
+    if (!info.training_sets.empty()) {
+        Configuration training_config;
+        training_config.load(training_config_file);
+
+        if (trainer_name == "")
+            trainer_name = (train_sources ? "phase1" : "default");
+
+        cerr << "training " << info.training_sets.size()
+             << " classifiers with " << trainer_name << "..." << endl;
+        train_all(info.training_sets, training_config, trainer_name, rseed);
+        cerr << "elapsed: " << timer.elapsed() << endl;
+    }
+
     if (dump_merger_data || dump_source_data) return(0);
 
     if (results.size() != users_tested.size())
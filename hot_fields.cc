@@ -0,0 +1,150 @@
+/* hot_fields.cc
+   Jeremy Barnes, 6 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the hot field arrays.
+*/
+
+#include "hot_fields.h"
+#include "data.h"
+
+
+using namespace std;
+using namespace ML;
+
+
+/*****************************************************************************/
+/* REPO_HOT_FIELDS                                                           */
+/*****************************************************************************/
+
+Repo_Hot_Fields::
+Repo_Hot_Fields()
+{
+}
+
+void
+Repo_Hot_Fields::
+clear()
+{
+    valid_.clear();
+    author_.clear();
+    parent_.clear();
+    popularity_rank_.clear();
+    repo_prob_.clear();
+    repo_prob_rank_.clear();
+    kmeans_cluster_.clear();
+    min_user_.clear();
+    max_user_.clear();
+    total_loc_.clear();
+    num_watchers_.clear();
+}
+
+void
+Repo_Hot_Fields::
+build(const std::vector<Repo> & repos)
+{
+    clear();
+
+    size_t n = repos.size();
+
+    valid_.reserve(n);
+    author_.reserve(n);
+    parent_.reserve(n);
+    popularity_rank_.reserve(n);
+    repo_prob_.reserve(n);
+    repo_prob_rank_.reserve(n);
+    kmeans_cluster_.reserve(n);
+    min_user_.reserve(n);
+    max_user_.reserve(n);
+    total_loc_.reserve(n);
+    num_watchers_.reserve(n);
+
+    for (unsigned i = 0;  i < n;  ++i) {
+        const Repo & repo = repos[i];
+        valid_.push_back(!repo.invalid());
+        author_.push_back(repo.author);
+        parent_.push_back(repo.parent);
+        popularity_rank_.push_back(repo.popularity_rank);
+        repo_prob_.push_back(repo.repo_prob);
+        repo_prob_rank_.push_back(repo.repo_prob_rank);
+        kmeans_cluster_.push_back(repo.kmeans_cluster);
+        min_user_.push_back(repo.min_user);
+        max_user_.push_back(repo.max_user);
+        total_loc_.push_back(repo.total_loc);
+        num_watchers_.push_back(repo.watchers.size());
+    }
+}
+
+size_t
+Repo_Hot_Fields::
+memusage() const
+{
+    return valid_.capacity()
+        + sizeof(int) * (author_.capacity() + parent_.capacity()
+                         + popularity_rank_.capacity()
+                         + repo_prob_rank_.capacity()
+                         + kmeans_cluster_.capacity()
+                         + min_user_.capacity() + max_user_.capacity()
+                         + num_watchers_.capacity())
+        + sizeof(float) * repo_prob_.capacity()
+        + sizeof(size_t) * total_loc_.capacity();
+}
+
+
+/*****************************************************************************/
+/* USER_HOT_FIELDS                                                           */
+/*****************************************************************************/
+
+User_Hot_Fields::
+User_Hot_Fields()
+{
+}
+
+void
+User_Hot_Fields::
+clear()
+{
+    user_prob_.clear();
+    user_prob_rank_.clear();
+    kmeans_cluster_.clear();
+    min_repo_.clear();
+    max_repo_.clear();
+    num_watching_.clear();
+}
+
+void
+User_Hot_Fields::
+build(const std::vector<User> & users)
+{
+    clear();
+
+    size_t n = users.size();
+
+    user_prob_.reserve(n);
+    user_prob_rank_.reserve(n);
+    kmeans_cluster_.reserve(n);
+    min_repo_.reserve(n);
+    max_repo_.reserve(n);
+    num_watching_.reserve(n);
+
+    for (unsigned i = 0;  i < n;  ++i) {
+        const User & user = users[i];
+        user_prob_.push_back(user.user_prob);
+        user_prob_rank_.push_back(user.user_prob_rank);
+        kmeans_cluster_.push_back(user.kmeans_cluster);
+        min_repo_.push_back(user.min_repo);
+        max_repo_.push_back(user.max_repo);
+        num_watching_.push_back(user.watching.size());
+    }
+}
+
+size_t
+User_Hot_Fields::
+memusage() const
+{
+    return sizeof(float) * user_prob_.capacity()
+        + sizeof(int) * (user_prob_rank_.capacity()
+                         + kmeans_cluster_.capacity()
+                         + min_repo_.capacity() + max_repo_.capacity()
+                         + num_watching_.capacity());
+}
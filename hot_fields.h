@@ -0,0 +1,101 @@
+/* hot_fields.h                                                    -*- C++ -*-
+   Jeremy Barnes, 6 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   The scalar fields of the repos and users that scoring reads all the time,
+   kept in arrays of their own.
+*/
+
+#ifndef __github__hot_fields_h__
+#define __github__hot_fields_h__
+
+#include <vector>
+#include <stddef.h>
+
+struct Repo;
+struct User;
+
+
+/*****************************************************************************/
+/* REPO_HOT_FIELDS                                                           */
+/*****************************************************************************/
+
+/** The fields of the repos that the sources and the ranker read in their
+    inner loops, one array per field indexed by repo ID.  A Repo is several
+    hundred bytes of strings, sets and vectors, so a loop over the watched
+    repos that only wanted the parent would otherwise bring in a cache line
+    or more for each one.
+
+    These are copies; the Repo structure still holds the real values.  They
+    need to be rebuilt (by Data::calc_hot_fields()) if anything changes
+    them.  Invalid repos have the same values as a default constructed
+    Repo.
+*/
+
+struct Repo_Hot_Fields {
+    Repo_Hot_Fields();
+
+    void build(const std::vector<Repo> & repos);
+
+    void clear();
+
+    size_t size() const { return author_.size(); }
+
+    bool invalid(int repo_id) const { return !valid_[repo_id]; }
+
+    int author(int repo_id) const { return author_[repo_id]; }
+    int parent(int repo_id) const { return parent_[repo_id]; }
+    int popularity_rank(int repo_id) const { return popularity_rank_[repo_id]; }
+    float repo_prob(int repo_id) const { return repo_prob_[repo_id]; }
+    int repo_prob_rank(int repo_id) const { return repo_prob_rank_[repo_id]; }
+    int kmeans_cluster(int repo_id) const { return kmeans_cluster_[repo_id]; }
+    int min_user(int repo_id) const { return min_user_[repo_id]; }
+    int max_user(int repo_id) const { return max_user_[repo_id]; }
+    size_t total_loc(int repo_id) const { return total_loc_[repo_id]; }
+    int num_watchers(int repo_id) const { return num_watchers_[repo_id]; }
+
+    size_t memusage() const;
+
+private:
+    std::vector<unsigned char> valid_;
+    std::vector<int> author_, parent_, popularity_rank_;
+    std::vector<float> repo_prob_;
+    std::vector<int> repo_prob_rank_, kmeans_cluster_;
+    std::vector<int> min_user_, max_user_;
+    std::vector<size_t> total_loc_;
+    std::vector<int> num_watchers_;
+};
+
+
+/*****************************************************************************/
+/* USER_HOT_FIELDS                                                           */
+/*****************************************************************************/
+
+/** The same for the users, indexed by user ID. */
+
+struct User_Hot_Fields {
+    User_Hot_Fields();
+
+    void build(const std::vector<User> & users);
+
+    void clear();
+
+    size_t size() const { return user_prob_.size(); }
+
+    float user_prob(int user_id) const { return user_prob_[user_id]; }
+    int user_prob_rank(int user_id) const { return user_prob_rank_[user_id]; }
+    int kmeans_cluster(int user_id) const { return kmeans_cluster_[user_id]; }
+    int min_repo(int user_id) const { return min_repo_[user_id]; }
+    int max_repo(int user_id) const { return max_repo_[user_id]; }
+    int num_watching(int user_id) const { return num_watching_[user_id]; }
+
+    size_t memusage() const;
+
+private:
+    std::vector<float> user_prob_;
+    std::vector<int> user_prob_rank_, kmeans_cluster_;
+    std::vector<int> min_repo_, max_repo_;
+    std::vector<int> num_watching_;
+};
+
+#endif /* __github__hot_fields_h__ */
@@ -0,0 +1,146 @@
+/* keyword_index.cc
+   Jeremy Barnes, 28 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the inverted keyword index.
+*/
+
+#include "keyword_index.h"
+#include "data.h"
+#include "parallel.h"
+#include "utils/string_functions.h"
+
+#include <algorithm>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace {
+
+struct Sort_By_Weight {
+    bool operator () (const Keyword_Index::Posting & p1,
+                      const Keyword_Index::Posting & p2) const
+    {
+        if (p1.weight != p2.weight) return p1.weight > p2.weight;
+        return p1.repo_id < p2.repo_id;
+    }
+};
+
+enum { TERMS_PER_CHUNK = 1000 };
+
+} // file scope
+
+
+/*****************************************************************************/
+/* KEYWORD_INDEX                                                             */
+/*****************************************************************************/
+
+/** Sorts the posting lists for a range of terms */
+struct Keyword_Index::Sort_Job {
+    Sort_Job(Keyword_Index & index)
+        : index(index)
+    {
+    }
+
+    Keyword_Index & index;
+
+    void operator () (int chunk, int first, int last) const
+    {
+        for (int term = first;  term < last;  ++term)
+            std::sort(index.postings.begin() + index.offsets[term],
+                      index.postings.begin() + index.offsets[term + 1],
+                      Sort_By_Weight());
+    }
+};
+
+Keyword_Index::
+Keyword_Index()
+{
+    clear();
+}
+
+void
+Keyword_Index::
+clear()
+{
+    offsets.clear();
+    offsets.push_back(0);
+    postings.clear();
+}
+
+void
+Keyword_Index::
+build(const Data & data)
+{
+    clear();
+
+    // Count the postings for each term
+    for (unsigned i = 0;  i < data.repos.size();  ++i) {
+        const Repo & repo = data.repos[i];
+        if (repo.invalid() || repo.keywords_idf.empty()) continue;
+
+        for (Cooccurrences::const_iterator
+                 it = repo.keywords_idf.begin(),
+                 end = repo.keywords_idf.end();
+             it != end;  ++it) {
+            if (it->with + 2 > (int)offsets.size())
+                offsets.resize(it->with + 2);
+            offsets[it->with + 1] += 1;
+        }
+    }
+
+    int nterms = offsets.size() - 1;
+
+    for (int i = 0;  i < nterms;  ++i)
+        offsets[i + 1] += offsets[i];
+
+    postings.resize(offsets[nterms]);
+
+    // Fill them in
+    vector<int> fill(offsets.begin(), offsets.end() - 1);
+
+    for (unsigned i = 0;  i < data.repos.size();  ++i) {
+        const Repo & repo = data.repos[i];
+        if (repo.invalid() || repo.keywords_idf.empty()) continue;
+        if (repo.keywords_idf_2norm <= 0.0) continue;
+
+        float factor = 1.0 / repo.keywords_idf_2norm;
+
+        for (Cooccurrences::const_iterator
+                 it = repo.keywords_idf.begin(),
+                 end = repo.keywords_idf.end();
+             it != end;  ++it) {
+            Posting & posting = postings[fill[it->with]++];
+            posting.repo_id = i;
+            posting.weight = it->score * factor;
+        }
+    }
+
+    // Repos with a zero norm were counted but not filled in; close the gaps
+    int out = 0;
+    for (int term = 0;  term < nterms;  ++term) {
+        int start = offsets[term];
+        offsets[term] = out;
+        for (int j = start;  j < fill[term];  ++j)
+            postings[out++] = postings[j];
+    }
+    offsets[nterms] = out;
+    postings.resize(out);
+
+    run_in_parallel(nterms, TERMS_PER_CHUNK, Sort_Job(*this),
+                    "sort keyword postings");
+
+    cerr << format("keyword index: %d terms, %zd postings, %.1fMB",
+                   nterms, postings.size(), memusage() / 1048576.0)
+         << endl;
+}
+
+size_t
+Keyword_Index::
+memusage() const
+{
+    return sizeof(int) * offsets.capacity()
+        + sizeof(Posting) * postings.capacity();
+}
@@ -0,0 +1,70 @@
+/* keyword_index.h                                                 -*- C++ -*-
+   Jeremy Barnes, 28 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Inverted index from keywords to the repos that contain them.
+*/
+
+#ifndef __github__keyword_index_h__
+#define __github__keyword_index_h__
+
+#include <vector>
+#include <stddef.h>
+
+struct Data;
+
+
+/*****************************************************************************/
+/* KEYWORD_INDEX                                                             */
+/*****************************************************************************/
+
+/** For each keyword (vocabulary ID), the repos whose tf-idf vectors contain
+    it, along with the weight of the keyword in the repo's vector once it
+    has been normalized to unit length.  Each posting list is sorted by
+    descending weight so that a top-k query can stop early.
+*/
+
+struct Keyword_Index {
+    Keyword_Index();
+
+    struct Posting {
+        int repo_id;
+        float weight;
+    };
+
+    /// Build from the keywords_idf vectors of the repos.  Must be called
+    /// once analyze_keywords() has set them.
+    void build(const Data & data);
+
+    void clear();
+
+    bool empty() const { return postings.empty(); }
+
+    size_t num_terms() const { return offsets.size() - 1; }
+
+    const Posting * begin(int term) const
+    {
+        return &postings[0] + offsets[term];
+    }
+
+    const Posting * end(int term) const
+    {
+        return &postings[0] + offsets[term + 1];
+    }
+
+    size_t size(int term) const
+    {
+        return offsets[term + 1] - offsets[term];
+    }
+
+    /// Memory used by the index, in bytes
+    size_t memusage() const;
+
+private:
+    std::vector<int> offsets;  ///< num_terms + 1 of them
+    std::vector<Posting> postings;
+
+    struct Sort_Job;
+};
+
+#endif /* __github__keyword_index_h__ */
@@ -6,6 +6,8 @@
 */
 
 #include "keywords.h"
+#include "tokenizer.h"
+#include "parallel.h"
 #include "utils/vector_utils.h"
 #include "utils/hash_map.h"
 #include "utils/hash_set.h"
@@ -14,6 +16,7 @@
 #include "utils/string_functions.h"
 
 #include "svdlibc/svdlib.h"
+#include "svd_cache.h"
 #include "arch/timers.h"
 
 using namespace std;
@@ -150,104 +153,236 @@ tokenize(const std::string & str,
     return tokens;
 }
 
-void analyze_keywords(Data & data)
+const Token_Table & get_stopword_table()
 {
-    // Steps:
-    // * Tokenize.  We also turn CamelCase into camel case and normalize
-    //   punctuation, etc.
-    // * Convert runtogethertext into run together text (hard)
-    // * Filter out stopwords
-    // * Substitution of known synonyms
-    // * replacement of known compound terms with compound_terms
-    // * Get the term frequency matrix
-    // * Run a SVD to get the major variation in co-usage
-    // * Write the data file
+    static Token_Table results;
 
-    // The goal is to get as far towards a uniform representation as possible,
-    // without spending too much time on trying to get it perfect.
+    if (results.size() == 0) {
+        const std::hash_set<std::string> & stopwords = get_stopwords();
+        for (std::hash_set<std::string>::const_iterator
+                 it = stopwords.begin(), end = stopwords.end();
+             it != end;  ++it)
+            results.insert(*it);
+    }
 
-    // Tokenization
+    return results;
+}
 
-    vector<Name> names;
+namespace {
+
+enum { REPOS_PER_CHUNK = 2000 };
+
+/// Vocabulary over one chunk of the repos
+struct Vocab_Chunk {
+    Vocab_Chunk() : num_valid_repos(0) {}
+
+    Token_Table table;
+    std::vector<Vocab_Entry> vocab;
+    int num_valid_repos;
+
+    // The (local) ids of the tokens in each valid repo, if recorded
+    std::vector<int> repo_ids;        ///< Repo id
+    std::vector<int> repo_ntokens;    ///< Total tokens including stopwords
+    std::vector<int> repo_offsets;    ///< Offset of first token in ids
+    std::vector<int> ids;
+
+    // Mapping from local ids onto the merged vocabulary
+    std::vector<int> global_ids;
+};
+
+struct Vocab_Chunk_Job {
+    Vocab_Chunk_Job(const Data & data,
+                    const Token_Table * prev_table,
+                    const std::vector<Vocab_Entry> * prev_vocab,
+                    bool record_ids,
+                    std::vector<Vocab_Chunk> & chunks)
+        : data(data), prev_table(prev_table), prev_vocab(prev_vocab),
+          record_ids(record_ids), chunks(chunks)
+    {
+    }
 
-    std::hash_map<string, int> vocab_map;
-    vector<Vocab_Entry> vocab;
+    const Data & data;
+    const Token_Table * prev_table;
+    const std::vector<Vocab_Entry> * prev_vocab;
+    bool record_ids;
+    std::vector<Vocab_Chunk> & chunks;
 
-    int num_valid_repos = 0;
+    void operator () (int chunk_num, int begin, int end) const
+    {
+        Vocab_Chunk & chunk = chunks[chunk_num];
 
-    const std::hash_set<std::string> & stopwords = get_stopwords();
+        const Token_Table & stopwords = get_stopword_table();
 
-    for (unsigned i = 0;  i < data.repos.size();  ++i) {
-        if (data.repos[i].invalid()) continue;
-        ++num_valid_repos;
-        Repo & repo = data.repos[i];
-        vector<string> tokens = tokenize(repo.name, Repo_Name);
+        Tokenizer tokenizer;
 
-        vector<string> desc_tokens = tokenize(repo.description, Description);
+        // Which repo was the vocab entry last seen in?  Used to count each
+        // token only once per repo.
+        vector<int> last_seen;
 
-        //cerr << "name " << name << " tokens " << tokens << endl;
+        for (int i = begin;  i < end;  ++i) {
+            if (data.repos[i].invalid()) continue;
+            ++chunk.num_valid_repos;
+            const Repo & repo = data.repos[i];
 
-        // Add each token to the vocabulary
+            tokenizer.clear();
+            tokenizer.tokenize(repo.name, prev_table, prev_vocab);
+            tokenizer.tokenize(repo.description, prev_table, prev_vocab);
 
-        tokens.insert(tokens.end(),
-                      desc_tokens.begin(), desc_tokens.end());
+            const vector<Token_Ref> & tokens = tokenizer.tokens;
 
-        //cerr << "name: " << repo.name << " desc: " << repo.description
-        //     << endl;
-        //cerr << "  processed: " << tokens << endl;
-        
-        set<int> ids_done;
+            if (record_ids) {
+                chunk.repo_ids.push_back(i);
+                chunk.repo_ntokens.push_back(tokens.size());
+                chunk.repo_offsets.push_back(chunk.ids.size());
+            }
 
-        for (unsigned j = 0;  j < tokens.size();  ++j) {
-            string token = tokens[j];
+            for (unsigned j = 0;  j < tokens.size();  ++j) {
+                const Token_Ref & token = tokens[j];
 
-            // filter stopwords
-            if (stopwords.count(token)) continue;
+                // filter stopwords
+                if (tokenizer.find(token, stopwords) != -1) continue;
 
-            // Insert or find vocabulary entry
-            hash_map<string, int>::iterator it;
-            bool inserted;
-            boost::tie(it, inserted)
-                = vocab_map.insert(make_pair(token, vocab.size()));
+                // Insert or find vocabulary entry
+                int id;
+                bool inserted;
+                boost::tie(id, inserted) = tokenizer.insert(token, chunk.table);
+
+                if (inserted) {
+                    Vocab_Entry new_entry;
+                    new_entry.id = id;
+                    new_entry.token = tokenizer.token(token);
+                    chunk.vocab.push_back(new_entry);
+                    last_seen.push_back(-1);
+                }
+
+                Vocab_Entry & entry = chunk.vocab[id];
+
+                entry.seen_count += 1;
+
+                if (last_seen[id] != i) {
+                    last_seen[id] = i;
+                    entry.in_names += 1;
+                }
+
+                if (record_ids) chunk.ids.push_back(id);
+            }
+        }
+
+        if (record_ids) chunk.repo_offsets.push_back(chunk.ids.size());
+    }
+};
+
+struct Set_Keywords_Job {
+    Set_Keywords_Job(Data & data, const std::vector<Vocab_Chunk> & chunks)
+        : data(data), chunks(chunks)
+    {
+    }
+
+    Data & data;
+    const std::vector<Vocab_Chunk> & chunks;
+
+    void operator () (int chunk_num, int begin, int end) const
+    {
+        const Vocab_Chunk & chunk = chunks[chunk_num];
+
+        for (unsigned i = 0;  i < chunk.repo_ids.size();  ++i) {
+            Repo & repo = data.repos[chunk.repo_ids[i]];
+            int ntokens = chunk.repo_ntokens[i];
+
+            for (unsigned j = chunk.repo_offsets[i];
+                 j < chunk.repo_offsets[i + 1];  ++j)
+                repo.keywords.add(chunk.global_ids[chunk.ids[j]],
+                                  1.0 / ntokens);
+
+            repo.keywords.finish();
+            repo.keywords_2norm
+                = sqrt(repo.keywords.overlap(repo.keywords).first);
+        }
+    }
+};
+
+} // file scope
+
+int vocab_pass(Data & data,
+               const Token_Table * prev_table,
+               const std::vector<Vocab_Entry> * prev_vocab,
+               Token_Table & table,
+               std::vector<Vocab_Entry> & vocab,
+               bool set_keywords)
+{
+    // Make sure it's loaded before the threads need it
+    get_stopword_table();
+
+    int nrepos = data.repos.size();
+
+    vector<Vocab_Chunk> chunks(num_chunks(nrepos, REPOS_PER_CHUNK));
+
+    run_in_parallel(nrepos, REPOS_PER_CHUNK,
+                    Vocab_Chunk_Job(data, prev_table, prev_vocab,
+                                    set_keywords, chunks),
+                    "vocab pass");
+
+    // Merge the chunks in order.  As each chunk's local IDs are in order of
+    // first occurrence, the merged IDs are the same as those of a serial
+    // pass over all of the repos, no matter how many chunks there are.
+    int num_valid_repos = 0;
+
+    for (unsigned i = 0;  i < chunks.size();  ++i) {
+        Vocab_Chunk & chunk = chunks[i];
+        num_valid_repos += chunk.num_valid_repos;
+
+        chunk.global_ids.resize(chunk.vocab.size());
+
+        for (unsigned j = 0;  j < chunk.vocab.size();  ++j) {
+            const Vocab_Entry & local = chunk.vocab[j];
 
             int id;
+            bool inserted;
+            boost::tie(id, inserted) = table.insert(local.token);
+
             if (inserted) {
                 Vocab_Entry new_entry;
-                new_entry.id = vocab.size();
-                new_entry.token = token;
-
-                id = vocab.size();
+                new_entry.id = id;
+                new_entry.token = local.token;
                 vocab.push_back(new_entry);
             }
-            else id = it->second;
 
             Vocab_Entry & entry = vocab[id];
-            
-            entry.seen_count += 1;
+            entry.seen_count += local.seen_count;
+            entry.in_names += local.in_names;
 
-            if (!ids_done.count(id)) {
-                ids_done.insert(id);
-                entry.in_names += 1;
-            }
+            chunk.global_ids[j] = id;
         }
     }
 
-    cerr << "pass 1: " << vocab.size() << " vocab entries" << endl;
+    if (set_keywords)
+        run_in_parallel(chunks.size(), 1, Set_Keywords_Job(data, chunks),
+                        "set keywords");
 
-    std::hash_map<string, int> vocab_map2;
-    vector<Vocab_Entry> vocab2;
+    return num_valid_repos;
+}
+
+namespace {
+
+// Old version of vocab_pass, based upon strings.  Used to check that the
+// results are identical.
+void vocab_pass_strings(const Data & data,
+                        const std::hash_map<string, int> * prev_map,
+                        const std::vector<Vocab_Entry> * prev_vocab,
+                        std::hash_map<string, int> & vocab_map,
+                        std::vector<Vocab_Entry> & vocab)
+{
+    const std::hash_set<std::string> & stopwords = get_stopwords();
 
-    // Pass 2: we can use frequency counts to improve our tokenization
     for (unsigned i = 0;  i < data.repos.size();  ++i) {
         if (data.repos[i].invalid()) continue;
-        ++num_valid_repos;
-        Repo & repo = data.repos[i];
+        const Repo & repo = data.repos[i];
         vector<string> tokens = tokenize(repo.name, Repo_Name,
-                                         &vocab_map, &vocab);
+                                         prev_map, prev_vocab);
 
         vector<string> desc_tokens
             = tokenize(repo.description, Description,
-                       &vocab_map, &vocab);
+                       prev_map, prev_vocab);
 
         tokens.insert(tokens.end(),
                       desc_tokens.begin(), desc_tokens.end());
@@ -259,24 +394,23 @@ void analyze_keywords(Data & data)
 
             if (stopwords.count(token)) continue;
 
-            // Insert or find vocabulary entry
             hash_map<string, int>::iterator it;
             bool inserted;
             boost::tie(it, inserted)
-                = vocab_map2.insert(make_pair(token, vocab2.size()));
+                = vocab_map.insert(make_pair(token, vocab.size()));
 
             int id;
             if (inserted) {
                 Vocab_Entry new_entry;
-                new_entry.id = vocab2.size();
+                new_entry.id = vocab.size();
                 new_entry.token = token;
 
-                id = vocab2.size();
-                vocab2.push_back(new_entry);
+                id = vocab.size();
+                vocab.push_back(new_entry);
             }
             else id = it->second;
 
-            Vocab_Entry & entry = vocab2[id];
+            Vocab_Entry & entry = vocab[id];
             
             entry.seen_count += 1;
 
@@ -284,13 +418,225 @@ void analyze_keywords(Data & data)
                 ids_done.insert(id);
                 entry.in_names += 1;
             }
+        }
+    }
+}
 
-            repo.keywords.add(id, 1.0 / tokens.size());
+void check_same_vocab(const std::vector<Vocab_Entry> & vocab1,
+                      const std::vector<Vocab_Entry> & vocab2)
+{
+    if (vocab1.size() != vocab2.size())
+        throw Exception(format("vocabularies differ in size: %zd vs %zd",
+                               vocab1.size(), vocab2.size()));
+
+    for (unsigned i = 0;  i < vocab1.size();  ++i) {
+        const Vocab_Entry & e1 = vocab1[i], & e2 = vocab2[i];
+        if (e1.token != e2.token || e1.id != e2.id
+            || e1.seen_count != e2.seen_count || e1.in_names != e2.in_names)
+            throw Exception(format("vocabularies differ at entry %d: "
+                                   "%s/%d/%d vs %s/%d/%d",
+                                   i, e1.token.c_str(), e1.seen_count,
+                                   e1.in_names, e2.token.c_str(),
+                                   e2.seen_count, e2.in_names));
+    }
+}
+
+} // file scope
+
+void benchmark_tokenizer(Data & data, int iterations)
+{
+    // Old version
+    std::hash_map<string, int> vocab_map, vocab_map2;
+    vector<Vocab_Entry> vocab, vocab2;
+
+    Timer timer;
+    for (int i = 0;  i < iterations;  ++i) {
+        vocab_map.clear();  vocab.clear();
+        vocab_map2.clear();  vocab2.clear();
+        vocab_pass_strings(data, 0, 0, vocab_map, vocab);
+        vocab_pass_strings(data, &vocab_map, &vocab, vocab_map2, vocab2);
+    }
+    double old_time = timer.elapsed_wall();
+
+    // New version
+    Token_Table table, table2;
+    vector<Vocab_Entry> new_vocab, new_vocab2;
+
+    get_stopword_table();  // don't time loading the stopwords
+
+    timer.restart();
+    for (int i = 0;  i < iterations;  ++i) {
+        table.clear();  new_vocab.clear();
+        table2.clear();  new_vocab2.clear();
+        vocab_pass(data, 0, 0, table, new_vocab, false);
+        vocab_pass(data, &table, &new_vocab, table2, new_vocab2, false);
+    }
+    double new_time = timer.elapsed_wall();
+
+    check_same_vocab(vocab, new_vocab);
+    check_same_vocab(vocab2, new_vocab2);
+
+    size_t num_chars = 0;
+    for (unsigned i = 0;  i < data.repos.size();  ++i) {
+        if (data.repos[i].invalid()) continue;
+        num_chars += data.repos[i].name.size()
+            + data.repos[i].description.size();
+    }
+
+    double mb = 2.0 * iterations * num_chars / 1000000.0;
+
+    cerr << "vocabularies are identical: " << vocab.size() << " and "
+         << vocab2.size() << " entries" << endl;
+    cerr << format("string tokenizer: %8.3fs  %8.2f MB/s\n",
+                   old_time, mb / old_time);
+    cerr << format("token tokenizer:  %8.3fs  %8.2f MB/s\n",
+                   new_time, mb / new_time);
+    cerr << format("speedup: %.2fx\n", old_time / new_time);
+}
+
+namespace {
+
+struct Tf_Idf_Job {
+    Tf_Idf_Job(Data & data, const std::vector<Vocab_Entry> & vocab,
+               int min_keyword_freq, int num_valid_repos)
+        : data(data), vocab(vocab), min_keyword_freq(min_keyword_freq),
+          num_valid_repos(num_valid_repos)
+    {
+    }
+
+    Data & data;
+    const std::vector<Vocab_Entry> & vocab;
+    int min_keyword_freq;
+    int num_valid_repos;
+
+    void operator () (int chunk_num, int first, int last) const
+    {
+        for (int i = first;  i < last;  ++i) {
+            if (data.repos[i].invalid()) continue;
+            Repo & repo = data.repos[i];
+
+            // Filter out keywords that didn't appear enough times
+            Cooccurrences filtered;
+
+            double total_score = 0.0;
+            for (Cooccurrences::const_iterator
+                     it = repo.keywords.begin(),
+                     end = repo.keywords.end();
+                 it != end;  ++it) {
+                float freq = vocab[it->with].in_names;
+                if (freq < min_keyword_freq) continue;
+
+                filtered.add(it->with, it->score);
+                total_score += it->score;
+            }
+
+            // Normalize
+            double factor = 1.0 / total_score;
+            for (Cooccurrences::iterator
+                     it = repo.keywords.begin(),
+                     end = repo.keywords.end();
+                 it != end;  ++it)
+                it->score *= factor;
+
+            filtered.finish();
+            repo.keywords.swap(filtered);
+
+            if (repo.keywords.empty()) continue;
+
+            // Calculate tf-idf
+            repo.keywords_idf.reserve(repo.keywords.size());
+            for (Cooccurrences::const_iterator
+                     it = repo.keywords.begin(),
+                     end = repo.keywords.end();
+                 it != end;  ++it) {
+                float freq = vocab[it->with].in_names;
+                float idf = log(1.0 * num_valid_repos / freq);
+                repo.keywords_idf.add(it->with, it->score * idf);
+            }
+            repo.keywords_idf.finish();
+            repo.keywords_idf_2norm
+                = sqrt(repo.keywords_idf.overlap(repo.keywords_idf).first);
         }
+    }
+};
+
+struct Fill_Matrix_Job {
+    Fill_Matrix_Job(const Data & data,
+                    const std::vector<int> & index_to_repo,
+                    const std::vector<int> & word_to_index,
+                    smat & matrix)
+        : data(data), index_to_repo(index_to_repo),
+          word_to_index(word_to_index), matrix(matrix)
+    {
+    }
+
+    const Data & data;
+    const std::vector<int> & index_to_repo;
+    const std::vector<int> & word_to_index;
+    smat & matrix;
+
+    void operator () (int chunk_num, int first, int last) const
+    {
+        for (int index = first;  index < last;  ++index) {
+            const Repo & repo = data.repos[index_to_repo[index]];
+
+            int entry_num = matrix.pointr[index];
+
+            for (Cooccurrences::const_iterator
+                     it = repo.keywords.begin(),
+                     end = repo.keywords.end();
+                 it != end;  ++it) {
+
+                matrix.rowind[entry_num] = word_to_index[it->with];
 
-        repo.keywords.finish();
-        repo.keywords_2norm = sqrt(repo.keywords.overlap(repo.keywords).first);
+                if (matrix.rowind[entry_num] == -1)
+                    throw Exception("invalid entry num");
+
+                matrix.value[entry_num] = 1.0;//it->score;
+                ++entry_num;
+            }
+
+            if (entry_num != matrix.pointr[index + 1])
+                throw Exception("wrong number of entries for repo");
+        }
     }
+};
+
+} // file scope
+
+void analyze_keywords(Data & data)
+{
+    // Steps:
+    // * Tokenize.  We also turn CamelCase into camel case and normalize
+    //   punctuation, etc.
+    // * Convert runtogethertext into run together text (hard)
+    // * Filter out stopwords
+    // * Substitution of known synonyms
+    // * replacement of known compound terms with compound_terms
+    // * Get the term frequency matrix
+    // * Run a SVD to get the major variation in co-usage
+    // * Write the data file
+
+    // The goal is to get as far towards a uniform representation as possible,
+    // without spending too much time on trying to get it perfect.
+
+    // Tokenization
+
+    Token_Table vocab_map;
+    vector<Vocab_Entry> vocab;
+
+    int num_valid_repos = 0;
+
+    num_valid_repos += vocab_pass(data, 0, 0, vocab_map, vocab, false);
+
+    cerr << "pass 1: " << vocab.size() << " vocab entries" << endl;
+
+    Token_Table vocab_map2;
+    vector<Vocab_Entry> vocab2;
+
+    // Pass 2: we can use frequency counts to improve our tokenization
+    num_valid_repos
+        += vocab_pass(data, &vocab_map, &vocab, vocab_map2, vocab2, true);
 
     cerr << vocab2.size() << " vocab entries" << endl;
 
@@ -308,6 +654,12 @@ void analyze_keywords(Data & data)
     cerr << "num over threshold of " << min_keyword_freq
          << " = " << num_gt_two << endl;
     
+    // Filter and scale by IDF in parallel
+    run_in_parallel(data.repos.size(), REPOS_PER_CHUNK,
+                    Tf_Idf_Job(data, vocab2, min_keyword_freq,
+                               num_valid_repos),
+                    "tf-idf");
+
     size_t num_entries = 0;
     size_t empty_repos = 0;
     size_t non_empty_repos = 0;
@@ -318,66 +670,33 @@ void analyze_keywords(Data & data)
     vector<int> word_to_index(vocab2.size(), -1);
     vector<int> index_to_word;
 
-    // Scale by IDF and add new vector, then prepare data for the SVD
+    // Prepare data for the SVD.  The words are indexed in order of first
+    // occurrence, so this needs to be serial (but it's cheap).
     for (unsigned i = 0;  i < data.repos.size();  ++i) {
         if (data.repos[i].invalid()) continue;
-        Repo & repo = data.repos[i];
+        const Repo & repo = data.repos[i];
 
-        // Filter out keywords that didn't appear enough times
-        Cooccurrences filtered;
+        if (repo.keywords.empty()) {
+            empty_repos += 1;
+            continue;
+        }
 
-        double total_score = 0.0;
         for (Cooccurrences::const_iterator
                  it = repo.keywords.begin(),
                  end = repo.keywords.end();
              it != end;  ++it) {
-            float freq = vocab2[it->with].in_names;
-            if (freq < min_keyword_freq) continue;
-
-            filtered.add(it->with, it->score);
-            total_score += it->score;
             if (word_to_index[it->with] == -1) {
                 word_to_index[it->with] = index_to_word.size();
                 index_to_word.push_back(it->with);
             }
         }
 
-        // Normalize
-        double factor = 1.0 / total_score;
-        for (Cooccurrences::iterator
-                 it = repo.keywords.begin(),
-                 end = repo.keywords.end();
-             it != end;  ++it)
-            it->score *= factor;
-        
-        filtered.finish();
-        repo.keywords.swap(filtered);
-
-        if (repo.keywords.empty()) {
-            empty_repos += 1;
-            continue;
-        }
-
         num_entries += repo.keywords.size();
 
         repo_to_index[i] = index_to_repo.size();
         index_to_repo.push_back(i);
 
         non_empty_repos += 1;
-
-        // Calculate tf-idf
-        repo.keywords_idf.reserve(repo.keywords.size());
-        for (Cooccurrences::const_iterator
-                 it = repo.keywords.begin(),
-                 end = repo.keywords.end();
-             it != end;  ++it) {
-            float freq = vocab2[it->with].in_names;
-            float idf = log(1.0 * num_valid_repos / freq);
-            repo.keywords_idf.add(it->with, it->score * idf);
-        }
-        repo.keywords_idf.finish();
-        repo.keywords_idf_2norm
-            = sqrt(repo.keywords_idf.overlap(repo.keywords_idf).first);
     }
 
     cerr << "num_entries = " << num_entries << endl;
@@ -396,46 +715,23 @@ void analyze_keywords(Data & data)
     matrix.rowind = new long[matrix.vals];
     matrix.value  = new double[matrix.vals];
 
-    // Fill it in
+    // Column starts
     int entry_num = 0;
-    int last_index = -1;
-    for (unsigned i = 0;  i < data.repos.size();  ++i) {
-        if (data.repos[i].invalid()) continue;
-        Repo & repo = data.repos[i];
-        if (repo_to_index[i] == -1) continue;
-
-        int index = repo_to_index[i];
+    for (unsigned index = 0;  index < index_to_repo.size();  ++index) {
         matrix.pointr[index] = entry_num;
-
-        if (index < 0 || index >= index_to_repo.size()) {
-            cerr << "i = " << i << " index = " << index << endl;
-            throw Exception("bad index");
-        }
-        if (index != last_index + 1) {
-            throw Exception("index didn't increment");
-        }
-
-        last_index = index;
-
-        for (Cooccurrences::const_iterator
-                 it = repo.keywords.begin(),
-                 end = repo.keywords.end();
-             it != end;  ++it) {
-
-            matrix.rowind[entry_num] = word_to_index[it->with];
-
-            if (matrix.rowind[entry_num] == -1)
-                throw Exception("invalid entry num");
-            
-            matrix.value[entry_num] = 1.0;//it->score;
-            ++entry_num;
-        }
+        entry_num += data.repos[index_to_repo[index]].keywords.size();
     }
     matrix.pointr[index_to_repo.size()] = entry_num;
 
     if (entry_num != num_entries)
         throw Exception("wrong num_entries");
 
+    // Fill it in
+    run_in_parallel(index_to_repo.size(), REPOS_PER_CHUNK,
+                    Fill_Matrix_Job(data, index_to_repo, word_to_index,
+                                    matrix),
+                    "fill keyword matrix");
+
     // Now for the SVD
     cerr << "running keyword SVD" << endl;
 
@@ -444,7 +740,7 @@ void analyze_keywords(Data & data)
     int nvalues = 100;
 
     // Run the SVD
-    svdrec * result = svdLAS2A(&matrix, nvalues);
+    svdrec * result = cached_svdLAS2A(matrix, nvalues, "keywords");
 
     cerr << "SVD elapsed: " << timer.elapsed() << endl;
 
@@ -531,4 +827,7 @@ void analyze_keywords(Data & data)
     delete[] matrix.rowind;
     delete[] matrix.value;
     svdFreeSVDRec(result);
+
+    // Index the repos by keyword for the keywords candidate source
+    data.keyword_index.build(data);
 }
@@ -12,6 +12,7 @@
 #include <string>
 #include "data.h"
 #include "utils/hash_map.h"
+#include "tokenizer.h"
 
 struct Vocab_Entry {
     Vocab_Entry()
@@ -42,6 +43,29 @@ tokenize(const std::string & str,
          const std::hash_map<std::string, int> * vocab_map = 0,
          const std::vector<Vocab_Entry> * vocab = 0);
 
+/** One pass of tokenization over all valid repos, adding the tokens that
+    aren't stopwords to the vocabulary in table and vocab.  If prev_table
+    and prev_vocab are given, the frequency counts from the previous pass
+    are used to guide the tokenization.  If set_keywords is true, the
+    keywords of each repo are set to the IDs.  Returns the number of valid
+    repos.
+*/
+int vocab_pass(Data & data,
+               const Token_Table * prev_table,
+               const std::vector<Vocab_Entry> * prev_vocab,
+               Token_Table & table,
+               std::vector<Vocab_Entry> & vocab,
+               bool set_keywords);
+
+/** Stopwords, in a token table. */
+const Token_Table & get_stopword_table();
+
+/** Time the string based and token based tokenizers against each other
+    over the repo names and descriptions, checking that they produce an
+    identical vocabulary.  Throws if they don't.
+*/
+void benchmark_tokenizer(Data & data, int iterations = 5);
+
 void analyze_keywords(Data & data);
 
 
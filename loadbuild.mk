@@ -6,23 +6,43 @@ JML_BIN := jml/../build/$(ARCH)/bin
 
 loadbuild: results.txt fake-results.txt prob-results.txt
 
-SOURCES := $(shell grep 'sources=' config.txt | sed 's/.*sources=//;s/;//;s/,/ /g')
+SOURCES := $(shell grep '^ *sources=' config.txt | sed 's/.*sources=//;s/;//;s/,/ /g')
 
-FAMILY_FEATURES := repo_has_parent repo_num_children repo_num_ancestors repo_num_siblings repo_parent_watchers
+# The features that each source's classifier isn't trained on come from the
+# train_ignore keys in config.txt
+$(foreach source,$(SOURCES),$(eval IGNORE_FEATURES_$(source) := $(shell awk -v source=$(source) -f train_ignore.awk config.txt)))
 
-IGNORE_FEATURES_authored_by_me := $(FAMILY_FEATURES)
-IGNORE_FEATURES_by_watched_authors := $(FAMILY_FEATURES)
-IGNORE_FEATURES_same_name := $(FAMILY_FEATURES)
-IGNORE_FEATURES_in_cluster_user := $(FAMILY_FEATURES)
-IGNORE_FEATURES_in_cluster_repo := $(FAMILY_FEATURES)
-IGNORE_FEATURES_in_id_range := $(FAMILY_FEATURES)
-IGNORE_FEATURES_coocs := $(FAMILY_FEATURES)
-IGNORE_FEATURES_coocs2 := $(FAMILY_FEATURES)
-IGNORE_FEATURES_most_watched := $(FAMILY_FEATURES)
+# Set to 1 to train the classifiers inside the github program (github
+# --train) rather than dumping the examples and training them with
+# classifier_training_tool.  Off until it has been shown to be as accurate
+# (see train-parity below).
+TRAIN_IN_PROCESS ?= 0
 
-define process_source
+ifeq ($(TRAIN_IN_PROCESS),1)
 
-#$$(warning ignoring for $(1) $$(foreach feature,$$(IGNORE_FEATURES_$(1)), --ignore-var $$(feature)))
+PHASE1_FILES := $(foreach source,$(SOURCES),data/$(source).cls)
+
+# The classifiers of all of the sources are trained together, in one
+# process, so there is just a stamp file for the lot of them
+data/sources.trained: data/kmeans_users.txt data/kmeans_repos.txt \
+		ranker-classifier-training-config.txt config.txt
+	set -o pipefail && \
+	/usr/bin/time \
+	$(BIN)/github \
+		--train=sources \
+		--include-all-correct=1 \
+		--num-users=20000 \
+		--tranches=10 \
+		generator.load_data=false \
+		ranker.load_data=false \
+	2>&1 | tee $@.log
+	touch $@
+
+$(PHASE1_FILES): data/sources.trained
+
+else
+
+define process_source
 
 data/$(1)-fv.txt.gz: data/kmeans_users.txt data/kmeans_repos.txt
 	set -o pipefail && \
@@ -71,6 +91,8 @@ endef
 
 $(foreach source,$(SOURCES),$(eval $(call process_source,$(source))))
 
+endif
+
 results.txt:	prob-results.txt
 	set -o pipefail && \
 	cat $< \
@@ -100,8 +122,43 @@ fake-results.txt: data/ranker.cls
 	mv $@~ $@
 	tail -n20 $@
 
+ifeq ($(TRAIN_IN_PROCESS),1)
+
 data/ranker.cls: \
-		data/ranker-fv.txt.gz \
+		$(PHASE1_FILES) \
+		ranker-classifier-training-config.txt
+	set -o pipefail && \
+	/usr/bin/time \
+	$(BIN)/github \
+		--train=ranker \
+		--include-all-correct=0 \
+		--num-users=20000 \
+		ranker.load_data=false \
+		--tranches=01 \
+	2>&1 | tee $@.log
+
+# First stage of the ranking cascade, trained on the generator features
+# only.  Used when ranker.cascade_keep is set in config.txt.
+data/cascade.cls: \
+		$(PHASE1_FILES) \
+		ranker-classifier-training-config.txt
+	set -o pipefail && \
+	/usr/bin/time \
+	$(BIN)/github \
+		--train=cascade \
+		--include-all-correct=0 \
+		--num-users=20000 \
+		ranker.load_data=false \
+		ranker.cascade_classifier_file=$@ \
+		--tranches=01 \
+	2>&1 | tee $@.log
+
+else
+
+# Trains either the ranker (from data/ranker-fv.txt.gz) or the first stage
+# of the cascade (from data/cascade-fv.txt.gz)
+data/ranker.cls data/cascade.cls: data/%.cls: \
+		data/%-fv.txt.gz \
 		ranker-classifier-training-config.txt
 	set -o pipefail && \
 	/usr/bin/time \
@@ -138,6 +195,64 @@ data/ranker-fv.txt.gz: $(PHASE1_FILES)
 	2>&1 | tee $@.log
 	mv $@~ $@
 
+# First stage of the ranking cascade, trained on the generator features
+# only.  Used when ranker.cascade_keep is set in config.txt.
+data/cascade-fv.txt.gz: $(PHASE1_FILES)
+	set -o pipefail && \
+	/usr/bin/time \
+	$(BIN)/github \
+		--dump-merger-data \
+		--dump-cascade-data \
+		--include-all-correct=0 \
+		--num-users=20000 \
+		--output-file $@~ \
+		ranker.load_data=false \
+		--tranches=01 \
+	2>&1 | tee $@.log
+	mv $@~ $@
+
+endif
+
+
+# The fake test with the ranking cascade turned on as it is (commented out)
+# in config.txt, to see how much it costs in accuracy.  The recall of the
+# correct repo at each stage of the cascade is at the end of the log.
+CASCADE_KEEP ?= 200
+
+fake-cascade-results.txt: data/ranker.cls data/cascade.cls
+	set -o pipefail && \
+	/usr/bin/time \
+	$(BIN)/github \
+		--fake-test \
+		--random-seed 2 \
+		--output-file $@~ \
+		ranker.cascade_keep=$(CASCADE_KEEP) \
+		ranker.cascade_classifier_file=data/cascade.cls \
+	2>&1 | tee $@.log
+	mv $@~ $@
+	tail -n20 $@
+	grep -A4 '^cascade ' $@.log
+
+# Trains the classifiers both ways and runs the fake test with each, leaving
+# fake-results-tool.txt and fake-results-in-process.txt to compare.  The
+# classifiers in data/ end up being the in process ones.  The users in the
+# validation and testing splits aren't the same as the ones that
+# classifier_training_tool chooses, so the results should be close but
+# won't be identical.
+TRAINED_CLASSIFIERS := $(foreach source,$(SOURCES),data/$(source).cls) \
+	data/ranker.cls
+
+train-parity:
+	rm -f $(TRAINED_CLASSIFIERS) data/sources.trained fake-results.txt
+	$(MAKE) TRAIN_IN_PROCESS=0 fake-results.txt
+	mv fake-results.txt fake-results-tool.txt
+	rm -f $(TRAINED_CLASSIFIERS) data/sources.trained
+	$(MAKE) TRAIN_IN_PROCESS=1 fake-results.txt
+	mv fake-results.txt fake-results-in-process.txt
+	diff fake-results-tool.txt fake-results-in-process.txt || true
+
+.PHONY: train-parity
+
 
 # For both of these, we cause the same (user, repo) pairs to be removed from
 # the dataset as in the rest of the training, to avoid problems with the
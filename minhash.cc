@@ -0,0 +1,269 @@
+/* minhash.cc
+   Jeremy Barnes, 27 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the MinHash index.
+*/
+
+#include "minhash.h"
+#include "data.h"
+#include "parallel.h"
+#include "arch/exception.h"
+#include "arch/timers.h"
+#include "utils/string_functions.h"
+
+#include <algorithm>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace {
+
+/// Mixes the bits of a 64 bit integer (the finalizer from MurmurHash3)
+inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/// Hash of the rows of a signature that make up a band (FNV-1a)
+inline uint64_t band_key(const uint32_t * rows, int n)
+{
+    uint64_t result = 14695981039346656037ULL;
+    for (int i = 0;  i < n;  ++i) {
+        result ^= rows[i];
+        result *= 1099511628211ULL;
+    }
+    return result;
+}
+
+enum { REPOS_PER_CHUNK = 2000 };
+
+} // file scope
+
+
+/*****************************************************************************/
+/* MINHASH_INDEX                                                             */
+/*****************************************************************************/
+
+/** Calculates the signatures for a range of repos.  Hash function j maps
+    user u to mix64(u ^ seeds[j]); the signature for each hash is the
+    minimum over the watchers.
+*/
+struct MinHash_Index::Signature_Job {
+    Signature_Job(MinHash_Index & index, const Data & data,
+                  const vector<uint64_t> & seeds)
+        : index(index), data(data), seeds(seeds)
+    {
+    }
+
+    MinHash_Index & index;
+    const Data & data;
+    const vector<uint64_t> & seeds;
+
+    void operator () (int chunk, int first, int last) const
+    {
+        int nh = index.num_hashes_;
+
+        for (int i = first;  i < last;  ++i) {
+            uint32_t * sig = &index.signatures[i * nh];
+            std::fill(sig, sig + nh, (uint32_t)-1);
+
+            const Repo & repo = data.repos[i];
+            if (repo.invalid()) continue;
+
+            for (IdSet::const_iterator
+                     it = repo.watchers.begin(),
+                     end = repo.watchers.end();
+                 it != end;  ++it) {
+                for (int j = 0;  j < nh;  ++j) {
+                    uint32_t h = mix64(*it ^ seeds[j]) >> 32;
+                    sig[j] = std::min(sig[j], h);
+                }
+            }
+        }
+    }
+};
+
+/** Puts the repos into buckets for one band.  The buckets are numbered
+    locally to the band; build() renumbers them afterwards.
+*/
+struct MinHash_Index::Band_Job {
+    Band_Job(MinHash_Index & index, const vector<int> & valid,
+             vector<vector<int> > & band_members,
+             vector<vector<int> > & band_offsets)
+        : index(index), valid(valid), band_members(band_members),
+          band_offsets(band_offsets)
+    {
+    }
+
+    MinHash_Index & index;
+    const vector<int> & valid;
+    vector<vector<int> > & band_members;
+    vector<vector<int> > & band_offsets;
+
+    void operator () (int chunk, int first, int last) const
+    {
+        for (int band = first;  band < last;  ++band) {
+            vector<pair<uint64_t, int> > keys;
+            keys.reserve(valid.size());
+
+            for (unsigned i = 0;  i < valid.size();  ++i) {
+                int repo_id = valid[i];
+                const uint32_t * sig
+                    = &index.signatures[repo_id * index.num_hashes_]
+                    + band * index.rows_per_band;
+                keys.push_back(make_pair(band_key(sig, index.rows_per_band),
+                                         repo_id));
+            }
+
+            std::sort(keys.begin(), keys.end());
+
+            vector<int> & members = band_members[band];
+            vector<int> & offsets = band_offsets[band];
+            members.resize(keys.size());
+
+            int * bucket_ids = &index.bucket_ids[band * index.nrepos];
+
+            for (unsigned i = 0;  i < keys.size();  ++i) {
+                if (i == 0 || keys[i].first != keys[i - 1].first)
+                    offsets.push_back(i);
+                members[i] = keys[i].second;
+                bucket_ids[keys[i].second] = offsets.size() - 1;
+            }
+
+            offsets.push_back(keys.size());
+        }
+    }
+};
+
+MinHash_Index::
+MinHash_Index()
+{
+    clear();
+}
+
+void
+MinHash_Index::
+clear()
+{
+    nrepos = 0;
+    num_bands_ = 0;
+    rows_per_band = 0;
+    num_hashes_ = 0;
+    signatures.clear();
+    bucket_ids.clear();
+    bucket_offsets.clear();
+    bucket_offsets.push_back(0);
+    members.clear();
+    members.push_back(-1);  // sentinel so that &members[0] is valid
+    build_time_ = 0.0;
+}
+
+void
+MinHash_Index::
+build(const Data & data, int num_bands, int rows_per_band, int seed)
+{
+    if (num_bands <= 0 || rows_per_band <= 0)
+        throw Exception("MinHash_Index::build(): need a positive number of "
+                        "bands and rows");
+
+    Timer timer;
+
+    clear();
+
+    nrepos = data.repos.size();
+    num_bands_ = num_bands;
+    this->rows_per_band = rows_per_band;
+    num_hashes_ = num_bands * rows_per_band;
+
+    vector<uint64_t> seeds(num_hashes_);
+    for (int j = 0;  j < num_hashes_;  ++j)
+        seeds[j] = mix64((uint64_t)seed * num_hashes_ + j + 1);
+
+    signatures.resize((size_t)nrepos * num_hashes_);
+
+    run_in_parallel(nrepos, REPOS_PER_CHUNK,
+                    Signature_Job(*this, data, seeds),
+                    "minhash signatures");
+
+    // Only repos with watchers go into the buckets
+    vector<int> valid;
+    for (int i = 0;  i < nrepos;  ++i) {
+        const Repo & repo = data.repos[i];
+        if (repo.invalid() || repo.watchers.empty()) continue;
+        valid.push_back(i);
+    }
+
+    bucket_ids.clear();
+    bucket_ids.resize((size_t)nrepos * num_bands, -1);
+
+    vector<vector<int> > band_members(num_bands), band_offsets(num_bands);
+
+    run_in_parallel(num_bands, 1,
+                    Band_Job(*this, valid, band_members, band_offsets),
+                    "minhash bands");
+
+    // Concatenate the bands, renumbering the buckets so that they're unique
+    members.clear();
+    members.reserve(valid.size() * num_bands + 1);
+    bucket_offsets.clear();
+
+    int bucket_base = 0;
+    for (int band = 0;  band < num_bands;  ++band) {
+        const vector<int> & offsets = band_offsets[band];
+
+        for (unsigned i = 0;  i + 1 < offsets.size();  ++i)
+            bucket_offsets.push_back(members.size() + offsets[i]);
+
+        for (unsigned i = 0;  i < valid.size();  ++i)
+            bucket_ids[band * nrepos + valid[i]] += bucket_base;
+
+        members.insert(members.end(),
+                       band_members[band].begin(), band_members[band].end());
+        bucket_base += offsets.size() - 1;
+    }
+
+    bucket_offsets.push_back(members.size());
+    members.push_back(-1);  // sentinel
+
+    build_time_ = timer.elapsed_wall();
+
+    cerr << format("minhash: %d repos, %d hashes in %d bands, %d buckets; "
+                   "%.2fs, %.1fMB",
+                   (int)valid.size(), num_hashes_, num_bands_, bucket_base,
+                   build_time_, memusage() / 1048576.0)
+         << endl;
+}
+
+float
+MinHash_Index::
+jaccard(int repo1, int repo2) const
+{
+    if (!has_signature(repo1) || !has_signature(repo2))
+        return 0.0;
+
+    const uint32_t * sig1 = &signatures[repo1 * num_hashes_];
+    const uint32_t * sig2 = &signatures[repo2 * num_hashes_];
+
+    int nequal = 0;
+    for (int j = 0;  j < num_hashes_;  ++j)
+        nequal += (sig1[j] == sig2[j]);
+
+    return (float)nequal / num_hashes_;
+}
+
+size_t
+MinHash_Index::
+memusage() const
+{
+    return sizeof(uint32_t) * signatures.capacity()
+        + sizeof(int) * (bucket_ids.capacity() + bucket_offsets.capacity()
+                         + members.capacity());
+}
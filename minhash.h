@@ -0,0 +1,106 @@
+/* minhash.h                                                       -*- C++ -*-
+   Jeremy Barnes, 27 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   MinHash signatures of the repo watcher sets, with a banded LSH index to
+   find repos with similar sets of watchers.
+*/
+
+#ifndef __github__minhash_h__
+#define __github__minhash_h__
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+struct Data;
+
+
+/*****************************************************************************/
+/* MINHASH_INDEX                                                             */
+/*****************************************************************************/
+
+/** A MinHash signature of num_bands * rows_per_band hashes over the watchers
+    of each repo, from which the Jaccard similarity of two repos' watcher
+    sets can be estimated.  The signatures are split into bands; repos whose
+    signatures agree on all of a band's rows land in the same bucket for
+    that band, so the repos with a high Jaccard similarity to a given repo
+    can be found by looking through its buckets.
+
+    Unlike the cooccurrences, no repos or users are skipped for having too
+    many watchers or watches.
+*/
+
+struct MinHash_Index {
+    MinHash_Index();
+
+    void build(const Data & data, int num_bands = 16, int rows_per_band = 4,
+               int seed = 0);
+
+    void clear();
+
+    bool empty() const { return nrepos == 0; }
+
+    int num_bands() const { return num_bands_; }
+    int num_hashes() const { return num_hashes_; }
+
+    /// Does the repo have a signature (ie, any watchers)?
+    bool has_signature(int repo_id) const
+    {
+        return bucket_ids[repo_id] != -1;
+    }
+
+    /// The repos that share the given repo's bucket for the band, including
+    /// the repo itself.  Empty if the repo has no signature.
+    const int * bucket_begin(int band, int repo_id) const
+    {
+        int bucket = bucket_ids[band * nrepos + repo_id];
+        if (bucket == -1) return &members[0];
+        return &members[0] + bucket_offsets[bucket];
+    }
+
+    const int * bucket_end(int band, int repo_id) const
+    {
+        int bucket = bucket_ids[band * nrepos + repo_id];
+        if (bucket == -1) return &members[0];
+        return &members[0] + bucket_offsets[bucket + 1];
+    }
+
+    size_t bucket_size(int band, int repo_id) const
+    {
+        return bucket_end(band, repo_id) - bucket_begin(band, repo_id);
+    }
+
+    /// Estimated Jaccard similarity of the watcher sets of the two repos
+    float jaccard(int repo1, int repo2) const;
+
+    /// Memory used by the index, in bytes
+    size_t memusage() const;
+
+    /// How long the last build took, in seconds
+    double build_time() const { return build_time_; }
+
+private:
+    int nrepos;
+    int num_bands_;
+    int rows_per_band;
+    int num_hashes_;
+
+    /// nrepos * num_hashes_ of them
+    std::vector<uint32_t> signatures;
+
+    /// Global bucket number for each band and repo, or -1 if the repo has
+    /// no signature.  Indexed by band * nrepos + repo_id.
+    std::vector<int> bucket_ids;
+
+    /// Repos in each bucket, with the buckets contiguous
+    std::vector<int> bucket_offsets;
+    std::vector<int> members;
+
+    double build_time_;
+
+    struct Signature_Job;
+    struct Band_Job;
+};
+
+#endif /* __github__minhash_h__ */
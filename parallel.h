@@ -0,0 +1,63 @@
+/* parallel.h                                                      -*- C++ -*-
+   Jeremy Barnes, 23 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Helper to run loops in parallel on the worker task.
+*/
+
+#ifndef __github__parallel_h__
+#define __github__parallel_h__
+
+#include "boosting/worker_task.h"
+#include "utils/guard.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <string>
+
+
+/** Run the given function over the range [0, n), split into chunks of at
+    most chunk_size, on the worker task's threads.  The function is called
+    as fn(chunk, begin, end) where chunk is the index of the chunk; the
+    chunks are numbered in order so that results can be merged
+    deterministically afterwards.  Returns once all chunks have finished.
+*/
+template<class Fn>
+void run_in_parallel(int n, int chunk_size, const Fn & fn,
+                     const std::string & name = "parallel job")
+{
+    using namespace ML;
+
+    if (n <= 0) return;
+
+    static Worker_Task & worker = Worker_Task::instance(num_threads() - 1);
+
+    int group;
+    {
+        int parent = -1;  // no parent group
+        group = worker.get_group(NO_JOB, name + " task", parent);
+
+        // Make sure the group gets unlocked once we've populated
+        // everything
+        Call_Guard guard(boost::bind(&Worker_Task::unlock_group,
+                                     boost::ref(worker),
+                                     group));
+
+        for (int begin = 0, chunk = 0;  begin < n;
+             begin += chunk_size, ++chunk) {
+            int end = std::min(n, begin + chunk_size);
+            worker.add(boost::bind<void>(fn, chunk, begin, end), name, group);
+        }
+    }
+
+    // Add this thread to the thread pool until we're ready
+    worker.run_until_finished(group);
+}
+
+/// Number of chunks that run_in_parallel will split n into
+inline int num_chunks(int n, int chunk_size)
+{
+    if (n <= 0) return 0;
+    return (n + chunk_size - 1) / chunk_size;
+}
+
+#endif /* __github__parallel_h__ */
@@ -0,0 +1,74 @@
+/* quantized.cc
+   Jeremy Barnes, 20 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of quantized vectors.
+*/
+
+#include "quantized.h"
+#include "arch/exception.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace ML;
+
+
+/*****************************************************************************/
+/* QUANTIZED_VEC                                                             */
+/*****************************************************************************/
+
+namespace {
+
+int dotprod_int8(const int8_t * x, const int8_t * y, size_t n)
+{
+#ifdef __SSE2__
+    // n is always a multiple of 16 as the vectors are padded
+    __m128i total = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t i = 0;  i < n;  i += 16) {
+        __m128i xv = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i yv = _mm_loadu_si128((const __m128i *)(y + i));
+
+        // Sign extend to 16 bits
+        __m128i xs = _mm_cmpgt_epi8(zero, xv);
+        __m128i ys = _mm_cmpgt_epi8(zero, yv);
+
+        __m128i xlo = _mm_unpacklo_epi8(xv, xs);
+        __m128i xhi = _mm_unpackhi_epi8(xv, xs);
+        __m128i ylo = _mm_unpacklo_epi8(yv, ys);
+        __m128i yhi = _mm_unpackhi_epi8(yv, ys);
+
+        // Multiply and add adjacent pairs into 32 bits
+        total = _mm_add_epi32(total, _mm_madd_epi16(xlo, ylo));
+        total = _mm_add_epi32(total, _mm_madd_epi16(xhi, yhi));
+    }
+
+    int32_t parts[4];
+    _mm_storeu_si128((__m128i *)parts, total);
+    return parts[0] + parts[1] + parts[2] + parts[3];
+#else
+    int result = 0;
+    for (size_t i = 0;  i < n;  ++i)
+        result += x[i] * y[i];
+    return result;
+#endif
+}
+
+} // file scope
+
+float
+Quantized_Vec::
+dotprod(const Quantized_Vec & other) const
+{
+    if (vals.size() != other.vals.size())
+        throw Exception("Quantized_Vec::dotprod(): sizes don't match");
+
+    if (vals.empty()) return 0.0;
+
+    return scale * other.scale
+        * dotprod_int8(&vals[0], &other.vals[0], vals.size());
+}
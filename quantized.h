@@ -0,0 +1,215 @@
+/* quantized.h                                                     -*- C++ -*-
+   Jeremy Barnes, 20 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Quantized (int8) storage of embedding vectors, so that the many dot
+   products between them can be done with integer SIMD arithmetic.
+*/
+
+#ifndef __github__quantized_h__
+#define __github__quantized_h__
+
+#include "stats/distribution.h"
+#include "math/xdiv.h"
+#include "arch/exception.h"
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+
+/*****************************************************************************/
+/* QUANTIZED_VEC                                                             */
+/*****************************************************************************/
+
+// A vector stored as int8 values with a single scale factor for the whole
+// vector.  The dot product of two of them comes with a bound on the error
+// against the dot product of the float vectors they were made from, which
+// is what allows us to use them to prune without changing results.
+struct Quantized_Vec {
+    Quantized_Vec()
+        : n(0), scale(0.0), l1norm(0.0)
+    {
+    }
+
+    template<class Float>
+    explicit Quantized_Vec(const ML::distribution<Float> & vec)
+    {
+        quantize(vec);
+    }
+
+    template<class Float>
+    void quantize(const ML::distribution<Float> & vec)
+    {
+        n = vec.size();
+
+        // Padded to a multiple of 16 so that the SIMD loop has no tail
+        vals.clear();
+        vals.resize((n + 15) & ~15, 0);
+
+        double maxabs = 0.0, l1 = 0.0;
+        for (unsigned i = 0;  i < n;  ++i) {
+            maxabs = std::max<double>(maxabs, fabs(vec[i]));
+            l1 += fabs(vec[i]);
+        }
+
+        l1norm = l1;
+        scale = maxabs / 127.0;
+
+        if (scale == 0.0) return;
+
+        for (unsigned i = 0;  i < n;  ++i) {
+            int q = (int)rint(vec[i] / scale);
+            vals[i] = std::max(-127, std::min(127, q));
+        }
+    }
+
+    bool empty() const { return n == 0; }
+
+    size_t size() const { return n; }
+
+    /// Approximate float version of the vector
+    void dequantize(ML::distribution<float> & result) const
+    {
+        result.resize(n);
+        for (unsigned i = 0;  i < n;  ++i)
+            result[i] = vals[i] * scale;
+    }
+
+    /// Approximate dot product with the other vector
+    float dotprod(const Quantized_Vec & other) const;
+
+    /// Upper bound on |float dot product - dotprod()|
+    float error_bound(const Quantized_Vec & other) const
+    {
+        // With a = sa * qa + ea where |ea_i| <= sa / 2:
+        // |a.b - sa*sb*qa.qb| <= |a|_1 sb / 2 + |b|_1 sa / 2 + n sa sb / 4
+        // We add a little bit for the rounding of the float dot product
+        // that we're comparing against.
+        float err = 0.5f * (l1norm * other.scale + other.l1norm * scale)
+                  + 0.25f * n * scale * other.scale;
+        return err * 1.001f + 1e-6f;
+    }
+
+    size_t memusage() const
+    {
+        return sizeof(*this) + vals.capacity();
+    }
+
+    std::vector<int8_t> vals;
+    unsigned n;
+    float scale;
+    float l1norm;
+};
+
+
+/*****************************************************************************/
+/* EMBEDDING                                                                 */
+/*****************************************************************************/
+
+/** Read-only view of an embedding: its float vector or, if that was
+    released after quantization (see Data::quantize_embeddings()), its
+    quantized one.  Nothing is copied, so the elements of a quantized one
+    are worked out as they are read.
+*/
+struct Embedding {
+    Embedding(const ML::distribution<float> & vec, const Quantized_Vec & q)
+        : vec(vec), q(q), quantized(vec.empty() && !q.empty())
+    {
+    }
+
+    size_t size() const { return quantized ? q.size() : vec.size(); }
+
+    float operator [] (unsigned i) const
+    {
+        return quantized ? q.vals[i] * q.scale : vec[i];
+    }
+
+    /// Dot product; with int8 arithmetic if both are quantized
+    float dotprod(const Embedding & other) const
+    {
+        if (!quantized && !other.quantized) return vec.dotprod(other.vec);
+        if (quantized && other.quantized) return q.dotprod(other.q);
+        check_size(other.size());
+        float result = 0.0;
+        for (unsigned i = 0;  i < size();  ++i)
+            result += (*this)[i] * other[i];
+        return result;
+    }
+
+    /// Dot product with a float vector
+    float dotprod(const ML::distribution<float> & other) const
+    {
+        if (!quantized) return vec.dotprod(other);
+        check_size(other.size());
+        float result = 0.0;
+        for (unsigned i = 0;  i < size();  ++i)
+            result += (*this)[i] * other[i];
+        return result;
+    }
+
+    void check_size(size_t other_size) const
+    {
+        if (size() != other_size)
+            throw ML::Exception("embedding: sizes don't match");
+    }
+
+    const ML::distribution<float> & vec;
+    const Quantized_Vec & q;
+    bool quantized;  ///< Only the quantized version is available
+};
+
+/// Dot product of the two vectors.  If rescore is false and both quantized
+/// vectors are available, the quantized dot product is returned instead of
+/// the exact one.
+inline float
+dotprod(const ML::distribution<float> & v1, const Quantized_Vec & q1,
+        const ML::distribution<float> & v2, const Quantized_Vec & q2,
+        bool rescore = true)
+{
+    if (!rescore && !q1.empty() && q1.size() == q2.size())
+        return q1.dotprod(q2);
+    return v1.dotprod(v2);
+}
+
+/// Update the best dot product and best normalized dot product of the two
+/// vectors.  If both quantized vectors are available, the quantized dot
+/// product and its error bound are used to skip the float dot product when
+/// it can't possibly improve either maximum.  If rescore is false, the
+/// quantized dot product is used directly without ever touching the
+/// floats.
+inline void
+update_best_dp(const ML::distribution<float> & v1, float norm1,
+               const Quantized_Vec & q1,
+               const ML::distribution<float> & v2, float norm2,
+               const Quantized_Vec & q2,
+               float & best_dp, float & best_dp_norm,
+               bool rescore = true)
+{
+    float norm = norm1 * norm2;
+
+    if (!q1.empty() && q1.size() == q2.size()) {
+        float approx = q1.dotprod(q2);
+
+        if (!rescore) {
+            best_dp = std::max(best_dp, approx);
+            best_dp_norm = std::max(best_dp_norm, ML::xdiv(approx, norm));
+            return;
+        }
+
+        float upper = approx + q1.error_bound(q2);
+
+        bool can_improve_dp = upper > best_dp;
+        bool can_improve_norm
+            = (norm == 0.0 ? 0.0f > best_dp_norm
+               : (norm > 0.0 ? upper / norm > best_dp_norm : true));
+
+        if (!can_improve_dp && !can_improve_norm) return;
+    }
+
+    float dp = v1.dotprod(v2);
+    float dp_norm = ML::xdiv(dp, norm);
+    best_dp = std::max(best_dp, dp);
+    best_dp_norm = std::max(best_dp_norm, dp_norm);
+}
+
+#endif /* __github__quantized_h__ */
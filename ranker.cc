@@ -16,6 +16,9 @@
 #include "utils/hash_map.h"
 
 #include "boosting/dense_features.h"
+#include "parallel.h"
+#include "candidate_cache.h"
+#include "ranking_memo.h"
 #include <limits>
 
 using namespace std;
@@ -23,12 +26,24 @@ using namespace ML;
 
 namespace {
 const float NaN = numeric_limits<float>::quiet_NaN();
+
+/// Version of what the generator produces, in the fingerprint of the
+/// candidate cache.  Bump it when the candidates or what's stored with
+/// them change in a way that the configuration doesn't show.
+/// 2: the generator features are no longer stored with the candidates.
+const uint32_t CANDIDATES_VERSION = 2;
 };
 
 /*****************************************************************************/
 /* CANDIDATE_GENERATOR                                                       */
 /*****************************************************************************/
 
+Candidate_Generator::
+Candidate_Generator()
+    : num_features(0), parallel_sources(false)
+{
+}
+
 Candidate_Generator::
 ~Candidate_Generator()
 {
@@ -44,6 +59,8 @@ configure(const ML::Configuration & config_,
     string sources;
     config.require(sources, "sources");
 
+    config.find(parallel_sources, "parallel_sources");
+
     vector<string> source_names = split(sources, ',');
 
     this->sources.clear();
@@ -70,6 +87,8 @@ init()
             = sources[i]->specific_feature_space();
         source_num_features[i] = source_fs.variable_count();
     }
+
+    num_features = feature_space()->variable_count();
 }
 
 boost::shared_ptr<const ML::Dense_Feature_Space>
@@ -108,19 +127,92 @@ feature_space() const
 
 void
 Candidate_Generator::
-features(std::vector<ML::distribution<float> > & results,
+features(Feature_Matrix & results,
          int user_id,
          const Ranked & candidates,
          const Candidate_Data & candidate_data,
          const Data & data) const
 {
-    results.resize(candidates.size());
-    // We just copy them over...
+    results.check(candidates.size(), num_features, "generator features");
+
+    if (candidate_data.source_sizes.size() != sources.size())
+        throw Exception(format("generator features: candidate data has %zd "
+                               "sources not %zd",
+                               candidate_data.source_sizes.size(),
+                               sources.size()));
+
+    // The common features are normally already there from generating the
+    // candidates, but not if they came out of the cache.  Adding them again
+    // is cheap.
+    Common_Block & common
+        = (candidate_data.common ? *candidate_data.common : common_block());
+    common.add(user_id, candidates, data);
 
     for (unsigned i = 0;  i < candidates.size();  ++i) {
-        const Ranked_Entry & candidate = candidates[i];
-        distribution<float> & result = results[i];
-        result = candidate.features;
+        int repo_id = candidates[i].repo_id;
+
+        Feature_Writer features(results, i, 0);
+
+        std::map<int, std::map<int, Ranked_Entry> >::const_iterator found
+            = candidate_data.info.find(repo_id);
+        if (found == candidate_data.info.end())
+            throw Exception(format("generator features: no source has "
+                                   "repo %d", repo_id));
+        const map<int, Ranked_Entry> & info_entry = found->second;
+
+        const float * common_row = common.row(repo_id);
+        features.append(common_row, common_row + Common_Block::NUM_FEATURES);
+
+        int total_rank = 0, min_rank = 10000, max_rank = 0, num_in = 0;
+        float total_score = 0.0, min_score = 2.0, max_score = -1.0;
+
+        // Go for each source
+        for (unsigned j = 0;  j < sources.size();  ++j) {
+            int source_size = candidate_data.source_sizes[j];
+
+            map<int, Ranked_Entry>::const_iterator jt = info_entry.find(j);
+            if (jt == info_entry.end()) {
+                features.fill(source_num_features[j], NaN);
+                features.push_back(1000);   // rank
+                features.push_back(2.0);    // percentile
+                features.push_back(-1.0);   // score
+                total_rank += source_size + 1;
+                continue;
+            }
+
+            const Ranked_Entry & source_entry = jt->second;
+            ++num_in;
+            total_rank += source_entry.min_rank;
+            min_rank = std::min(min_rank, source_entry.min_rank);
+            max_rank = std::max(max_rank, source_entry.min_rank);
+            total_score += source_entry.score;
+            min_score = std::min(min_score, source_entry.score);
+            max_score = std::max(max_score, source_entry.score);
+
+            if (source_entry.source_features.size()
+                != source_num_features[j])
+                throw Exception("num features for " + sources[j]->name()
+                                + " doesn't match");
+
+            features.append(source_entry.source_features.begin(),
+                            source_entry.source_features.end());
+            features.push_back(source_entry.min_rank);
+            features.push_back(1.0f * source_entry.min_rank / source_size);
+            features.push_back(source_entry.score);
+        }
+
+        features.push_back(total_rank);
+        features.push_back(min_rank);
+        features.push_back(max_rank);
+        features.push_back(num_in);
+        features.push_back(1.0 * total_rank / num_in);
+        features.push_back(total_score);
+        features.push_back(min_score);
+        features.push_back(max_score);
+        features.push_back(1.0 * total_score / num_in);
+
+        if (features.column() != num_features)
+            throw Exception("generator features: wrong number of features");
     }
 }
 
@@ -212,26 +304,144 @@ insert_choices(IdSet & possible_choices, const Set & s,
     st.max_size = std::max(st.max_size, filtered_choices.size());
 }
 
+namespace {
+
+/** Runs one phase of the candidate sources in [first, last) for one user:
+    either getting their candidate sets, or scoring them once the common
+    features of all of them are in the block.  Each source writes only its
+    own entry of source_ranked, so the results are the same as running
+    them in order.  The per-thread statistics variables are set to those of
+    the calling thread while the job runs, as this thread may be in the
+    middle of something else.
+*/
+struct Gen_Candidates_Job {
+    Gen_Candidates_Job(const Candidate_Generator & generator,
+                       vector<Ranked> & source_ranked,
+                       const Data & data, int user_id,
+                       const Common_Block * common)
+        : generator(generator), source_ranked(source_ranked), data(data),
+          user_id(user_id), common(common), correct_repo(::correct_repo),
+          watching(::watching)
+    {
+    }
+
+    const Candidate_Generator & generator;
+    vector<Ranked> & source_ranked;
+    const Data & data;
+    int user_id;
+    const Common_Block * common;  ///< Scoring if set; candidate sets if not
+    int correct_repo;
+    const IdSet * watching;
+
+    void operator () (int chunk, int first, int last) const
+    {
+        int old_correct_repo = ::correct_repo;
+        const IdSet * old_watching = ::watching;
+
+        ::correct_repo = correct_repo;
+        ::watching = watching;
+
+        for (int i = first;  i < last;  ++i) {
+            const Candidate_Source & source = *generator.sources[i];
+            if (common)
+                source.score_candidates(source_ranked[i], user_id, data,
+                                        *common);
+            else {
+                Candidate_Data candidate_data;
+                candidate_data.scratch = &generator.scratch(data);
+                source.candidate_set(source_ranked[i], user_id, data,
+                                     candidate_data);
+            }
+        }
+
+        ::correct_repo = old_correct_repo;
+        ::watching = old_watching;
+    }
+};
+
+} // file scope
+
+Candidate_Scratch &
+Candidate_Generator::
+scratch(const Data & data) const
+{
+    if (!scratch_.get())
+        scratch_.reset(new Candidate_Scratch());
+    if (!scratch_->initialized(data))
+        scratch_->init(data);
+    return *scratch_;
+}
+
+Common_Block &
+Candidate_Generator::
+common_block() const
+{
+    if (!common_.get())
+        common_.reset(new Common_Block());
+    return *common_;
+}
+
+uint64_t
+Candidate_Generator::
+fingerprint() const
+{
+    uint64_t result = ::fingerprint("generator");
+    result = ::fingerprint(&CANDIDATES_VERSION, sizeof(CANDIDATES_VERSION),
+                           result);
+
+    for (unsigned i = 0;  i < sources.size();  ++i)
+        result = sources[i]->fingerprint(result);
+
+    return result;
+}
+
 void
 Candidate_Generator::
 candidates(Ranked & candidates, Candidate_Data & candidate_data,
            const Data & data, int user_id) const
 {
+    if (!candidate_data.scratch)
+        candidate_data.scratch = &scratch(data);
+    if (!candidate_data.common)
+        candidate_data.common = &common_block();
+
     IdSet possible_choices;
 
     vector<Ranked> source_ranked(sources.size());
-    vector<int> num_kept(sources.size());
 
     candidates.clear();
+    candidate_data.source_sizes.resize(sources.size());
+
+    // Run the sources, one per job if we're doing them in parallel.  The
+    // common features of everything that they found are calculated between
+    // getting the candidates and scoring them, so that the scoring jobs
+    // only read them.
+    if (parallel_sources) {
+        run_in_parallel(sources.size(), 1,
+                        Gen_Candidates_Job(*this, source_ranked, data,
+                                           user_id, 0),
+                        "gen candidate sets");
+
+        Common_Block & common = candidate_data.get_common();
+        for (unsigned i = 0;  i < sources.size();  ++i)
+            common.add(user_id, source_ranked[i], data);
+
+        run_in_parallel(sources.size(), 1,
+                        Gen_Candidates_Job(*this, source_ranked, data,
+                                           user_id, &common),
+                        "score candidates");
+    }
+    else {
+        for (unsigned i = 0;  i < sources.size();  ++i)
+            sources[i]->gen_candidates(source_ranked[i], user_id, data,
+                                       candidate_data);
+    }
 
     // First, generate a set of those that we want to keep
     for (unsigned i = 0;  i < sources.size();  ++i) {
         Ranked & source_entries = source_ranked[i];
 
-        sources[i]->gen_candidates(source_entries, user_id, data,
-                                   candidate_data);
-
-        num_kept[i] = source_entries.size();
+        candidate_data.source_sizes[i] = source_entries.size();
 
         IdSet to_keep;
         for (unsigned j = 0;  j < source_entries.size();  ++j)
@@ -271,65 +481,19 @@ candidates(Ranked & candidates, Candidate_Data & candidate_data,
         }
     }
 
-    // Finally, go through and calculate the features
+    // Score each by the total of its sources' scores.  The features are
+    // calculated from the info by features(), so that the ones that come
+    // out of the cache get them too.
     for (unsigned i = 0;  i < candidates.size();  ++i) {
         Ranked_Entry & entry = candidates[i];
-        int repo_id = entry.repo_id;
-
-        distribution<float> & features = entry.features;
-
-        map<int, Ranked_Entry> & info_entry
-            = candidate_data.info[repo_id];
-
-        features.clear();
-        Candidate_Source::common_features(features, user_id, repo_id,
-                                          data, candidate_data);
-
-        int total_rank = 0, min_rank = 10000, max_rank = 0, num_in = 0;
-        float total_score = 0.0, min_score = 2.0, max_score = -1.0;
-
-        // Go for each source
-        for (unsigned j = 0;  j < sources.size();  ++j) {
-            if (!info_entry.count(j)) {
-                features.insert(features.end(), source_num_features[j], NaN);
-                features.push_back(1000);   // rank
-                features.push_back(2.0);    // percentile
-                features.push_back(-1.0);   // score
-                total_rank += num_kept[j] + 1;
-                continue;
-            }
-
-            Ranked_Entry & source_entry = info_entry[j];
-            ++num_in;
-            total_rank += source_entry.min_rank;
-            min_rank = std::min(min_rank, source_entry.min_rank);
-            max_rank = std::max(max_rank, source_entry.min_rank);
-            total_score += source_entry.score;
-            min_score = std::min(min_score, source_entry.score);
-            max_score = std::max(max_score, source_entry.score);
-
-            if (source_entry.features.size() != source_num_features[j])
-                throw Exception("num features for " + sources[j]->name()
-                                + " doesn't match");
+        const map<int, Ranked_Entry> & info_entry
+            = candidate_data.info[entry.repo_id];
 
-            features.insert(features.end(),
-                            source_entry.features.begin(),
-                            source_entry.features.end());
-            features.push_back(source_entry.min_rank);
-            features.push_back(1.0f * source_entry.min_rank
-                               / source_ranked[j].size());
-            features.push_back(source_entry.score);
-        }
-
-        features.push_back(total_rank);
-        features.push_back(min_rank);
-        features.push_back(max_rank);
-        features.push_back(num_in);
-        features.push_back(1.0 * total_rank / num_in);
-        features.push_back(total_score);
-        features.push_back(min_score);
-        features.push_back(max_score);
-        features.push_back(1.0 * total_score / num_in);
+        float total_score = 0.0;
+        for (map<int, Ranked_Entry>::const_iterator
+                 it = info_entry.begin(), end = info_entry.end();
+             it != end;  ++it)
+            total_score += it->second.score;
 
         entry.score = total_score;
     }
@@ -348,6 +512,84 @@ candidates(Ranked & candidates, Candidate_Data & candidate_data,
 /* RANKER                                                                    */
 /*****************************************************************************/
 
+namespace {
+
+/// The groups of features in the feature registry
+enum Feature_Group {
+    FG_COLLABORATES_ON,
+    FG_USER_KEYWORDS,
+    FG_USER_AVERAGE_KEYWORDS,
+    FG_SINGULAR_DP,
+    FG_USER_REPO_COOC,
+    FG_USER_REPO_COOC2,
+    FG_REPO_USER_COOC,
+    FG_REPO_USER_COOC2,
+    FG_KEYWORD_OVERLAP,
+    FG_KEYWORD_IDF_OVERLAP,
+    FG_AUTHOR_USER_DP,
+    FG_MAX_DP_WITH_WATCHED,
+    FG_MAX_KEYWORD_DP_WITH_WATCHED,
+    FG_KEYWORD_DOTPROD,
+    FG_FOLLOWING_AUTHOR,
+    NUM_FEATURE_GROUPS
+};
+
+struct Feature_Group_Info {
+    const char * name;
+    float cost;      ///< Rough cost per candidate
+    int depends;     ///< Group that this one needs, or -1
+    const char * features[7];
+};
+
+/** The ranker features that are expensive enough to be worth skipping when
+    the classifier doesn't use them, in the order of Feature_Group.  The
+    rest are cheap or gathered from the repo columns, and always done.
+*/
+const Feature_Group_Info feature_groups[NUM_FEATURE_GROUPS] = {
+    { "collaborates_on", 1, -1,
+      { "user_num_collaborates_on_api", "collaborates_on_api" } },
+    { "user_keywords", 1, -1,
+      { "user_nkeywords", "user_keyword_factor", "user_keyword_idf_factor" } },
+    { "user_average_keywords", 1, -1,
+      { "user_keyword_max", "user_keyword_max_norm" } },
+    { "singular_dp", 2, -1,
+      { "user_repo_singular_dp", "user_repo_singular_unscaled_dp",
+        "user_repo_singular_unscaled_dp_max",
+        "user_repo_singular_unscaled_dp_max_norm",
+        "user_repo_centroid_repo_cosine" } },
+    { "user_repo_cooc", 4, -1,
+      { "user_repo_cooccurrences", "user_repo_cooccurrences_avg",
+        "user_repo_cooccurrences_max" } },
+    { "user_repo_cooc2", 4, -1,
+      { "user_repo_cooccurrences2", "user_repo_cooccurrences_avg2",
+        "user_repo_cooccurrences_max2" } },
+    { "repo_user_cooc", 4, -1,
+      { "repo_user_cooccurrences", "repo_user_cooccurrences_avg",
+        "repo_user_cooccurrences_max" } },
+    { "repo_user_cooc2", 4, -1,
+      { "repo_user_cooccurrences2", "repo_user_cooccurrences_avg2",
+        "repo_user_cooccurrences_max2" } },
+    { "keyword_overlap", 4, FG_USER_KEYWORDS,
+      { "keyword_overlap_score", "keyword_overlap_score_norm" } },
+    { "keyword_idf_overlap", 4, FG_USER_KEYWORDS,
+      { "keyword_overlap_idf", "keyword_overlap_idf_norm",
+        "keyword_overlap_count" } },
+    { "author_user_dp", 20, -1,
+      { "author_user_dp", "author_user_dp_norm" } },
+    { "max_dp_with_watched", 10, -1,
+      { "max_dp_with_watched", "max_dp_with_watched_norm" } },
+    { "max_keyword_dp_with_watched", 10, -1,
+      { "max_keyword_dp_with_watched", "max_keyword_dp_with_watched_norm" } },
+    { "keyword_dotprod", 2, FG_USER_AVERAGE_KEYWORDS,
+      { "user_repo_keyword_dotprod", "user_repo_keyword_dotprod_max",
+        "user_repo_keyword_dotprod_avg", "user_repo_keyword_cosine",
+        "user_repo_keyword_cosine_max", "user_repo_keyword_cosine_avg" } },
+    { "following_author", 3, -1,
+      { "user_following_author", "author_following_user" } }
+};
+
+} // file scope
+
 Ranker::~Ranker()
 {
 }
@@ -364,6 +606,53 @@ Ranker::
 init(boost::shared_ptr<Candidate_Generator> generator)
 {
     this->generator = generator;
+
+    registry = Feature_Registry();
+
+    for (unsigned i = 0;  i < NUM_FEATURE_GROUPS;  ++i) {
+        const Feature_Group_Info & info = feature_groups[i];
+
+        vector<string> features;
+        for (unsigned j = 0;  j < 7 && info.features[j];  ++j)
+            features.push_back(info.features[j]);
+
+        vector<int> depends;
+        if (info.depends != -1) depends.push_back(info.depends);
+
+        registry.add_group(info.name, features, info.cost, depends);
+    }
+
+    // Make sure that the names match up with the feature space
+    boost::shared_ptr<const Dense_Feature_Space> fs = Ranker::feature_space();
+    vector<Feature> all_features = fs->features();
+    set<string> names;
+    for (unsigned i = 0;  i < all_features.size();  ++i)
+        names.insert(fs->print(all_features[i]));
+
+    vector<string> registered = registry.all_features();
+    for (unsigned i = 0;  i < registered.size();  ++i)
+        if (!names.count(registered[i]))
+            throw Exception("feature registry: feature " + registered[i]
+                            + " isn't in the ranker feature space");
+
+    first_feature = generator->num_features;
+    num_features = fs->variable_count();
+}
+
+Feature_Matrix &
+Ranker::
+matrix() const
+{
+    if (!matrix_.get())
+        matrix_.reset(new Feature_Matrix());
+    return *matrix_;
+}
+
+void
+Ranker::
+calculate_all_features()
+{
+    registry.set_all_live();
 }
 
 boost::shared_ptr<const ML::Dense_Feature_Space>
@@ -539,18 +828,113 @@ struct Group_Info {
 
 void
 Ranker::
-features(std::vector<ML::distribution<float> > & results,
+features(Feature_Matrix & results,
          int user_id,
          const Ranked & candidates,
          const Candidate_Data & candidate_data,
          const Data & data) const
 {
-    generator->features(results, user_id, candidates, candidate_data, data);
+    results.check(candidates.size(), num_features, "ranker features");
+
+    Ranking_Memo * memo = candidate_data.memo;
+    uint64_t key = (memo ? Ranking_Memo::key(candidates) : 0);
+    if (memo && memo->get_features(this, candidates, key, results,
+                                   0, num_features))
+        return;
+
+    Ranked heuristic;
+    this->heuristic(heuristic, user_id, candidates, candidate_data, data);
+
+    calc_features(results, user_id, candidates, heuristic, heuristic.size(),
+                  candidate_data, data);
+
+    if (memo)
+        memo->put_features(this, candidates, key, results, 0, num_features);
+}
+
+void
+Ranker::
+subset_features(Feature_Matrix & results,
+                int user_id,
+                const Ranked & candidates,
+                const Ranked & all_heuristic,
+                const Candidate_Data & candidate_data,
+                const Data & data) const
+{
+    results.check(candidates.size(), num_features, "ranker features");
+
+    Ranking_Memo * memo = candidate_data.memo;
+    uint64_t key = (memo ? Ranking_Memo::key(candidates) : 0);
+    if (memo && memo->get_features(this, candidates, key, results,
+                                   0, num_features))
+        return;
+
+    // Our part of the heuristic order, with the index of each in candidates
+    hash_map<int, int> repo_to_index;
+    for (unsigned i = 0;  i < candidates.size();  ++i)
+        repo_to_index[candidates[i].repo_id] = i;
+
+    Ranked heuristic;
+    heuristic.reserve(candidates.size());
+    for (unsigned i = 0;  i < all_heuristic.size();  ++i) {
+        hash_map<int, int>::const_iterator found
+            = repo_to_index.find(all_heuristic[i].repo_id);
+        if (found == repo_to_index.end()) continue;
+        heuristic.push_back(all_heuristic[i]);
+        heuristic.back().index = found->second;
+    }
+
+    if (heuristic.size() != candidates.size())
+        throw Exception(format("ranker features: %zd of the %zd candidates "
+                               "were in the heuristic order",
+                               heuristic.size(), candidates.size()));
+
+    calc_features(results, user_id, candidates, heuristic,
+                  all_heuristic.size(), candidate_data, data);
+
+    if (memo)
+        memo->put_features(this, candidates, key, results, 0, num_features);
+}
+
+void
+Ranker::
+heuristic(Ranked & heuristic,
+          int user_id,
+          const Ranked & candidates,
+          const Candidate_Data & candidate_data,
+          const Data & data) const
+{
+    // Rank by the heuristic score.  The features aren't needed for that, so
+    // they're not copied; everything else is as in candidates.
+    Ranking_Memo * memo = candidate_data.memo;
+    uint64_t key = (memo ? Ranking_Memo::key(candidates) : 0);
+    if (memo && memo->get_heuristic(heuristic, candidates, key)) return;
+
+    heuristic.resize(candidates.size());
+    for (unsigned i = 0;  i < candidates.size();  ++i) {
+        heuristic[i].index = candidates[i].index;
+        heuristic[i].repo_id = candidates[i].repo_id;
+        heuristic[i].score = candidates[i].score;
+    }
 
-    Ranked heuristic = candidates;
     Ranker::rank(heuristic, user_id, candidate_data, data);
     heuristic.sort();
 
+    if (memo) memo->put_heuristic(heuristic, candidates, key);
+}
+
+void
+Ranker::
+calc_features(Feature_Matrix & results,
+              int user_id,
+              const Ranked & candidates,
+              const Ranked & heuristic,
+              size_t nranked,
+              const Candidate_Data & candidate_data,
+              const Data & data) const
+{
+    generator->features(results, user_id, candidates, candidate_data, data);
+
     const User & user = data.users[user_id];
 
     // Get cooccurrences for all repos
@@ -558,24 +942,39 @@ features(std::vector<ML::distribution<float> > & results,
 
     distribution<float> user_average_keywords(data.keyword_singular_values.size());
 
+    bool do_user_keywords = registry.live(FG_USER_KEYWORDS);
+    bool do_user_average_keywords = registry.live(FG_USER_AVERAGE_KEYWORDS);
+
     for (IdSet::const_iterator
              it = user.watching.begin(), end = user.watching.end();
          it != end;  ++it) {
         const Repo & repo = data.repos[*it];
-        user_keywords.add(repo.keywords);
-        user_keywords_idf.add(repo.keywords_idf);
-        user_average_keywords
-            += xdiv(repo.keyword_vec,
-                    repo.keyword_vec_2norm * user.watching.size());
+        if (do_user_keywords) {
+            user_keywords.add(repo.keywords);
+            user_keywords_idf.add(repo.keywords_idf);
+        }
+        if (!do_user_average_keywords) continue;
+
+        float norm = repo.keyword_vec_2norm * user.watching.size();
+        if (repo.keyword_vec.empty() && !repo.keyword_q.empty()) {
+            Embedding keyword_vec(repo.keyword_vec, repo.keyword_q);
+            keyword_vec.check_size(user_average_keywords.size());
+            for (unsigned i = 0;  i < keyword_vec.size();  ++i)
+                user_average_keywords[i] += xdiv(keyword_vec[i], norm);
+        }
+        else user_average_keywords += xdiv(repo.keyword_vec, norm);
     }
 
     user_keywords.finish();
     user_keywords_idf.finish();
 
-    float user_keywords_2norm
-        = sqrt(user_keywords.overlap(user_keywords).first);
-    float user_keywords_idf_2norm
-        = sqrt(user_keywords_idf.overlap(user_keywords_idf).first);
+    float user_keywords_2norm = NaN, user_keywords_idf_2norm = NaN;
+    if (do_user_keywords) {
+        user_keywords_2norm
+            = sqrt(user_keywords.overlap(user_keywords).first);
+        user_keywords_idf_2norm
+            = sqrt(user_keywords_idf.overlap(user_keywords_idf).first);
+    }
 
     // What else can we know about the user?
     // - do they watch popular or non-popular repos?
@@ -594,20 +993,24 @@ features(std::vector<ML::distribution<float> > & results,
     hash_map<int, Group_Info> author_groups;
     hash_map<std::string, Group_Info> name_groups;
 
+    // Only the name needs the repo itself
+    const Repo_Hot_Fields & hot = data.repo_hot;
+
     for (IdSet::const_iterator
              it = user.watching.begin(),
              end = user.watching.end();
          it != end;  ++it) {
-        const Repo & repo = data.repos[*it];
-        min_popularity = std::min(min_popularity, repo.popularity_rank);
-        max_popularity = std::max(max_popularity, repo.popularity_rank);
-        total_popularity += repo.popularity_rank;
+        int popularity_rank = hot.popularity_rank(*it);
+        min_popularity = std::min(min_popularity, popularity_rank);
+        max_popularity = std::max(max_popularity, popularity_rank);
+        total_popularity += popularity_rank;
 
-        min_watchers = std::min<int>(min_watchers, repo.watchers.size());
-        max_watchers = std::min<int>(max_watchers, repo.watchers.size());
-        total_watchers += repo.watchers.size();
+        int num_watchers = hot.num_watchers(*it);
+        min_watchers = std::min<int>(min_watchers, num_watchers);
+        max_watchers = std::min<int>(max_watchers, num_watchers);
+        total_watchers += num_watchers;
 
-        int author = repo.author;
+        int author = hot.author(*it);
         if (author != -1) {
             Group_Info & info = author_groups[author];
             if (info.group_size == -1)
@@ -616,9 +1019,10 @@ features(std::vector<ML::distribution<float> > & results,
         }
 
         {
-            Group_Info & info = name_groups[repo.name];
+            const std::string & name = data.repos[*it].name;
+            Group_Info & info = name_groups[name];
             if (info.group_size == -1)
-                info.group_size = data.name_to_repos(repo.name).size();
+                info.group_size = data.name_to_repos(name).size();
             ++info.watcher_count;
         }
     }
@@ -696,32 +1100,76 @@ features(std::vector<ML::distribution<float> > & results,
 
     IdSet user_collaborates_on;
 
+    bool do_collaborates_on = registry.live(FG_COLLABORATES_ON);
+
+    if (do_collaborates_on) {
+        for (IdSet::const_iterator
+                 it = user.inferred_authors.begin(),
+                 end = user.inferred_authors.end();
+             it != end;  ++it) {
+            user_collaborates_on.insert(data.authors[*it].repositories.begin(),
+                                        data.authors[*it].repositories.end());
+        }
+
+        user_features.push_back(user_collaborates_on.size());
+    }
+    else user_features.push_back(NaN);
+
+    user_features.push_back(user.followers.size());
+    user_features.push_back(user.following.size());
+
+    // Other things that depend only upon the user, used below
+    static const boost::gregorian::date epoch(2007, 1, 1);
+
+    long user_date = 10000;
+    int author_num_followers = -1;
+    int author_num_following = -1;
     for (IdSet::const_iterator
              it = user.inferred_authors.begin(),
              end = user.inferred_authors.end();
          it != end;  ++it) {
-        user_collaborates_on.insert(data.authors[*it].repositories.begin(),
-                                    data.authors[*it].repositories.end());
+        if (data.authors[*it].num_followers != -1) {
+            author_num_followers = max(author_num_followers,
+                                       data.authors[*it].num_followers);
+            author_num_following = max(author_num_following,
+                                       data.authors[*it].num_following);
+            user_date = min(user_date,
+                            (data.authors[*it].date - epoch).days());
+        }
     }
 
-    user_features.push_back(user_collaborates_on.size());
-
-    user_features.push_back(user.followers.size());
-    user_features.push_back(user.following.size());
-
+    float user_keywords_max
+        = (do_user_average_keywords ? user_average_keywords.max() : NaN);
+
+    bool do_singular_dp = registry.live(FG_SINGULAR_DP);
+    bool do_user_repo_cooc = registry.live(FG_USER_REPO_COOC);
+    bool do_user_repo_cooc2 = registry.live(FG_USER_REPO_COOC2);
+    bool do_repo_user_cooc = registry.live(FG_REPO_USER_COOC);
+    bool do_repo_user_cooc2 = registry.live(FG_REPO_USER_COOC2);
+    bool do_keyword_overlap = registry.live(FG_KEYWORD_OVERLAP);
+    bool do_keyword_idf_overlap = registry.live(FG_KEYWORD_IDF_OVERLAP);
+    bool do_author_user_dp = registry.live(FG_AUTHOR_USER_DP);
+    bool do_max_dp = registry.live(FG_MAX_DP_WITH_WATCHED);
+    bool do_max_keyword_dp = registry.live(FG_MAX_KEYWORD_DP_WITH_WATCHED);
+    bool do_keyword_dotprod = registry.live(FG_KEYWORD_DOTPROD);
+    bool do_following_author = registry.live(FG_FOLLOWING_AUTHOR);
+
+    // Features that only depend upon the repo were precomputed
+    const Repo_Features & columns = data.repo_features;
+    columns.check(data);
 
     // Features that depend upon the repo as well
     for (unsigned i = 0;  i < heuristic.size();  ++i) {
-        distribution<float> & result = results[heuristic[i].index];
+        Feature_Writer result(results, heuristic[i].index, first_feature);
 
-        result.insert(result.end(), user_features.begin(), user_features.end());
+        result.append(user_features.begin(), user_features.end());
 
         int repo_id = heuristic[i].repo_id;
         const Repo & repo = data.repos[repo_id];
 
         result.push_back(heuristic[i].score);
         result.push_back((heuristic[i].min_rank + heuristic[i].max_rank) * 0.5);
-        result.push_back(result.back() / heuristic.size());
+        result.push_back(result.back() / nranked);
 
         float dp = repo.language_vec.dotprod(user.language_vec);
 
@@ -737,46 +1185,55 @@ features(std::vector<ML::distribution<float> > & results,
             cerr << "u2 = " << user.language_2norm << endl;
         }
 
-        dp = (repo.singular_vec * data.singular_values)
-             .dotprod(user.singular_vec);
-
-        result.push_back(dp);
+        if (do_singular_dp) {
+            Embedding repo_vec(repo.singular_vec, repo.singular_q);
+            Embedding user_vec(user.singular_vec, user.singular_q);
 
-        distribution<float> dpvec = (repo.singular_vec * user.singular_vec);
+            if (repo_vec.quantized || user_vec.quantized) {
+                // Straight from the int8 values, without a float copy
+                repo_vec.check_size(user_vec.size());
 
-        result.push_back(dpvec.total());
-        result.push_back(dpvec.max());
-        result.push_back(dpvec.max() / dpvec.total());
+                float weighted = 0.0, max = -INFINITY;
+                for (unsigned i = 0;  i < repo_vec.size();  ++i) {
+                    float prod = repo_vec[i] * user_vec[i];
+                    weighted += prod * data.singular_values[i];
+                    max = std::max(max, prod);
+                }
 
-        dp = -1.0;
-        if (user.repo_centroid.size() && repo.singular_vec.size())
-            dp = repo.singular_vec.dotprod(user.repo_centroid)
-                / repo.singular_2norm;
+                float total = repo_vec.dotprod(user_vec);
 
-        result.push_back(dp);
+                result.push_back(weighted);
+                result.push_back(total);
+                result.push_back(max);
+                result.push_back(max / total);
+            }
+            else {
+                dp = (repo.singular_vec * data.singular_values)
+                    .dotprod(user.singular_vec);
 
-        bool valid_author
-            = repo.author >= 0 && repo.author < data.authors.size();
+                result.push_back(dp);
 
-        string author_name
-            = (valid_author ? data.authors[repo.author].name : string());
+                distribution<float> dpvec
+                    = (repo.singular_vec * user.singular_vec);
 
-        const Data::Name_Info & name_info = data.name_to_repos(repo.name);
+                result.push_back(dpvec.total());
+                result.push_back(dpvec.max());
+                result.push_back(dpvec.max() / dpvec.total());
+            }
 
-        result.push_back(author_name.find(repo.name) != string::npos);
-        result.push_back(repo.name.find(author_name) != string::npos);
+            dp = -1.0;
+            if (user.repo_centroid.size() && repo_vec.size())
+                dp = repo_vec.dotprod(user.repo_centroid)
+                    / repo.singular_2norm;
 
-        if (valid_author) {
-            result.push_back(data.authors[repo.author].repositories.size());
-            result.push_back(data.authors[repo.author].num_watchers);
-        }
-        else {
-            result.push_back(-1);
-            result.push_back(-1);
+            result.push_back(dp);
         }
+        else result.fill(5, NaN);
+
+        for (int c = Repo_Features::REPO_NAME_CONTAINS_USER;
+             c <= Repo_Features::NUM_WATCHERS_OF_REPOS_WITH_SAME_NAME;  ++c)
+            result.push_back(columns.get(Repo_Features::Column(c), repo_id));
 
-        result.push_back(name_info.size());
-        result.push_back(name_info.num_watchers);
         result.push_back(user.inferred_authors.count(repo.author));
         result.push_back(user.inferred_authors.size());
 
@@ -784,79 +1241,57 @@ features(std::vector<ML::distribution<float> > & results,
         double total_cooc = 0.0, max_cooc = 0.0;
         double total_cooc2 = 0.0, max_cooc2 = 0.0;
 
-        boost::tie(total_cooc, max_cooc)
-            = repo.cooc.overlap(user.watching);
-        boost::tie(total_cooc2, max_cooc2)
-            = repo.cooc2.overlap(user.watching);
-        
-        result.push_back(total_cooc);
-        result.push_back(total_cooc / user.watching.size());
-        result.push_back(max_cooc);
+        if (do_user_repo_cooc) {
+            boost::tie(total_cooc, max_cooc)
+                = repo.cooc.overlap(user.watching);
+            result.push_back(total_cooc);
+            result.push_back(total_cooc / user.watching.size());
+            result.push_back(max_cooc);
+        }
+        else result.fill(3, NaN);
         result.push_back(user.cooc.size());
 
-        result.push_back(total_cooc2);
-        result.push_back(total_cooc2 / user.watching.size());
-        result.push_back(max_cooc2);
+        if (do_user_repo_cooc2) {
+            boost::tie(total_cooc2, max_cooc2)
+                = repo.cooc2.overlap(user.watching);
+            result.push_back(total_cooc2);
+            result.push_back(total_cooc2 / user.watching.size());
+            result.push_back(max_cooc2);
+        }
+        else result.fill(3, NaN);
         result.push_back(user.cooc2.size());
 
         // Find num cooc with each repo already watched
         total_cooc = max_cooc = total_cooc2 = max_cooc2 = 0.0;
-        boost::tie(total_cooc, max_cooc)
-            = user.cooc.overlap(repo.watchers);
-        boost::tie(total_cooc2, max_cooc2)
-            = user.cooc2.overlap(repo.watchers);
-
-        result.push_back(total_cooc);
-        result.push_back(total_cooc / repo.watchers.size());
-        result.push_back(max_cooc);
-        result.push_back(repo.cooc.size());
-
-        result.push_back(total_cooc2);
-        result.push_back(total_cooc2 / repo.watchers.size());
-        result.push_back(max_cooc2);
-        result.push_back(repo.cooc2.size());
-
-        
-        static const boost::gregorian::date epoch(2007, 1, 1);
-
-        long repo_date = (repo.date - epoch).days();
-
-        result.push_back(repo_date);
 
-        long author_date = 0;
-
-        if (repo.author != -1 && data.authors[repo.author].num_followers != -1){
-            author_date = (data.authors[repo.author].date - epoch).days();
+        if (do_repo_user_cooc) {
+            boost::tie(total_cooc, max_cooc)
+                = user.cooc.overlap(repo.watchers);
+            result.push_back(total_cooc);
+            result.push_back(total_cooc / repo.watchers.size());
+            result.push_back(max_cooc);
         }
-
-        result.push_back(author_date);
-        result.push_back(repo_date - author_date);
-
-        if (repo.author != -1) {
-            result.push_back(data.authors[repo.author].num_followers);
-            result.push_back(data.authors[repo.author].num_following);
-        }
-        else {
-            result.push_back(-1);
-            result.push_back(-1);
+        else result.fill(3, NaN);
+        result.push_back(columns.get(Repo_Features::REPO_NUM_COOCCURRENCES,
+                                     repo_id));
+
+        if (do_repo_user_cooc2) {
+            boost::tie(total_cooc2, max_cooc2)
+                = user.cooc2.overlap(repo.watchers);
+            result.push_back(total_cooc2);
+            result.push_back(total_cooc2 / repo.watchers.size());
+            result.push_back(max_cooc2);
         }
+        else result.fill(3, NaN);
+        result.push_back(columns.get(Repo_Features::REPO_NUM_COOCCURRENCES2,
+                                     repo_id));
 
-        long user_date = 10000;
-        int author_num_followers = -1;
-        int author_num_following = -1;
-        for (IdSet::const_iterator
-                 it = user.inferred_authors.begin(),
-                 end = user.inferred_authors.end();
-             it != end;  ++it) {
-            if (data.authors[*it].num_followers != -1) {
-                author_num_followers = max(author_num_followers,
-                                           data.authors[*it].num_followers);
-                author_num_following = max(author_num_following,
-                                           data.authors[*it].num_following);
-                user_date = min(user_date,
-                                (data.authors[*it].date - epoch).days());
-            }
-        }
+        long repo_date = columns.repo_date(repo_id);
+        long author_date = columns.author_date(repo_id);
+
+        for (int c = Repo_Features::REPO_DATE;
+             c <= Repo_Features::AUTHOR_NUM_FOLLOWING;  ++c)
+            result.push_back(columns.get(Repo_Features::Column(c), repo_id));
 
         result.push_back(user_date);
         result.push_back(repo_date - user_date);
@@ -864,21 +1299,25 @@ features(std::vector<ML::distribution<float> > & results,
         result.push_back(author_num_followers);
         result.push_back(author_num_following);
 
+        int min_repo = data.user_hot.min_repo(user_id);
+        int max_repo = data.user_hot.max_repo(user_id);
+
         bool repo_in_id_range
-            = repo_id >= user.min_repo && repo_id <= user.max_repo;
+            = repo_id >= min_repo && repo_id <= max_repo;
         bool user_in_id_range
-            = user_id >= repo.min_user && user_id <= repo.max_user;
+            = user_id >= data.repo_hot.min_user(repo_id)
+            && user_id <= data.repo_hot.max_user(repo_id);
         bool suspicious_user
             = user.watching.empty()
-            || *user.watching.begin() > user.max_repo;
+            || *user.watching.begin() > max_repo;
         bool suspicious_repo
-            = repo.watchers.empty()
-            || *repo.watchers.begin() > repo.max_user;
+            = columns.get(Repo_Features::ID_RANGE_SUSPICIOUS_REPO, repo_id);
 
         result.push_back(repo_in_id_range);
         result.push_back(user_in_id_range);
-        result.push_back(repo.max_user - repo.min_user);
-        result.push_back(user.max_repo - user.min_repo);
+        result.push_back(columns.get(Repo_Features::REPO_ID_RANGE_SIZE,
+                                     repo_id));
+        result.push_back(max_repo - min_repo);
         result.push_back(suspicious_user);
         result.push_back(suspicious_repo);
 
@@ -897,44 +1336,59 @@ features(std::vector<ML::distribution<float> > & results,
 
         {
             float score, count;
-            boost::tie(score, count)
-                = repo.keywords.overlap(user_keywords);
 
-            result.push_back(score);
+            if (do_keyword_overlap) {
+                boost::tie(score, count)
+                    = repo.keywords.overlap(user_keywords);
 
-            float norm = repo.keywords_2norm * user_keywords_2norm;
-            if (norm == 0.0)
-                result.push_back(-2.0);
-            else result.push_back(score / norm);
+                result.push_back(score);
 
+                float norm = repo.keywords_2norm * user_keywords_2norm;
+                if (norm == 0.0)
+                    result.push_back(-2.0);
+                else result.push_back(score / norm);
+            }
+            else result.fill(2, NaN);
 
-            boost::tie(score, count)
-                = repo.keywords_idf.overlap(user_keywords_idf);
+            if (do_keyword_idf_overlap) {
+                boost::tie(score, count)
+                    = repo.keywords_idf.overlap(user_keywords_idf);
 
-            result.push_back(score);
+                result.push_back(score);
 
-            norm = repo.keywords_idf_2norm * user_keywords_idf_2norm;
-            if (norm == 0.0)
-                result.push_back(-2.0);
-            else result.push_back(score / norm);
+                float norm = repo.keywords_idf_2norm * user_keywords_idf_2norm;
+                if (norm == 0.0)
+                    result.push_back(-2.0);
+                else result.push_back(score / norm);
             
-            result.push_back(count);
-
-            result.push_back(user_keywords.size());
-            result.push_back(user_keywords_2norm);
-            result.push_back(user_keywords_idf_2norm);
-            result.push_back(repo.keywords.size());
-            result.push_back(repo.keywords_2norm);
-            result.push_back(repo.keywords_idf_2norm);
+                result.push_back(count);
+            }
+            else result.fill(3, NaN);
+
+            if (do_user_keywords) {
+                result.push_back(user_keywords.size());
+                result.push_back(user_keywords_2norm);
+                result.push_back(user_keywords_idf_2norm);
+            }
+            else result.fill(3, NaN);
+            result.push_back(columns.get(Repo_Features::REPO_NKEYWORDS,
+                                         repo_id));
+            result.push_back(columns.get(Repo_Features::REPO_KEYWORD_FACTOR,
+                                         repo_id));
+            result.push_back(columns.get
+                             (Repo_Features::REPO_KEYWORD_IDF_FACTOR,
+                              repo_id));
         }
 
-        result.push_back(user_average_keywords.max());
-        result.push_back(repo.keyword_vec.max());
-        result.push_back(user_average_keywords.max());
-        result.push_back(repo.keyword_vec.max() / repo.keyword_vec_2norm);
+        result.push_back(user_keywords_max);
+        result.push_back(columns.get(Repo_Features::REPO_KEYWORD_MAX,
+                                     repo_id));
+        result.push_back(user_keywords_max);
+        result.push_back(columns.get(Repo_Features::REPO_KEYWORD_MAX_NORM,
+                                     repo_id));
 
         int author = repo.author;
-        if (author != -1) {
+        if (author != -1 && do_author_user_dp) {
             float best_dp = -2.0, best_dp_norm = -2.0;
 
             for (IdSet::const_iterator
@@ -946,11 +1400,12 @@ features(std::vector<ML::distribution<float> > & results,
 
                 const User & user2 = data.users[*jt];
 
-                float dp = user.singular_vec.dotprod(user2.singular_vec);
-                float dp_norm
-                    = xdiv(dp, user.singular_2norm * user2.singular_2norm);
-                best_dp = max(best_dp, dp);
-                best_dp_norm = max(best_dp_norm, dp_norm);
+                update_best_dp(user.singular_vec, user.singular_2norm,
+                               user.singular_q,
+                               user2.singular_vec, user2.singular_2norm,
+                               user2.singular_q,
+                               best_dp, best_dp_norm,
+                               data.quantized_rescore);
             }
 
             result.push_back(best_dp);
@@ -963,25 +1418,32 @@ features(std::vector<ML::distribution<float> > & results,
         
         float best_dp = -2.0, best_dp_norm = -2.0;
         float best_dp_kw = -2.0, best_dp_kw_norm = -2.0;
+
+        if (!do_max_dp) best_dp = best_dp_norm = NaN;
+        if (!do_max_keyword_dp) best_dp_kw = best_dp_kw_norm = NaN;
         
         for (IdSet::const_iterator
                  jt = user.watching.begin(),
                  jend = user.watching.end();
-             jt != jend;  ++jt) {
+             (do_max_dp || do_max_keyword_dp) && jt != jend;  ++jt) {
             if (*jt == -1) continue;
             const Repo & repo2 = data.repos[*jt];
 
-            float dp = repo.singular_vec.dotprod(repo2.singular_vec);
-            float dp_norm
-                = xdiv(dp, repo.singular_2norm * repo2.singular_2norm);
-            best_dp = max(best_dp, dp);
-            best_dp_norm = max(best_dp_norm, dp_norm);
-
-            dp = repo.keyword_vec.dotprod(repo2.keyword_vec);
-            dp_norm
-                = xdiv(dp, repo.keyword_vec_2norm * repo2.keyword_vec_2norm);
-            best_dp_kw = max(best_dp_kw, dp);
-            best_dp_kw_norm = max(best_dp_kw_norm, dp_norm);
+            if (do_max_dp)
+                update_best_dp(repo.singular_vec, repo.singular_2norm,
+                               repo.singular_q,
+                               repo2.singular_vec, repo2.singular_2norm,
+                               repo2.singular_q,
+                               best_dp, best_dp_norm,
+                               data.quantized_rescore);
+
+            if (do_max_keyword_dp)
+                update_best_dp(repo.keyword_vec, repo.keyword_vec_2norm,
+                               repo.keyword_q,
+                               repo2.keyword_vec, repo2.keyword_vec_2norm,
+                               repo2.keyword_q,
+                               best_dp_kw, best_dp_kw_norm,
+                               data.quantized_rescore);
         }
 
         result.push_back(best_dp);
@@ -991,38 +1453,65 @@ features(std::vector<ML::distribution<float> > & results,
         result.push_back(best_dp_kw_norm);
 
         // Keyword features
-        dpvec = (repo.keyword_vec * user_average_keywords);
-        result.push_back(dpvec.total());
-        result.push_back(dpvec.max());
-        result.push_back(dpvec.max() / dpvec.total());
+        if (do_keyword_dotprod
+            && repo.keyword_vec.empty() && !repo.keyword_q.empty()) {
+            // Straight from the int8 values, without a float copy
+            Embedding keyword_vec(repo.keyword_vec, repo.keyword_q);
+            keyword_vec.check_size(user_average_keywords.size());
+
+            float total = 0.0, max = -INFINITY;
+            float total_norm = 0.0, max_norm = -INFINITY;
+            for (unsigned i = 0;  i < keyword_vec.size();  ++i) {
+                float prod = keyword_vec[i] * user_average_keywords[i];
+                total += prod;
+                max = std::max(max, prod);
+                float prod_norm = xdiv(prod, repo.keyword_vec_2norm);
+                total_norm += prod_norm;
+                max_norm = std::max(max_norm, prod_norm);
+            }
 
-        dpvec = xdiv(dpvec, repo.keyword_vec_2norm);
+            result.push_back(total);
+            result.push_back(max);
+            result.push_back(max / total);
 
-        result.push_back(dpvec.total());
-        result.push_back(dpvec.max());
-        result.push_back(dpvec.max() / dpvec.total());
+            result.push_back(total_norm);
+            result.push_back(max_norm);
+            result.push_back(max_norm / total_norm);
+        }
+        else if (do_keyword_dotprod) {
+            distribution<float> dpvec
+                = (repo.keyword_vec * user_average_keywords);
+            result.push_back(dpvec.total());
+            result.push_back(dpvec.max());
+            result.push_back(dpvec.max() / dpvec.total());
+
+            dpvec = xdiv(dpvec, repo.keyword_vec_2norm);
+
+            result.push_back(dpvec.total());
+            result.push_back(dpvec.max());
+            result.push_back(dpvec.max() / dpvec.total());
+        }
+        else result.fill(6, NaN);
         
         // num_watches_api
-        result.push_back(repo.num_watches_api);
-        result.push_back(repo.num_watches_api - (int)repo.watchers.size());
-        result.push_back(repo.num_forks_api);
-        result.push_back(repo.num_forks_api - (int)repo.children.size());
+        for (int c = Repo_Features::NUM_WATCHES_API;
+             c <= Repo_Features::NUM_MISSING_FORKS;  ++c)
+            result.push_back(columns.get(Repo_Features::Column(c), repo_id));
 
         // collaborates_on
-        result.push_back(user_collaborates_on.count(repo_id));
+        if (do_collaborates_on)
+            result.push_back(user_collaborates_on.count(repo_id));
+        else result.push_back(NaN);
 
         // user following author
         // Are any of the possible users for the author being followed by the
         // user?
         bool user_following_author = false;
         bool author_following_user = false;
-        int author_num_possible_users = 0;
 
-        if (repo.author != -1) {
+        if (repo.author != -1 && do_following_author) {
             const Author & author = data.authors[repo.author];
 
-            author_num_possible_users = author.possible_users.size();
-
             for (IdSet::const_iterator
                      it = author.possible_users.begin(),
                      end = author.possible_users.end();
@@ -1032,9 +1521,17 @@ features(std::vector<ML::distribution<float> > & results,
             }
         }
 
-        result.push_back(user_following_author);
-        result.push_back(author_following_user);
-        result.push_back(author_num_possible_users);
+        if (do_following_author) {
+            result.push_back(user_following_author);
+            result.push_back(author_following_user);
+        }
+        else result.fill(2, NaN);
+        result.push_back(columns.get(Repo_Features::AUTHOR_NUM_POSSIBLE_USERS,
+                                     repo_id));
+
+        if (result.column() != num_features)
+            throw Exception(format("ranker features: wrote %zd of %zd",
+                                   result.column(), num_features));
     }
 }
 
@@ -1101,6 +1598,12 @@ configure(const ML::Configuration & config_,
 
     load_data = true;
     config.get(load_data, "load_data");
+
+    cascade_keep = 0;
+    config.find(cascade_keep, "cascade_keep");
+
+    cascade_classifier_file = "";
+    config.find(cascade_classifier_file, "cascade_classifier_file");
 }
 
 void
@@ -1124,9 +1627,25 @@ init(boost::shared_ptr<Candidate_Generator> generator)
     vector<ML::Feature> classifier_features
         = classifier.all_features();
 
-    // TODO: check for missing features
-    //for (unsigned i = 0;  i < classifier_features.size();  ++i) {
-    //}
+    // Only calculate the expensive features that the classifier uses
+    used_features.clear();
+    for (unsigned i = 0;  i < classifier_features.size();  ++i)
+        used_features.push_back(classifier_fs->print(classifier_features[i]));
+
+    registry.set_live(used_features);
+
+    cerr << "ranker " << classifier_file << ": " << registry.summary()
+         << endl;
+
+    if (cascade_classifier_file != "") {
+        cascade_classifier.load(cascade_classifier_file);
+        cascade_classifier_fs
+            = cascade_classifier.feature_space<ML::Dense_Feature_Space>();
+        cascade_opt_info = cascade_classifier.impl
+            ->optimize(cascade_classifier_fs->features());
+        cascade_fs = generator->feature_space();
+        cascade_classifier_fs->create_mapping(*cascade_fs, cascade_mapping);
+    }
 }
 
 boost::shared_ptr<const ML::Dense_Feature_Space>
@@ -1138,7 +1657,7 @@ feature_space() const
 
 void
 Classifier_Ranker::
-features(std::vector<ML::distribution<float> > & features,
+features(Feature_Matrix & features,
          int user_id,
          const Ranked & candidates,
          const Candidate_Data & candidate_data,
@@ -1153,22 +1672,130 @@ classify(Ranked & candidates,
          int user_id,
          const Candidate_Data & candidate_data,
          const Data & data,
-         const std::vector<ML::distribution<float> > & features) const
+         const Feature_Matrix & features) const
 {
+    features.check(candidates.size(), ranker_fs->variable_count(),
+                   "classifier ranker");
+
+    Ranking_Memo * memo = candidate_data.memo;
+    uint64_t key = (memo ? Ranking_Memo::key(candidates) : 0);
+    if (memo && memo->get_scores(this, candidates, key)) return;
+
+    float encoded[classifier_fs->variable_count()];
+
     for (unsigned i = 0;  i < candidates.size();  ++i) {
         Ranked_Entry & entry = candidates[i];
         int repo_id = entry.repo_id;
 
-        float encoded[classifier_fs->variable_count()];
-        classifier_fs->encode(&features[i][0], encoded, *ranker_fs, mapping);
+        classifier_fs->encode(features[i], encoded, *ranker_fs, mapping);
         float score = classifier.impl->predict(1, encoded, opt_info);
 
         entry.index = i;
         entry.repo_id = repo_id;
         entry.score = score;
     }
+
+    if (memo) memo->put_scores(this, candidates, key);
 }
 
+void
+Classifier_Ranker::
+cascade_scores(std::vector<float> & scores,
+               int user_id,
+               const Ranked & candidates,
+               const Candidate_Data & candidate_data,
+               const Data & data) const
+{
+    scores.resize(candidates.size());
+
+    if (cascade_classifier_file == "") {
+        for (unsigned i = 0;  i < candidates.size();  ++i)
+            scores[i] = candidates[i].score;
+        return;
+    }
+
+    Feature_Matrix & features = matrix();
+    features.init(candidates.size(), generator->num_features);
+    generator->features(features, user_id, candidates, candidate_data, data);
+
+    float encoded[cascade_classifier_fs->variable_count()];
+
+    for (unsigned i = 0;  i < candidates.size();  ++i) {
+        cascade_classifier_fs->encode(features[i], encoded, *cascade_fs,
+                                      cascade_mapping);
+        scores[i] = cascade_classifier.impl->predict(1, encoded,
+                                                     cascade_opt_info);
+    }
+}
+
+namespace {
+
+struct Cascade_Stats {
+    Cascade_Stats()
+        : n(0), in_candidates(0), in_kept(0), in_top10(0), total_candidates(0),
+          total_kept(0)
+    {
+    }
+
+    size_t n;
+    size_t in_candidates;
+    size_t in_kept;
+    size_t in_top10;
+    size_t total_candidates;
+    size_t total_kept;
+};
+
+Cascade_Stats cascade_stats;
+Lock cascade_stats_lock;
+
+struct PrintCascadeStats {
+    ~PrintCascadeStats()
+    {
+        const Cascade_Stats & s = cascade_stats;
+        if (s.n == 0) return;
+
+        cerr << "cascade             users  recall" << endl;
+        cerr << format("candidates        %7zd %5zd(%5.2f%%) avg %7.1f\n",
+                       s.n, s.in_candidates, 100.0 * s.in_candidates / s.n,
+                       1.0 * s.total_candidates / s.n);
+        cerr << format("first stage kept  %7zd %5zd(%5.2f%%) avg %7.1f\n",
+                       s.n, s.in_kept, 100.0 * s.in_kept / s.n,
+                       1.0 * s.total_kept / s.n);
+        cerr << format("final top 10      %7zd %5zd(%5.2f%%)\n",
+                       s.n, s.in_top10, 100.0 * s.in_top10 / s.n);
+        cerr << endl;
+    }
+} print_cascade_stats;
+
+/// Records where the correct repo (if we know it) got to in the cascade
+void record_cascade_stats(const Ranked & candidates, const IdSet & kept)
+{
+    if (correct_repo == -1) return;
+
+    bool in_candidates = false;
+    float correct_score = 0.0;
+    for (unsigned i = 0;  i < candidates.size();  ++i) {
+        if (candidates[i].repo_id != correct_repo) continue;
+        in_candidates = true;
+        correct_score = candidates[i].score;
+    }
+
+    int nbetter = 0;
+    for (unsigned i = 0;  in_candidates && i < candidates.size();  ++i)
+        if (candidates[i].score > correct_score) ++nbetter;
+
+    Guard guard(cascade_stats_lock);
+    Cascade_Stats & s = cascade_stats;
+    ++s.n;
+    s.in_candidates += in_candidates;
+    s.in_kept += kept.count(correct_repo);
+    s.in_top10 += in_candidates && nbetter < 10;
+    s.total_candidates += candidates.size();
+    s.total_kept += kept.size();
+}
+
+} // file scope
+
 void
 Classifier_Ranker::
 rank(Ranked & candidates,
@@ -1176,10 +1803,65 @@ rank(Ranked & candidates,
      const Candidate_Data & candidate_data,
      const Data & data) const
 {
-    vector<distribution<float> > features;
-    this->features(features, user_id, candidates, candidate_data, data);
+    Feature_Matrix & features = matrix();
 
-    classify(candidates, user_id, candidate_data, data, features);
+    if (cascade_keep <= 0 || !load_data) {
+        features.init(candidates.size(), ranker_fs->variable_count());
+        this->features(features, user_id, candidates, candidate_data, data);
+
+        classify(candidates, user_id, candidate_data, data, features);
+        return;
+    }
+
+    // The heuristic ranks are features, and need to be those over all of
+    // the candidates, as they are when the full features are calculated
+    // for training
+    Ranked heuristic;
+    this->heuristic(heuristic, user_id, candidates, candidate_data, data);
+
+    // First stage: keep the best cascade_keep by the cheap score
+    vector<float> scores;
+    cascade_scores(scores, user_id, candidates, candidate_data, data);
+
+    // Best score first, then in the order that they came in
+    typedef pair<float, int> Scored;  // score, -index
+    vector<Scored> order;
+    order.reserve(candidates.size());
+    for (unsigned i = 0;  i < candidates.size();  ++i)
+        order.push_back(Scored(scores[i], -(int)i));
+    std::sort(order.begin(), order.end(), std::greater<Scored>());
+
+    size_t nkeep = std::min<size_t>(cascade_keep, candidates.size());
+
+    Ranked kept;
+    kept.reserve(nkeep);
+    IdSet kept_ids;
+    for (unsigned i = 0;  i < nkeep;  ++i) {
+        kept.push_back(candidates[-order[i].second]);
+        kept.back().index = i;
+        kept_ids.insert(kept.back().repo_id);
+    }
+    kept_ids.finish();
+
+    // Second stage: the full features and classifier on those only
+    features.init(kept.size(), ranker_fs->variable_count());
+    subset_features(features, user_id, kept, heuristic, candidate_data, data);
+    classify(kept, user_id, candidate_data, data, features);
+
+    float min_kept = 0.0;
+    for (unsigned i = 0;  i < nkeep;  ++i) {
+        candidates[-order[i].second].score = kept[i].score;
+        min_kept = std::min(min_kept, kept[i].score);
+    }
+
+    // The rest go below, in first stage order
+    for (unsigned i = nkeep;  i < candidates.size();  ++i)
+        candidates[-order[i].second].score = min_kept - 1.0 - (i - nkeep);
+
+    for (unsigned i = 0;  i < candidates.size();  ++i)
+        candidates[i].index = i;
+
+    record_cascade_stats(candidates, kept_ids);
 }
 
 
@@ -1211,6 +1893,21 @@ init(boost::shared_ptr<Candidate_Generator> generator)
     this->generator = generator;
     phase1.init(generator);
     Classifier_Ranker::init(generator);
+
+    // Our features include those of phase 1, so it needs to calculate the
+    // ones that our classifier uses as well
+    if (load_data) phase1.registry.add_live(used_features);
+    else phase1.calculate_all_features();
+
+    prerank_column = Feature_Matrix::column(*ranker_fs, "prerank_score");
+}
+
+void
+Classifier_Reranker::
+calculate_all_features()
+{
+    Classifier_Ranker::calculate_all_features();
+    phase1.calculate_all_features();
 }
 
 boost::shared_ptr<const ML::Dense_Feature_Space>
@@ -1233,12 +1930,14 @@ feature_space() const
 
 void
 Classifier_Reranker::
-features(std::vector<ML::distribution<float> > & result,
+features(Feature_Matrix & result,
          int user_id,
          const Ranked & candidates,
          const Candidate_Data & candidate_data,
          const Data & data) const
 {
+    result.check(candidates.size(), prerank_column + 3, "reranker features");
+
     phase1.features(result, user_id, candidates, candidate_data, data);
 
     // First, we rank with the phase 1 classifier
@@ -1265,7 +1964,7 @@ features(std::vector<ML::distribution<float> > & result,
 
     // Now, go through and add the extra features in
     for (unsigned i = 0;  i < ranked.size();  ++i) {
-        distribution<float> & fv = result[ranked[i].index];
+        Feature_Writer fv(result, ranked[i].index, prerank_column);
         fv.push_back(ranked[i].score);
         fv.push_back((ranked[i].min_rank + ranked[i].max_rank) * 0.5);
         fv.push_back(fv.back() / ranked.size());
@@ -1293,7 +1992,7 @@ classify(Ranked & candidates,
          int user_id,
          const Candidate_Data & candidate_data,
          const Data & data,
-         const std::vector<ML::distribution<float> > & features) const
+         const Feature_Matrix & features) const
 {
     hash_map<int, vector<pair<int, float> > > rank_per_author;
 
@@ -1301,9 +2000,9 @@ classify(Ranked & candidates,
         Ranked_Entry & entry = candidates[i];
         int repo_id = entry.repo_id;
 
-        float score = features[i][features[i].size() - 3];
+        float score = features[i][prerank_column];
 
-        rank_per_author[data.repos[repo_id].author]
+        rank_per_author[data.repo_hot.author(repo_id)]
             .push_back(make_pair(repo_id, score));
     }
     
@@ -1318,11 +2017,11 @@ classify(Ranked & candidates,
         float score;
 
 #if 1
-        int rank = features[i][features[i].size() - 2];
+        int rank = features[i][prerank_column + 1];
         if (rank > 200) score = 0.0;
         else {
             float encoded[classifier_fs->variable_count()];
-            classifier_fs->encode(&features[i][0], encoded, *ranker_fs,
+            classifier_fs->encode(features[i], encoded, *ranker_fs,
                                   mapping);
             score = classifier.impl->predict(1, encoded, opt_info);
         }
@@ -1339,7 +2038,7 @@ classify(Ranked & candidates,
             found = (author_ranks[j].first == repo_id);
         }
         
-        if (found) score = features[i][features[i].size() - 3];
+        if (found) score = features[i][prerank_column];
         else score = 0.0;
 #endif
         entry.score = score;
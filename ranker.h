@@ -11,10 +11,13 @@
 
 #include "data.h"
 #include "candidate_source.h"
+#include "feature_registry.h"
+#include "feature_matrix.h"
 #include "utils/configuration.h"
 
 #include "boosting/dense_features.h"
 #include "boosting/classifier.h"
+#include <boost/thread/tss.hpp>
 
 // Global variables for statistics; per-thread
 extern __thread int correct_repo;
@@ -28,6 +31,8 @@ extern __thread const IdSet * watching;
 // Base class for a candidate generator
 struct Candidate_Generator {
 
+    Candidate_Generator();
+
     virtual ~Candidate_Generator();
 
     virtual void configure(const ML::Configuration & config,
@@ -38,20 +43,45 @@ struct Candidate_Generator {
     virtual boost::shared_ptr<const ML::Dense_Feature_Space>
     feature_space() const;
 
+    /// Write the features of each candidate straight into its row of the
+    /// result, from the per-source entries in the candidate data
     virtual void
-    features(std::vector<ML::distribution<float> > & result,
+    features(Feature_Matrix & result,
              int user_id,
              const Ranked & candidates,
              const Candidate_Data & candidate_data,
              const Data & data) const;
 
-    /// Generates a set of candidates to be ranked for the given user
+    /// Generates a set of candidates to be ranked for the given user,
+    /// scored by the total of their sources' scores
     virtual void
     candidates(Ranked & ranked, Candidate_Data & candidate_data,
                const Data & data, int user_id) const;
 
+    /// Scratch space for the sources, one per thread
+    Candidate_Scratch & scratch(const Data & data) const;
+
+    /// Block of common features, one per thread, reused from user to user
+    Common_Block & common_block() const;
+
+    /// Fingerprint of the sources and their classifiers, for the candidate
+    /// cache
+    uint64_t fingerprint() const;
+
     std::vector<boost::shared_ptr<Candidate_Source> > sources;
     std::vector<int> source_num_features;
+
+    /// Number of variables in the feature space
+    size_t num_features;
+
+    /// Run the sources for a single user in parallel on the worker task?
+    /// Reduces the latency for one user; not useful when the users are
+    /// already being processed in parallel.
+    bool parallel_sources;
+
+private:
+    mutable boost::thread_specific_ptr<Candidate_Scratch> scratch_;
+    mutable boost::thread_specific_ptr<Common_Block> common_;
 };
 
 
@@ -74,7 +104,7 @@ struct Ranker {
     feature_space() const;
 
     virtual void
-    features(std::vector<ML::distribution<float> > & result,
+    features(Feature_Matrix & result,
              int user_id,
              const Ranked & candidates,
              const Candidate_Data & candidate_data,
@@ -86,7 +116,54 @@ struct Ranker {
          const Candidate_Data & candidate_data,
          const Data & data) const;
 
+    /// Calculate the features that the classifier doesn't use as well (for
+    /// dumping training data)
+    virtual void calculate_all_features();
+
+    /// The candidates in order of the heuristic score, with the index of
+    /// each as it is in candidates and their ranks.  Shared through the
+    /// memo.
+    void heuristic(Ranked & heuristic,
+                   int user_id,
+                   const Ranked & candidates,
+                   const Candidate_Data & candidate_data,
+                   const Data & data) const;
+
+    /// The features of some of the candidates that heuristic() ranked as
+    /// all_heuristic.  The heuristic ranks and percentiles are those
+    /// within all of them, so that they're the same as features() over
+    /// all of the candidates would give.
+    void subset_features(Feature_Matrix & result,
+                         int user_id,
+                         const Ranked & candidates,
+                         const Ranked & all_heuristic,
+                         const Candidate_Data & candidate_data,
+                         const Data & data) const;
+
+    /// Feature matrix for ranking, one per thread so that it can be reused
+    /// from one user to the next
+    Feature_Matrix & matrix() const;
+
     boost::shared_ptr<Candidate_Generator> generator;
+
+    /// Columns of the ranker's own features (after the generator's)
+    size_t first_feature, num_features;
+
+    /// The expensive features and which of them need to be calculated
+    Feature_Registry registry;
+
+private:
+    mutable boost::thread_specific_ptr<Feature_Matrix> matrix_;
+
+    /// The features, given the candidates' part of the heuristic order and
+    /// the number of candidates that it was over
+    void calc_features(Feature_Matrix & result,
+                       int user_id,
+                       const Ranked & candidates,
+                       const Ranked & heuristic,
+                       size_t nranked,
+                       const Candidate_Data & candidate_data,
+                       const Data & data) const;
 };
 
 struct Classifier_Ranker : public Ranker {
@@ -102,7 +179,7 @@ struct Classifier_Ranker : public Ranker {
     feature_space() const;
 
     virtual void
-    features(std::vector<ML::distribution<float> > & result,
+    features(Feature_Matrix & result,
              int user_id,
              const Ranked & candidates,
              const Candidate_Data & candidate_data,
@@ -113,7 +190,7 @@ struct Classifier_Ranker : public Ranker {
              int user_id,
              const Candidate_Data & candidate_data,
              const Data & data,
-             const std::vector<ML::distribution<float> > & features) const;
+             const Feature_Matrix & features) const;
     
     virtual void
     rank(Ranked & candidates,
@@ -128,6 +205,31 @@ struct Classifier_Ranker : public Ranker {
     ML::Dense_Feature_Space::Mapping mapping;
     ML::Optimization_Info opt_info;
     bool load_data;
+
+    /// Names of the features that the classifier uses
+    std::vector<std::string> used_features;
+
+    /// First stage of the ranking cascade: score the candidates cheaply,
+    /// using only the generator features
+    void cascade_scores(std::vector<float> & scores,
+                        int user_id,
+                        const Ranked & candidates,
+                        const Candidate_Data & candidate_data,
+                        const Data & data) const;
+
+    /// If non-zero, only this many candidates (the best according to
+    /// cascade_scores()) get the full features and the classifier; the rest
+    /// are ranked below them, in cascade order
+    int cascade_keep;
+
+    /// Classifier for the first stage, over the generator feature space.
+    /// If empty, the generator's merged score is used.
+    std::string cascade_classifier_file;
+    ML::Classifier cascade_classifier;
+    boost::shared_ptr<const ML::Dense_Feature_Space> cascade_fs;
+    boost::shared_ptr<const ML::Dense_Feature_Space> cascade_classifier_fs;
+    ML::Dense_Feature_Space::Mapping cascade_mapping;
+    ML::Optimization_Info cascade_opt_info;
 };
 
 struct Classifier_Reranker : public Classifier_Ranker {
@@ -143,7 +245,7 @@ struct Classifier_Reranker : public Classifier_Ranker {
     feature_space() const;
 
     virtual void
-    features(std::vector<ML::distribution<float> > & result,
+    features(Feature_Matrix & result,
              int user_id,
              const Ranked & candidates,
              const Candidate_Data & candidate_data,
@@ -160,9 +262,14 @@ struct Classifier_Reranker : public Classifier_Ranker {
              int user_id,
              const Candidate_Data & candidate_data,
              const Data & data,
-             const std::vector<ML::distribution<float> > & features) const;
+             const Feature_Matrix & features) const;
+
+    virtual void calculate_all_features();
 
     Classifier_Ranker phase1;
+
+    /// Column of the first of our features (prerank_score)
+    size_t prerank_column;
 };
 
 // Factory methods
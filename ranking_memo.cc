@@ -0,0 +1,268 @@
+/* ranking_memo.cc
+   Jeremy Barnes, 4 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the ranking memo.
+*/
+
+#include "ranking_memo.h"
+#include "boosting/worker_task.h"
+#include "utils/guard.h"
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+#include <iostream>
+#include <string.h>
+#include <stdint.h>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace {
+
+const char * kind_names[Ranking_Memo::NUM_KINDS]
+    = { "heuristic", "features", "scores" };
+
+struct Memo_Stats {
+    Memo_Stats()
+        : users(0)
+    {
+        std::fill(calculated, calculated + Ranking_Memo::NUM_KINDS, 0);
+        std::fill(reused, reused + Ranking_Memo::NUM_KINDS, 0);
+    }
+
+    size_t users;
+    size_t calculated[Ranking_Memo::NUM_KINDS];
+    size_t reused[Ranking_Memo::NUM_KINDS];
+};
+
+Memo_Stats memo_stats;
+Lock memo_stats_lock;
+
+struct PrintMemoStats {
+    ~PrintMemoStats()
+    {
+        const Memo_Stats & s = memo_stats;
+        if (s.users == 0) return;
+
+        cerr << "ranking memo     calculated  per user     reused" << endl;
+        for (unsigned i = 0;  i < Ranking_Memo::NUM_KINDS;  ++i)
+            cerr << format("%-15s %11zd %9.2f %10zd\n",
+                           kind_names[i], s.calculated[i],
+                           1.0 * s.calculated[i] / s.users, s.reused[i]);
+        cerr << format("%zd users\n", s.users) << endl;
+    }
+} print_memo_stats;
+
+} // file scope
+
+
+/*****************************************************************************/
+/* RANKING_MEMO                                                              */
+/*****************************************************************************/
+
+Ranking_Memo::
+Ranking_Memo()
+{
+    std::fill(calculated, calculated + NUM_KINDS, 0);
+    std::fill(reused, reused + NUM_KINDS, 0);
+}
+
+Ranking_Memo::
+~Ranking_Memo()
+{
+    Guard guard(memo_stats_lock);
+    ++memo_stats.users;
+    for (unsigned i = 0;  i < NUM_KINDS;  ++i) {
+        memo_stats.calculated[i] += calculated[i];
+        memo_stats.reused[i] += reused[i];
+    }
+}
+
+uint64_t
+Ranking_Memo::
+key(const Ranked & candidates)
+{
+    // The entries are summed so that the order doesn't matter
+    uint64_t result = 0;
+
+    for (unsigned i = 0;  i < candidates.size();  ++i) {
+        const Ranked_Entry & entry = candidates[i];
+
+        // FNV-1a over the bits of each field
+        uint64_t h = 14695981039346656037ULL;
+        h = (h ^ (uint32_t)entry.repo_id) * 1099511628211ULL;
+
+        uint32_t bits;
+        memcpy(&bits, &entry.score, sizeof(bits));
+        h = (h ^ bits) * 1099511628211ULL;
+
+        result += h;
+    }
+
+    return result;
+}
+
+bool
+Ranking_Memo::Entry_Key::
+operator < (const Entry_Key & other) const
+{
+    if (kind != other.kind) return kind < other.kind;
+    if (ranker != other.ranker) return ranker < other.ranker;
+    return key < other.key;
+}
+
+Ranking_Memo::Entry *
+Ranking_Memo::
+find(Kind kind, const Ranker * ranker, const Ranked & candidates,
+     uint64_t key)
+{
+    Entry_Key entry_key;
+    entry_key.kind = kind;
+    entry_key.ranker = ranker;
+    entry_key.key = key;
+
+    std::pair<Entries::iterator, Entries::iterator> found
+        = entries.equal_range(entry_key);
+
+    for (Entries::iterator it = found.first;  it != found.second;  ++it) {
+        const Entry & entry = it->second;
+        if (entry.repo_ids.size() != candidates.size()) continue;
+
+        bool same = true;
+        for (unsigned i = 0;  same && i < candidates.size();  ++i)
+            same = entry.repo_to_row.count(candidates[i].repo_id);
+
+        if (same) return &it->second;
+    }
+
+    return 0;
+}
+
+Ranking_Memo::Entry &
+Ranking_Memo::
+insert(Kind kind, const Ranker * ranker, const Ranked & candidates,
+       uint64_t key)
+{
+    if (find(kind, ranker, candidates, key))
+        throw Exception(format("ranking memo: %s stored twice",
+                               kind_names[kind]));
+
+    ++calculated[kind];
+
+    Entry_Key entry_key;
+    entry_key.kind = kind;
+    entry_key.ranker = ranker;
+    entry_key.key = key;
+
+    Entry & entry
+        = entries.insert(std::make_pair(entry_key, Entry()))->second;
+    entry.first = entry.last = 0;
+
+    entry.repo_ids.resize(candidates.size());
+    for (unsigned i = 0;  i < candidates.size();  ++i) {
+        entry.repo_ids[i] = candidates[i].repo_id;
+        entry.repo_to_row[candidates[i].repo_id] = i;
+    }
+
+    return entry;
+}
+
+bool
+Ranking_Memo::
+get_heuristic(Ranked & heuristic, const Ranked & candidates, uint64_t key)
+{
+    Entry * entry = find(HEURISTIC, 0, candidates, key);
+    if (!entry) return false;
+
+    ++reused[HEURISTIC];
+
+    std::hash_map<int, int> repo_to_index;
+    for (unsigned i = 0;  i < candidates.size();  ++i)
+        repo_to_index[candidates[i].repo_id] = candidates[i].index;
+
+    heuristic = entry->heuristic;
+    for (unsigned i = 0;  i < heuristic.size();  ++i)
+        heuristic[i].index = repo_to_index[heuristic[i].repo_id];
+
+    return true;
+}
+
+void
+Ranking_Memo::
+put_heuristic(const Ranked & heuristic, const Ranked & candidates,
+              uint64_t key)
+{
+    Entry & entry = insert(HEURISTIC, 0, candidates, key);
+    entry.heuristic = heuristic;
+}
+
+bool
+Ranking_Memo::
+get_features(const Ranker * ranker, const Ranked & candidates,
+             uint64_t key, Feature_Matrix & result,
+             size_t first, size_t last)
+{
+    Entry * entry = find(FEATURES, ranker, candidates, key);
+    if (!entry) return false;
+
+    ++reused[FEATURES];
+
+    if (entry->first != first || entry->last != last)
+        throw Exception("ranking memo: features asked for with different "
+                        "columns");
+
+    for (unsigned i = 0;  i < candidates.size();  ++i) {
+        const float * row
+            = entry->features[entry->repo_to_row[candidates[i].repo_id]];
+        std::copy(row, row + (last - first), result[i] + first);
+    }
+
+    return true;
+}
+
+void
+Ranking_Memo::
+put_features(const Ranker * ranker, const Ranked & candidates,
+             uint64_t key, const Feature_Matrix & features,
+             size_t first, size_t last)
+{
+    Entry & entry = insert(FEATURES, ranker, candidates, key);
+    entry.first = first;
+    entry.last = last;
+    entry.features.init(candidates.size(), last - first);
+
+    for (unsigned i = 0;  i < candidates.size();  ++i)
+        std::copy(features[i] + first, features[i] + last,
+                  entry.features[i]);
+}
+
+bool
+Ranking_Memo::
+get_scores(const Ranker * ranker, Ranked & candidates, uint64_t key)
+{
+    Entry * entry = find(SCORES, ranker, candidates, key);
+    if (!entry) return false;
+
+    ++reused[SCORES];
+
+    for (unsigned i = 0;  i < candidates.size();  ++i) {
+        candidates[i].index = i;
+        candidates[i].score
+            = entry->scores[entry->repo_to_row[candidates[i].repo_id]];
+    }
+
+    return true;
+}
+
+void
+Ranking_Memo::
+put_scores(const Ranker * ranker, const Ranked & candidates,
+           uint64_t key)
+{
+    Entry & entry = insert(SCORES, ranker, candidates, key);
+    entry.scores.resize(candidates.size());
+    for (unsigned i = 0;  i < candidates.size();  ++i)
+        entry.scores[i] = candidates[i].score;
+}
@@ -0,0 +1,122 @@
+/* ranking_memo.h                                                  -*- C++ -*-
+   Jeremy Barnes, 4 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Results for one user that are shared between the ranker stages.
+*/
+
+#ifndef __github__ranking_memo_h__
+#define __github__ranking_memo_h__
+
+#include "candidate_source.h"
+#include "feature_matrix.h"
+#include "utils/hash_map.h"
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+struct Ranker;
+
+
+/*****************************************************************************/
+/* RANKING_MEMO                                                              */
+/*****************************************************************************/
+
+/** Remembers the results of ranking one user's candidates so that they are
+    calculated once, even though the ranker stages and output modes each
+    ask for them: the heuristic ranks, the feature matrix of each ranker
+    and the scores of each classifier.
+
+    Each result is for a ranker (the key) and a set of candidates.  It
+    doesn't matter what order the candidates are in when it's asked for
+    again (the output modes ask after sorting them), but a different set
+    (such as the candidates kept by the first stage of a cascade) is a
+    different result.  So is the same set with different scores: the
+    features depend upon the scores through the heuristic ranks, so once
+    the candidates have been ranked (and have the classifier's scores)
+    their features are calculated again.
+
+    Each stage calculates the key of its candidates once, with key(), and
+    passes it to both the get and the put.  The entries are looked up by
+    the key, and the repo IDs are only compared when it matches.
+
+    Made for one user by the caller and pointed to by the Candidate_Data;
+    not thread safe.  The counts of what was calculated and reused are
+    printed at exit.
+*/
+
+struct Ranking_Memo {
+    Ranking_Memo();
+
+    /// Adds the counts to the totals
+    ~Ranking_Memo();
+
+    /// Hash of the repo ID and score of each of the candidates.  It doesn't
+    /// depend upon their order.
+    static uint64_t key(const Ranked & candidates);
+
+    /// The candidates in heuristic order, with the index of each as it is
+    /// in candidates and their min_rank and max_rank
+    bool get_heuristic(Ranked & heuristic, const Ranked & candidates,
+                       uint64_t key);
+    void put_heuristic(const Ranked & heuristic, const Ranked & candidates,
+                       uint64_t key);
+
+    /// Columns [first, last) of the features that the ranker calculated,
+    /// copied into the rows of result
+    bool get_features(const Ranker * ranker, const Ranked & candidates,
+                      uint64_t key, Feature_Matrix & result,
+                      size_t first, size_t last);
+    void put_features(const Ranker * ranker, const Ranked & candidates,
+                      uint64_t key, const Feature_Matrix & features,
+                      size_t first, size_t last);
+
+    /// The scores from the ranker's classifier, into candidates; the index
+    /// of each is set to its position.  The key is of the candidates before
+    /// they were scored.
+    bool get_scores(const Ranker * ranker, Ranked & candidates,
+                    uint64_t key);
+    void put_scores(const Ranker * ranker, const Ranked & candidates,
+                    uint64_t key);
+
+    enum Kind {
+        HEURISTIC,
+        FEATURES,
+        SCORES,
+        NUM_KINDS
+    };
+
+    int calculated[NUM_KINDS];
+    int reused[NUM_KINDS];
+
+private:
+    struct Entry_Key {
+        Kind kind;
+        const Ranker * ranker;
+        uint64_t key;
+
+        bool operator < (const Entry_Key & other) const;
+    };
+
+    struct Entry {
+        std::vector<int> repo_ids;            ///< Order they were stored in
+        std::hash_map<int, int> repo_to_row;  ///< Inverse of repo_ids
+        Ranked heuristic;
+        Feature_Matrix features;
+        size_t first, last;
+        std::vector<float> scores;
+    };
+
+    /// Several entries can have the same key if the hash collides
+    typedef std::multimap<Entry_Key, Entry> Entries;
+    Entries entries;
+
+    /// Entry for the ranker and the set of candidates, or 0 if none
+    Entry * find(Kind kind, const Ranker * ranker, const Ranked & candidates,
+                 uint64_t key);
+
+    Entry & insert(Kind kind, const Ranker * ranker,
+                   const Ranked & candidates, uint64_t key);
+};
+
+#endif /* __github__ranking_memo_h__ */
@@ -0,0 +1,219 @@
+/* repo_features.cc
+   Jeremy Barnes, 1 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the precomputed repo features.
+*/
+
+#include "repo_features.h"
+#include "data.h"
+#include "parallel.h"
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+
+#include <cmath>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace {
+
+enum { REPOS_PER_CHUNK = 2000 };
+
+} // file scope
+
+
+/*****************************************************************************/
+/* REPO_FEATURES                                                             */
+/*****************************************************************************/
+
+/** Fills in the columns for a range of repos.  The expressions here must
+    stay the same as the ones that they replaced in common_features() and
+    Ranker::features(), so that the values are the same to the bit.
+*/
+struct Repo_Features::Build_Job {
+    Build_Job(Repo_Features & features, const Data & data)
+        : features(features), data(data)
+    {
+    }
+
+    Repo_Features & features;
+    const Data & data;
+
+    void set(Column column, int repo_id, float value) const
+    {
+        features.values[column * features.nrepos + repo_id] = value;
+    }
+
+    void operator () (int chunk, int first, int last) const
+    {
+        static const boost::gregorian::date epoch(2007, 1, 1);
+
+        for (int repo_id = first;  repo_id < last;  ++repo_id) {
+            const Repo & repo = data.repos[repo_id];
+            if (repo.invalid()) continue;
+
+            // Common features
+            set(REPO_WATCHED_USERS, repo_id, repo.watchers.size());
+            set(REPO_LINES_OF_CODE, repo_id, log(repo.total_loc + 1));
+            set(REPO_PROB, repo_id, repo.repo_prob);
+            set(REPO_PROB_RANK, repo_id, repo.repo_prob_rank);
+            set(REPO_HAS_PARENT, repo_id, repo.parent != -1);
+            set(REPO_NUM_CHILDREN, repo_id,
+                data.fork_forest.num_children(repo_id));
+            set(REPO_NUM_ANCESTORS, repo_id,
+                data.fork_forest.depth(repo_id));
+
+            if (repo.parent == -1) {
+                set(REPO_NUM_SIBLINGS, repo_id, 0);
+                set(REPO_PARENT_WATCHERS, repo_id, -1);
+            }
+            else {
+                set(REPO_NUM_SIBLINGS, repo_id,
+                    data.fork_forest.num_children(repo.parent));
+                set(REPO_PARENT_WATCHERS, repo_id,
+                    data.repos[repo.parent].watchers.size());
+            }
+
+            // Ranker features
+            bool valid_author
+                = repo.author >= 0 && repo.author < (int)data.authors.size();
+
+            string author_name
+                = (valid_author ? data.authors[repo.author].name : string());
+
+            const Data::Name_Info & name_info = data.name_to_repos(repo.name);
+
+            set(REPO_NAME_CONTAINS_USER, repo_id,
+                author_name.find(repo.name) != string::npos);
+            set(USER_NAME_CONTAINS_REPO, repo_id,
+                repo.name.find(author_name) != string::npos);
+
+            if (valid_author) {
+                const Author & author = data.authors[repo.author];
+                set(REPOS_AUTHORED_BY, repo_id, author.repositories.size());
+                set(AUTHOR_HAS_WATCHERS, repo_id, author.num_watchers);
+            }
+            else {
+                set(REPOS_AUTHORED_BY, repo_id, -1);
+                set(AUTHOR_HAS_WATCHERS, repo_id, -1);
+            }
+
+            set(NUM_REPOS_WITH_SAME_NAME, repo_id, name_info.size());
+            set(NUM_WATCHERS_OF_REPOS_WITH_SAME_NAME, repo_id,
+                name_info.num_watchers);
+
+            set(REPO_NUM_COOCCURRENCES, repo_id, repo.cooc.size());
+            set(REPO_NUM_COOCCURRENCES2, repo_id, repo.cooc2.size());
+
+            long repo_date = (repo.date - epoch).days();
+            long author_date = 0;
+
+            if (repo.author != -1
+                && data.authors[repo.author].num_followers != -1)
+                author_date = (data.authors[repo.author].date - epoch).days();
+
+            features.repo_dates[repo_id] = repo_date;
+            features.author_dates[repo_id] = author_date;
+
+            set(REPO_DATE, repo_id, repo_date);
+            set(AUTHOR_DATE, repo_id, author_date);
+            set(AUTHOR_REPO_DATE_DIFFERENCE, repo_id, repo_date - author_date);
+
+            if (repo.author != -1) {
+                set(AUTHOR_NUM_FOLLOWERS, repo_id,
+                    data.authors[repo.author].num_followers);
+                set(AUTHOR_NUM_FOLLOWING, repo_id,
+                    data.authors[repo.author].num_following);
+            }
+            else {
+                set(AUTHOR_NUM_FOLLOWERS, repo_id, -1);
+                set(AUTHOR_NUM_FOLLOWING, repo_id, -1);
+            }
+
+            bool suspicious_repo
+                = repo.watchers.empty()
+                || *repo.watchers.begin() > repo.max_user;
+
+            set(REPO_ID_RANGE_SIZE, repo_id, repo.max_user - repo.min_user);
+            set(ID_RANGE_SUSPICIOUS_REPO, repo_id, suspicious_repo);
+
+            set(REPO_NKEYWORDS, repo_id, repo.keywords.size());
+            set(REPO_KEYWORD_FACTOR, repo_id, repo.keywords_2norm);
+            set(REPO_KEYWORD_IDF_FACTOR, repo_id, repo.keywords_idf_2norm);
+
+            set(REPO_KEYWORD_MAX, repo_id, repo.keyword_vec.max());
+            set(REPO_KEYWORD_MAX_NORM, repo_id,
+                repo.keyword_vec.max() / repo.keyword_vec_2norm);
+
+            set(NUM_WATCHES_API, repo_id, repo.num_watches_api);
+            set(NUM_MISSING_WATCHES, repo_id,
+                repo.num_watches_api - (int)repo.watchers.size());
+            set(NUM_FORKS_API, repo_id, repo.num_forks_api);
+            set(NUM_MISSING_FORKS, repo_id,
+                repo.num_forks_api - data.fork_forest.num_children(repo_id));
+
+            int author_num_possible_users = 0;
+            if (repo.author != -1)
+                author_num_possible_users
+                    = data.authors[repo.author].possible_users.size();
+
+            set(AUTHOR_NUM_POSSIBLE_USERS, repo_id, author_num_possible_users);
+        }
+    }
+};
+
+Repo_Features::
+Repo_Features()
+    : nrepos(0)
+{
+}
+
+void
+Repo_Features::
+clear()
+{
+    nrepos = 0;
+    values.clear();
+    repo_dates.clear();
+    author_dates.clear();
+}
+
+void
+Repo_Features::
+build(const Data & data)
+{
+    clear();
+
+    nrepos = data.repos.size();
+    values.resize(NUM_COLUMNS * nrepos, NAN);
+    repo_dates.resize(nrepos);
+    author_dates.resize(nrepos);
+
+    run_in_parallel(nrepos, REPOS_PER_CHUNK, Build_Job(*this, data),
+                    "repo features");
+
+    cerr << format("repo features: %d columns, %zd repos, %.1fMB",
+                   (int)NUM_COLUMNS, nrepos, memusage() / 1048576.0)
+         << endl;
+}
+
+void
+Repo_Features::
+check(const Data & data) const
+{
+    if (nrepos != data.repos.size())
+        throw Exception(format("repo features have %zd repos but data has "
+                               "%zd; was Data::calc_repo_features() called?",
+                               nrepos, data.repos.size()));
+}
+
+size_t
+Repo_Features::
+memusage() const
+{
+    return sizeof(float) * values.capacity()
+        + sizeof(long) * (repo_dates.capacity() + author_dates.capacity());
+}
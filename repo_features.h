@@ -0,0 +1,118 @@
+/* repo_features.h                                                 -*- C++ -*-
+   Jeremy Barnes, 1 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Features that depend only upon the repo, precomputed into columns.
+*/
+
+#ifndef __github__repo_features_h__
+#define __github__repo_features_h__
+
+#include <vector>
+#include <stddef.h>
+
+struct Data;
+
+
+/*****************************************************************************/
+/* REPO_FEATURES                                                             */
+/*****************************************************************************/
+
+/** The features of the common and ranker feature vectors that depend only
+    upon the repo, calculated once for every repo so that building the
+    feature vector for a (user, repo) pair just needs to gather them.
+
+    Each column holds exactly the float that the feature vector would have
+    held had it been calculated in place, so the vectors are unchanged.
+    The dates are also kept as integers, as they are used in differences
+    with the user's dates that need to be done before rounding.
+
+    Must be built after everything that it reads is done: the fake test
+    setup, the factors, the keywords and the author data.  Invalid repos
+    get NaN.
+*/
+
+struct Repo_Features {
+    Repo_Features();
+
+    enum Column {
+        // Common features (Candidate_Source::common_features)
+        REPO_WATCHED_USERS,
+        REPO_LINES_OF_CODE,
+        REPO_PROB,
+        REPO_PROB_RANK,
+        REPO_HAS_PARENT,
+        REPO_NUM_CHILDREN,
+        REPO_NUM_ANCESTORS,
+        REPO_NUM_SIBLINGS,
+        REPO_PARENT_WATCHERS,
+
+        // Ranker features (Ranker::features)
+        REPO_NAME_CONTAINS_USER,
+        USER_NAME_CONTAINS_REPO,
+        REPOS_AUTHORED_BY,
+        AUTHOR_HAS_WATCHERS,
+        NUM_REPOS_WITH_SAME_NAME,
+        NUM_WATCHERS_OF_REPOS_WITH_SAME_NAME,
+        REPO_NUM_COOCCURRENCES,
+        REPO_NUM_COOCCURRENCES2,
+        REPO_DATE,
+        AUTHOR_DATE,
+        AUTHOR_REPO_DATE_DIFFERENCE,
+        AUTHOR_NUM_FOLLOWERS,
+        AUTHOR_NUM_FOLLOWING,
+        REPO_ID_RANGE_SIZE,
+        ID_RANGE_SUSPICIOUS_REPO,
+        REPO_NKEYWORDS,
+        REPO_KEYWORD_FACTOR,
+        REPO_KEYWORD_IDF_FACTOR,
+        REPO_KEYWORD_MAX,
+        REPO_KEYWORD_MAX_NORM,
+        NUM_WATCHES_API,
+        NUM_MISSING_WATCHES,
+        NUM_FORKS_API,
+        NUM_MISSING_FORKS,
+        AUTHOR_NUM_POSSIBLE_USERS,
+
+        NUM_COLUMNS
+    };
+
+    void build(const Data & data);
+
+    void clear();
+
+    bool empty() const { return nrepos == 0; }
+
+    size_t num_repos() const { return nrepos; }
+
+    /// Throw if we weren't built for this data
+    void check(const Data & data) const;
+
+    float get(Column column, int repo_id) const
+    {
+        return values[column * nrepos + repo_id];
+    }
+
+    /// The whole column, indexed by repo ID
+    const float * column(Column column) const
+    {
+        return &values[column * nrepos];
+    }
+
+    /// Days from the epoch to the repo's creation
+    long repo_date(int repo_id) const { return repo_dates[repo_id]; }
+
+    /// Days from the epoch to the author's creation, or 0 if not known
+    long author_date(int repo_id) const { return author_dates[repo_id]; }
+
+    size_t memusage() const;
+
+private:
+    size_t nrepos;
+    std::vector<float> values;  ///< NUM_COLUMNS * nrepos, column major
+    std::vector<long> repo_dates, author_dates;
+
+    struct Build_Job;
+};
+
+#endif /* __github__repo_features_h__ */
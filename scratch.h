@@ -0,0 +1,274 @@
+/* scratch.h                                                       -*- C++ -*-
+   Jeremy Barnes, 25 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Reusable scratch space for the candidate sources, so that generating
+   candidates for a user doesn't need to allocate and free hash tables.
+*/
+
+#ifndef __github__scratch_h__
+#define __github__scratch_h__
+
+#include "data.h"
+#include "arch/exception.h"
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+
+/*****************************************************************************/
+/* DENSE_ACCUMULATOR                                                         */
+/*****************************************************************************/
+
+struct Dense_Accumulator_Base {
+    virtual ~Dense_Accumulator_Base() {}
+};
+
+/// A vector that keeps its capacity from one use to the next
+template<class T>
+struct Scratch_Buffer : public Dense_Accumulator_Base {
+    std::vector<T> vec;
+};
+
+/** A map from an integer ID in [0, n) to a T, stored as a dense array.  The
+    IDs that have been accessed are kept in a list so that iterating and
+    clearing are O(number touched) rather than O(n).  Once it has grown to
+    size, nothing is allocated.
+*/
+template<class T>
+struct Dense_Accumulator : public Dense_Accumulator_Base {
+    Dense_Accumulator(size_t n = 0)
+    {
+        init(n);
+    }
+
+    void init(size_t n)
+    {
+        clear();
+        if (values.size() < n) {
+            values.resize(n);
+            is_touched.resize(n);
+        }
+        touched.reserve(n);
+    }
+
+    T & operator [] (int id)
+    {
+        if (!is_touched[id]) {
+            is_touched[id] = true;
+            touched.push_back(id);
+        }
+        return values[id];
+    }
+
+    const T & get(int id) const
+    {
+        return values[id];
+    }
+
+    bool count(int id) const
+    {
+        return is_touched[id];
+    }
+
+    size_t size() const { return touched.size(); }
+    bool empty() const { return touched.empty(); }
+
+    /// The IDs that have been accessed, in order of first access
+    const std::vector<int> & ids() const { return touched; }
+
+    void clear()
+    {
+        for (unsigned i = 0;  i < touched.size();  ++i) {
+            values[touched[i]] = T();
+            is_touched[touched[i]] = false;
+        }
+        touched.clear();
+    }
+
+private:
+    std::vector<T> values;
+    std::vector<unsigned char> is_touched;
+    std::vector<int> touched;
+};
+
+
+/*****************************************************************************/
+/* DENSE_SET                                                                 */
+/*****************************************************************************/
+
+/** Set of integer IDs in [0, n) with O(number inserted) clearing. */
+struct Dense_Set {
+    Dense_Set(size_t n = 0)
+    {
+        init(n);
+    }
+
+    void init(size_t n)
+    {
+        clear();
+        if (is_member.size() < n)
+            is_member.resize(n);
+        members.reserve(n);
+    }
+
+    /// Returns true if it was inserted (ie, not already there)
+    bool insert(int id)
+    {
+        if (is_member[id]) return false;
+        is_member[id] = true;
+        members.push_back(id);
+        return true;
+    }
+
+    bool count(int id) const
+    {
+        return is_member[id];
+    }
+
+    size_t size() const { return members.size(); }
+    bool empty() const { return members.empty(); }
+
+    const std::vector<int> & ids() const { return members; }
+
+    void clear()
+    {
+        for (unsigned i = 0;  i < members.size();  ++i)
+            is_member[members[i]] = false;
+        members.clear();
+    }
+
+private:
+    std::vector<unsigned char> is_member;
+    std::vector<int> members;
+};
+
+
+/*****************************************************************************/
+/* CANDIDATE_SCRATCH                                                         */
+/*****************************************************************************/
+
+/** Scratch space for generating candidates for one user at a time.  Not
+    thread safe; the generator keeps one per thread.
+*/
+
+struct Candidate_Scratch {
+    Candidate_Scratch()
+        : num_repos(0), num_users(0), num_names(0), num_authors(0)
+    {
+    }
+
+    /// Size everything for the given data
+    void init(const Data & data)
+    {
+        num_repos = data.repos.size();
+        num_users = data.users.size();
+        num_names = data.repo_name_to_repos.size();
+        num_authors = data.authors.size();
+
+        // Both have an extra entry for the -1 ID
+        watched_names.init(num_names + 1);
+        watched_authors.init(num_authors + 1);
+    }
+
+    /// Is it initialized for the given data?
+    bool initialized(const Data & data) const
+    {
+        return num_repos == data.repos.size()
+            && num_users == data.users.size()
+            && num_names == data.repo_name_to_repos.size()
+            && num_authors == data.authors.size();
+    }
+
+    /** Record the names and authors of the repos that the user watches, so
+        that the sources can skip candidates that the same name and same
+        author sources will handle.  Replaces the previous user's.
+    */
+    void set_watched(const User & user, const Data & data)
+    {
+        watched_names.clear();
+        watched_authors.clear();
+
+        for (IdSet::const_iterator
+                 it = user.watching.begin(),
+                 end = user.watching.end();
+             it != end;  ++it) {
+            const Repo & repo = data.repos[*it];
+            watched_names.insert(repo.name_id + 1);
+            watched_authors.insert(repo.author + 1);
+        }
+    }
+
+    bool watched_name(const Repo & repo) const
+    {
+        return watched_names.count(repo.name_id + 1);
+    }
+
+    bool watched_author(const Repo & repo) const
+    {
+        return watched_authors.count(repo.author + 1);
+    }
+
+    /** Get an accumulator indexed by repo ID, cleared and ready to use.
+        The slot identifies the accumulator; each user of the scratch should
+        use its own slot(s).
+    */
+    template<class T>
+    Dense_Accumulator<T> & repo_accumulator(int slot)
+    {
+        return accumulator<T>(slot, num_repos);
+    }
+
+    /// Same as repo_accumulator but indexed by user ID
+    template<class T>
+    Dense_Accumulator<T> & user_accumulator(int slot)
+    {
+        return accumulator<T>(slot, num_users);
+    }
+
+    /// Accumulator indexed by cluster number or similar
+    template<class T>
+    Dense_Accumulator<T> & accumulator(int slot, size_t size)
+    {
+        Dense_Accumulator<T> & result = get_slot<Dense_Accumulator<T> >(slot);
+        result.init(size);
+        return result;
+    }
+
+    /// Get an empty vector that keeps its capacity between uses
+    template<class T>
+    std::vector<T> & buffer(int slot)
+    {
+        Scratch_Buffer<T> & result = get_slot<Scratch_Buffer<T> >(slot);
+        result.vec.clear();
+        return result.vec;
+    }
+
+    size_t num_repos, num_users, num_names, num_authors;
+
+    Dense_Set watched_names;
+    Dense_Set watched_authors;
+
+private:
+    std::vector<boost::shared_ptr<Dense_Accumulator_Base> > slots;
+
+    template<class Slot>
+    Slot & get_slot(int slot)
+    {
+        if (slot < 0)
+            throw ML::Exception("Candidate_Scratch: invalid slot");
+
+        if (slot >= slots.size())
+            slots.resize(slot + 1);
+
+        if (!slots[slot])
+            slots[slot].reset(new Slot());
+
+        Slot * result = dynamic_cast<Slot *>(slots[slot].get());
+        if (!result)
+            throw ML::Exception("Candidate_Scratch: slot used with two types");
+
+        return *result;
+    }
+};
+
+#endif /* __github__scratch_h__ */
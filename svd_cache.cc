@@ -0,0 +1,247 @@
+/* svd_cache.cc
+   Jeremy Barnes, 21 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the SVD cache.
+*/
+
+#include "svd_cache.h"
+#include "arch/exception.h"
+#include "arch/timers.h"
+#include "utils/string_functions.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace ML;
+
+
+std::string svd_cache_dir;
+
+
+/*****************************************************************************/
+/* FINGERPRINT                                                               */
+/*****************************************************************************/
+
+namespace {
+
+// 64 bit FNV-1a
+struct Fnv_Hash {
+    Fnv_Hash() : val(14695981039346656037ULL) {}
+
+    void add(const void * data, size_t len)
+    {
+        const unsigned char * p = (const unsigned char *)data;
+        for (size_t i = 0;  i < len;  ++i) {
+            val ^= p[i];
+            val *= 1099511628211ULL;
+        }
+    }
+
+    template<class T>
+    void add(const T & x)
+    {
+        add(&x, sizeof(x));
+    }
+
+    uint64_t val;
+};
+
+} // file scope
+
+uint64_t svd_fingerprint(const smat & matrix, int nvalues)
+{
+    Fnv_Hash hash;
+    hash.add(nvalues);
+    hash.add(matrix.rows);
+    hash.add(matrix.cols);
+    hash.add(matrix.vals);
+    hash.add(matrix.pointr, sizeof(long) * (matrix.cols + 1));
+    hash.add(matrix.rowind, sizeof(long) * matrix.vals);
+    hash.add(matrix.value, sizeof(double) * matrix.vals);
+    return hash.val;
+}
+
+
+/*****************************************************************************/
+/* CACHE                                                                     */
+/*****************************************************************************/
+
+namespace {
+
+static const char CACHE_MAGIC[8] = { 'S', 'V', 'D', 'C', 'A', 'C', 'H', '1' };
+
+struct Cache_Header {
+    char magic[8];
+    uint64_t fingerprint;
+    int32_t d;
+    int32_t nvalues;
+    int64_t ut_rows, ut_cols;
+    int64_t vt_rows, vt_cols;
+};
+
+size_t file_size(const Cache_Header & header)
+{
+    return sizeof(Cache_Header)
+        + sizeof(double) * (header.d
+                            + header.ut_rows * header.ut_cols
+                            + header.vt_rows * header.vt_cols);
+}
+
+// Returns 0 if the file doesn't exist or doesn't match
+svdrec * load_cached(const std::string & filename, uint64_t fingerprint,
+                     int nvalues, const smat & matrix)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(Cache_Header)) {
+        close(fd);
+        return 0;
+    }
+
+    void * mapped = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) return 0;
+
+    const Cache_Header & header = *(const Cache_Header *)mapped;
+
+    svdrec * result = 0;
+
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+        && header.fingerprint == fingerprint
+        && header.nvalues == nvalues
+        && header.ut_cols == matrix.rows
+        && header.vt_cols == matrix.cols
+        && file_size(header) == (size_t)st.st_size) {
+
+        const double * p
+            = (const double *)((const char *)mapped + sizeof(Cache_Header));
+
+        result = svdNewSVDRec();
+        if (!result) throw Exception("couldn't allocate SVD record");
+
+        result->d = header.d;
+
+        result->S = (double *)malloc(sizeof(double) * header.d);
+        std::copy(p, p + header.d, result->S);
+        p += header.d;
+
+        result->Ut = svdNewDMat(header.ut_rows, header.ut_cols);
+        size_t ut_size = header.ut_rows * header.ut_cols;
+        std::copy(p, p + ut_size, result->Ut->value[0]);
+        p += ut_size;
+
+        result->Vt = svdNewDMat(header.vt_rows, header.vt_cols);
+        size_t vt_size = header.vt_rows * header.vt_cols;
+        std::copy(p, p + vt_size, result->Vt->value[0]);
+        p += vt_size;
+    }
+
+    munmap(mapped, st.st_size);
+
+    return result;
+}
+
+void write_all(int fd, const void * data, size_t len,
+               const std::string & filename)
+{
+    const char * p = (const char *)data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            throw Exception("writing SVD cache file " + filename + ": "
+                            + strerror(errno));
+        }
+        p += written;
+        len -= written;
+    }
+}
+
+void save_cached(const std::string & filename, uint64_t fingerprint,
+                 int nvalues, const svdrec & svd)
+{
+    Cache_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.fingerprint = fingerprint;
+    header.d = svd.d;
+    header.nvalues = nvalues;
+    header.ut_rows = svd.Ut->rows;
+    header.ut_cols = svd.Ut->cols;
+    header.vt_rows = svd.Vt->rows;
+    header.vt_cols = svd.Vt->cols;
+
+    // Write to a temporary file and rename so that nobody can see a
+    // partially written file
+    string tmp_filename = format("%s.tmp.%d", filename.c_str(), (int)getpid());
+
+    int fd = open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+        throw Exception("couldn't open SVD cache file " + tmp_filename
+                        + ": " + strerror(errno));
+
+    try {
+        write_all(fd, &header, sizeof(header), tmp_filename);
+        write_all(fd, svd.S, sizeof(double) * svd.d, tmp_filename);
+        write_all(fd, svd.Ut->value[0],
+                  sizeof(double) * svd.Ut->rows * svd.Ut->cols, tmp_filename);
+        write_all(fd, svd.Vt->value[0],
+                  sizeof(double) * svd.Vt->rows * svd.Vt->cols, tmp_filename);
+    } catch (...) {
+        close(fd);
+        unlink(tmp_filename.c_str());
+        throw;
+    }
+
+    if (close(fd) == -1 || rename(tmp_filename.c_str(), filename.c_str()) == -1) {
+        unlink(tmp_filename.c_str());
+        throw Exception("couldn't write SVD cache file " + filename
+                        + ": " + strerror(errno));
+    }
+}
+
+} // file scope
+
+svdrec * cached_svdLAS2A(smat & matrix, int nvalues, const std::string & what)
+{
+    if (svd_cache_dir == "")
+        return svdLAS2A(&matrix, nvalues);
+
+    uint64_t fingerprint = svd_fingerprint(matrix, nvalues);
+
+    string filename = format("%s/svd-%s-%016llx.bin",
+                             svd_cache_dir.c_str(), what.c_str(),
+                             (unsigned long long)fingerprint);
+
+    svdrec * result = load_cached(filename, fingerprint, nvalues, matrix);
+    if (result) {
+        cerr << "loaded " << what << " SVD from " << filename << endl;
+        return result;
+    }
+
+    result = svdLAS2A(&matrix, nvalues);
+    if (!result) return result;
+
+    try {
+        save_cached(filename, fingerprint, nvalues, *result);
+        cerr << "saved " << what << " SVD to " << filename << endl;
+    } catch (const std::exception & exc) {
+        // Failing to write the cache isn't fatal
+        cerr << "warning: " << exc.what() << endl;
+    }
+
+    return result;
+}
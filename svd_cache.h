@@ -0,0 +1,31 @@
+/* svd_cache.h                                                     -*- C++ -*-
+   Jeremy Barnes, 21 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   On-disk cache of SVD results, keyed by a fingerprint of the input matrix.
+*/
+
+#ifndef __github__svd_cache_h__
+#define __github__svd_cache_h__
+
+#include "svdlibc/svdlib.h"
+#include <string>
+#include <stdint.h>
+
+
+/// Directory in which cached SVD results are stored.  Empty (the default)
+/// disables the cache, so that the SVD is always recomputed.
+extern std::string svd_cache_dir;
+
+/// Fingerprint of a sparse matrix and the number of singular values wanted
+uint64_t svd_fingerprint(const smat & matrix, int nvalues);
+
+/** Same as svdLAS2A, but looks for the result in the cache first.  The
+    what parameter is used to name the cache file, so that it's easy to see
+    which file holds which decomposition.  On a miss, the SVD is performed
+    and the result atomically written to the cache.  The result must be
+    freed with svdFreeSVDRec as usual.
+*/
+svdrec * cached_svdLAS2A(smat & matrix, int nvalues, const std::string & what);
+
+#endif /* __github__svd_cache_h__ */
@@ -0,0 +1,215 @@
+/* tokenizer.cc
+   Jeremy Barnes, 22 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the in-place tokenizer.
+*/
+
+#include "tokenizer.h"
+#include "keywords.h"
+#include "arch/exception.h"
+
+#include <cctype>
+#include <cstring>
+
+
+using namespace std;
+using namespace ML;
+
+
+/*****************************************************************************/
+/* TOKEN_TABLE                                                               */
+/*****************************************************************************/
+
+Token_Table::
+Token_Table()
+    : buckets(64)
+{
+}
+
+bool
+Token_Table::
+matches(const Bucket & bucket, const char * str, size_t len,
+        uint64_t hash) const
+{
+    return bucket.hash == hash
+        && lengths[bucket.id] == len
+        && (len == 0 || memcmp(&arena[starts[bucket.id]], str, len) == 0);
+}
+
+int
+Token_Table::
+find(const char * str, size_t len, uint64_t hash) const
+{
+    size_t mask = buckets.size() - 1;
+
+    for (size_t i = hash & mask;;  i = (i + 1) & mask) {
+        const Bucket & bucket = buckets[i];
+        if (bucket.id == -1) return -1;
+        if (matches(bucket, str, len, hash)) return bucket.id;
+    }
+}
+
+std::pair<int, bool>
+Token_Table::
+insert(const char * str, size_t len, uint64_t hash)
+{
+    // Keep the load factor under 1/2
+    if (2 * (size() + 1) > buckets.size())
+        grow();
+
+    size_t mask = buckets.size() - 1;
+
+    size_t i = hash & mask;
+    for (;;  i = (i + 1) & mask) {
+        const Bucket & bucket = buckets[i];
+        if (bucket.id == -1) break;
+        if (matches(bucket, str, len, hash))
+            return make_pair(bucket.id, false);
+    }
+
+    int id = size();
+    starts.push_back(arena.size());
+    lengths.push_back(len);
+    arena.insert(arena.end(), str, str + len);
+
+    buckets[i].hash = hash;
+    buckets[i].id = id;
+
+    return make_pair(id, true);
+}
+
+void
+Token_Table::
+grow()
+{
+    vector<Bucket> new_buckets(buckets.size() * 2);
+    size_t mask = new_buckets.size() - 1;
+
+    for (unsigned i = 0;  i < buckets.size();  ++i) {
+        const Bucket & bucket = buckets[i];
+        if (bucket.id == -1) continue;
+
+        size_t j = bucket.hash & mask;
+        while (new_buckets[j].id != -1)
+            j = (j + 1) & mask;
+        new_buckets[j] = bucket;
+    }
+
+    buckets.swap(new_buckets);
+}
+
+void
+Token_Table::
+clear()
+{
+    vector<Bucket>(64).swap(buckets);
+    arena.clear();
+    starts.clear();
+    lengths.clear();
+}
+
+
+/*****************************************************************************/
+/* TOKENIZER                                                                 */
+/*****************************************************************************/
+
+namespace {
+
+inline bool is_separator(char c)
+{
+    return c == '_' || c == ':' || c == '-' || c == '.' || c == ' '
+        || c == '/';
+}
+
+} // file scope
+
+void
+Tokenizer::
+tokenize(const std::string & str,
+         const Token_Table * vocab_map,
+         const std::vector<Vocab_Entry> * vocab)
+{
+    const char * p = str.c_str();
+    size_t n = str.size();
+
+    size_t start = 0;
+    for (size_t i = 0;  i <= n;  ++i) {
+        if (i != n && !is_separator(p[i])) continue;
+        if (i != start)
+            add_token(p + start, i - start, vocab_map, vocab);
+        start = i + 1;
+    }
+}
+
+void
+Tokenizer::
+add_token(const char * raw, size_t len,
+          const Token_Table * vocab_map,
+          const std::vector<Vocab_Entry> * vocab)
+{
+    // Write the lowercased version into the buffer.  All of the tokens that
+    // we produce are ranges of it.
+    uint32_t start = buffer.size();
+    buffer.resize(start + len);
+    char * lc = &buffer[start];
+
+    for (size_t i = 0;  i < len;  ++i)
+        lc[i] = tolower(raw[i]);
+
+    bool keeptogether = true;
+
+    if (vocab_map) {
+        int id = vocab_map->find(lc, len, Token_Table::hash(lc, len));
+        if (id != -1)
+            keeptogether = ((*vocab)[id].in_names >= 50);
+    }
+
+    if (keeptogether) {
+        add_unpunct(start, start + len);
+        return;
+    }
+
+    // Same logic as uncamelcase()
+    int num_lower = 0, num_upper = 0;
+    for (size_t i = 0;  i < len;  ++i) {
+        if (islower(raw[i])) ++num_lower;
+        if (isupper(raw[i])) ++num_upper;
+    }
+
+    if (num_upper < 2 || num_lower < 2) {
+        add_unpunct(start, start + len);
+        return;
+    }
+
+    // We split on lower-to-upper transitions
+    bool last_lower = false;
+    size_t piece_start = 0;
+    for (size_t i = 0;  i <= len;  ++i) {
+        bool upper = (i == len ? true : isupper(raw[i]));
+        bool lower = (i == len ? true : islower(raw[i]));
+
+        if ((last_lower && upper) || i == len) {
+            add_unpunct(start + piece_start, start + i);
+            piece_start = i;
+        }
+
+        last_lower = lower;
+    }
+}
+
+void
+Tokenizer::
+add_unpunct(uint32_t start, uint32_t end)
+{
+    // Same logic as unpunct()
+    while (start < end && ispunct(buffer[start])) ++start;
+    while (end > start && ispunct(buffer[end - 1])) --end;
+    if (start == end) return;
+
+    Token_Ref ref;
+    ref.start = start;
+    ref.length = end - start;
+    ref.hash = Token_Table::hash(&buffer[start], end - start);
+    tokens.push_back(ref);
+}
@@ -0,0 +1,159 @@
+/* tokenizer.h                                                     -*- C++ -*-
+   Jeremy Barnes, 22 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Tokenizer that works in place over names and descriptions, without
+   allocating a string per token.
+*/
+
+#ifndef __github__tokenizer_h__
+#define __github__tokenizer_h__
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <stdint.h>
+
+struct Vocab_Entry;
+
+
+/*****************************************************************************/
+/* TOKEN_TABLE                                                               */
+/*****************************************************************************/
+
+/** Interns tokens, mapping each distinct one onto a dense integer ID in the
+    order in which they were first inserted.  Open addressing with linear
+    probing, with all of the token text in a single arena.  Lookups are done
+    with a hash that the caller has already calculated.
+*/
+
+struct Token_Table {
+    Token_Table();
+
+    /// Hash for the given token text
+    static uint64_t hash(const char * str, size_t len)
+    {
+        uint64_t result = 14695981039346656037ULL;
+        for (size_t i = 0;  i < len;  ++i) {
+            result ^= (unsigned char)str[i];
+            result *= 1099511628211ULL;
+        }
+        return result;
+    }
+
+    /// Returns the ID of the token, or -1 if it's not there
+    int find(const char * str, size_t len, uint64_t hash) const;
+
+    int find(const std::string & str) const
+    {
+        return find(str.c_str(), str.size(), hash(str.c_str(), str.size()));
+    }
+
+    /// Insert the token if it's not already there.  Returns the ID and
+    /// whether or not it was inserted.
+    std::pair<int, bool> insert(const char * str, size_t len, uint64_t hash);
+
+    std::pair<int, bool> insert(const std::string & str)
+    {
+        return insert(str.c_str(), str.size(),
+                      hash(str.c_str(), str.size()));
+    }
+
+    size_t size() const { return starts.size(); }
+
+    std::string token(int id) const
+    {
+        return std::string(&arena[starts[id]], lengths[id]);
+    }
+
+    void clear();
+
+private:
+    struct Bucket {
+        Bucket() : hash(0), id(-1) {}
+        uint64_t hash;
+        int id;
+    };
+
+    std::vector<Bucket> buckets;  ///< Size is always a power of two
+    std::vector<char> arena;
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> lengths;
+
+    bool matches(const Bucket & bucket, const char * str, size_t len,
+                 uint64_t hash) const;
+
+    void grow();
+};
+
+
+/*****************************************************************************/
+/* TOKENIZER                                                                 */
+/*****************************************************************************/
+
+/// Reference to a token held in the tokenizer's buffer
+struct Token_Ref {
+    uint32_t start;
+    uint32_t length;
+    uint64_t hash;
+};
+
+/** Tokenizer that produces exactly the same tokens as tokenize() in
+    keywords.h, but writes the lowercased text into a buffer that is reused
+    from call to call and produces references into it along with the hash
+    of each token.  Once the buffers have grown to size, tokenizing does no
+    memory allocation.
+
+    Not thread safe; each thread should have its own.
+*/
+
+struct Tokenizer {
+
+    /// Clear the tokens (but keep the memory)
+    void clear()
+    {
+        buffer.clear();
+        tokens.clear();
+    }
+
+    /** Tokenize the given string, adding the tokens to those already there.
+        If vocab_map is passed, tokens that were seen in fewer than 50 names
+        according to vocab are split on camel case boundaries.
+    */
+    void tokenize(const std::string & str,
+                  const Token_Table * vocab_map = 0,
+                  const std::vector<Vocab_Entry> * vocab = 0);
+
+    const char * str(const Token_Ref & ref) const
+    {
+        return &buffer[ref.start];
+    }
+
+    std::string token(const Token_Ref & ref) const
+    {
+        return std::string(&buffer[ref.start], ref.length);
+    }
+
+    int find(const Token_Ref & ref, const Token_Table & table) const
+    {
+        return table.find(str(ref), ref.length, ref.hash);
+    }
+
+    std::pair<int, bool>
+    insert(const Token_Ref & ref, Token_Table & table) const
+    {
+        return table.insert(str(ref), ref.length, ref.hash);
+    }
+
+    std::vector<char> buffer;
+    std::vector<Token_Ref> tokens;
+
+private:
+    void add_token(const char * raw, size_t len,
+                   const Token_Table * vocab_map,
+                   const std::vector<Vocab_Entry> * vocab);
+
+    void add_unpunct(uint32_t start, uint32_t end);
+};
+
+#endif /* __github__tokenizer_h__ */
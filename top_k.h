@@ -0,0 +1,93 @@
+/* top_k.h                                                         -*- C++ -*-
+   Jeremy Barnes, 30 September 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Bounded selection of the best k values out of a stream.
+*/
+
+#ifndef __github__top_k_h__
+#define __github__top_k_h__
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+
+/*****************************************************************************/
+/* TOP_K                                                                     */
+/*****************************************************************************/
+
+/** Keeps the best k of the values passed to add(), in a heap whose top is
+    the worst of them.  Adding n values costs O(n log k) instead of the
+    O(n log n) to sort them all and truncate.
+
+    Better(a, b) returns true if a should be ranked before b.  It should be
+    a strict total order (break ties on the ID), otherwise which of the tied
+    values are kept depends upon the order that they were added in.
+
+    The values are stored in a vector that is passed in, so that it can be
+    a scratch buffer that keeps its capacity between users.
+
+    A caller that has an upper bound on the values still to come can stop
+    once full() and the bound isn't better than worst(); accepts() can be
+    used to skip the work of building a value that wouldn't be kept.
+*/
+
+template<class T, class Better = std::greater<T> >
+struct Top_K {
+    Top_K(std::vector<T> & values, size_t k, const Better & better = Better())
+        : values(values), k(k), better(better)
+    {
+        values.clear();
+    }
+
+    /// Would the value be kept if it were added now?
+    bool accepts(const T & val) const
+    {
+        if (values.size() < k) return true;
+        return k > 0 && better(val, values.front());
+    }
+
+    /// Add the value, returning true if it was kept (possibly pushing out
+    /// the worst one)
+    bool add(const T & val)
+    {
+        if (values.size() < k) {
+            values.push_back(val);
+            std::push_heap(values.begin(), values.end(), better);
+            return true;
+        }
+
+        if (k == 0 || !better(val, values.front())) return false;
+
+        std::pop_heap(values.begin(), values.end(), better);
+        values.back() = val;
+        std::push_heap(values.begin(), values.end(), better);
+        return true;
+    }
+
+    /// Have we got k values yet?
+    bool full() const { return values.size() >= k; }
+
+    /// The worst of the values that we have; only valid if !empty()
+    const T & worst() const { return values.front(); }
+
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    /// The values in heap order
+    const T & operator [] (size_t i) const { return values[i]; }
+
+    /// Sort the values, best first.  No more can be added afterwards.
+    void sort()
+    {
+        std::sort_heap(values.begin(), values.end(), better);
+    }
+
+private:
+    std::vector<T> & values;
+    size_t k;
+    Better better;
+};
+
+#endif /* __github__top_k_h__ */
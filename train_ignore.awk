@@ -0,0 +1,35 @@
+# Script to print the features that a source's classifier isn't trained on
+# Usage: awk -v source=NAME -f train_ignore.awk config.txt
+#
+# The source's own train_ignore key is used if it has one (an empty one
+# means that nothing is ignored); otherwise it's the one of the generator.
+
+{
+    sub("#.*", "");
+}
+
+/\{/ {
+    block[++depth] = $1;
+}
+
+/^[ \t]*train_ignore=/ {
+    value = $0;
+    sub("^[ \t]*train_ignore=", "", value);
+    sub(";.*", "", value);
+    gsub(",", " ", value);
+
+    if (depth == 1 && block[1] == "generator")
+        shared = value;
+    else if (depth == 2 && block[1] == "generator" && block[2] == source) {
+        own = value;
+        has_own = 1;
+    }
+}
+
+/\}/ {
+    --depth;
+}
+
+END {
+    print (has_own ? own : shared);
+}
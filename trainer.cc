@@ -0,0 +1,320 @@
+/* trainer.cc
+   Jeremy Barnes, 5 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Implementation of the in process training.
+*/
+
+#include "trainer.h"
+#include "parallel.h"
+#include "boosting/classifier.h"
+#include "boosting/classifier_generator.h"
+#include "boosting/training_data.h"
+#include "boosting/thread_context.h"
+#include "boosting/probabilizer.h"
+#include "boosting/decoded_classifier.h"
+#include "utils/guard.h"
+#include "arch/exception.h"
+#include "utils/string_functions.h"
+#include <iostream>
+#include <cstdio>
+#include <set>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace {
+
+/// The columns that come before the features
+enum {
+    LABEL,
+    WT,
+    GROUP,
+    REAL_TEST,
+    NUM_LEADING
+};
+
+enum Split {
+    TRAINING,
+    VALIDATION,
+    TESTING
+};
+
+/// Which part of the data a user's examples go to: 20% validation, 10%
+/// testing and the rest training, as classifier_training_tool's
+/// --validation-split 20 --testing-split 10 does by group.  Hashed rather
+/// than drawn from a random number generator so that the sets can be
+/// trained at the same time and still get the same split, so the users in
+/// each part aren't the same as the tool would choose.
+Split get_split(int group, int random_seed)
+{
+    unsigned hash = (unsigned)(group * 2 + 1) * 2654435761U
+        + (unsigned)random_seed * 40503U;
+    int bucket = (hash >> 16) % 10;
+    if (bucket < 2) return VALIDATION;
+    if (bucket < 3) return TESTING;
+    return TRAINING;
+}
+
+struct Train_Job {
+    Train_Job(const vector<boost::shared_ptr<Training_Set> > & sets,
+              const Configuration & config,
+              const string & trainer_name,
+              int random_seed)
+        : sets(sets), config(config), trainer_name(trainer_name),
+          random_seed(random_seed)
+    {
+    }
+
+    const vector<boost::shared_ptr<Training_Set> > & sets;
+    const Configuration & config;
+    const string & trainer_name;
+    int random_seed;
+
+    void operator () (int chunk, int begin, int end) const
+    {
+        for (int i = begin;  i < end;  ++i)
+            sets[i]->train(config, trainer_name, random_seed);
+    }
+};
+
+} // file scope
+
+
+/*****************************************************************************/
+/* TRAINING_SET                                                              */
+/*****************************************************************************/
+
+Training_Set::
+Training_Set(const std::string & name,
+             const ML::Dense_Feature_Space & features_fs,
+             const std::string & classifier_file)
+    : name(name), classifier_file(classifier_file)
+{
+    boost::shared_ptr<Dense_Feature_Space> result(new Dense_Feature_Space());
+    result->add_feature("LABEL",
+                        Feature_Info(Feature_Info::BOOLEAN, false, true));
+    result->add_feature("WT",
+                        Feature_Info(Feature_Info::REAL, false, true));
+    result->add_feature("GROUP",
+                        Feature_Info(Feature_Info::REAL, false, true, true));
+    result->add_feature("REAL_TEST",
+                        Feature_Info(Feature_Info::BOOLEAN, false, true));
+    result->add(features_fs);
+
+    fs = result;
+    ncols = fs->variable_count();
+}
+
+void
+Training_Set::Examples::
+add(bool label, float weight, int group, bool real_test,
+    const float * first, const float * last)
+{
+    size_t n = NUM_LEADING + (last - first);
+    if (ncols == 0) ncols = n;
+    else if (n != ncols)
+        throw Exception(format("Training_Set: example has %zd columns but "
+                               "the others have %zd", n, ncols));
+
+    values.push_back(label);
+    values.push_back(weight);
+    values.push_back(group);
+    values.push_back(real_test);
+    values.insert(values.end(), first, last);
+}
+
+void
+Training_Set::
+add(int job, Examples & examples)
+{
+    if (examples.values.empty()) return;
+
+    if (examples.ncols != ncols)
+        throw Exception(format("training set %s has %zd columns but the "
+                               "examples have %zd",
+                               name.c_str(), ncols, examples.ncols));
+
+    Guard guard(lock);
+
+    if (jobs.count(job))
+        throw Exception(format("training set %s: job %d added twice",
+                               name.c_str(), job));
+
+    jobs[job].swap(examples.values);
+    examples.values.clear();
+}
+
+size_t
+Training_Set::
+size() const
+{
+    Guard guard(lock);
+
+    size_t result = 0;
+    for (map<int, vector<float> >::const_iterator
+             it = jobs.begin(), end = jobs.end();
+         it != end;  ++it)
+        result += it->second.size() / ncols;
+    return result;
+}
+
+void
+Training_Set::
+train(const ML::Configuration & config,
+      const std::string & trainer_name,
+      int random_seed)
+{
+    vector<Feature> all_features = fs->features();
+    Feature label = all_features[LABEL];
+
+    // The trainer gets everything but the leading columns and those that
+    // are ignored
+    set<string> ignored(ignore_features.begin(), ignore_features.end());
+    vector<Feature> features;
+    for (unsigned i = NUM_LEADING;  i < all_features.size();  ++i)
+        if (!ignored.count(fs->print(all_features[i])))
+            features.push_back(all_features[i]);
+
+    Training_Data training(fs), validation(fs);
+    distribution<float> training_weights, validation_weights;
+
+    // The testing examples are the only ones kept as they are; the others
+    // are in the training data once encoded.  Each job's values are freed
+    // as soon as they're encoded so that the raw and encoded examples
+    // aren't all in memory at once.
+    vector<float> testing;
+
+    for (;;) {
+        vector<float> values;
+        {
+            Guard guard(lock);
+            if (jobs.empty()) break;
+            values.swap(jobs.begin()->second);
+            jobs.erase(jobs.begin());
+        }
+
+        for (size_t i = 0;  i < values.size();  i += ncols) {
+            const float * row = &values[i];
+
+            Split split = get_split((int)row[GROUP], random_seed);
+            if (split == TESTING) {
+                testing.insert(testing.end(), row, row + ncols);
+                continue;
+            }
+
+            boost::shared_ptr<Mutable_Feature_Set> encoded
+                = fs->encode(distribution<float>(row, row + ncols));
+
+            if (split == TRAINING) {
+                training.add_example(encoded);
+                training_weights.push_back(row[WT]);
+            }
+            else {
+                validation.add_example(encoded);
+                validation_weights.push_back(row[WT]);
+            }
+        }
+    }
+
+    if (training_weights.empty() || validation_weights.empty())
+        throw Exception("training set " + name + " has no examples to train "
+                        "or validate on");
+
+    training.preindex(label);
+    validation.preindex(label);
+
+    boost::shared_ptr<Classifier_Generator> generator
+        = get_trainer(trainer_name, config);
+    generator->init(fs, label);
+
+    Thread_Context context;
+    context.seed(random_seed);
+
+    boost::shared_ptr<Classifier_Impl> raw
+        = generator->generate(context, training, validation,
+                              training_weights, validation_weights,
+                              features);
+
+    // Turn the outputs into probabilities with a GLZ fitted over the
+    // weighted validation examples, as classifier_training_tool does with
+    // --probabilize-mode=2 --probabilize-weighted=1.  The min_prob of the
+    // sources and the ranker's sentinel scores assume they're in [0, 1].
+    GLZ_Probabilizer probabilizer;
+    probabilizer.train(validation, *raw, raw->optimize(all_features),
+                       validation_weights, 2, "logit");
+
+    boost::shared_ptr<Classifier_Impl> impl
+        (new Decoded_Classifier(Classifier(raw), Decoder(probabilizer)));
+
+    // Test it: how accurate it is over the testing examples of the repos
+    // that were taken away (classifier_training_tool's --testing-filter
+    // 'REAL_TEST == 1'), and how often each of those scores above all of
+    // the incorrect ones of its user
+    Optimization_Info opt_info = impl->optimize(all_features);
+
+    double total_weight = 0.0, correct_weight = 0.0;
+    map<int, float> real_test_score, max_incorrect_score;
+
+    for (size_t i = 0;  i < testing.size();  i += ncols) {
+        const float * row = &testing[i];
+        float score = impl->predict(1, row, opt_info);
+        bool is_label = row[LABEL] > 0.5;
+        int group = (int)row[GROUP];
+
+        if (row[REAL_TEST] > 0.5) {
+            total_weight += row[WT];
+            if ((score > 0.5) == is_label)
+                correct_weight += row[WT];
+
+            real_test_score[group] = score;
+        }
+        else if (!is_label) {
+            if (!max_incorrect_score.count(group)
+                || score > max_incorrect_score[group])
+                max_incorrect_score[group] = score;
+        }
+    }
+
+    int num_first = 0;
+    for (map<int, float>::const_iterator
+             it = real_test_score.begin(), end = real_test_score.end();
+         it != end;  ++it)
+        num_first += (!max_incorrect_score.count(it->first)
+                      || it->second > max_incorrect_score[it->first]);
+
+    cerr << format("%s: trained on %zd examples, validated on %zd; %s; "
+                   "real test accuracy %.2f%%, first for %d/%zd users\n",
+                   name.c_str(), training_weights.size(),
+                   validation_weights.size(), probabilizer.print().c_str(),
+                   total_weight == 0.0
+                   ? 0.0 : 100.0 * correct_weight / total_weight,
+                   num_first, real_test_score.size());
+
+    // Save to a temporary file first so that a failure doesn't leave a
+    // partial classifier behind
+    Classifier classifier(impl);
+    string tmp_file = classifier_file + "~";
+    classifier.save(tmp_file);
+
+    if (rename(tmp_file.c_str(), classifier_file.c_str()) == -1)
+        throw Exception("couldn't rename " + tmp_file + " to "
+                        + classifier_file);
+}
+
+
+/*****************************************************************************/
+/* TRAIN_ALL                                                                 */
+/*****************************************************************************/
+
+void train_all(const std::vector<boost::shared_ptr<Training_Set> > & sets,
+               const ML::Configuration & config,
+               const std::string & trainer_name,
+               int random_seed)
+{
+    run_in_parallel(sets.size(), 1,
+                    Train_Job(sets, config, trainer_name, random_seed),
+                    "train classifiers");
+}
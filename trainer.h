@@ -0,0 +1,96 @@
+/* trainer.h                                                       -*- C++ -*-
+   Jeremy Barnes, 5 October 2009
+   Copyright (c) 2009 Jeremy Barnes.  All rights reserved.
+
+   Training of the source and ranker classifiers in process.
+*/
+
+#ifndef __github__trainer_h__
+#define __github__trainer_h__
+
+#include "boosting/dense_features.h"
+#include "boosting/worker_task.h"
+#include "utils/configuration.h"
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <string>
+#include <map>
+
+
+/*****************************************************************************/
+/* TRAINING_SET                                                              */
+/*****************************************************************************/
+
+/** The examples to train one classifier, kept in memory instead of being
+    dumped to a file for classifier_training_tool.  Each example has the
+    same columns as a line of the dump: LABEL, WT (its weight), GROUP (the
+    user, so that a user's examples are never split between training and
+    testing) and REAL_TEST (if it's the repo that was taken away), followed
+    by the features.
+
+    The examples are added a job at a time and kept in job order, so that
+    the training doesn't depend upon the order that the threads finish in.
+*/
+
+struct Training_Set {
+    /// The features of the examples are those of features_fs
+    Training_Set(const std::string & name,
+                 const ML::Dense_Feature_Space & features_fs,
+                 const std::string & classifier_file);
+
+    std::string name;
+
+    /// Feature space of the examples, including the four leading columns
+    boost::shared_ptr<const ML::Dense_Feature_Space> fs;
+
+    /// Where the trained classifier is saved
+    std::string classifier_file;
+
+    /// Features that aren't given to the trainer
+    std::vector<std::string> ignore_features;
+
+    /// Examples for one job, in the order they were generated
+    struct Examples {
+        Examples()
+            : ncols(0)
+        {
+        }
+
+        void add(bool label, float weight, int group, bool real_test,
+                 const float * first, const float * last);
+
+        size_t size() const { return ncols ? values.size() / ncols : 0; }
+
+        size_t ncols;
+        std::vector<float> values;
+    };
+
+    /// Take the examples of the given job.  Thread safe.
+    void add(int job, Examples & examples);
+
+    /// Number of examples over all jobs so far
+    size_t size() const;
+
+    /// Train the classifier with the named trainer from the configuration,
+    /// probabilize it and save it.  A fifth of the users are used for
+    /// validation and a tenth for testing, chosen with the given random
+    /// seed; only the testing examples with REAL_TEST set are scored.
+    /// The examples are used up: each job's are freed once encoded.
+    void train(const ML::Configuration & config,
+               const std::string & trainer_name,
+               int random_seed);
+
+private:
+    std::map<int, std::vector<float> > jobs;
+    size_t ncols;
+    mutable ML::Lock lock;
+};
+
+
+/// Train each of the sets at the same time on the worker task
+void train_all(const std::vector<boost::shared_ptr<Training_Set> > & sets,
+               const ML::Configuration & config,
+               const std::string & trainer_name,
+               int random_seed);
+
+#endif /* __github__trainer_h__ */